@@ -0,0 +1,226 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file InplaceTask.hpp Contains a move-only type erased task wrapper with inline
+/// storage.
+
+#ifndef IYFT_INPLACE_TASK_HPP
+#define IYFT_INPLACE_TASK_HPP
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef IYFT_INPLACE_TASK_SIZE
+/// \brief The number of bytes that an InplaceTask reserves for the callable it stores.
+///
+/// Callables that fit into this buffer (e.g., small lambdas or std::bind results with
+/// a couple of arguments) are stored without allocating any memory. Bigger ones are 
+/// moved to the heap.
+///
+/// Default value is 64.
+#define IYFT_INPLACE_TASK_SIZE 64
+#endif // IYFT_INPLACE_TASK_SIZE
+
+namespace iyft {
+/// \brief A move-only wrapper for a callable that takes no parameters and returns
+/// nothing.
+///
+/// Unlike std::function, InplaceTask doesn't require the callable to be copyable. Unlike
+/// std::packaged_task, it doesn't create a shared state and it doesn't allocate any
+/// memory if the callable fits into IYFT_INPLACE_TASK_SIZE bytes.
+///
+/// \remark The stored callable may be invoked multiple times.
+class InplaceTask {
+public:
+    /// \brief The number of bytes available for inline storage.
+    static constexpr std::size_t Capacity = IYFT_INPLACE_TASK_SIZE;
+    
+    /// \brief Checks if a callable of type F will be stored inline.
+    template <typename F>
+    static constexpr bool StoresInline() {
+        return sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<F>::value;
+    }
+    
+    /// \brief Creates an empty InplaceTask.
+    InplaceTask() noexcept : operations(nullptr) {}
+    
+    /// \brief Creates an InplaceTask that stores the provided callable.
+    template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InplaceTask>::value>::type>
+    InplaceTask(F&& f) : operations(nullptr) {
+        using FunctorType = typename std::decay<F>::type;
+        store<FunctorType>(std::forward<F>(f), std::integral_constant<bool, StoresInline<FunctorType>()>());
+    }
+    
+    /// \brief Takes over the callable stored in the other task. The other task becomes
+    /// empty.
+    InplaceTask(InplaceTask&& other) noexcept : operations(other.operations) {
+        if (operations != nullptr) {
+            operations->move(&other.storage, &storage);
+            other.operations = nullptr;
+        }
+    }
+    
+    /// \brief Destroys the currently stored callable and takes over the callable stored
+    /// in the other task. The other task becomes empty.
+    InplaceTask& operator=(InplaceTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            
+            if (other.operations != nullptr) {
+                other.operations->move(&other.storage, &storage);
+                operations = other.operations;
+                other.operations = nullptr;
+            }
+        }
+        
+        return *this;
+    }
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    InplaceTask(const InplaceTask&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    InplaceTask& operator=(const InplaceTask&) = delete;
+    
+    ~InplaceTask() {
+        reset();
+    }
+    
+    /// \brief Invokes the stored callable.
+    ///
+    /// \throws std::bad_function_call if the task is empty.
+    inline void operator()() {
+        if (operations == nullptr) {
+            throw std::bad_function_call();
+        }
+        
+        operations->invoke(&storage);
+    }
+    
+    /// \brief Destroys the stored callable and makes the task empty.
+    inline void reset() noexcept {
+        if (operations != nullptr) {
+            operations->destroy(&storage);
+            operations = nullptr;
+        }
+    }
+    
+    /// \brief Checks if the task stores a callable.
+    inline explicit operator bool() const noexcept {
+        return operations != nullptr;
+    }
+private:
+    using Storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+    
+    /// \brief Type erased operations that are performed on the stored callable.
+    struct Operations {
+        void (*invoke)(void* storage);
+        void (*move)(void* source, void* destination);
+        void (*destroy)(void* storage);
+    };
+    
+    /// \brief Operations for callables that are stored in the inline buffer.
+    template <typename F>
+    struct InlineOperations {
+        static void Invoke(void* storage) {
+            (*static_cast<F*>(storage))();
+        }
+        
+        static void Move(void* source, void* destination) noexcept {
+            F* sourceFunctor = static_cast<F*>(source);
+            
+            new (destination) F(std::move(*sourceFunctor));
+            sourceFunctor->~F();
+        }
+        
+        static void Destroy(void* storage) noexcept {
+            static_cast<F*>(storage)->~F();
+        }
+        
+        static const Operations Table;
+    };
+    
+    /// \brief Operations for callables that didn't fit into the inline buffer. The 
+    /// buffer only stores a pointer to them.
+    template <typename F>
+    struct HeapOperations {
+        static void Invoke(void* storage) {
+            (**static_cast<F**>(storage))();
+        }
+        
+        static void Move(void* source, void* destination) noexcept {
+            new (destination) F*(*static_cast<F**>(source));
+        }
+        
+        static void Destroy(void* storage) noexcept {
+            delete *static_cast<F**>(storage);
+        }
+        
+        static const Operations Table;
+    };
+    
+    template <typename F, typename T>
+    inline void store(T&& f, std::true_type) {
+        new (&storage) F(std::forward<T>(f));
+        operations = &InlineOperations<F>::Table;
+    }
+    
+    template <typename F, typename T>
+    inline void store(T&& f, std::false_type) {
+        new (&storage) F*(new F(std::forward<T>(f)));
+        operations = &HeapOperations<F>::Table;
+    }
+    
+    /// \brief Either the callable or a pointer to it.
+    Storage storage;
+    
+    /// \brief Operations that can be performed on the stored callable or nullptr if the
+    /// task is empty.
+    const Operations* operations;
+};
+
+template <typename F>
+const InplaceTask::Operations InplaceTask::InlineOperations<F>::Table = {
+    &InplaceTask::InlineOperations<F>::Invoke,
+    &InplaceTask::InlineOperations<F>::Move,
+    &InplaceTask::InlineOperations<F>::Destroy
+};
+
+template <typename F>
+const InplaceTask::Operations InplaceTask::HeapOperations<F>::Table = {
+    &InplaceTask::HeapOperations<F>::Invoke,
+    &InplaceTask::HeapOperations<F>::Move,
+    &InplaceTask::HeapOperations<F>::Destroy
+};
+
+}
+
+#endif // IYFT_INPLACE_TASK_HPP
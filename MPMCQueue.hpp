@@ -0,0 +1,183 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file MPMCQueue.hpp Contains a bounded lock-free multi-producer multi-consumer queue.
+
+#ifndef IYFT_MPMC_QUEUE_HPP
+#define IYFT_MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Spinlock.hpp"
+
+namespace iyft {
+/// \brief A bounded lock-free multi-producer multi-consumer queue.
+///
+/// Based on Dmitry Vyukov's bounded MPMC queue. Every cell of the ring buffer has a
+/// sequence number that tells the producers and the consumers if the cell is ready
+/// to be written to or read from. Producers and consumers only contend on a single
+/// CAS and never wait for each other unless the queue is full or empty.
+template <typename T>
+class BoundedMPMCQueue {
+public:
+    /// \brief Creates a new BoundedMPMCQueue.
+    ///
+    /// \throws std::logic_error if capacity is not a power of two or if it's < 2.
+    ///
+    /// \param capacity The maximum number of items that the queue can contain. Must be
+    /// a power of two and >= 2.
+    explicit BoundedMPMCQueue(std::size_t capacity)
+        : cells(new Cell[capacity]), mask(capacity - 1), enqueuePaddingStart(), enqueuePosition(0),
+          dequeuePaddingStart(), dequeuePosition(0), dequeuePaddingEnd() {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            throw std::logic_error("capacity must be a power of two and >= 2");
+        }
+        
+        for (std::size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    /// \brief Destroys all items that are still in the queue.
+    ~BoundedMPMCQueue() {
+        T item;
+        while (tryPop(item)) {;}
+    }
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    BoundedMPMCQueue(const BoundedMPMCQueue&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    BoundedMPMCQueue& operator=(const BoundedMPMCQueue&) = delete;
+    
+    /// \brief Tries to add an item to the queue.
+    ///
+    /// \param item The item to add. It will only be moved from if this function
+    /// returns true.
+    ///
+    /// \return true if the item was added, false if the queue was full.
+    bool tryPush(T&& item) {
+        Cell* cell;
+        std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        
+        while (true) {
+            cell = &cells[position & mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+            
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        
+        new (&cell->storage) T(std::move(item));
+        cell->sequence.store(position + 1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    /// \brief Tries to remove the oldest item from the queue.
+    ///
+    /// \param item The removed item will be move assigned here.
+    ///
+    /// \return true if an item was removed, false if the queue was empty.
+    bool tryPop(T& item) {
+        Cell* cell;
+        std::size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        
+        while (true) {
+            cell = &cells[position & mask];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position + 1);
+            
+            if (difference == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        
+        T* stored = reinterpret_cast<T*>(&cell->storage);
+        item = std::move(*stored);
+        stored->~T();
+        
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    /// \brief Returns the maximum number of items that the queue can contain.
+    inline std::size_t getCapacity() const {
+        return mask + 1;
+    }
+    
+    /// \brief Returns an approximate number of items in the queue.
+    ///
+    /// \return The number of items. The value may be outdated by the time it's returned.
+    std::size_t size() const {
+        const std::size_t enqueued = enqueuePosition.load(std::memory_order_relaxed);
+        const std::size_t dequeued = dequeuePosition.load(std::memory_order_relaxed);
+        
+        return (enqueued > dequeued) ? (enqueued - dequeued) : 0;
+    }
+private:
+    /// \brief A slot of the ring buffer.
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    
+    /// \brief Used to keep the positions on separate cache lines.
+    using Padding = CacheLinePadding<>;
+    
+    std::unique_ptr<Cell[]> cells;
+    const std::size_t mask;
+    Padding enqueuePaddingStart;
+    std::atomic<std::size_t> enqueuePosition;
+    Padding dequeuePaddingStart;
+    std::atomic<std::size_t> dequeuePosition;
+    Padding dequeuePaddingEnd;
+};
+}
+
+#endif // IYFT_MPMC_QUEUE_HPP
@@ -26,14 +26,54 @@
 // CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
 // WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-/// \file Spinlock.hpp Contains an an atomic_flag based spinlock.
+/// \file Spinlock.hpp Contains an an atomic_flag based spinlock and the helpers that are
+/// shared by the lock-free containers.
 
 #ifndef IYFT_SPINLOCK_HPP
 #define IYFT_SPINLOCK_HPP
 
 #include <atomic>
+#include <cstddef>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
 
 namespace iyft {
+/// \brief Tells the CPU that the calling thread is busy waiting.
+///
+/// On x86, this emits the pause instruction that reduces the power consumption and
+/// the penalty of leaving the spin loop. On ARM, it emits yield. Does nothing on other
+/// architectures.
+inline void SpinPause() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/// \brief The assumed size of a cache line in bytes.
+static const std::size_t CacheLineSize = 64;
+
+/// \brief Placed between members that are written by different threads to keep them on
+/// separate cache lines and avoid false sharing.
+///
+/// \remark Padding is used instead of alignas because C++11 operator new ignores
+/// extended alignment, so an over-aligned member would not be aligned in a heap
+/// allocated object.
+///
+/// \tparam UsedBytes The number of bytes of the cache line that are already taken by the
+/// member that precedes the padding.
+template <std::size_t UsedBytes = 0>
+struct CacheLinePadding {
+    static_assert(UsedBytes < CacheLineSize, "The preceding member must fit into a cache line");
+    
+    char bytes[CacheLineSize - UsedBytes];
+};
+
 /// \brief An atomic_flag based spinlock.
 ///
 /// Lower latency than std::mutex because it avoids system calls. However, it is a form
@@ -43,7 +83,16 @@ class Spinlock {
 public:
     /// \brief Locks the spinlock.
     void lock() {
-        while (spinlock.test_and_set(std::memory_order_acquire)) {;}
+        while (spinlock.test_and_set(std::memory_order_acquire)) {
+            SpinPause();
+        }
+    }
+    
+    /// \brief Tries to lock the spinlock without waiting.
+    ///
+    /// \return true if the spinlock was locked by this call.
+    bool try_lock() {
+        return !spinlock.test_and_set(std::memory_order_acquire);
     }
     
     /// \brief Unlocks the spinlock.
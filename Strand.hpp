@@ -0,0 +1,301 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file Strand.hpp Contains a serial executor that runs its tasks on a ThreadPool.
+
+#ifndef IYFT_STRAND_HPP
+#define IYFT_STRAND_HPP
+
+#include <atomic>
+#include <future>
+#include <stdexcept>
+
+#include "InplaceTask.hpp"
+#include "Spinlock.hpp"
+#include "ThreadPool.hpp"
+
+#ifndef IYFT_STRAND_BATCH_SIZE
+/// \brief The maximum number of tasks that a Strand runs before it lets the other tasks
+/// of the ThreadPool use the worker.
+///
+/// Larger batches keep the data of the strand in the cache of a single worker for
+/// longer, while smaller ones share the workers more fairly.
+///
+/// Default value is 32.
+#define IYFT_STRAND_BATCH_SIZE 32
+#endif // IYFT_STRAND_BATCH_SIZE
+
+static_assert(IYFT_STRAND_BATCH_SIZE >= 1, "IYFT_STRAND_BATCH_SIZE must be >= 1");
+
+namespace iyft {
+/// \brief Runs tasks one at a time, in the order they were posted, on the workers of a
+/// ThreadPool.
+///
+/// A strand doesn't own a thread. The first task that's posted to an idle strand
+/// schedules a single drain task on the pool, which runs the queued tasks until the
+/// strand becomes idle again or IYFT_STRAND_BATCH_SIZE tasks have run. In the latter
+/// case, it schedules itself again. Different strands run in parallel.
+///
+/// Posting is lock-free: the tasks are pushed to an intrusive multi-producer
+/// single-consumer queue and only the transition from idle to busy adds a task to the
+/// pool. In SchedulingMode::WorkStealing, a drain task that's rescheduled by a worker
+/// goes to the deque of that worker, which keeps the strand on the same core.
+///
+/// \warning The strand must be destroyed before its ThreadPool. The destructor waits
+/// for all posted tasks.
+class Strand {
+public:
+    /// \brief Creates a strand.
+    ///
+    /// \param pool The pool that will run the tasks.
+    /// \param options The options of the drain tasks that are added to the pool.
+    explicit Strand(ThreadPool& pool, TaskOptions options = TaskOptions()) 
+        : pool(pool), options(options), pendingTasks(0), head(&stub), tail(&stub) {}
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Strand(const Strand&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Strand& operator=(const Strand&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Strand(Strand&&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Strand& operator=(Strand&&) = delete;
+    
+    /// \warning Must not be called from a task of this strand.
+    ~Strand() {
+        waitForAll();
+        
+        // The drain task stops touching the strand right after the counter reaches 0.
+        while (pendingTasks.load(std::memory_order_acquire) != 0) {
+            SpinPause();
+        }
+        
+        // Only the stub or the last executed node remain.
+        if (tail != &stub) {
+            delete tail;
+        }
+    }
+    
+    /// \brief Adds a task that runs after all tasks that were posted before it.
+    ///
+    /// Exceptions thrown by the task are discarded, just like the exceptions of
+    /// ThreadPool::addTask().
+    ///
+    /// \throws std::runtime_error if the pool is awaiting destruction and the strand was
+    /// idle. The task and the ones that other threads posted in the meantime are
+    /// destroyed without running.
+    template<typename F, typename... Args>
+    inline void post(F&& f, Args&&... args) {
+        push(InplaceTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    }
+    
+    /// \brief Adds a task that returns a future and runs after all tasks that were
+    /// posted before it.
+    ///
+    /// \throws std::runtime_error if the pool is awaiting destruction and the strand was
+    /// idle. The futures of the tasks that are destroyed without running report
+    /// std::future_errc::broken_promise.
+    template<typename F, typename... Args>
+#ifdef IYFT_HAS_CPP17
+    std::future<std::invoke_result_t<F, Args...>> postWithResult(F&& f, Args&&... args) {
+        using ReturnValueType = std::invoke_result_t<F, Args...>;
+#else // IYFT_HAS_CPP17
+    std::future<typename std::result_of<F&&(Args&&...)>::type> postWithResult(F&& f, Args&&... args) {
+        using ReturnValueType = typename std::result_of<F&&(Args&&...)>::type;
+#endif // IYFT_HAS_CPP17
+        std::packaged_task<ReturnValueType()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        auto taskResult = task.get_future();
+        
+        push(InplaceTask(std::move(task)));
+        
+        return taskResult;
+    }
+    
+    /// \brief Blocks until all tasks that were posted before this call complete. The
+    /// calling thread executes pending tasks of the pool while it waits.
+    ///
+    /// \throws std::logic_error if called from a task of this strand, which would wait
+    /// for itself.
+    void waitForAll() {
+        if (runningInThisThread()) {
+            throw std::logic_error("A Strand can't wait for itself");
+        }
+        
+        if (pendingTasks.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        
+        // The tasks run in order, therefore, all earlier ones are done once this one is.
+        const std::future<void> marker = postWithResult([](){});
+        pool.waitFor(marker);
+    }
+    
+    /// \brief Returns true if the calling thread is currently executing a task of this
+    /// strand.
+    inline bool runningInThisThread() const {
+        return CurrentStrand() == this;
+    }
+    
+    /// \brief Returns the number of tasks that were posted and haven't completed yet.
+    inline std::size_t getPendingTaskCount() const {
+        return pendingTasks.load(std::memory_order_relaxed);
+    }
+    
+    /// \brief Returns the pool that runs the tasks of this strand.
+    inline ThreadPool& getPool() const {
+        return pool;
+    }
+private:
+    /// \brief A node of the task queue.
+    struct Node {
+        Node() : next(nullptr) {}
+        explicit Node(InplaceTask&& task) : task(std::move(task)), next(nullptr) {}
+        
+        InplaceTask task;
+        std::atomic<Node*> next;
+    };
+    
+    /// \brief Returns the strand whose task the calling thread is executing or nullptr.
+    static const Strand*& CurrentStrand() {
+        static thread_local const Strand* strand = nullptr;
+        return strand;
+    }
+    
+    /// \brief Adds a task to the queue and schedules the drain task if the strand was
+    /// idle.
+    void push(InplaceTask&& task) {
+        Node* node = new Node(std::move(task));
+        
+        // Vyukov's intrusive MPSC queue. The consumer waits for the link if it sees the
+        // count of a node that hasn't been linked yet.
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+        
+        if (pendingTasks.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            try {
+                schedule();
+            } catch (...) {
+                // Linked nodes can't be removed, but no drain task exists, which makes
+                // this thread the consumer. The pool won't run the queued tasks, so
+                // they're destroyed until the strand becomes idle again.
+                while (!runNext(false)) {}
+                throw;
+            }
+        }
+    }
+    
+    /// \brief Adds the drain task to the pool.
+    inline void schedule() {
+        pool.addTask(options, [this](){
+            drain();
+        });
+    }
+    
+    /// \brief Runs (or only destroys) the oldest queued task. Must only be called by the
+    /// consumer.
+    ///
+    /// \return true if the strand became idle, in which case it may already have been
+    /// destroyed.
+    bool runNext(bool run) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        while (next == nullptr) {
+            SpinPause();
+            next = tail->next.load(std::memory_order_acquire);
+        }
+        
+        // The old tail has already been executed (or is the stub). The new one keeps its
+        // task until it's executed and becomes the next tail.
+        if (tail != &stub) {
+            delete tail;
+        }
+        tail = next;
+        
+        if (run) {
+            try {
+                tail->task();
+            } catch (...) {}
+        }
+        tail->task.reset();
+        
+        // The strand may be destroyed as soon as the counter reaches 0.
+        return pendingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+    
+    /// \brief Runs at most IYFT_STRAND_BATCH_SIZE tasks. Only one drain task exists at
+    /// any given time.
+    void drain() {
+        const Strand*& current = CurrentStrand();
+        const Strand* previousStrand = current;
+        current = this;
+        
+        std::size_t executed = 0;
+        bool canReschedule = true;
+        while (!runNext(true)) {
+            executed++;
+            
+            if (canReschedule && executed >= IYFT_STRAND_BATCH_SIZE) {
+                // Let other tasks use this worker. A pool that's awaiting destruction
+                // doesn't accept new tasks, in which case the rest of the tasks run here.
+                try {
+                    schedule();
+                    break;
+                } catch (...) {
+                    canReschedule = false;
+                }
+            }
+        }
+        
+        current = previousStrand;
+    }
+    
+    /// \brief The pool that runs the tasks.
+    ThreadPool& pool;
+    
+    /// \brief The options of the drain tasks.
+    const TaskOptions options;
+    
+    /// \brief The number of tasks that were posted and haven't completed yet. The 
+    /// strand is idle while this is 0.
+    std::atomic<std::size_t> pendingTasks;
+    
+    /// \brief An empty node that the queue starts with.
+    Node stub;
+    
+    /// \brief The most recently pushed node. Modified by the producers.
+    std::atomic<Node*> head;
+    
+    /// \brief The most recently executed node (or the stub). Only used by the drain
+    /// task.
+    Node* tail;
+};
+}
+
+#endif // IYFT_STRAND_HPP
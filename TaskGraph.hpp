@@ -0,0 +1,335 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file TaskGraph.hpp Contains a reusable dependency graph of tasks.
+
+#ifndef IYFT_TASK_GRAPH_HPP
+#define IYFT_TASK_GRAPH_HPP
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+#if defined(IYFT_THREAD_POOL_PROFILE) && defined(IYFT_ENABLE_PROFILING)
+#define IYFT_TASK_GRAPH_PROFILE
+#endif // defined(IYFT_THREAD_POOL_PROFILE) && defined(IYFT_ENABLE_PROFILING)
+
+namespace iyft {
+/// \brief A directed acyclic graph of tasks that can be executed on a ThreadPool
+/// multiple times.
+///
+/// Declare the nodes and the edges once and call execute() as many times as you need
+/// (e.g., once per frame). Every node is scheduled as soon as all of its predecessors
+/// complete. Executing the graph doesn't allocate any memory.
+///
+/// If IYFT_THREAD_POOL_PROFILE is defined, every node is recorded as a separate scope
+/// that uses the name of the node.
+///
+/// \warning The functions stored in the nodes must not throw. An exception would
+/// prevent the graph from completing.
+class TaskGraph {
+public:
+    /// \brief An ID of a node in the graph.
+    using NodeID = std::size_t;
+    
+    TaskGraph() : activePool(nullptr), completionBarrier(nullptr), remainingNodes(0), executing(false), validated(true) {}
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    TaskGraph(const TaskGraph&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    TaskGraph& operator=(const TaskGraph&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    TaskGraph(TaskGraph&&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    TaskGraph& operator=(TaskGraph&&) = delete;
+    
+    /// \brief Adds a new node to the graph.
+    ///
+    /// \throws std::logic_error if the graph is being executed.
+    ///
+    /// \param name The name of the node. Used when profiling.
+    /// \param f The function to call every time the graph is executed.
+    /// \param args The arguments to call the function with.
+    /// \return The ID of the new node.
+    template<typename F, typename... Args>
+    NodeID addNode(const std::string& name, F&& f, Args&&... args) {
+        checkNotExecuting();
+        
+        std::unique_ptr<Node> node(new Node(name, InplaceTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...))));
+        
+#ifdef IYFT_TASK_GRAPH_PROFILE
+        // The identifier is used to compute the hash of the scope. Nodes with the same
+        // name share a scope.
+        const std::string identifier = "TaskGraphNode:" + name;
+        node->scopeInfo = &InsertScopeInfo(name.c_str(), IYFT_THREAD_PROFILER_RUNTIME_SCOPE_HASH(identifier.c_str()), FUNCTION_NAME_MACRO, __FILE__, __LINE__, ProfilerTag::NoTag);
+#endif // IYFT_TASK_GRAPH_PROFILE
+        
+        nodes.push_back(std::move(node));
+        validated = false;
+        
+        return nodes.size() - 1;
+    }
+    
+    /// \brief Adds an edge that makes the node after depend on the node before.
+    ///
+    /// \throws std::out_of_range if any of the IDs is invalid.
+    /// \throws std::logic_error if before == after or if the graph is being executed.
+    void addEdge(NodeID before, NodeID after) {
+        checkNotExecuting();
+        
+        if (before >= nodes.size() || after >= nodes.size()) {
+            throw std::out_of_range("Invalid node ID");
+        }
+        
+        if (before == after) {
+            throw std::logic_error("A node can't depend on itself");
+        }
+        
+        nodes[before]->successors.push_back(after);
+        nodes[after]->predecessorCount++;
+        validated = false;
+    }
+    
+    /// \brief Returns the number of nodes in the graph.
+    inline std::size_t getNodeCount() const {
+        return nodes.size();
+    }
+    
+    /// \brief Starts executing the graph and returns immediately.
+    ///
+    /// The first execution after any changes checks the graph for cycles and may 
+    /// allocate memory.
+    ///
+    /// \throws std::logic_error if the graph contains a cycle or if it's already being
+    /// executed.
+    ///
+    /// \param pool The pool that will execute the nodes.
+    /// \param barrier A barrier that will be notified once after all nodes complete.
+    /// It must have been created with a taskCount of 1.
+    void execute(ThreadPool& pool, Barrier& barrier) {
+        if (executing.exchange(true)) {
+            throw std::logic_error("The TaskGraph is already being executed");
+        }
+        
+        if (!validated) {
+            try {
+                validate();
+            } catch (...) {
+                executing = false;
+                throw;
+            }
+        }
+        
+        if (nodes.empty()) {
+            executing = false;
+            barrier.notifyCompleted();
+            return;
+        }
+        
+        for (auto& node : nodes) {
+            node->remainingPredecessors.store(node->predecessorCount, std::memory_order_relaxed);
+        }
+        
+        activePool = &pool;
+        completionBarrier = &barrier;
+        remainingNodes.store(nodes.size());
+        
+        pool.addTasks(rootTasks.begin(), rootTasks.end());
+    }
+    
+    /// \brief Executes the graph and blocks until all nodes complete.
+    ///
+    /// The calling thread executes pending tasks of the pool while it waits (check 
+    /// ThreadPool::waitFor()), which makes it safe to call this from a task.
+    ///
+    /// \copydetails execute(ThreadPool&, Barrier&)
+    void execute(ThreadPool& pool) {
+        Barrier barrier(1);
+        execute(pool, barrier);
+        pool.waitFor(barrier);
+    }
+private:
+    /// \brief A single node of the graph.
+    struct Node {
+        Node(const std::string& name, InplaceTask&& function) 
+            : name(name), function(std::move(function)), predecessorCount(0), remainingPredecessors(0)
+#ifdef IYFT_TASK_GRAPH_PROFILE
+            , scopeInfo(nullptr)
+#endif // IYFT_TASK_GRAPH_PROFILE
+            {}
+        
+        std::string name;
+        InplaceTask function;
+        
+        /// \brief Nodes that depend on this one.
+        std::vector<NodeID> successors;
+        
+        /// \brief The number of nodes that this node depends on.
+        std::size_t predecessorCount;
+        
+        /// \brief The number of predecessors that haven't completed during the current
+        /// execution.
+        std::atomic<std::size_t> remainingPredecessors;
+        
+#ifdef IYFT_TASK_GRAPH_PROFILE
+        ScopeInfo* scopeInfo;
+#endif // IYFT_TASK_GRAPH_PROFILE
+    };
+    
+    /// \brief A task that executes a node and the nodes that become ready after it.
+    struct NodeTask {
+        TaskGraph* graph;
+        NodeID node;
+        
+        void operator()() {
+            graph->run(node);
+        }
+    };
+    
+    /// \brief Throws if the graph is being executed.
+    inline void checkNotExecuting() const {
+        if (executing) {
+            throw std::logic_error("A TaskGraph can't be modified while it's being executed");
+        }
+    }
+    
+    /// \brief Checks for cycles using Kahn's algorithm and collects the nodes that
+    /// don't have any predecessors.
+    void validate() {
+        std::vector<std::size_t> remaining(nodes.size());
+        std::vector<NodeID> ready;
+        
+        rootTasks.clear();
+        
+        for (NodeID i = 0; i < nodes.size(); ++i) {
+            remaining[i] = nodes[i]->predecessorCount;
+            
+            if (remaining[i] == 0) {
+                ready.push_back(i);
+                rootTasks.push_back(NodeTask{this, i});
+            }
+        }
+        
+        std::size_t visited = 0;
+        while (!ready.empty()) {
+            const NodeID current = ready.back();
+            ready.pop_back();
+            visited++;
+            
+            for (NodeID s : nodes[current]->successors) {
+                remaining[s]--;
+                
+                if (remaining[s] == 0) {
+                    ready.push_back(s);
+                }
+            }
+        }
+        
+        if (visited != nodes.size()) {
+            rootTasks.clear();
+            throw std::logic_error("The TaskGraph contains a cycle");
+        }
+        
+        validated = true;
+    }
+    
+    /// \brief Executes a node and keeps executing its ready successors on the same
+    /// thread. Other ready successors are added to the pool.
+    void run(NodeID id) {
+        while (true) {
+            Node& node = *nodes[id];
+            
+            {
+#ifdef IYFT_TASK_GRAPH_PROFILE
+                ScopeProfilerHelper profiledScope(*node.scopeInfo);
+#endif // IYFT_TASK_GRAPH_PROFILE
+                node.function();
+            }
+            
+            bool hasNext = false;
+            NodeID next = 0;
+            
+            for (NodeID s : node.successors) {
+                if (nodes[s]->remainingPredecessors.fetch_sub(1) == 1) {
+                    if (!hasNext) {
+                        hasNext = true;
+                        next = s;
+                    } else {
+                        activePool->addTask(NodeTask{this, s});
+                    }
+                }
+            }
+            
+            if (remainingNodes.fetch_sub(1) == 1) {
+                // This was the last node. The graph may be executed again or destroyed
+                // as soon as the barrier is notified.
+                Barrier* barrier = completionBarrier;
+                executing = false;
+                barrier->notifyCompleted();
+                
+                return;
+            }
+            
+            if (!hasNext) {
+                return;
+            }
+            
+            id = next;
+        }
+    }
+    
+    std::vector<std::unique_ptr<Node>> nodes;
+    
+    /// \brief Tasks for the nodes that don't have any predecessors.
+    std::vector<NodeTask> rootTasks;
+    
+    /// \brief The pool that's executing the graph.
+    ThreadPool* activePool;
+    
+    /// \brief The barrier that will be notified once all nodes complete.
+    Barrier* completionBarrier;
+    
+    /// \brief The number of nodes that haven't completed during the current execution.
+    std::atomic<std::size_t> remainingNodes;
+    
+    /// \brief True while the graph is being executed.
+    std::atomic<bool> executing;
+    
+    /// \brief False if the graph has been modified since the last check for cycles.
+    bool validated;
+};
+}
+
+#endif // IYFT_TASK_GRAPH_HPP
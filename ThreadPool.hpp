@@ -31,18 +31,88 @@
 #ifndef IYFT_THREAD_POOL_HPP
 #define IYFT_THREAD_POOL_HPP
 
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <future>
 #include <queue>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 
+#include "InplaceTask.hpp"
+#include "Spinlock.hpp"
+#include "Topology.hpp"
+#include "WorkStealingDeque.hpp"
+
+#ifdef IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+#include "MPMCQueue.hpp"
+#endif // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+
 #if __cplusplus >= 201703L
 #define IYFT_HAS_CPP17
 #endif
 
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#define IYFT_HAS_COROUTINES
+#include <coroutine>
+#endif
+
+#ifndef IYFT_THREAD_POOL_QUEUE_CAPACITY
+/// \brief The capacity of the lock-free ring buffer that's used as the shared queue
+/// when IYFT_THREAD_POOL_LOCK_FREE_QUEUE is defined.
+///
+/// Tasks that don't fit into the ring buffer are stored in a mutex protected overflow
+/// queue, therefore, adding a task never fails or blocks.
+///
+/// Default value is 4096.
+///
+/// \warning Must be a power of two.
+#define IYFT_THREAD_POOL_QUEUE_CAPACITY 4096
+#endif // IYFT_THREAD_POOL_QUEUE_CAPACITY
+
+#ifndef IYFT_THREAD_POOL_SPIN_COUNT
+/// \brief The number of times an idle worker checks for new tasks before it falls
+/// asleep on a condition variable.
+///
+/// Waking up a sleeping worker requires a system call. Spinning for a short while 
+/// allows the workers to pick up tasks that arrive in quick succession much faster.
+///
+/// Default value is 128.
+#define IYFT_THREAD_POOL_SPIN_COUNT 128
+#endif // IYFT_THREAD_POOL_SPIN_COUNT
+
+#ifndef IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL
+/// \brief Every IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL-th task that a worker acquires
+/// is taken from the low priority lane (if it's not empty) to prevent starvation.
+///
+/// Default value is 16.
+#define IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL 16
+#endif // IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL
+
+#ifndef IYFT_THREAD_POOL_WAIT_POLL_INTERVAL
+/// \brief The number of microseconds that a thread blocked in ThreadPool::waitFor()
+/// sleeps before it checks for new tasks that it could help with.
+///
+/// The thread wakes up immediately when the awaited Barrier or future completes. This
+/// interval only limits how long newly added tasks may stay unnoticed while all other
+/// workers are busy.
+///
+/// Default value is 100.
+#define IYFT_THREAD_POOL_WAIT_POLL_INTERVAL 100
+#endif // IYFT_THREAD_POOL_WAIT_POLL_INTERVAL
+
+static_assert(IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL >= 1, "IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL must be >= 1");
+
 #ifdef IYFT_THREAD_POOL_PROFILE
 #include "ThreadProfiler.hpp"
 #endif // IYFT_THREAD_POOL_PROFILE
@@ -50,8 +120,13 @@
 /// \brief The main namespace of the IYFThreading library
 namespace iyft {
 class ThreadPool;
+class TaskGraph;
 
 /// \brief A barrier that will block until all tasks complete.
+///
+/// Tasks decrement an atomic counter. Only the final decrement locks a mutex to
+/// wake up the waiting threads and to schedule the continuation (if one was set
+/// using ThreadPool::addContinuation()).
 class Barrier {
 public:
     /// \brief Create a barrier that will block until taskCount tasks complete.
@@ -59,7 +134,11 @@ public:
     /// \throws std::logic_error if taskCount < 0.
     ///
     /// \param taskCount The number of tasks to block for. Must be >= 0.
-    Barrier(int taskCount) : taskCount(taskCount) {
+#ifdef IYFT_HAS_COROUTINES
+    Barrier(int taskCount) : taskCount(taskCount), completed(taskCount == 0), continuationPool(nullptr), awaiters(nullptr) {
+#else // IYFT_HAS_COROUTINES
+    Barrier(int taskCount) : taskCount(taskCount), completed(taskCount == 0), continuationPool(nullptr) {
+#endif // IYFT_HAS_COROUTINES
         if (taskCount < 0) {
             throw std::logic_error("You must use a non-negative integer for taskCount");
         }
@@ -79,39 +158,331 @@ public:
     
     /// \brief This function will block the calling thread until all tasks complete.
     ///
+    /// The thread spins for a short while (IYFT_THREAD_POOL_SPIN_COUNT iterations) and
+    /// then falls asleep until the last task completes.
+    ///
     /// \warning This function will cause a deadlock if you add less than taskCount 
     /// tasks that use this barrier to the ThreadPool.
+    ///
+    /// \warning Calling this function from a task blocks a worker of the pool. Use
+    /// ThreadPool::waitFor() instead.
     void waitForAll() {
-        std::unique_lock<std::mutex> lock(counterMutex);
-        barrierCondition.wait(lock, [this]{
-            return taskCount == 0;
+        spinUntilCompleted();
+        
+        // Even if the counter has already reached 0, the mutex must be locked to make
+        // sure that the thread that completed the final task has stopped using this
+        // object, which may be destroyed as soon as this function returns.
+        std::unique_lock<std::mutex> lock(completionMutex);
+        completionCondition.wait(lock, [this]{
+            return completed;
         });
     }
-private:
-    friend class ThreadPool;
     
-    /// \brief Called by the ThreadPool to notify that the task finished executing.
-    void notifyCompleted() {
-        {
-            std::lock_guard<std::mutex> lock(counterMutex);
-            taskCount--;
+    /// \brief Blocks the calling thread until all tasks complete or until the timeout
+    /// expires.
+    ///
+    /// \return true if all tasks completed, false if the timeout expired.
+    template <typename Rep, typename Period>
+    bool waitForAll(const std::chrono::duration<Rep, Period>& timeout) {
+        spinUntilCompleted();
+        
+        std::unique_lock<std::mutex> lock(completionMutex);
+        return completionCondition.wait_for(lock, timeout, [this]{
+            return completed;
+        });
+    }
+    
+#ifdef IYFT_HAS_COROUTINES
+    /// \brief Suspends a coroutine until all tasks of a Barrier complete. Returned by
+    /// the co_await operator of the Barrier.
+    class Awaiter {
+    public:
+        explicit Awaiter(Barrier& barrier) : barrier(barrier), next(nullptr) {}
+        
+        inline bool await_ready() const noexcept {
+            return false;
+        }
+        
+        /// \return false if the barrier has already completed and the coroutine should
+        /// continue without suspending.
+        bool await_suspend(std::coroutine_handle<> awaitingCoroutine) {
+            std::lock_guard<std::mutex> lock(barrier.completionMutex);
             
-            if (taskCount < 0) {
-                throw std::runtime_error("Too many completed task notifications. Did you set the correct task count when creating the barrier?");
+            if (barrier.completed) {
+                return false;
             }
+            
+            handle = awaitingCoroutine;
+            next = barrier.awaiters;
+            barrier.awaiters = this;
+            
+            return true;
         }
         
-        barrierCondition.notify_all();
+        inline void await_resume() const noexcept {}
+    private:
+        friend class Barrier;
+        
+        Barrier& barrier;
+        std::coroutine_handle<> handle;
+        
+        /// \brief The next suspended coroutine of the same barrier.
+        Awaiter* next;
+    };
+    
+    /// \brief Allows a coroutine to co_await the barrier without blocking a thread.
+    ///
+    /// The coroutine is resumed on the thread that completes the final task (usually a
+    /// worker of the pool), after the continuation (if any) has been scheduled. Use
+    /// co_await ThreadPool::schedule() afterwards if you need to spread the resumed
+    /// coroutines among the workers. Any number of coroutines may await the same barrier.
+    inline Awaiter operator co_await() {
+        return Awaiter(*this);
+    }
+#endif // IYFT_HAS_COROUTINES
+private:
+    friend class ThreadPool;
+    friend class TaskGraph;
+    
+    inline void spinUntilCompleted() const {
+        for (std::size_t i = 0; i < IYFT_THREAD_POOL_SPIN_COUNT && taskCount.load() != 0; ++i) {
+            SpinPause();
+        }
     }
     
+    /// \brief Called by the ThreadPool to notify that the task finished executing.
+    ///
+    /// Defined after the ThreadPool because it may need to schedule a continuation.
+    inline void notifyCompleted();
+    
     /// \brief The number of tasks to block for.
-    int taskCount;
+    std::atomic<int> taskCount;
+    
+    /// \brief Set to true once all tasks complete. Protected by the completionMutex.
+    bool completed;
+    
+    /// \brief The pool that the continuation will be added to or nullptr if this
+    /// barrier doesn't have a continuation. Protected by the completionMutex.
+    ThreadPool* continuationPool;
     
-    /// \brief A mutex that protects the counter.
-    std::mutex counterMutex;
+    /// \brief A task that will be added to the continuationPool once all tasks 
+    /// complete. Protected by the completionMutex.
+    InplaceTask continuation;
+    
+    /// \brief A mutex that's only locked by the waiting threads, by the final
+    /// notification and when registering a continuation.
+    std::mutex completionMutex;
     
     /// \brief A condition variable that's used for waiting.
-    std::condition_variable barrierCondition;
+    std::condition_variable completionCondition;
+    
+#ifdef IYFT_HAS_COROUTINES
+    /// \brief A list of suspended coroutines that await this barrier. The nodes are
+    /// stored in the coroutine frames. Protected by the completionMutex.
+    Awaiter* awaiters;
+#endif // IYFT_HAS_COROUTINES
+};
+
+/// \brief Determines how the ThreadPool distributes tasks among its workers.
+enum class SchedulingMode {
+    /// All tasks are stored in a single mutex protected queue that every worker takes
+    /// them from.
+    SharedQueue,
+    /// Every worker owns a lock-free Chase-Lev deque. Tasks that are added by a worker
+    /// of the pool are pushed to the deque of that worker, other workers steal them
+    /// when they run out of work and the shared queue only receives tasks that are
+    /// added by external threads.
+    ///
+    /// \remark The worker that owns the deque executes its tasks in LIFO order,
+    /// while thieves (and tasks from the shared queue) follow the FIFO order.
+    WorkStealing
+};
+
+/// \brief Determines the order in which the workers of a ThreadPool take tasks.
+///
+/// Every priority has its own queue (a lane). Workers drain the higher lanes first, but
+/// every IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL-th acquired task comes from the low
+/// priority lane (if available) to prevent starvation.
+enum class TaskPriority {
+    /// Latency critical tasks.
+    High = 0,
+    /// The default priority. In work stealing mode, normal priority tasks that are
+    /// added by the workers go to their deques.
+    Normal = 1,
+    /// Background tasks.
+    Low = 2
+};
+
+/// \brief Options that determine how a task is scheduled.
+///
+/// TaskOptions can be implicitly constructed from a TaskPriority, therefore, every 
+/// function that takes TaskOptions also accepts a plain priority.
+class TaskOptions {
+public:
+    /// \brief A node hint that leaves the choice of the node to the ThreadPool.
+    static const std::size_t AnyNode = static_cast<std::size_t>(-1);
+    
+    /// \brief Creates the options.
+    ///
+    /// \param priority The priority of the task.
+    /// \param node The NUMA node (LogicalProcessor::node) that should preferably execute
+    /// the task or AnyNode. Pools that were created without a CPUTopology have a single
+    /// node and ignore this hint.
+    TaskOptions(TaskPriority priority = TaskPriority::Normal, std::size_t node = AnyNode) : priority(priority), node(node) {}
+    
+    /// \brief Returns the priority of the task.
+    inline TaskPriority getPriority() const {
+        return priority;
+    }
+    
+    /// \brief Returns the node hint or AnyNode.
+    inline std::size_t getNode() const {
+        return node;
+    }
+private:
+    TaskPriority priority;
+    std::size_t node;
+};
+
+/// \brief The limits and the timings of a ThreadPool that adjusts the number of its
+/// workers to the load.
+///
+/// An elastic pool starts minWorkers workers. When tasks stay queued for longer than
+/// the spawn latency and no worker is sleeping, it starts another worker (at most one
+/// per spawn latency interval) until maxWorkers are running. Workers that sleep for
+/// longer than the idle timeout exit, as long as at least minWorkers remain.
+class ElasticWorkers {
+public:
+    /// \brief Creates the settings.
+    ///
+    /// \param minWorkers The number of workers that are always running. Must be > 0.
+    /// \param maxWorkers The maximum number of workers. Must be >= minWorkers.
+    /// \param spawnLatency How long the queue must stay non-empty before a new worker
+    /// is started.
+    /// \param idleTimeout How long a worker may sleep before it exits.
+    ElasticWorkers(std::size_t minWorkers, std::size_t maxWorkers, std::chrono::microseconds spawnLatency = std::chrono::microseconds(500),
+                   std::chrono::milliseconds idleTimeout = std::chrono::milliseconds(1000))
+        : minWorkers(minWorkers), maxWorkers(maxWorkers), spawnLatency(spawnLatency), idleTimeout(idleTimeout) {}
+    
+    /// \brief Returns the number of workers that are always running.
+    inline std::size_t getMinWorkers() const {
+        return minWorkers;
+    }
+    
+    /// \brief Returns the maximum number of workers.
+    inline std::size_t getMaxWorkers() const {
+        return maxWorkers;
+    }
+    
+    /// \brief Returns how long the queue must stay non-empty before a new worker is
+    /// started.
+    inline std::chrono::microseconds getSpawnLatency() const {
+        return spawnLatency;
+    }
+    
+    /// \brief Returns how long a worker may sleep before it exits.
+    inline std::chrono::milliseconds getIdleTimeout() const {
+        return idleTimeout;
+    }
+    
+    /// \brief Returns true if the pool may start or stop workers.
+    inline bool isElastic() const {
+        return minWorkers < maxWorkers;
+    }
+private:
+    std::size_t minWorkers;
+    std::size_t maxWorkers;
+    std::chrono::microseconds spawnLatency;
+    std::chrono::milliseconds idleTimeout;
+};
+
+/// \brief A snapshot of the counters of a single worker (or of the threads that don't
+/// belong to the pool) that was taken by ThreadPool::getStatistics().
+///
+/// The durations are only measured if IYFT_THREAD_POOL_TIMED_STATISTICS is defined.
+/// Otherwise, they're always 0.
+struct ThreadPoolWorkerStatistics {
+    ThreadPoolWorkerStatistics() : executedTasks(0), wakeups(0), spuriousWakeups(0), busyTime(0), idleTime(0), totalQueueLatency(0), maxQueueLatency(0) {}
+    
+    /// \brief The number of tasks that were executed.
+    std::uint64_t executedTasks;
+    
+    /// \brief The number of times the worker woke up after falling asleep.
+    std::uint64_t wakeups;
+    
+    /// \brief The number of wakeups that didn't find any queued tasks.
+    std::uint64_t spuriousWakeups;
+    
+    /// \brief The time spent executing tasks.
+    std::chrono::nanoseconds busyTime;
+    
+    /// \brief The time spent spinning, sleeping and acquiring tasks.
+    std::chrono::nanoseconds idleTime;
+    
+    /// \brief The sum of the times that the executed tasks spent in the queues, from
+    /// their submission until the start of their execution.
+    std::chrono::nanoseconds totalQueueLatency;
+    
+    /// \brief The longest time that an executed task spent in the queues.
+    std::chrono::nanoseconds maxQueueLatency;
+    
+    /// \brief Returns the average time that the executed tasks spent in the queues.
+    inline std::chrono::nanoseconds getAverageQueueLatency() const {
+        return (executedTasks == 0) ? std::chrono::nanoseconds(0) : totalQueueLatency / static_cast<std::int64_t>(executedTasks);
+    }
+};
+
+/// \brief A snapshot of the counters of a ThreadPool that was taken by
+/// ThreadPool::getStatistics().
+///
+/// The counters are updated using relaxed atomics, therefore, a snapshot that's
+/// taken while tasks are running may be slightly inconsistent (e.g., a task may be
+/// counted as executed before its busy time is added).
+struct ThreadPoolStatistics {
+    ThreadPoolStatistics() : queueHighWaterMark(0), remoteSteals(0), activeWorkers(0), spawnedWorkers(0), retiredWorkers(0) {}
+    
+    /// \brief The counters of every worker, indexed by the worker number. Elastic pools
+    /// have an entry for every worker that may run and reuse the entries of workers that
+    /// exited.
+    std::vector<ThreadPoolWorkerStatistics> workers;
+    
+    /// \brief The counters of all threads that don't belong to the pool. They execute
+    /// tasks while they're waiting for barriers or futures. Wakeups are never counted.
+    ThreadPoolWorkerStatistics externalThreads;
+    
+    /// \brief The largest number of tasks that were queued at the same time.
+    std::size_t queueHighWaterMark;
+    
+    /// \brief Same as ThreadPool::getRemoteStealCount().
+    std::uint64_t remoteSteals;
+    
+    /// \brief Same as ThreadPool::getActiveWorkerCount().
+    std::size_t activeWorkers;
+    
+    /// \brief The number of workers that an elastic pool started after its creation.
+    std::uint64_t spawnedWorkers;
+    
+    /// \brief The number of workers of an elastic pool that exited after reaching the
+    /// idle timeout.
+    std::uint64_t retiredWorkers;
+    
+    /// \brief Returns the sum of the counters of all workers and external threads.
+    /// The maxQueueLatency of the result is the maximum of all maximums.
+    inline ThreadPoolWorkerStatistics getTotal() const {
+        ThreadPoolWorkerStatistics total = externalThreads;
+        
+        for (const ThreadPoolWorkerStatistics& w : workers) {
+            total.executedTasks += w.executedTasks;
+            total.wakeups += w.wakeups;
+            total.spuriousWakeups += w.spuriousWakeups;
+            total.busyTime += w.busyTime;
+            total.idleTime += w.idleTime;
+            total.totalQueueLatency += w.totalQueueLatency;
+            total.maxQueueLatency = std::max(total.maxQueueLatency, w.maxQueueLatency);
+        }
+        
+        return total;
+    }
 };
 
 /// \brief A class that assigns work to multiple threads.
@@ -151,15 +522,122 @@ public:
     /// threads (e.g., set priorities and/or core affinities using native handles,
     /// set custom thread names, etc.).
     inline ThreadPool(std::size_t workerCount, SetupFunction setupFunction = &DefaultSetupFunction)
-        : tasksInFlight(0), running(true) {
+        : ThreadPool(workerCount, SchedulingMode::SharedQueue, setupFunction) {}
+    
+    /// \brief Creates a ThreadPool with the specified number of workers and the
+    /// specified scheduling mode.
+    ///
+    /// \param workerCount The number of workers to create. Must be > 0
+    /// \param mode The SchedulingMode that the pool will use.
+    /// \param setupFunction An optional function that can be used to setup the
+    /// threads (e.g., set priorities and/or core affinities using native handles,
+    /// set custom thread names, etc.).
+    inline ThreadPool(std::size_t workerCount, SchedulingMode mode, SetupFunction setupFunction = &DefaultSetupFunction)
+        : ThreadPool(workerCount, mode, CPUTopology(), WorkerPlacement::Unpinned, setupFunction) {}
+    
+    /// \brief Creates a topology aware ThreadPool with one worker per physical core
+    /// of the topology, minus one for the main thread.
+    ///
+    /// \copydetails ThreadPool(std::size_t, SchedulingMode, const CPUTopology&, WorkerPlacement, SetupFunction)
+    inline ThreadPool(SchedulingMode mode, const CPUTopology& topology, WorkerPlacement placement, SetupFunction setupFunction = &DefaultSetupFunction)
+        : ThreadPool(DetermineWorkerCount(topology.getCoreCount()), mode, topology, placement, setupFunction) {}
+    
+    /// \brief Creates a topology aware ThreadPool with the specified number of workers.
+    ///
+    /// Unless the placement is WorkerPlacement::Unpinned, every worker is pinned before
+    /// the setupFunction runs and every NUMA node of the topology gets its own set of
+    /// lanes. Tasks go to the lanes of the node that was hinted in their TaskOptions or,
+    /// if there's no hint, to the node of the worker that added them (external threads
+    /// distribute them among the nodes in a round-robin fashion). Workers prefer the 
+    /// tasks of their own node and only take tasks from other nodes when their node runs
+    /// out of work. Use getRemoteStealCount() to check how often that happens.
+    ///
+    /// \remark Pinning failures (e.g., due to a restrictive cpuset) are ignored.
+    ///
+    /// \throws std::logic_error if workerCount is 0 or if a pinned placement is
+    /// requested with a topology that contains no processors.
+    ///
+    /// \param workerCount The number of workers to create. Must be > 0. If it exceeds
+    /// the number of cores (or cache groups), multiple workers share them.
+    /// \param mode The SchedulingMode that the pool will use.
+    /// \param topology The topology of the machine, usually from CPUTopology::Detect().
+    /// \param placement Determines how the workers are pinned.
+    /// \param setupFunction An optional function that can be used to setup the
+    /// threads (e.g., set priorities, set custom thread names, etc.).
+    inline ThreadPool(std::size_t workerCount, SchedulingMode mode, const CPUTopology& topology, WorkerPlacement placement, SetupFunction setupFunction = &DefaultSetupFunction)
+        : ThreadPool(ElasticWorkers(workerCount, workerCount), mode, topology, placement, setupFunction) {}
+    
+    /// \brief Creates an elastic ThreadPool that starts and stops workers depending on
+    /// the load.
+    ///
+    /// \param limits The minimum and the maximum number of workers and the timings that
+    /// determine when workers are started or stopped.
+    /// \param mode The SchedulingMode that the pool will use.
+    /// \param setupFunction An optional function that can be used to setup the
+    /// threads. It runs in every thread that's started, including the ones that replace
+    /// workers that exited. The first parameter is always the maximum number of workers.
+    inline ThreadPool(const ElasticWorkers& limits, SchedulingMode mode = SchedulingMode::SharedQueue, SetupFunction setupFunction = &DefaultSetupFunction)
+        : ThreadPool(limits, mode, CPUTopology(), WorkerPlacement::Unpinned, setupFunction) {}
+    
+    /// \brief Creates a topology aware elastic ThreadPool.
+    ///
+    /// Every worker number that may run is placed in advance, the same way as it would
+    /// be in a pool with limits.getMaxWorkers() workers. A worker that's started later
+    /// takes the lowest free number and its placement.
+    ///
+    /// \throws std::logic_error if any of the limits is invalid or if a pinned placement
+    /// is requested with a topology that contains no processors.
+    ///
+    /// \param limits The minimum and the maximum number of workers and the timings that
+    /// determine when workers are started or stopped.
+    /// \param mode The SchedulingMode that the pool will use.
+    /// \param topology The topology of the machine, usually from CPUTopology::Detect().
+    /// \param placement Determines how the workers are pinned.
+    /// \param setupFunction An optional function that can be used to setup the
+    /// threads. It runs in every thread that's started, including the ones that replace
+    /// workers that exited. The first parameter is always the maximum number of workers.
+    inline ThreadPool(const ElasticWorkers& limits, SchedulingMode mode, const CPUTopology& topology, WorkerPlacement placement, SetupFunction setupFunction = &DefaultSetupFunction)
+        : mode(mode), nodeCount((placement == WorkerPlacement::Unpinned) ? 1 : topology.getNodeCount()), pendingTasks(0), queuedTasks(0), 
+          sleepingWorkers(0), queueHighWaterMark(0), lanes(new TaskLane[nodeCount * PriorityCount]), nextNode(0), remoteSteals(0), 
+          workerCounters(new WorkerCounters[limits.getMaxWorkers() + 1]), idleWaiters(0), elastic(limits.isElastic()), minWorkers(limits.getMinWorkers()),
+          spawnLatency(std::chrono::duration_cast<std::chrono::nanoseconds>(limits.getSpawnLatency()).count()), idleTimeout(limits.getIdleTimeout()),
+          setupFunction(setupFunction), activeWorkers(0), activeSlots(new std::atomic<bool>[limits.getMaxWorkers()]), backlogStart(0), spawnedWorkers(0),
+          retiredWorkers(0), running(true) {
+        const std::size_t workerCount = limits.getMaxWorkers();
+        
         if (workerCount == 0) {
             throw std::logic_error("workerCount must be > 0");
         }
         
-        workers.reserve(workerCount);
+        if (limits.getMinWorkers() == 0 || limits.getMinWorkers() > workerCount) {
+            throw std::logic_error("ElasticWorkers must have 0 < minWorkers <= maxWorkers");
+        }
+        
+        if (placement != WorkerPlacement::Unpinned && topology.getProcessors().empty()) {
+            throw std::logic_error("Workers can't be pinned using a topology that contains no processors");
+        }
+        
+        placeWorkers(workerCount, topology, placement);
+        
+        if (mode == SchedulingMode::WorkStealing) {
+            workerData.reserve(workerCount);
+            
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                workerData.emplace_back(new WorkerData());
+            }
+            
+            buildStealOrders();
+        }
+        
+        workers.resize(workerCount);
         
         for (std::size_t i = 0; i < workerCount; ++i) {
-            workers.emplace_back(&ThreadPool::executeTasks, this, workerCount, i, setupFunction);
+            activeSlots[i].store(i < minWorkers, std::memory_order_relaxed);
+        }
+        
+        activeWorkers.store(minWorkers);
+        for (std::size_t i = 0; i < minWorkers; ++i) {
+            workers[i] = std::thread(&ThreadPool::executeTasks, this, workerCount, i, setupFunction);
         }
     }
     
@@ -183,8 +661,25 @@ public:
         // and exit so that we could join them.
         newTaskNotifier.notify_all();
         
+        // Wait for a worker that's being started. No new workers will be started once
+        // the mutex is released because running is false.
+        {
+            std::lock_guard<std::mutex> lock(spawnMutex);
+        }
+        
         for (auto& w : workers) {
-            w.join();
+            if (w.joinable()) {
+                w.join();
+            }
+        }
+        
+        // All workers have finished their work, therefore, all deques must be empty.
+        // Still, it's better to be safe than sorry.
+        for (auto& wd : workerData) {
+            TaskNode* node;
+            while (wd->localTasks.pop(node)) {
+                delete node;
+            }
         }
     }
     
@@ -193,62 +688,177 @@ public:
     
     /// \brief Returns the number of the threads in the pool.
     ///
-    /// \return The number of threads.
+    /// \return The number of threads. For elastic pools, it's the maximum number of
+    /// workers. Use getActiveWorkerCount() to get the number of running ones.
     inline std::size_t getWorkerCount() const {
         return workers.size();
     }
     
-    /// \brief Returns the number of tasks remaining in the queue.
+    /// \brief Returns the number of workers that are currently running. Only differs
+    /// from getWorkerCount() in elastic pools.
+    inline std::size_t getActiveWorkerCount() const {
+        return activeWorkers.load(std::memory_order_relaxed);
+    }
+    
+    /// \brief Returns true if the pool was created with ElasticWorkers that allow it
+    /// to start and stop workers.
+    inline bool isElastic() const {
+        return elastic;
+    }
+    
+    /// \brief Returns the SchedulingMode that was used to create this pool.
+    ///
+    /// \return The SchedulingMode.
+    inline SchedulingMode getSchedulingMode() const {
+        return mode;
+    }
+    
+    /// \brief Returns the number of NUMA nodes that have their own lanes. Always 1 if
+    /// the pool was created without a CPUTopology or with WorkerPlacement::Unpinned.
+    inline std::size_t getNodeCount() const {
+        return nodeCount;
+    }
+    
+    /// \brief Returns the NUMA node that the specified worker was placed on.
+    ///
+    /// \throws std::out_of_range if the worker doesn't exist.
+    inline std::size_t getWorkerNode(std::size_t worker) const {
+        return workerNodes.at(worker);
+    }
+    
+    /// \brief Returns the number of tasks that workers took from the lanes or deques
+    /// of other NUMA nodes.
+    inline std::uint64_t getRemoteStealCount() const {
+        return remoteSteals.load(std::memory_order_relaxed);
+    }
+    
+#ifdef IYFT_HAS_COROUTINES
+    /// \brief Moves a coroutine to a worker of the pool. Returned by schedule().
+    class ScheduleAwaiter {
+    public:
+        ScheduleAwaiter(ThreadPool& pool, TaskOptions options) : pool(pool), options(options) {}
+        
+        inline bool await_ready() const noexcept {
+            return false;
+        }
+        
+        /// \throws std::runtime_error if the pool is awaiting destruction. The
+        /// exception is rethrown in the coroutine.
+        void await_suspend(std::coroutine_handle<> handle) {
+            // The coroutine (and this object) may be destroyed before enqueue() returns.
+            pool.enqueue(InplaceTask([handle](){
+                handle.resume();
+            }), options);
+        }
+        
+        inline void await_resume() const noexcept {}
+    private:
+        ThreadPool& pool;
+        TaskOptions options;
+    };
+    
+    /// \brief Returns an awaitable that suspends the calling coroutine and resumes it
+    /// on a worker of this pool, e.g., co_await pool.schedule().
+    ///
+    /// A suspended coroutine doesn't occupy a thread while it waits in the queue.
+    ///
+    /// \param options The options of the task that resumes the coroutine.
+    inline ScheduleAwaiter schedule(TaskOptions options = TaskOptions()) {
+        return ScheduleAwaiter(*this, options);
+    }
+#endif // IYFT_HAS_COROUTINES
+    
+    /// \brief Takes a snapshot of the counters that the workers maintain.
+    ///
+    /// The counters are cheap (a few relaxed atomic increments per task) and always
+    /// enabled. Busy, idle and queue latency times are only measured if
+    /// IYFT_THREAD_POOL_TIMED_STATISTICS is defined because they require reading
+    /// the clock.
+    ThreadPoolStatistics getStatistics() const {
+        ThreadPoolStatistics statistics;
+        
+        statistics.workers.resize(workers.size());
+        for (std::size_t i = 0; i < workers.size(); ++i) {
+            workerCounters[i].read(statistics.workers[i]);
+        }
+        
+        workerCounters[workers.size()].read(statistics.externalThreads);
+        
+        const int highWaterMark = queueHighWaterMark.load(std::memory_order_relaxed);
+        statistics.queueHighWaterMark = (highWaterMark > 0) ? static_cast<std::size_t>(highWaterMark) : 0;
+        statistics.remoteSteals = remoteSteals.load(std::memory_order_relaxed);
+        statistics.activeWorkers = activeWorkers.load(std::memory_order_relaxed);
+        statistics.spawnedWorkers = spawnedWorkers.load(std::memory_order_relaxed);
+        statistics.retiredWorkers = retiredWorkers.load(std::memory_order_relaxed);
+        
+        return statistics;
+    }
+    
+    /// \brief Returns the number of tasks remaining in the queue (and in the deques
+    /// of the workers, if work stealing is used).
     ///
     /// \return The number of tasks.
     inline std::size_t getRemainingTaskCount() const {
-        std::unique_lock<std::mutex> lock(taskMutex);
-        return tasks.size();
+        const int count = queuedTasks.load();
+        return (count > 0) ? static_cast<std::size_t>(count) : 0;
+    }
+    
+    /// \brief Returns the number of tasks that were added to the pool and haven't
+    /// completed yet, including the ones that are currently running.
+    ///
+    /// \return The number of tasks.
+    inline std::size_t getPendingTaskCount() const {
+        const int count = pendingTasks.load();
+        return (count > 0) ? static_cast<std::size_t>(count) : 0;
     }
     
     /// \brief Adds a task that returns nothing.
     template<typename F, typename... Args>
     inline void addTask(F&& f, Args&&... args) {
+        addTask(TaskPriority::Normal, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified priority that returns nothing.
+    template<typename F, typename... Args>
+    inline void addTask(TaskPriority priority, F&& f, Args&&... args) {
+        addTask(TaskOptions(priority), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified options that returns nothing.
+    template<typename F, typename... Args>
+    inline void addTask(TaskOptions options, F&& f, Args&&... args) {
 #ifdef IYFT_THREAD_POOL_PROFILE
         IYFT_PROFILE(AddTaskNoResultNoBarrier);
 #endif // IYFT_THREAD_POOL_PROFILE
 
-        {
-            std::lock_guard<std::mutex> lock(taskMutex);
-            
-            checkRunning();
-            
-            // If I recall correctly, assigning a packaged_task that returns a 
-            // non-void to one that does invokes undefined behaviour.
-            auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-            tasks.emplace([func](){
-                func();
-            });
-        }
-        
-        newTaskNotifier.notify_one();
+        // The result of std::bind is stored in the task directly. If it's small
+        // enough, no memory will be allocated.
+        enqueue(InplaceTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...)), options);
     }
     
     /// \brief Adds a task that returns nothing and notifies a barrier upon 
     /// completion.
     template<typename F, typename... Args>
     inline void addTask(Barrier& barrier, F&& f, Args&&... args) {
+        addTask(TaskPriority::Normal, barrier, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified priority that returns nothing and
+    /// notifies a barrier upon completion.
+    template<typename F, typename... Args>
+    inline void addTask(TaskPriority priority, Barrier& barrier, F&& f, Args&&... args) {
+        addTask(TaskOptions(priority), barrier, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified options that returns nothing and
+    /// notifies a barrier upon completion.
+    template<typename F, typename... Args>
+    inline void addTask(TaskOptions options, Barrier& barrier, F&& f, Args&&... args) {
 #ifdef IYFT_THREAD_POOL_PROFILE
         IYFT_PROFILE(AddTaskNoResultWithBarrier);
 #endif // IYFT_THREAD_POOL_PROFILE
-        {
-            std::lock_guard<std::mutex> lock(taskMutex);
-            
-            checkRunning();
-            
-            auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-            tasks.emplace([func, &barrier](){
-                func();
-                barrier.notifyCompleted();
-            });
-        }
-        
-        newTaskNotifier.notify_one();
+        auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        enqueue(InplaceTask(BarrierNotifyingTask<decltype(func)>{std::move(func), &barrier}), options);
     }
     
     /// \brief Adds a task that returns a future.
@@ -256,7 +866,27 @@ public:
 #ifdef IYFT_HAS_CPP17
     std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(F&& f, Args&&... args) {
 #else // IYFT_HAS_CPP17
-     std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(F&& f, Args&&... args) {
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(F&& f, Args&&... args) {
+#endif // IYFT_HAS_CPP17
+        return addTaskWithResult(TaskPriority::Normal, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified priority that returns a future.
+    template<typename F, typename... Args>
+#ifdef IYFT_HAS_CPP17
+    std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(TaskPriority priority, F&& f, Args&&... args) {
+#else // IYFT_HAS_CPP17
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(TaskPriority priority, F&& f, Args&&... args) {
+#endif // IYFT_HAS_CPP17
+        return addTaskWithResult(TaskOptions(priority), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified options that returns a future.
+    template<typename F, typename... Args>
+#ifdef IYFT_HAS_CPP17
+    std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(TaskOptions options, F&& f, Args&&... args) {
+#else // IYFT_HAS_CPP17
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(TaskOptions options, F&& f, Args&&... args) {
 #endif // IYFT_HAS_CPP17
     
 #ifdef IYFT_THREAD_POOL_PROFILE
@@ -271,20 +901,11 @@ public:
         
         using TaskType = std::packaged_task<ReturnValueType()>;
         
-        TaskType task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        TaskType task(EndsFlow(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
         auto taskResult = task.get_future();
         
-        {
-            std::lock_guard<std::mutex> lock(taskMutex);
-            
-            checkRunning();
-            
-            tasks.emplace(std::bind([](TaskType& task){
-                task();
-            }, std::move(task)));
-        }
+        enqueue(InplaceTask(std::move(task)), options);
         
-        newTaskNotifier.notify_one();
         return taskResult;
     }
     
@@ -294,7 +915,29 @@ public:
 #ifdef IYFT_HAS_CPP17
     std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(Barrier& barrier, F&& f, Args&&... args) {
 #else // IYFT_HAS_CPP17
-    std::future<typename std::result_of<F&&(Args&&...)>::value> addTaskWithResult(Barrier& barrier, F&& f, Args&&... args) {
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(Barrier& barrier, F&& f, Args&&... args) {
+#endif // IYFT_HAS_CPP17
+        return addTaskWithResult(TaskPriority::Normal, barrier, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified priority that returns a future and
+    /// notifies a barrier upon completion.
+    template<typename F, typename... Args>
+#ifdef IYFT_HAS_CPP17
+    std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(TaskPriority priority, Barrier& barrier, F&& f, Args&&... args) {
+#else // IYFT_HAS_CPP17
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(TaskPriority priority, Barrier& barrier, F&& f, Args&&... args) {
+#endif // IYFT_HAS_CPP17
+        return addTaskWithResult(TaskOptions(priority), barrier, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+    
+    /// \brief Adds a task with the specified options that returns a future and
+    /// notifies a barrier upon completion.
+    template<typename F, typename... Args>
+#ifdef IYFT_HAS_CPP17
+    std::future<std::invoke_result_t<F, Args...>> addTaskWithResult(TaskOptions options, Barrier& barrier, F&& f, Args&&... args) {
+#else // IYFT_HAS_CPP17
+    std::future<typename std::result_of<F&&(Args&&...)>::type> addTaskWithResult(TaskOptions options, Barrier& barrier, F&& f, Args&&... args) {
 #endif // IYFT_HAS_CPP17
 #ifdef IYFT_THREAD_POOL_PROFILE
         IYFT_PROFILE(AddTaskWithResultWithBarrier);
@@ -307,50 +950,1427 @@ public:
 #endif // IYFT_HAS_CPP17
         using TaskType = std::packaged_task<ReturnValueType()>;
         
-        TaskType task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        TaskType task(EndsFlow(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
         auto taskResult = task.get_future();
         
-        {
-            std::lock_guard<std::mutex> lock(taskMutex);
-            
-            checkRunning();
-            
-            tasks.emplace(std::bind([&barrier](TaskType& task){
-                task();
-                barrier.notifyCompleted();
-            }, std::move(task)));
-        }
+        enqueue(InplaceTask(BarrierNotifyingTask<TaskType>{std::move(task), &barrier}), options);
         
-        newTaskNotifier.notify_one();
         return taskResult;
     }
-
-    /// \brief Busily waits until all tasks complete.
-    void waitForAll() {
-        /// TODO a less strict operation would do.
-        while (tasksInFlight.load() != 0) {
-            ;
-        }
-    }
-private:
-    static std::size_t DetermineWorkerCount(std::size_t i) {
-        if (i <= 1) {
-            return 1;
-        } else {
-            return i - 1;
-        }
-    }
     
-    /// \brief Used to check for an invalid state.
-    inline void checkRunning() const {
-        if (!running) {
-            throw std::runtime_error("Cannot add tasks to a pool that's awaiting destruction.");
-        }
+    /// \brief Adds a task to the pool once all tasks of the barrier complete.
+    ///
+    /// Unlike Barrier::waitForAll(), this doesn't block any threads, which allows you 
+    /// to build multi-stage pipelines. The continuation is counted as a pending task
+    /// from the moment it's registered. If the barrier has already completed, the task
+    /// is added immediately.
+    ///
+    /// \throws std::logic_error if the barrier already has a continuation.
+    ///
+    /// \warning The barrier must complete before this pool is destroyed and the
+    /// barrier itself must not be destroyed until it completes.
+    template<typename F, typename... Args>
+    void addContinuation(Barrier& barrier, F&& f, Args&&... args) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddContinuationNoBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        registerContinuation(barrier, InplaceTask(std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    }
+    
+    /// \brief Adds a task that notifies nextBarrier upon completion to the pool once all
+    /// tasks of the barrier complete.
+    ///
+    /// \copydetails addContinuation(Barrier&, F&&, Args&&...)
+    template<typename F, typename... Args>
+    void addContinuation(Barrier& barrier, Barrier& nextBarrier, F&& f, Args&&... args) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddContinuationWithBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        registerContinuation(barrier, InplaceTask(BarrierNotifyingTask<decltype(func)>{std::move(func), &nextBarrier}));
+    }
+    
+    /// \brief Adds every callable from the range [first, last) as a separate task.
+    ///
+    /// All tasks are added using a single critical section and at most one sleeping
+    /// worker per task is woken up.
+    ///
+    /// \remark The callables are copied. Use std::make_move_iterator if you want to
+    /// move them instead.
+    ///
+    /// \param first A forward iterator that points to the first callable.
+    /// \param last A forward iterator that points past the last callable.
+    template <typename ForwardIterator>
+    void addTasks(ForwardIterator first, ForwardIterator last) {
+        addTasks(TaskPriority::Normal, first, last);
+    }
+    
+    /// \brief Adds every callable from the range [first, last) as a separate task with
+    /// the specified options.
+    ///
+    /// \copydetails addTasks(ForwardIterator, ForwardIterator)
+    template <typename ForwardIterator>
+    void addTasks(TaskOptions options, ForwardIterator first, ForwardIterator last) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddTasksNoBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        const std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+        enqueueBatch(count, [&first](std::size_t) -> InplaceTask {
+            InplaceTask task(*first);
+            ++first;
+            
+            return task;
+        }, options);
+    }
+    
+    /// \brief Adds every callable from the range [first, last) as a separate task. Each
+    /// task notifies the barrier upon completion.
+    ///
+    /// \copydetails addTasks(ForwardIterator, ForwardIterator)
+    template <typename ForwardIterator>
+    void addTasks(Barrier& barrier, ForwardIterator first, ForwardIterator last) {
+        addTasks(TaskPriority::Normal, barrier, first, last);
+    }
+    
+    /// \brief Adds every callable from the range [first, last) as a separate task with
+    /// the specified options. Each task notifies the barrier upon completion.
+    ///
+    /// \copydetails addTasks(ForwardIterator, ForwardIterator)
+    template <typename ForwardIterator>
+    void addTasks(TaskOptions options, Barrier& barrier, ForwardIterator first, ForwardIterator last) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddTasksWithBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        using FunctorType = typename std::iterator_traits<ForwardIterator>::value_type;
+        
+        const std::size_t count = static_cast<std::size_t>(std::distance(first, last));
+        enqueueBatch(count, [&first, &barrier](std::size_t) -> InplaceTask {
+            InplaceTask task(BarrierNotifyingTask<FunctorType>{*first, &barrier});
+            ++first;
+            
+            return task;
+        }, options);
+    }
+    
+    /// \brief Splits the index range [begin, end) into chunks of at most grain indices
+    /// and adds a task that calls f(chunkBegin, chunkEnd) for every chunk.
+    ///
+    /// All tasks are added using a single critical section and at most one sleeping
+    /// worker per task is woken up. Use ChunkCount() to determine the number of tasks.
+    ///
+    /// \remark Every task gets its own copy of f.
+    ///
+    /// \throws std::logic_error if grain is 0.
+    template <typename F>
+    void addTasks(std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+        addTasks(TaskPriority::Normal, begin, end, grain, std::forward<F>(f));
+    }
+    
+    /// \brief Splits the index range [begin, end) into chunks of at most grain indices
+    /// and adds a task with the specified options that calls f(chunkBegin, chunkEnd)
+    /// for every chunk.
+    ///
+    /// \copydetails addTasks(std::size_t, std::size_t, std::size_t, F&&)
+    template <typename F>
+    void addTasks(TaskOptions options, std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddTaskRangeNoBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        using FunctorType = typename std::decay<F>::type;
+        
+        const std::size_t count = ChunkCount(begin, end, grain);
+        enqueueBatch(count, [&f, begin, end, grain](std::size_t chunk) -> InplaceTask {
+            return InplaceTask(ChunkTask<FunctorType>{f, ChunkBegin(begin, grain, chunk), ChunkEnd(begin, end, grain, chunk)});
+        }, options);
+    }
+    
+    /// \brief Splits the index range [begin, end) into chunks of at most grain indices
+    /// and adds a task that calls f(chunkBegin, chunkEnd) for every chunk. Each task
+    /// notifies the barrier upon completion.
+    ///
+    /// \copydetails addTasks(std::size_t, std::size_t, std::size_t, F&&)
+    template <typename F>
+    void addTasks(Barrier& barrier, std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+        addTasks(TaskPriority::Normal, barrier, begin, end, grain, std::forward<F>(f));
+    }
+    
+    /// \brief Splits the index range [begin, end) into chunks of at most grain indices
+    /// and adds a task with the specified options that calls f(chunkBegin, chunkEnd)
+    /// for every chunk. Each task notifies the barrier upon completion.
+    ///
+    /// \copydetails addTasks(std::size_t, std::size_t, std::size_t, F&&)
+    template <typename F>
+    void addTasks(TaskOptions options, Barrier& barrier, std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(AddTaskRangeWithBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        using FunctorType = typename std::decay<F>::type;
+        using TaskType = ChunkTask<FunctorType>;
+        
+        const std::size_t count = ChunkCount(begin, end, grain);
+        enqueueBatch(count, [&f, &barrier, begin, end, grain](std::size_t chunk) -> InplaceTask {
+            return InplaceTask(BarrierNotifyingTask<TaskType>{TaskType{f, ChunkBegin(begin, grain, chunk), ChunkEnd(begin, end, grain, chunk)}, &barrier});
+        }, options);
+    }
+    
+    /// \brief Calls f(i) for every i in [begin, end) in parallel.
+    ///
+    /// A single task that covers the whole range is added to the pool. Tasks keep 
+    /// splitting their ranges in half and adding the second half to the pool until 
+    /// they're left with a single chunk of at most grain indices. In work stealing mode,
+    /// this means that idle workers steal big ranges while busy workers keep the small 
+    /// ones to themselves.
+    ///
+    /// \throws std::logic_error if grain is 0 or if the range contains more than
+    /// std::numeric_limits<int>::max() chunks.
+    ///
+    /// \return A Barrier that will unblock once all indices are processed. The Barrier
+    /// and f will be kept alive for as long as the returned pointer or any of the tasks
+    /// exist.
+    template <typename F>
+    std::shared_ptr<Barrier> parallelFor(std::size_t begin, std::size_t end, std::size_t grain, F&& f) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(ParallelFor);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        using StateType = ParallelForState<typename std::decay<F>::type>;
+        
+        const std::size_t count = ChunkCount(begin, end, grain);
+        if (count > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+            throw std::logic_error("Too many chunks. Use a bigger grain.");
+        }
+        
+        auto state = std::make_shared<StateType>(std::forward<F>(f), begin, end, grain, static_cast<int>(count));
+        
+        if (count > 0) {
+            enqueue(InplaceTask(ParallelForTask<StateType>{this, state, 0, count}));
+        }
+        
+        // The barrier lives inside the state.
+        return std::shared_ptr<Barrier>(state, &state->barrier);
+    }
+    
+    /// \brief Determines the number of chunks that an index range will be split into.
+    ///
+    /// \throws std::logic_error if grain is 0.
+    ///
+    /// \return The number of chunks or 0 if end <= begin.
+    static std::size_t ChunkCount(std::size_t begin, std::size_t end, std::size_t grain) {
+        if (grain == 0) {
+            throw std::logic_error("grain must be > 0");
+        }
+        
+        if (end <= begin) {
+            return 0;
+        }
+        
+        const std::size_t length = end - begin;
+        return length / grain + ((length % grain) != 0 ? 1 : 0);
+    }
+    
+    /// \brief Blocks the calling thread until all queued and running tasks complete.
+    ///
+    /// The thread spins for a short while (IYFT_THREAD_POOL_SPIN_COUNT iterations) and
+    /// then falls asleep until the last task completes.
+    ///
+    /// \warning Calling this function from a task that's running in this pool will
+    /// cause a deadlock. Use waitFor() to wait for specific tasks instead.
+    void waitForAll() {
+        if (spinUntilIdle()) {
+            return;
+        }
+        
+        std::unique_lock<std::mutex> lock(idleMutex);
+        
+        // Check notifyIdleWaiters() for the reasons behind this order.
+        idleWaiters++;
+        idleNotifier.wait(lock, [this]{
+            return pendingTasks.load() == 0;
+        });
+        idleWaiters--;
+    }
+    
+    /// \brief Blocks the calling thread until all queued and running tasks complete or
+    /// until the timeout expires.
+    ///
+    /// \warning Calling this function from a task that's running in this pool will
+    /// always time out.
+    ///
+    /// \return true if all tasks completed, false if the timeout expired.
+    template <typename Rep, typename Period>
+    bool waitForAll(const std::chrono::duration<Rep, Period>& timeout) {
+        if (spinUntilIdle()) {
+            return true;
+        }
+        
+        std::unique_lock<std::mutex> lock(idleMutex);
+        
+        idleWaiters++;
+        const bool completed = idleNotifier.wait_for(lock, timeout, [this]{
+            return pendingTasks.load() == 0;
+        });
+        idleWaiters--;
+        
+        return completed;
+    }
+    
+    /// \brief Blocks the calling thread until all tasks of the barrier complete and
+    /// executes pending tasks of this pool in the meantime.
+    ///
+    /// Unlike Barrier::waitForAll(), this is safe to call from a task that's running in
+    /// this pool (e.g., when forking and joining recursively) because the waiting worker
+    /// keeps executing tasks, including the ones that the barrier waits for. Any thread
+    /// may call this function.
+    ///
+    /// \remark The calling thread may execute unrelated tasks, therefore, this function
+    /// may return some time after the barrier completes.
+    ///
+    /// \warning This function will cause a deadlock if you add less than taskCount 
+    /// tasks that use this barrier to the ThreadPool.
+    void waitFor(Barrier& barrier) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(WaitForBarrier);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        helpUntil([&barrier]{
+            return barrier.taskCount.load() == 0;
+        }, [&barrier](std::chrono::microseconds interval) {
+            std::unique_lock<std::mutex> lock(barrier.completionMutex);
+            barrier.completionCondition.wait_for(lock, interval, [&barrier]{
+                return barrier.completed;
+            });
+        });
+        
+        // Wait for the final notification to release the barrier.
+        barrier.waitForAll();
+    }
+    
+    /// \brief Blocks the calling thread until the future becomes ready and executes
+    /// pending tasks of this pool in the meantime.
+    ///
+    /// \copydetails waitFor(Barrier&)
+    ///
+    /// \throws std::future_error if the future has no shared state.
+    template <typename T>
+    void waitFor(const std::future<T>& future) {
+        waitForFuture(future);
+    }
+    
+    /// \brief Blocks the calling thread until the shared future becomes ready and
+    /// executes pending tasks of this pool in the meantime.
+    ///
+    /// \copydetails waitFor(const std::future<T>&)
+    template <typename T>
+    void waitFor(const std::shared_future<T>& future) {
+        waitForFuture(future);
+    }
+private:
+    friend class Barrier;
+    
+    static std::size_t DetermineWorkerCount(std::size_t i) {
+        if (i <= 1) {
+            return 1;
+        } else {
+            return i - 1;
+        }
+    }
+    
+    /// \brief Spins for IYFT_THREAD_POOL_SPIN_COUNT iterations or until all tasks
+    /// complete.
+    ///
+    /// \return true if all tasks completed.
+    bool spinUntilIdle() const {
+        for (std::size_t i = 0; i < IYFT_THREAD_POOL_SPIN_COUNT; ++i) {
+            if (pendingTasks.load() == 0) {
+                return true;
+            }
+            
+            SpinPause();
+        }
+        
+        return pendingTasks.load() == 0;
+    }
+    
+    /// \brief Called after a task completes.
+    ///
+    /// Wakes up threads that are blocked in waitForAll() if this was the last pending
+    /// task.
+    inline void taskCompleted() {
+        // Waiting threads increment idleWaiters before checking pendingTasks while we
+        // do the opposite. Just like in wakeUpWorkers(), at least one side is guaranteed
+        // to see the change made by the other.
+        if (pendingTasks.fetch_sub(1) == 1 && idleWaiters.load() > 0) {
+            { std::lock_guard<std::mutex> lock(idleMutex); }
+            idleNotifier.notify_all();
+        }
+    }
+    
+    /// \brief Implements waitFor() for both kinds of futures.
+    template <typename Future>
+    void waitForFuture(const Future& future) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(WaitForFuture);
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        if (!future.valid()) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        
+        // Deferred functions only run when the result is retrieved. Helping won't make
+        // them ready, so we return immediately.
+        helpUntil([&future]{
+            return future.wait_for(std::chrono::seconds(0)) != std::future_status::timeout;
+        }, [&future](std::chrono::microseconds interval) {
+            future.wait_for(interval);
+        });
+    }
+    
+    /// \brief Executes pending tasks until ready() returns true.
+    ///
+    /// Spins for IYFT_THREAD_POOL_SPIN_COUNT iterations once no tasks are available and
+    /// then calls park(interval), which must block until the awaited event happens or 
+    /// the interval expires.
+    template <typename Ready, typename Park>
+    void helpUntil(Ready ready, Park park) {
+        std::size_t idleSpins = 0;
+        
+        while (!ready()) {
+            if (tryRunPendingTask()) {
+                idleSpins = 0;
+            } else if (idleSpins < IYFT_THREAD_POOL_SPIN_COUNT) {
+                idleSpins++;
+                SpinPause();
+            } else {
+                park(std::chrono::microseconds(IYFT_THREAD_POOL_WAIT_POLL_INTERVAL));
+            }
+        }
+    }
+    
+    /// \brief Executes a single pending task on the calling thread.
+    ///
+    /// \return true if a task was executed, false if none were available.
+    bool tryRunPendingTask() {
+        if (queuedTasks.load(std::memory_order_relaxed) <= 0) {
+            return false;
+        }
+        
+        QueuedTask task;
+        
+        WorkerIdentity& identity = CurrentWorker();
+        const bool worker = (identity.pool == this);
+        const bool acquired = worker ? tryAcquireTask(identity.id, task, identity.acquiredCount) : tryAcquireExternalTask(task);
+        
+        if (!acquired) {
+            return false;
+        }
+        
+        WorkerCounters& counters = workerCounters[worker ? identity.id : workers.size()];
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+        const std::int64_t start = Now();
+        counters.recordQueueLatency(start - task.enqueueTime);
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
+        
+        runQueuedTask(task);
+        taskCompleted();
+        
+        counters.executedTasks.fetch_add(1, std::memory_order_relaxed);
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+        // Time spent helping is busy time, but the wait itself isn't counted as idle.
+        counters.busyTime.fetch_add(Now() - start, std::memory_order_relaxed);
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
+        
+        return true;
+    }
+    
+    /// \brief Used to check for an invalid state.
+    inline void checkRunning() const {
+        if (!running) {
+            throw std::runtime_error("Cannot add tasks to a pool that's awaiting destruction.");
+        }
+    }
+    
+    /// \brief Invokes a callable and notifies a barrier once it completes.
+    template <typename F>
+    struct BarrierNotifyingTask {
+        F function;
+        Barrier* barrier;
+        
+        void operator()() {
+            function();
+            barrier->notifyCompleted();
+        }
+    };
+    
+#ifdef IYFT_THREAD_POOL_PROFILE
+    /// \brief Returns the ID of the PoolTask flow of the task that the calling thread is
+    /// running. 0 if the flow has ended or wasn't started.
+    static std::uint64_t& RunningTaskFlow() {
+        static thread_local std::uint64_t flowID = 0;
+        return flowID;
+    }
+    
+    /// \brief Invokes a callable and ends the PoolTask flow of the running task before
+    /// a std::packaged_task stores the result and makes the future ready.
+    template <typename F>
+    struct FlowEndingFunction {
+        F function;
+        
+        auto operator()() -> decltype(std::declval<F&>()()) {
+            // Runs after the result has been constructed, even if the function throws.
+            struct FlowEnder {
+                ~FlowEnder() {
+                    EndRunningTaskFlow();
+                }
+            } ender;
+            
+            return function();
+        }
+    };
+    
+    /// \brief Wraps a function of a std::packaged_task in a FlowEndingFunction.
+    template <typename F>
+    static FlowEndingFunction<typename std::decay<F>::type> EndsFlow(F&& f) {
+        return FlowEndingFunction<typename std::decay<F>::type>{std::forward<F>(f)};
+    }
+#else // IYFT_THREAD_POOL_PROFILE
+    /// \brief Flows are only recorded if IYFT_THREAD_POOL_PROFILE is defined.
+    template <typename F>
+    static F&& EndsFlow(F&& f) {
+        return std::forward<F>(f);
+    }
+#endif // IYFT_THREAD_POOL_PROFILE
+    
+    /// \brief Ends the PoolTask flow of the running task. Called right before the task
+    /// notifies a barrier or makes a future ready because the results may be collected
+    /// as soon as it does.
+    static inline void EndRunningTaskFlow() {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        std::uint64_t& flowID = RunningTaskFlow();
+        IYFT_PROFILER_FLOW_END(PoolTask, flowID)
+        flowID = 0;
+#endif // IYFT_THREAD_POOL_PROFILE
+    }
+    
+    /// \brief Calls a function with the boundaries of a single chunk of an index range.
+    template <typename F>
+    struct ChunkTask {
+        F function;
+        std::size_t begin;
+        std::size_t end;
+        
+        void operator()() {
+            function(begin, end);
+        }
+    };
+    
+    /// \brief Data shared by all tasks that were created by a single parallelFor() call.
+    template <typename F>
+    struct ParallelForState {
+        template <typename T>
+        ParallelForState(T&& function, std::size_t begin, std::size_t end, std::size_t grain, int chunkCount)
+            : function(std::forward<T>(function)), begin(begin), end(end), grain(grain), barrier(chunkCount) {}
+        
+        F function;
+        std::size_t begin;
+        std::size_t end;
+        std::size_t grain;
+        Barrier barrier;
+    };
+    
+    /// \brief Processes the chunks [firstChunk, lastChunk) of a parallelFor() range.
+    template <typename S>
+    struct ParallelForTask {
+        ThreadPool* pool;
+        std::shared_ptr<S> state;
+        std::size_t firstChunk;
+        std::size_t lastChunk;
+        
+        void operator()() {
+            // Give the second half of the range away until a single chunk remains.
+            while (lastChunk - firstChunk > 1) {
+                const std::size_t middle = firstChunk + (lastChunk - firstChunk) / 2;
+                
+                pool->enqueue(InplaceTask(ParallelForTask{pool, state, middle, lastChunk}));
+                lastChunk = middle;
+            }
+            
+            const std::size_t chunkBegin = ChunkBegin(state->begin, state->grain, firstChunk);
+            const std::size_t chunkEnd = ChunkEnd(state->begin, state->end, state->grain, firstChunk);
+            
+            for (std::size_t i = chunkBegin; i < chunkEnd; ++i) {
+                state->function(i);
+            }
+            
+            state->barrier.notifyCompleted();
+        }
+    };
+    
+    static std::size_t ChunkBegin(std::size_t begin, std::size_t grain, std::size_t chunk) {
+        return begin + chunk * grain;
+    }
+    
+    static std::size_t ChunkEnd(std::size_t begin, std::size_t end, std::size_t grain, std::size_t chunk) {
+        const std::size_t chunkBegin = ChunkBegin(begin, grain, chunk);
+        return (end - chunkBegin > grain) ? chunkBegin + grain : end;
+    }
+    
+    /// \brief A task that waits in a lane or in a deque.
+    ///
+    /// If IYFT_THREAD_POOL_TIMED_STATISTICS is defined, the time of the submission is
+    /// recorded to measure the queue latency. If IYFT_THREAD_POOL_PROFILE is defined and
+    /// the profiler is recording, the submission starts a PoolTask flow.
+    struct QueuedTask {
+        QueuedTask() {}
+        
+        /// \brief Intentionally implicit to allow storing the tasks directly.
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+        QueuedTask(InplaceTask&& task) : task(std::move(task)), enqueueTime(Now()) {
+#else // IYFT_THREAD_POOL_TIMED_STATISTICS
+        QueuedTask(InplaceTask&& task) : task(std::move(task)) {
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
+#ifdef IYFT_THREAD_POOL_PROFILE
+            // Tasks are wrapped on the submitting thread, inside the scope of the call
+            // that added them.
+            flowID = IYFT_PROFILER_NEW_FLOW_ID;
+            IYFT_PROFILER_FLOW_BEGIN(PoolTask, flowID)
+#endif // IYFT_THREAD_POOL_PROFILE
+        }
+        
+        InplaceTask task;
+        
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+        /// \brief The result of Now() at the time of the submission.
+        std::int64_t enqueueTime;
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
+
+#ifdef IYFT_THREAD_POOL_PROFILE
+        /// \brief Links the submission to the execution in the profiler results. 0 if
+        /// the profiler wasn't recording when the task was submitted.
+        std::uint64_t flowID = 0;
+#endif // IYFT_THREAD_POOL_PROFILE
+    };
+    
+    /// \brief The counters of a single worker. Only the owning worker modifies them
+    /// (except for the last slot, which is shared by all external threads), but any
+    /// thread may read them in getStatistics().
+    ///
+    /// \remark The padding keeps the counters of adjacent workers on different cache lines.
+    struct WorkerCounters {
+        WorkerCounters() : executedTasks(0), wakeups(0), spuriousWakeups(0), busyTime(0), idleTime(0), totalQueueLatency(0), maxQueueLatency(0), padding() {}
+        
+        /// \brief Stores the current values in a snapshot.
+        void read(ThreadPoolWorkerStatistics& statistics) const {
+            statistics.executedTasks = executedTasks.load(std::memory_order_relaxed);
+            statistics.wakeups = wakeups.load(std::memory_order_relaxed);
+            statistics.spuriousWakeups = spuriousWakeups.load(std::memory_order_relaxed);
+            statistics.busyTime = std::chrono::nanoseconds(busyTime.load(std::memory_order_relaxed));
+            statistics.idleTime = std::chrono::nanoseconds(idleTime.load(std::memory_order_relaxed));
+            statistics.totalQueueLatency = std::chrono::nanoseconds(totalQueueLatency.load(std::memory_order_relaxed));
+            statistics.maxQueueLatency = std::chrono::nanoseconds(maxQueueLatency.load(std::memory_order_relaxed));
+        }
+        
+        /// \brief Adds the latency of a task that's about to start.
+        void recordQueueLatency(std::int64_t latency) {
+            totalQueueLatency.fetch_add(latency, std::memory_order_relaxed);
+            
+            // A CAS loop because external threads share their counters.
+            std::int64_t current = maxQueueLatency.load(std::memory_order_relaxed);
+            while (latency > current && !maxQueueLatency.compare_exchange_weak(current, latency, std::memory_order_relaxed)) {;}
+        }
+        
+        std::atomic<std::uint64_t> executedTasks;
+        std::atomic<std::uint64_t> wakeups;
+        std::atomic<std::uint64_t> spuriousWakeups;
+        
+        /// \brief Durations in nanoseconds.
+        std::atomic<std::int64_t> busyTime;
+        std::atomic<std::int64_t> idleTime;
+        std::atomic<std::int64_t> totalQueueLatency;
+        std::atomic<std::int64_t> maxQueueLatency;
+        
+        CacheLinePadding<> padding;
+    };
+    
+    /// \brief Returns the current time in nanoseconds. Used by the timed statistics.
+    static inline std::int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    /// \brief Stores a task that was pushed to the deque of a worker.
+    ///
+    /// The nodes are recycled by the worker that allocated them to avoid allocating
+    /// memory for every single task.
+    struct TaskNode {
+        QueuedTask task;
+        
+        /// \brief The next free node. Only used while the node isn't storing a task.
+        TaskNode* next;
+        
+        /// \brief The ID of the worker that allocated this node.
+        std::size_t owner;
+    };
+    
+    /// \brief The number of values in TaskPriority.
+    static const std::size_t PriorityCount = 3;
+    
+    /// \brief A queue that contains pending tasks of a single priority and a single
+    /// node that were added by threads that don't belong to the pool (or all such tasks
+    /// if work stealing is disabled).
+    struct TaskLane {
+#ifdef IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        TaskLane() : tasks(IYFT_THREAD_POOL_QUEUE_CAPACITY), overflowTaskCount(0) {}
+        
+        /// \brief A lock-free ring buffer.
+        BoundedMPMCQueue<QueuedTask> tasks;
+        
+        /// \brief Pending tasks that didn't fit into the ring buffer. Protected by the
+        /// taskMutex.
+        std::queue<QueuedTask> overflowTasks;
+        
+        /// \brief The number of tasks in the overflow queue. Allows the workers to
+        /// avoid locking the mutex when the overflow queue is empty.
+        std::atomic<std::size_t> overflowTaskCount;
+#else // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        TaskLane() : taskCount(0) {}
+        
+        /// \brief The tasks. Protected by the taskMutex.
+        std::queue<QueuedTask> tasks;
+        
+        /// \brief The size of the queue. Only modified while the taskMutex is locked. 
+        /// Allows the workers to avoid locking the mutex when the lane is empty.
+        std::atomic<std::size_t> taskCount;
+#endif // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+    };
+    
+    /// \brief Data owned by a single worker. Only used if work stealing is enabled.
+    struct WorkerData {
+        WorkerData() : freeNodes(nullptr), returnedNodes(nullptr), localVictimCount(0) {}
+        
+        ~WorkerData() {
+            DeleteNodes(freeNodes);
+            DeleteNodes(returnedNodes.load());
+        }
+        
+        static void DeleteNodes(TaskNode* node) {
+            while (node != nullptr) {
+                TaskNode* next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+        
+        /// \brief Tasks that were added by this worker.
+        ///
+        /// Raw pointers are used because thieves copy the items speculatively.
+        WorkStealingDeque<TaskNode*> localTasks;
+        
+        /// \brief Nodes that are ready to be reused. Only accessed by the owner.
+        TaskNode* freeNodes;
+        
+        /// \brief Nodes that were released by thieves. They are pushed one by one and
+        /// the owner takes all of them at once, which makes this list immune to the ABA
+        /// problem.
+        std::atomic<TaskNode*> returnedNodes;
+        
+        /// \brief The IDs of the workers that this worker steals from, in order. Workers
+        /// of the same NUMA node come first.
+        std::vector<std::size_t> stealOrder;
+        
+        /// \brief The number of workers at the start of the stealOrder that belong to
+        /// the same NUMA node as this worker.
+        std::size_t localVictimCount;
+    };
+    
+    /// \brief Determines the node and the affinity of every worker.
+    void placeWorkers(std::size_t workerCount, const CPUTopology& topology, WorkerPlacement placement) {
+        workerNodes.assign(workerCount, 0);
+        workerAffinities.assign(workerCount, std::vector<std::size_t>());
+        
+        const std::vector<LogicalProcessor>& processors = topology.getProcessors();
+        
+        if (placement == WorkerPlacement::PerCore) {
+            const std::vector<std::size_t> order = topology.getSpreadOrder();
+            
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                const LogicalProcessor& processor = processors[order[i % order.size()]];
+                
+                workerNodes[i] = processor.node;
+                workerAffinities[i].push_back(processor.id);
+            }
+        } else if (placement == WorkerPlacement::PerCacheGroup) {
+            for (std::size_t i = 0; i < workerCount; ++i) {
+                const std::size_t group = i % topology.getCacheGroupCount();
+                
+                // A cache group never spans multiple nodes.
+                for (const LogicalProcessor& p : processors) {
+                    if (p.cacheGroup == group) {
+                        workerNodes[i] = p.node;
+                        break;
+                    }
+                }
+                
+                workerAffinities[i] = topology.getCacheGroupProcessors(group);
+            }
+        }
+        
+        for (std::size_t node : workerNodes) {
+            if (std::find(nodesWithWorkers.begin(), nodesWithWorkers.end(), node) == nodesWithWorkers.end()) {
+                nodesWithWorkers.push_back(node);
+            }
+        }
+    }
+    
+    /// \brief Fills the stealOrder of every worker. Must be called after placeWorkers().
+    void buildStealOrders() {
+        const std::size_t count = workerData.size();
+        
+        for (std::size_t current = 0; current < count; ++current) {
+            WorkerData& data = *workerData[current];
+            
+            for (int pass = 0; pass < 2; ++pass) {
+                const bool local = (pass == 0);
+                
+                // Starting with the next worker spreads the thieves among the victims.
+                for (std::size_t i = 1; i < count; ++i) {
+                    const std::size_t victim = (current + i) % count;
+                    
+                    if ((workerNodes[victim] == workerNodes[current]) == local) {
+                        data.stealOrder.push_back(victim);
+                    }
+                }
+                
+                if (local) {
+                    data.localVictimCount = data.stealOrder.size();
+                }
+            }
+        }
+    }
+    
+    /// \brief Obtains a free node from the worker's cache or allocates a new one.
+    ///
+    /// \warning May only be called by the worker that owns the data.
+    TaskNode* acquireNode(std::size_t current) {
+        WorkerData& data = *workerData[current];
+        
+        if (data.freeNodes == nullptr) {
+            data.freeNodes = data.returnedNodes.exchange(nullptr, std::memory_order_acquire);
+        }
+        
+        TaskNode* node = data.freeNodes;
+        if (node == nullptr) {
+            node = new TaskNode();
+            node->owner = current;
+        } else {
+            data.freeNodes = node->next;
+        }
+        
+        return node;
+    }
+    
+    /// \brief Returns an empty node to the worker that allocated it.
+    ///
+    /// \param node The node to return.
+    /// \param local true if the calling thread is the worker that owns the node.
+    void releaseNode(TaskNode* node, bool local) {
+        WorkerData& data = *workerData[node->owner];
+        
+        if (local) {
+            node->next = data.freeNodes;
+            data.freeNodes = node;
+        } else {
+            TaskNode* head = data.returnedNodes.load(std::memory_order_relaxed);
+            
+            do {
+                node->next = head;
+            } while (!data.returnedNodes.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        }
+    }
+    
+    /// \brief Identifies the pool and the worker that the current thread belongs to.
+    struct WorkerIdentity {
+        const ThreadPool* pool;
+        std::size_t id;
+        
+        /// \brief The number of tasks this worker has acquired so far.
+        std::size_t acquiredCount;
+    };
+    
+    /// \brief Returns the identity of the calling thread. The pool will be nullptr if
+    /// the current thread is not a worker of any pool.
+    static WorkerIdentity& CurrentWorker() {
+        static thread_local WorkerIdentity identity = {nullptr, 0, 0};
+        return identity;
+    }
+    
+    /// \brief Returns the lane with the specified node and priority.
+    inline TaskLane& getLane(std::size_t node, TaskPriority priority) {
+        return lanes[node * PriorityCount + static_cast<std::size_t>(priority)];
+    }
+    
+    /// \brief Determines the node that a task which can't go to a deque is added to.
+    std::size_t selectNode(std::size_t hint, const WorkerIdentity& identity) {
+        if (nodeCount == 1) {
+            return 0;
+        } else if (hint != TaskOptions::AnyNode) {
+            return hint % nodeCount;
+        } else if (identity.pool == this) {
+            return workerNodes[identity.id];
+        }
+        
+        return nodesWithWorkers[nextNode.fetch_add(1, std::memory_order_relaxed) % nodesWithWorkers.size()];
+    }
+    
+    /// \brief Adds a task to the deque of the calling worker or to the shared queue
+    /// and wakes up a sleeping worker.
+    ///
+    /// \param task The task to add.
+    /// \param options The priority and the node hint of the task.
+    /// \param counted Check admitTask().
+    inline void enqueue(InplaceTask&& task, TaskOptions options = TaskOptions(), bool counted = false) {
+        enqueueBatch(1, [&task](std::size_t){
+            return std::move(task);
+        }, options, counted);
+    }
+    
+    /// \brief Checks if the pool accepts new tasks and counts the new task as pending.
+    ///
+    /// \param counted true if the task has already been counted (e.g., continuations
+    /// are counted when they're registered). Such tasks are accepted even if the pool
+    /// is awaiting destruction because they have to complete before the workers exit.
+    inline void admitTask(bool counted) {
+        if (!counted) {
+            checkRunning();
+            pendingTasks++;
+        }
+    }
+    
+    /// \brief Stores a continuation in the barrier or adds it to the pool if the
+    /// barrier has already completed.
+    void registerContinuation(Barrier& barrier, InplaceTask&& task) {
+        checkRunning();
+        
+        {
+            std::lock_guard<std::mutex> lock(barrier.completionMutex);
+            
+            if (barrier.continuationPool != nullptr) {
+                throw std::logic_error("A Barrier can only have a single continuation");
+            }
+            
+            // Counting the continuation right away prevents waitForAll() from returning
+            // while it's still waiting for the barrier.
+            pendingTasks++;
+            
+            if (!barrier.completed) {
+                barrier.continuation = std::move(task);
+                barrier.continuationPool = this;
+                return;
+            }
+        }
+        
+        enqueue(std::move(task), TaskPriority::Normal, true);
+    }
+    
+    /// \brief Adds count tasks that are created by calling makeTask(i) for every i in
+    /// [0, count). Uses a single critical section and wakes up at most count workers.
+    ///
+    /// In work stealing mode, normal priority tasks that are added by a worker go to
+    /// its deque, unless they're hinted to run on a different node. All other tasks go
+    /// to the lane that matches their node and priority.
+    template <typename G>
+    void enqueueBatch(std::size_t count, G&& makeTask, TaskOptions options = TaskOptions(), bool counted = false) {
+        if (count == 0) {
+            return;
+        }
+        
+        const WorkerIdentity& identity = CurrentWorker();
+        const std::size_t targetNode = selectNode(options.getNode(), identity);
+        
+        if (mode == SchedulingMode::WorkStealing && options.getPriority() == TaskPriority::Normal) {
+            if (identity.pool == this && targetNode == workerNodes[identity.id]) {
+                WorkStealingDeque<TaskNode*>& deque = workerData[identity.id]->localTasks;
+                for (std::size_t i = 0; i < count; ++i) {
+                    admitTask(counted);
+                    
+                    TaskNode* node = acquireNode(identity.id);
+                    node->task = makeTask(i);
+                    
+                    // The counter must be incremented before the push to make sure
+                    // that workers never exit or go to sleep while a task is still
+                    // pending.
+                    countQueuedTask();
+                    deque.push(node);
+                }
+                
+                // The tasks of this worker can be stolen by others.
+                wakeUpWorkers(count);
+                considerSpawning();
+                return;
+            }
+        }
+        
+        TaskLane& lane = getLane(targetNode, options.getPriority());
+        
+#ifdef IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        std::size_t i = 0;
+        for (; i < count; ++i) {
+            QueuedTask task = makeTask(i);
+            
+            admitTask(counted);
+            countQueuedTask();
+            if (!lane.tasks.tryPush(std::move(task))) {
+                // The ring buffer is full. Move this and all remaining tasks to the
+                // overflow queue while holding the lock only once.
+                std::lock_guard<std::mutex> lock(taskMutex);
+                
+                lane.overflowTasks.emplace(std::move(task));
+                lane.overflowTaskCount++;
+                
+                for (++i; i < count; ++i) {
+                    admitTask(counted);
+                    countQueuedTask();
+                    lane.overflowTasks.emplace(makeTask(i));
+                    lane.overflowTaskCount++;
+                }
+                
+                break;
+            }
+        }
+        
+        wakeUpWorkers(count);
+#else // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        int sleeping;
+        {
+            std::lock_guard<std::mutex> lock(taskMutex);
+            
+            for (std::size_t i = 0; i < count; ++i) {
+                admitTask(counted);
+                countQueuedTask();
+                lane.tasks.emplace(makeTask(i));
+                lane.taskCount++;
+            }
+            
+            sleeping = sleepingWorkers.load();
+        }
+        
+        notifyWorkers(count, sleeping);
+#endif // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        
+        considerSpawning();
+    }
+    
+    /// \brief Increments queuedTasks and updates the queueHighWaterMark.
+    inline void countQueuedTask() {
+        const int count = ++queuedTasks;
+        
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILER_COUNTER(PoolQueuedTasks, count)
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        if (elastic && count == 1) {
+            // The queue was empty until now.
+            backlogStart.store(Now(), std::memory_order_relaxed);
+        }
+        
+        int highWaterMark = queueHighWaterMark.load(std::memory_order_relaxed);
+        while (count > highWaterMark && !queueHighWaterMark.compare_exchange_weak(highWaterMark, count, std::memory_order_relaxed)) {;}
+    }
+    
+    /// \brief Starts another worker if the pool is elastic, no worker is sleeping and
+    /// the queue hasn't been empty for longer than the spawn latency.
+    inline void considerSpawning() {
+        if (!elastic || sleepingWorkers.load() > 0 || queuedTasks.load(std::memory_order_relaxed) <= 0 ||
+            activeWorkers.load(std::memory_order_relaxed) >= workers.size()) {
+            return;
+        }
+        
+        const std::int64_t now = Now();
+        std::int64_t start = backlogStart.load(std::memory_order_relaxed);
+        
+        // Restarting the interval limits the pool to one new worker per spawn latency.
+        if (now - start < spawnLatency || !backlogStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            return;
+        }
+        
+        spawnWorker();
+    }
+    
+    /// \brief Starts a worker using the lowest free worker number.
+    void spawnWorker() {
+        std::lock_guard<std::mutex> lock(spawnMutex);
+        
+        if (!running || activeWorkers.load() >= workers.size()) {
+            return;
+        }
+        
+        for (std::size_t i = 0; i < workers.size(); ++i) {
+            if (activeSlots[i].load()) {
+                continue;
+            }
+            
+            // The previous worker of this slot has already decided to exit.
+            if (workers[i].joinable()) {
+                workers[i].join();
+            }
+            
+            activeSlots[i].store(true);
+            activeWorkers++;
+            spawnedWorkers.fetch_add(1, std::memory_order_relaxed);
+            
+            workers[i] = std::thread(&ThreadPool::executeTasks, this, workers.size(), i, setupFunction);
+            return;
+        }
+    }
+    
+    /// \brief Called by a worker that slept for longer than the idle timeout. Frees
+    /// its slot unless that would leave less than minWorkers running.
+    ///
+    /// \return true if the worker must exit.
+    bool tryRetireWorker(std::size_t current) {
+        std::size_t active = activeWorkers.load();
+        
+        do {
+            if (active <= minWorkers) {
+                return false;
+            }
+        } while (!activeWorkers.compare_exchange_weak(active, active - 1));
+        
+        retiredWorkers.fetch_add(1, std::memory_order_relaxed);
+        activeSlots[current].store(false);
+        
+        return true;
+    }
+    
+    /// \brief Wakes up a single worker if any of them are sleeping.
+    ///
+    /// \warning Must be called after queuedTasks was incremented.
+    inline void wakeUpWorker() {
+        wakeUpWorkers(1);
+    }
+    
+    /// \brief Wakes up at most count workers if any of them are sleeping.
+    ///
+    /// \warning Must be called after queuedTasks was incremented.
+    inline void wakeUpWorkers(std::size_t count) {
+        // Workers increment sleepingWorkers before checking queuedTasks while we do
+        // the opposite. Thanks to sequential consistency, at least one of us is 
+        // guaranteed to see the change made by the other. The mutex needs to be locked
+        // to avoid notifying a worker that hasn't started waiting yet.
+        if (sleepingWorkers.load() > 0) {
+            int sleeping;
+            {
+                std::lock_guard<std::mutex> lock(taskMutex);
+                sleeping = sleepingWorkers.load();
+            }
+            
+            notifyWorkers(count, sleeping);
+        }
+    }
+    
+    /// \brief Notifies min(count, sleeping) workers.
+    inline void notifyWorkers(std::size_t count, int sleeping) {
+        if (sleeping <= 0) {
+            return;
+        }
+        
+        if (count >= static_cast<std::size_t>(sleeping)) {
+            newTaskNotifier.notify_all();
+        } else {
+            for (std::size_t i = 0; i < count; ++i) {
+                newTaskNotifier.notify_one();
+            }
+        }
+    }
+    
+    /// \brief Tries to pop a task from the deque of the current worker.
+    bool tryPopLocalTask(std::size_t current, QueuedTask& task) {
+        TaskNode* acquired = nullptr;
+        
+        if (!workerData[current]->localTasks.pop(acquired)) {
+            return false;
+        }
+        
+        queuedTasks--;
+        
+        task = std::move(acquired->task);
+        releaseNode(acquired, true);
+        
+        return true;
+    }
+    
+    /// \brief Tries to steal a task from the deque of another worker.
+    ///
+    /// \param remote If false, only the workers of the same node are checked. If true,
+    /// only the workers of other nodes are checked.
+    bool tryStealTask(std::size_t current, QueuedTask& task, bool remote) {
+        TaskNode* acquired = nullptr;
+        
+        bool found = false;
+        
+        const WorkerData& data = *workerData[current];
+        const std::size_t first = remote ? data.localVictimCount : 0;
+        const std::size_t last = remote ? data.stealOrder.size() : data.localVictimCount;
+        for (std::size_t i = first; i < last && !found; ++i) {
+            found = workerData[data.stealOrder[i]]->localTasks.steal(acquired);
+        }
+        
+        if (found) {
+            queuedTasks--;
+            
+            if (remote) {
+                remoteSteals.fetch_add(1, std::memory_order_relaxed);
+            }
+            
+            task = std::move(acquired->task);
+            releaseNode(acquired, false);
+        }
+        
+        return found;
+    }
+    
+    /// \brief Tries to steal a task from the deque of any worker. Used by threads that
+    /// don't belong to the pool.
+    bool tryStealAnyTask(QueuedTask& task) {
+        TaskNode* acquired = nullptr;
+        
+        for (const auto& data : workerData) {
+            if (data->localTasks.steal(acquired)) {
+                queuedTasks--;
+                
+                task = std::move(acquired->task);
+                releaseNode(acquired, false);
+                
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    /// \brief Tries to take a task from the lane of any node other than the specified
+    /// one.
+    bool tryAcquireRemoteSharedTask(std::size_t node, TaskPriority priority, QueuedTask& task) {
+        for (std::size_t i = 1; i < nodeCount; ++i) {
+            if (tryAcquireSharedTask((node + i) % nodeCount, priority, task)) {
+                remoteSteals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    /// \brief Tries to take a task from the lane of the specified node and priority.
+    bool tryAcquireSharedTask(std::size_t node, TaskPriority priority, QueuedTask& task) {
+        TaskLane& lane = getLane(node, priority);
+        
+#ifdef IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        if (lane.tasks.tryPop(task)) {
+            queuedTasks--;
+            return true;
+        }
+        
+        if (lane.overflowTaskCount.load() == 0) {
+            return false;
+        }
+        
+        std::lock_guard<std::mutex> lock(taskMutex);
+        std::queue<QueuedTask>& queue = lane.overflowTasks;
+#else // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        // Avoid locking the mutex if the lane is empty.
+        if (lane.taskCount.load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+        
+        std::lock_guard<std::mutex> lock(taskMutex);
+        std::queue<QueuedTask>& queue = lane.tasks;
+#endif // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        
+        if (queue.empty()) {
+            return false;
+        }
+        
+        // Move the task from the queue and pop its hollow remains
+        task = std::move(queue.front());
+        queue.pop();
+        queuedTasks--;
+        
+#ifdef IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        lane.overflowTaskCount--;
+#else // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        lane.taskCount--;
+#endif // IYFT_THREAD_POOL_LOCK_FREE_QUEUE
+        
+        return true;
+    }
+    
+    /// \brief Tries to take a task from any source, respecting the priorities and
+    /// preferring the node of the current worker.
+    ///
+    /// The order is: the high priority lanes, the deque of the current worker, the
+    /// normal priority lane of the current node, the deques of other workers of the 
+    /// current node, the normal priority lanes and the deques of other nodes and, 
+    /// finally, the low priority lanes. Every IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL-th
+    /// task is taken from the low priority lanes first.
+    ///
+    /// \param current The ID of the current worker.
+    /// \param task The acquired task.
+    /// \param acquiredCount The number of tasks this worker has acquired so far.
+    bool tryAcquireTask(std::size_t current, QueuedTask& task, std::size_t& acquiredCount) {
+        const bool workStealing = (mode == SchedulingMode::WorkStealing);
+        const bool lowPriorityFirst = ((acquiredCount + 1) % IYFT_THREAD_POOL_LOW_PRIORITY_INTERVAL) == 0;
+        const std::size_t node = workerNodes[current];
+        
+        const bool acquired = (lowPriorityFirst && tryAcquireSharedTask(node, TaskPriority::Low, task)) ||
+                              (lowPriorityFirst && tryAcquireRemoteSharedTask(node, TaskPriority::Low, task)) ||
+                              tryAcquireSharedTask(node, TaskPriority::High, task) ||
+                              tryAcquireRemoteSharedTask(node, TaskPriority::High, task) ||
+                              (workStealing && tryPopLocalTask(current, task)) ||
+                              tryAcquireSharedTask(node, TaskPriority::Normal, task) ||
+                              (workStealing && tryStealTask(current, task, false)) ||
+                              tryAcquireRemoteSharedTask(node, TaskPriority::Normal, task) ||
+                              (workStealing && tryStealTask(current, task, true)) ||
+                              (!lowPriorityFirst && tryAcquireSharedTask(node, TaskPriority::Low, task)) ||
+                              (!lowPriorityFirst && tryAcquireRemoteSharedTask(node, TaskPriority::Low, task));
+        
+        if (acquired) {
+            acquiredCount++;
+        }
+        
+        return acquired;
+    }
+    
+    /// \brief Tries to take a task for a thread that doesn't belong to the pool.
+    ///
+    /// The order is: the high priority lanes, the normal priority lanes, the deques of
+    /// the workers and the low priority lanes.
+    bool tryAcquireExternalTask(QueuedTask& task) {
+        const TaskPriority priorities[] = {TaskPriority::High, TaskPriority::Normal, TaskPriority::Low};
+        
+        for (TaskPriority priority : priorities) {
+            for (std::size_t node = 0; node < nodeCount; ++node) {
+                if (tryAcquireSharedTask(node, priority, task)) {
+                    return true;
+                }
+            }
+            
+            if (priority == TaskPriority::Normal && tryStealAnyTask(task)) {
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    /// \brief Obtains the next task that the worker should execute. Spins for a while
+    /// and then puts the worker to sleep if none are available.
+    ///
+    /// \return true if a task was acquired, false if the worker needs to quit.
+    bool acquireTask(std::size_t current, QueuedTask& task, std::size_t& acquiredCount) {
+        std::size_t idleSpins = 0;
+        
+        while (true) {
+            if (queuedTasks.load(std::memory_order_relaxed) > 0 && tryAcquireTask(current, task, acquiredCount)) {
+                return true;
+            }
+            
+            if (idleSpins < IYFT_THREAD_POOL_SPIN_COUNT) {
+                idleSpins++;
+                SpinPause();
+                
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(taskMutex);
+            
+            // This must happen before checking queuedTasks. Check wakeUpWorker() for
+            // more info.
+            sleepingWorkers++;
+            
+            if (queuedTasks.load() == 0) {
+                // We make sure to finish any remaining tasks before exiting.
+                if (!running) {
+                    sleepingWorkers--;
+                    return false;
+                }
+                
+                const bool timedOut = elastic && (newTaskNotifier.wait_for(lock, idleTimeout) == std::cv_status::timeout);
+                if (!elastic) {
+                    newTaskNotifier.wait(lock);
+                }
+                
+                idleSpins = 0;
+                
+                // The lock is still held, therefore, the checks are exact. Any task that 
+                // is added after this point will be seen by another worker or will make 
+                // the pool start a new one.
+                if (timedOut) {
+                    if (queuedTasks.load() == 0 && running && tryRetireWorker(current)) {
+                        sleepingWorkers--;
+                        return false;
+                    }
+                } else {
+                    WorkerCounters& counters = workerCounters[current];
+                    counters.wakeups.fetch_add(1, std::memory_order_relaxed);
+                    if (queuedTasks.load() == 0 && running) {
+                        counters.spuriousWakeups.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+            
+            sleepingWorkers--;
+        }
+    }
+    
+    /// \brief Executes a task.
+    ///
+    /// Tasks that return a result store their exceptions in the future. Exceptions thrown
+    /// by tasks that don't return anything are discarded.
+    static void runTask(InplaceTask& task) {
+        try {
+            task();
+        } catch (...) {}
+    }
+    
+    /// \brief Runs a task that was taken from a queue and destroys it.
+    ///
+    /// If IYFT_THREAD_POOL_PROFILE is defined, the flow that the QueuedTask started
+    /// gets a step when the task starts and ends once it's done. Tasks that notify a
+    /// barrier or make a future ready end the flow themselves, right before they do.
+    inline void runQueuedTask(QueuedTask& task) {
+#ifdef IYFT_THREAD_POOL_PROFILE
+        IYFT_PROFILE(RunTask)
+        IYFT_PROFILER_FLOW_STEP(PoolTask, task.flowID)
+        IYFT_PROFILER_COUNTER(PoolQueuedTasks, queuedTasks.load(std::memory_order_relaxed))
+        
+        // Waiting tasks may run other tasks on this thread.
+        const std::uint64_t outerFlowID = RunningTaskFlow();
+        RunningTaskFlow() = task.flowID;
+#endif // IYFT_THREAD_POOL_PROFILE
+        
+        runTask(task.task);
+        
+        // Destroy the task before reporting its completion. Anything it captured
+        // may depend on objects that the waiting thread is about to destroy.
+        task.task.reset();
+        
+#ifdef IYFT_THREAD_POOL_PROFILE
+        EndRunningTaskFlow();
+        RunningTaskFlow() = outerFlowID;
+#endif // IYFT_THREAD_POOL_PROFILE
     }
     
     /// Every single worker in the pool executes this function to acquire new tasks
     /// to work on.
     void executeTasks(std::size_t count, std::size_t current, SetupFunction setup) {
+        // Pin before the setup to allow it to override the affinity.
+        CPUTopology::PinCurrentThread(workerAffinities[current]);
+        
         setup(count, current);
         
 #ifdef IYFT_THREAD_POOL_PROFILE
@@ -360,64 +2380,217 @@ private:
         iyft::AssignThreadName(name.c_str());
 #endif // IYFT_THREAD_POOL_PROFILE
         
-        // Don't quit until the destructor tells us to
+        WorkerIdentity& identity = CurrentWorker();
+        identity.pool = this;
+        identity.id = current;
+        identity.acquiredCount = 0;
+        
+        WorkerCounters& counters = workerCounters[current];
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+        std::int64_t idleStart = Now();
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
+        
+        // Don't quit until the destructor tells us to (or, in an elastic pool, until
+        // this worker has been idle for too long)
         while (true) {
-            std::packaged_task<void()> activeTask;
+            QueuedTask activeTask;
             
             {   
 #ifdef IYFT_THREAD_POOL_PROFILE
                 IYFT_PROFILE(SleepAndAcquireTask)
 #endif // IYFT_THREAD_POOL_PROFILE
-                std::unique_lock<std::mutex> lock(taskMutex);
-                
-                newTaskNotifier.wait(lock, [this](){
-                    // Stop waiting if we're no longer running or if pending tasks
-                    // exist. Return to sleep otherwise.
-                    return !(this->running) || !(this->tasks.empty());
-                });
-                
-                // We make sure to finish any remaining tasks before exiting.
-                if (!running && tasks.empty()) {
+                if (!acquireTask(current, activeTask, identity.acquiredCount)) {
                     break;
                 }
-                
-                // Move the task from the queue and pop its hollow remains
-                activeTask = std::move(tasks.front());
-                tasks.pop();
             }
+            
+            // Tasks that are still queued will have to wait for this one.
+            considerSpawning();
+        
+            
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+            const std::int64_t busyStart = Now();
+            counters.idleTime.fetch_add(busyStart - idleStart, std::memory_order_relaxed);
+            counters.recordQueueLatency(busyStart - activeTask.enqueueTime);
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
         
             // Execute the task in this thread
-            tasksInFlight++;
-            activeTask();
-            tasksInFlight--;
+            runQueuedTask(activeTask);
+            taskCompleted();
+            
+            counters.executedTasks.fetch_add(1, std::memory_order_relaxed);
+#ifdef IYFT_THREAD_POOL_TIMED_STATISTICS
+            idleStart = Now();
+            counters.busyTime.fetch_add(idleStart - busyStart, std::memory_order_relaxed);
+#endif // IYFT_THREAD_POOL_TIMED_STATISTICS
         }
+        
+        identity.pool = nullptr;
     }
     
-    /// \brief A mutex that protects the queue.
+    /// \brief The SchedulingMode used by this pool.
+    const SchedulingMode mode;
+    
+    /// \brief The number of NUMA nodes that have their own lanes.
+    const std::size_t nodeCount;
+    
+    /// \brief A mutex that protects the lanes (or only their overflow queues if
+    /// IYFT_THREAD_POOL_LOCK_FREE_QUEUE is defined) and the sleeping workers.
     ///
     /// \remark I don't like using mutable, but a mutable mutex is one of few actually
     /// valid cases.
-    ///
-    /// \todo Perhaps I should look into lock-free queues for lower latency.
     mutable std::mutex taskMutex;
     
-    /// \brief The number of tasks that are currently being worked on.
-    std::atomic<int> tasksInFlight;
+    /// \brief The number of tasks that were added to the pool and haven't completed yet,
+    /// including the ones that are currently being worked on.
+    std::atomic<int> pendingTasks;
+    
+    /// \brief The number of tasks that were added to the shared queue or to the deques
+    /// and haven't been taken by any worker yet.
+    std::atomic<int> queuedTasks;
+    
+    /// \brief The number of workers that are waiting on the newTaskNotifier.
+    ///
+    /// Only incremented or decremented while taskMutex is locked.
+    std::atomic<int> sleepingWorkers;
+    
+    /// \brief The largest value that queuedTasks has reached.
+    std::atomic<int> queueHighWaterMark;
+    
+    /// \brief Shared lanes, one for each TaskPriority of every node. Use getLane() to
+    /// access them.
+    std::unique_ptr<TaskLane[]> lanes;
+    
+    /// \brief The node of every worker.
+    std::vector<std::size_t> workerNodes;
+    
+    /// \brief The logical processors that every worker is pinned to. Empty if the
+    /// worker isn't pinned.
+    std::vector<std::vector<std::size_t>> workerAffinities;
     
-    /// \brief A vector that contains all pending tasks
-    std::queue<std::packaged_task<void()>> tasks;
+    /// \brief The nodes that have at least one worker.
+    std::vector<std::size_t> nodesWithWorkers;
+    
+    /// \brief Used to distribute the tasks of external threads among the nodes.
+    std::atomic<std::size_t> nextNode;
+    
+    /// \brief The number of tasks that were taken from other nodes.
+    std::atomic<std::uint64_t> remoteSteals;
+    
+    /// \brief The counters of every worker, followed by the counters shared by all
+    /// external threads.
+    std::unique_ptr<WorkerCounters[]> workerCounters;
+    
+    /// \brief Per-worker data. Empty if work stealing is disabled.
+    std::vector<std::unique_ptr<WorkerData>> workerData;
     
     /// \brief A condition variable used to notify the workers about newly available
     /// tasks.
     std::condition_variable newTaskNotifier;
     
-    /// \brief A vector that contains all launched threads.
+    /// \brief The number of threads that are blocked in waitForAll().
+    ///
+    /// Only incremented or decremented while idleMutex is locked.
+    std::atomic<int> idleWaiters;
+    
+    /// \brief A mutex used by the threads that are blocked in waitForAll().
+    std::mutex idleMutex;
+    
+    /// \brief A condition variable used to wake up the threads that are blocked in
+    /// waitForAll().
+    std::condition_variable idleNotifier;
+    
+    /// \brief True if the pool may start and stop workers.
+    const bool elastic;
+    
+    /// \brief The number of workers that an elastic pool keeps running.
+    const std::size_t minWorkers;
+    
+    /// \brief ElasticWorkers::getSpawnLatency() in nanoseconds.
+    const std::int64_t spawnLatency;
+    
+    /// \brief ElasticWorkers::getIdleTimeout().
+    const std::chrono::milliseconds idleTimeout;
+    
+    /// \brief Used to set up the workers that an elastic pool starts.
+    const SetupFunction setupFunction;
+    
+    /// \brief The number of workers that are running.
+    std::atomic<std::size_t> activeWorkers;
+    
+    /// \brief True for every worker number that's in use. Workers that exit clear their
+    /// own flag, while new ones are only started while the spawnMutex is locked.
+    std::unique_ptr<std::atomic<bool>[]> activeSlots;
+    
+    /// \brief Protects the workers vector while a worker is being started.
+    std::mutex spawnMutex;
+    
+    /// \brief The time (Now()) when the queue last became non-empty or when the last
+    /// worker was started. Only used by elastic pools.
+    std::atomic<std::int64_t> backlogStart;
+    
+    /// \brief The number of workers that were started or exited after the creation of
+    /// the pool.
+    std::atomic<std::uint64_t> spawnedWorkers;
+    std::atomic<std::uint64_t> retiredWorkers;
+    
+    /// \brief A vector that contains a thread for every worker number. Slots of workers
+    /// that were never started are empty.
     std::vector<std::thread> workers;
     
     /// \brief Used internally to determine if the pool is quitting.
-    bool running;
+    std::atomic<bool> running;
 };
 
+inline void Barrier::notifyCompleted() {
+    // The results may be collected as soon as the waiting threads wake up.
+    ThreadPool::EndRunningTaskFlow();
+    
+    const int remaining = taskCount.fetch_sub(1) - 1;
+    
+    if (remaining > 0) {
+        return;
+    } else if (remaining < 0) {
+        throw std::runtime_error("Too many completed task notifications. Did you set the correct task count when creating the barrier?");
+    }
+    
+    ThreadPool* pool;
+    InplaceTask task;
+#ifdef IYFT_HAS_COROUTINES
+    Awaiter* resumed;
+#endif // IYFT_HAS_COROUTINES
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completed = true;
+        
+        pool = continuationPool;
+        task = std::move(continuation);
+        
+#ifdef IYFT_HAS_COROUTINES
+        resumed = awaiters;
+        awaiters = nullptr;
+#endif // IYFT_HAS_COROUTINES
+        
+        // Notifying while the mutex is locked ensures that the waiting threads can't
+        // destroy the barrier before we stop using it.
+        completionCondition.notify_all();
+    }
+    
+    // The barrier may no longer exist at this point.
+    if (pool != nullptr) {
+        pool->enqueue(std::move(task), TaskPriority::Normal, true);
+    }
+    
+#ifdef IYFT_HAS_COROUTINES
+    // A resumed coroutine may destroy its awaiter, so the next one must be read first.
+    while (resumed != nullptr) {
+        Awaiter* next = resumed->next;
+        resumed->handle.resume();
+        resumed = next;
+    }
+#endif // IYFT_HAS_COROUTINES
+}
+
 }
 
 #endif // IYFT_THREAD_POOL_HPP
@@ -0,0 +1,298 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file ThreadPoolCoroutines.hpp Contains a C++20 coroutine task type that runs on a
+/// ThreadPool.
+///
+/// Everything in this file is only available if IYFT_HAS_COROUTINES is defined, i.e.,
+/// if the compiler supports C++20 coroutines. The ThreadPool header itself provides 
+/// ThreadPool::schedule() and makes Barrier objects awaitable.
+
+#ifndef IYFT_THREAD_POOL_COROUTINES_HPP
+#define IYFT_THREAD_POOL_COROUTINES_HPP
+
+#include "ThreadPool.hpp"
+
+#ifdef IYFT_HAS_COROUTINES
+
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace iyft {
+template <typename T>
+class Task;
+
+/// \brief Data and functions shared by the promises of all Task types.
+class TaskPromiseBase {
+public:
+    /// \brief Transfers the control to the coroutine that awaits the finished task.
+    class FinalAwaiter {
+    public:
+        inline bool await_ready() const noexcept {
+            return false;
+        }
+        
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+            const std::coroutine_handle<> continuation = finished.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        
+        inline void await_resume() const noexcept {}
+    };
+    
+    /// \brief Tasks are lazy. They start when they're awaited.
+    inline std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+    
+    inline FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+    
+    inline void unhandled_exception() noexcept {
+        exception = std::current_exception();
+    }
+protected:
+    template <typename T>
+    friend class Task;
+    
+    /// \brief The coroutine that awaits the task.
+    std::coroutine_handle<> continuation;
+    
+    /// \brief The exception that escaped the task or nullptr.
+    std::exception_ptr exception;
+};
+
+/// \brief The promise of a Task that returns a value.
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+    
+    template <typename U>
+    void return_value(U&& value) {
+        result.emplace(std::forward<U>(value));
+    }
+    
+    /// \brief Returns the value or rethrows the exception of the task.
+    T takeResult() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        
+        return std::move(*result);
+    }
+private:
+    std::optional<T> result;
+};
+
+/// \brief The promise of a Task that doesn't return anything.
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+    
+    inline void return_void() const noexcept {}
+    
+    /// \brief Rethrows the exception of the task, if it threw one.
+    void takeResult() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+/// \brief A lazily started coroutine that returns a T.
+///
+/// A coroutine that returns a Task starts running when another coroutine co_awaits the
+/// Task. Once it finishes, the awaiting coroutine continues on the same thread and
+/// receives the returned value (or the exception thrown by the task). Use Submit() to
+/// start a Task from ordinary code.
+///
+/// Combine it with co_await pool.schedule() to move the work to the ThreadPool and with
+/// co_await barrier to wait for regular pool tasks. A suspended Task doesn't occupy a
+/// thread.
+///
+/// \code
+/// iyft::Task<int> Compute(iyft::ThreadPool& pool) {
+///     co_await pool.schedule();
+///     co_return 42;
+/// }
+/// \endcode
+template <typename T>
+class Task {
+public:
+    using promise_type = TaskPromise<T>;
+    
+    /// \brief Created by the promise.
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Task(const Task&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    Task& operator=(const Task&) = delete;
+    
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            
+            handle = std::exchange(other.handle, nullptr);
+        }
+        
+        return *this;
+    }
+    
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+    
+    /// \brief Starts the task and suspends the awaiting coroutine until it finishes.
+    class Awaiter {
+    public:
+        explicit Awaiter(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+        
+        inline bool await_ready() const noexcept {
+            return false;
+        }
+        
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaitingCoroutine) noexcept {
+            handle.promise().continuation = awaitingCoroutine;
+            return handle;
+        }
+        
+        T await_resume() {
+            return handle.promise().takeResult();
+        }
+    private:
+        std::coroutine_handle<promise_type> handle;
+    };
+    
+    /// \throws std::logic_error if the Task is empty (e.g., it was moved from).
+    Awaiter operator co_await() const {
+        if (!handle) {
+            throw std::logic_error("Cannot await an empty Task");
+        }
+        
+        return Awaiter(handle);
+    }
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/// \brief A coroutine that starts immediately and destroys itself when it finishes.
+/// Used by Submit().
+class DetachedCoroutine {
+public:
+    class promise_type {
+    public:
+        inline DetachedCoroutine get_return_object() const noexcept {
+            return {};
+        }
+        
+        inline std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        
+        inline std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        
+        inline void return_void() const noexcept {}
+        
+        /// \brief Submit() catches everything, so this never happens.
+        inline void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+/// \brief Starts a Task on a worker of the pool and returns a future that receives its
+/// result.
+///
+/// Use ThreadPool::waitFor() to wait for the future without blocking a worker.
+///
+/// \warning The task must finish before the pool is destroyed.
+///
+/// \param pool The pool that starts the task.
+/// \param task The task to start.
+/// \param options The options of the task that starts the coroutine.
+///
+/// \return A future that receives the value or the exception of the task. It receives 
+/// a std::runtime_error if the pool is awaiting destruction.
+template <typename T>
+std::future<T> Submit(ThreadPool& pool, Task<T> task, TaskOptions options = TaskOptions()) {
+    std::promise<T> promise;
+    std::future<T> result = promise.get_future();
+    
+    // A lambda coroutine would be destroyed with the lambda, so the state is passed as
+    // parameters, which are stored in the coroutine frame.
+    struct Starter {
+        static DetachedCoroutine Run(ThreadPool& pool, Task<T> task, TaskOptions options, std::promise<T> promise) {
+            try {
+                co_await pool.schedule(options);
+                
+                if constexpr (std::is_void<T>::value) {
+                    co_await task;
+                    promise.set_value();
+                } else {
+                    promise.set_value(co_await task);
+                }
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    };
+    
+    Starter::Run(pool, std::move(task), options, std::move(promise));
+    return result;
+}
+}
+
+#endif // IYFT_HAS_COROUTINES
+
+#endif // IYFT_THREAD_POOL_COROUTINES_HPP
@@ -38,16 +38,23 @@
 // For std::uint8_t
 #include <cstdint>
 
+// For std::integral_constant
+#include <type_traits>
+
+// For std::atomic
+#include <atomic>
+
 namespace iyft {
 class ScopeInfo;
 
 // --- These first few functions may be useful even if profiling is disabled ---
 
-/// \brief Returns a constant ID that corresponds to the calling thread.
+/// \brief Returns an ID that corresponds to the calling thread.
 ///
 /// If the calling thread hasn't been assigned a name and ID yet, this function
-/// will fetch the next ID from the interval [0; IYFT_THREAD_PROFILER_MAX_THREAD_COUNT)
-/// and generate a default name for the thread as well.
+/// will fetch the smallest free ID and generate a default name for the thread as
+/// well. The ID stays constant until the thread exits. Afterwards, it may be
+/// assigned to a new thread.
 ///
 /// Both values will be assigned to static thread_local variables, therefore,
 /// subsequent calls will be cheap and won't require locking.
@@ -58,8 +65,8 @@ std::size_t GetCurrentThreadID();
 /// \brief Returns a name that was assigned to the thread.
 ///
 /// If the calling thread hasn't been assigned a name and ID yet, this function
-/// will fetch the next ID from the interval [0; IYFT_THREAD_PROFILER_MAX_THREAD_COUNT)
-/// and generate a default name for the thread as well.
+/// will fetch the smallest free ID and generate a default name for the thread as
+/// well.
 ///
 /// Both values will be assigned to static thread_local variables, therefore,
 /// subsequent calls will be cheap and won't require locking.
@@ -67,22 +74,26 @@ std::size_t GetCurrentThreadID();
 /// \return The name 
 const char* GetCurrentThreadName();
 
-/// \brief Returns the total number of registered threads. This function locks a
-/// mutex.
+/// \brief Returns the number of thread IDs that have been handed out so far. This
+/// function locks a mutex.
+///
+/// IDs of threads that have exited are reused, which is why this is one past the
+/// largest ID that has ever been assigned, and not the number of threads that were
+/// ever registered.
 ///
-/// \return The total number of registered threads.
+/// \return The number of thread IDs that are or were in use.
 std::size_t GetRegisteredThreadCount();
 
 /// \brief Assigns a name to the current thread.
 ///
 /// If the calling thread **hasn't been assigned a name and ID yet**, this function
-/// will fetch the next ID from the interval [0; IYFT_THREAD_PROFILER_MAX_THREAD_COUNT)
-/// and assign the provided name to the thread.
+/// will fetch the smallest free ID and assign the provided name to the thread.
 ///
 /// Both values will be assigned to static thread_local variables, therefore,
 /// subsequent calls will be cheap and won't require locking.
 ///
-/// \remark Thread names may repeat. Only the ID is unique.
+/// \remark Thread names may repeat. Only the IDs of threads that are running at the
+/// same time are unique.
 ///
 /// \param name A pointer to the name string. The contents will be copied. If you
 /// pass a nullptr or an empty string, the name will be assigned automatically.
@@ -100,6 +111,13 @@ enum class ProfilerStatus {
     EnabledAndRecording /*!< The profiler is enabled and recording. */
 };
 
+/*! \brief The kind of a flow marker. */
+enum class ProfilerFlowPhase : std::uint8_t {
+    Begin = 0, /*!< The flow starts, e.g., a task is submitted. */
+    Step = 1, /*!< The flow reached an intermediate point, e.g., a task started running. */
+    End = 2 /*!< The flow is finished. */
+};
+
 /// \brief An RGBA color that will be used for scopes tagged with a specific ProfilerTag.
 class ScopeColor {
 public:
@@ -157,7 +175,10 @@ private:
 #include "ThreadProfilerSettings.hpp"
 
 #ifndef IYFT_THREAD_PROFILER_MAX_THREAD_COUNT
-/// \brief The maximum number of threads that the ThreadProfiler will need to track.
+/// \brief The number of threads that the ThreadProfiler reserves space for up front.
+///
+/// This isn't a limit: more threads may register and the storage grows as needed.
+/// The per-thread event buffers are only allocated for threads that record events.
 ///
 /// Default value is 16.
 ///
@@ -165,12 +186,44 @@ private:
 #define IYFT_THREAD_PROFILER_MAX_THREAD_COUNT 16
 #endif // IYFT_THREAD_PROFILER_MAX_THREAD_COUNT
 
-#ifndef IYFT_THREAD_PROFILER_HASH
-/// \brief A hashing function that will be used to make ScopeKey objects.
+#ifndef IYFT_THREAD_PROFILER_BUFFER_CAPACITY
+/// \brief The number of begin and end markers (two per event) that every thread can
+/// buffer until they're retrieved. Counter samples and flow markers take two entries
+/// each.
 ///
-/// Must return a 32 bit integer and take std::string as the parameter.
-#define IYFT_THREAD_PROFILER_HASH(a) \
-    std::hash<std::string>{}(a)
+/// Default value is 65536.
+///
+/// \warning Must be a power of two.
+#define IYFT_THREAD_PROFILER_BUFFER_CAPACITY 65536
+#endif // IYFT_THREAD_PROFILER_BUFFER_CAPACITY
+
+#ifndef IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT
+/// \brief The maximum number of distinct profiled scopes (IYFT_PROFILE uses) in your
+/// program.
+///
+/// Default value is 4096.
+///
+/// \warning Must be >= 1
+#define IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT 4096
+#endif // IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT
+
+#ifdef IYFT_THREAD_PROFILER_HASH
+#include <string>
+/// \brief Computes the hash of a scope identifier using the custom hashing function.
+#define IYFT_THREAD_PROFILER_SCOPE_HASH(a) \
+    static_cast<std::uint32_t>(IYFT_THREAD_PROFILER_HASH(std::string(a)))
+/// \brief Computes the hash of a scope identifier that's only known at runtime using the
+/// custom hashing function.
+#define IYFT_THREAD_PROFILER_RUNTIME_SCOPE_HASH(a) \
+    static_cast<std::uint32_t>(IYFT_THREAD_PROFILER_HASH(std::string(a)))
+#else // IYFT_THREAD_PROFILER_HASH
+/// \brief Computes the hash of a scope identifier at compile time.
+#define IYFT_THREAD_PROFILER_SCOPE_HASH(a) \
+    std::integral_constant<std::uint32_t, iyft::HashScopeIdentifier(a)>::value
+/// \brief Computes the hash of a scope identifier that's only known at runtime. Produces
+/// the same values as IYFT_THREAD_PROFILER_SCOPE_HASH.
+#define IYFT_THREAD_PROFILER_RUNTIME_SCOPE_HASH(a) \
+    iyft::HashScopeIdentifier(a)
 #endif // IYFT_THREAD_PROFILER_HASH
 
 #if !defined IYFT_THREAD_TEXT_OUTPUT_DURATION || !defined IYFT_THREAD_TEXT_OUTPUT_NAME
@@ -181,6 +234,9 @@ private:
 #endif // !defined IYFT_THREAD_TEXT_OUTPUT_DURATION || !defined IYFT_THREAD_TEXT_OUTPUT_NAME
 
 static_assert(IYFT_THREAD_PROFILER_MAX_THREAD_COUNT >= 1, "IYFT_THREAD_PROFILER_MAX_THREAD_COUNT must be >= 1");
+static_assert(IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT >= 1, "IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT must be >= 1");
+static_assert(IYFT_THREAD_PROFILER_BUFFER_CAPACITY >= 1 && (IYFT_THREAD_PROFILER_BUFFER_CAPACITY & (IYFT_THREAD_PROFILER_BUFFER_CAPACITY - 1)) == 0,
+              "IYFT_THREAD_PROFILER_BUFFER_CAPACITY must be a power of two");
 
 namespace iyft {
 /// \brief Marks the start of the next frame.
@@ -188,21 +244,73 @@ namespace iyft {
 /// \remark You should prefer to use the IYFT_PROFILER_NEXT_FRAME macro.
 void MarkNextFrame();
 
-/// \brief Inserts a new scope into the scope map.
+/// \brief Applies a single FNV-1a step.
+constexpr std::uint32_t HashScopeIdentifierStep(std::uint32_t hash, char c) {
+    return (hash ^ static_cast<std::uint32_t>(static_cast<unsigned char>(c))) * 16777619u;
+}
+
+/// \brief Computes the 32 bit FNV-1a hash of a scope identifier.
+///
+/// Four characters are processed per call to keep the recursion depth of C++11
+/// constexpr evaluation low, even for long absolute __FILE__ paths.
+///
+/// \param identifier A null terminated string.
+/// \param hash The current hash value. Don't set it manually.
+constexpr std::uint32_t HashScopeIdentifier(const char* identifier, std::uint32_t hash = 2166136261u) {
+    return (identifier[0] == '\0') ? hash :
+           (identifier[1] == '\0') ? HashScopeIdentifierStep(hash, identifier[0]) :
+           (identifier[2] == '\0') ? HashScopeIdentifierStep(HashScopeIdentifierStep(hash, identifier[0]), identifier[1]) :
+           (identifier[3] == '\0') ? HashScopeIdentifierStep(HashScopeIdentifierStep(HashScopeIdentifierStep(hash, identifier[0]), identifier[1]), identifier[2]) :
+           HashScopeIdentifier(identifier + 4, HashScopeIdentifierStep(HashScopeIdentifierStep(HashScopeIdentifierStep(HashScopeIdentifierStep(hash, identifier[0]), identifier[1]), identifier[2]), identifier[3]));
+}
+
+/// \brief Registers a new scope with the ThreadProfiler.
 ///
 /// \warning Don't call this manually and use IYFT_PROFILE instead.
-ScopeInfo& InsertScopeInfo(const char* scopeName, const char* identifier, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag);
+ScopeInfo& InsertScopeInfo(const char* scopeName, std::uint32_t hash, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag);
+
+/// \brief Set while the ThreadProfiler is recording.
+///
+/// \warning Don't use this directly. Call SetRecording() or IsRecording() instead.
+extern std::atomic<bool> ProfilerRecordingFlag;
+
+/// \brief Checks if the ThreadProfiler is recording.
+///
+/// This is a single relaxed atomic load that allows ScopeProfilerHelper to skip
+/// all other work when the ThreadProfiler isn't recording.
+inline bool IsRecording() {
+    return ProfilerRecordingFlag.load(std::memory_order_relaxed);
+}
 
 /// \brief Starts monitoring the current scope.
 ///
 /// \warning Don't call this manually and use IYFT_PROFILE instead.
-void InsertScopeStart(const ScopeInfo& info);
+///
+/// \return true if the start of the scope was recorded. Only in that case
+/// InsertScopeEnd() must be called when the scope ends.
+bool InsertScopeStart(const ScopeInfo& info);
 
 /// \brief Finishes monitoring the current scope.
 ///
 /// \warning Don't call this manually and use IYFT_PROFILE instead.
 void InsertScopeEnd(const ScopeInfo& info);
 
+/// \brief Stores a sample of a counter if the ThreadProfiler is recording.
+///
+/// \warning Don't call this manually and use IYFT_PROFILER_COUNTER instead.
+void InsertCounterSample(const ScopeInfo& info, double value);
+
+/// \brief Stores a flow marker if the ThreadProfiler is recording.
+///
+/// \warning Don't call this manually and use the IYFT_PROFILER_FLOW_* macros instead.
+void InsertFlowMarker(const ScopeInfo& info, std::uint64_t id, ProfilerFlowPhase phase);
+
+/// \brief Returns a new flow ID if the ThreadProfiler is recording and 0 otherwise.
+/// The IDs are unique in the whole program.
+///
+/// \remark You should prefer to use the IYFT_PROFILER_NEW_FLOW_ID macro.
+std::uint64_t NewFlowID();
+
 /// \brief Starts or stops recording.
 ///
 /// \remark You should prefer to use the IYFT_PROFILER_SET_RECORDING macro.
@@ -216,17 +324,28 @@ ProfilerStatus GetStatus();
 /// \brief A class that helps with automatic scope start and end tracking.
 class ScopeProfilerHelper {
 public:
-    /// \brief Starts tracking the scope.
-    ScopeProfilerHelper(const ScopeInfo& info) : info(info) {
-        InsertScopeStart(info);
-    }
+    /// \brief Starts tracking the scope if the ThreadProfiler is recording.
+    ScopeProfilerHelper(const ScopeInfo& info) : info(info), recorded(IsRecording() && InsertScopeStart(info)) {}
     
     /// \brief Finishes tracking the scope.
+    ///
+    /// The end is recorded for every recorded start, even if the recording has been
+    /// stopped in the meantime. Scopes that started before the recording did are
+    /// ignored.
     ~ScopeProfilerHelper() {
-        InsertScopeEnd(info);
+        if (recorded) {
+            InsertScopeEnd(info);
+        }
     }
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ScopeProfilerHelper(const ScopeProfilerHelper&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ScopeProfilerHelper& operator=(const ScopeProfilerHelper&) = delete;
 private:
     const ScopeInfo& info;
+    const bool recorded;
 };
 }
 
@@ -257,7 +376,8 @@ private:
 #define IYFT_PROFILER_GET_CURRENT_THREAD_ID iyft::GetCurrentThreadID()
 
 // You should make sure that IYFT_ENABLE_PROFILING is NOT DEFINED in release builds.
-// Even if recording is off, profiling adds some overhead.
+// Even if recording is off, every profiled scope costs a relaxed atomic load and a
+// branch.
 #ifdef IYFT_ENABLE_PROFILING
 
 /// \brief Stringify the parameter.
@@ -295,7 +415,7 @@ private:
 #define IYFT_PROFILE_2(name, tag) \
 static iyft::ScopeInfo& ScopeInfo##name = iyft::InsertScopeInfo(\
     #name,\
-    __FILE__ ":" IYFT_EXPAND_STRINGIFY(__LINE__),\
+    IYFT_THREAD_PROFILER_SCOPE_HASH(__FILE__ ":" IYFT_EXPAND_STRINGIFY(__LINE__)),\
     FUNCTION_NAME_MACRO,\
     __FILE__,\
     __LINE__,\
@@ -306,7 +426,7 @@ static iyft::ScopeInfo& ScopeInfo##name = iyft::InsertScopeInfo(\
 #define IYFT_PROFILE_1(name) \
 static iyft::ScopeInfo& ScopeInfo##name = iyft::InsertScopeInfo(\
     #name,\
-    __FILE__ ":" IYFT_EXPAND_STRINGIFY(__LINE__),\
+    IYFT_THREAD_PROFILER_SCOPE_HASH(__FILE__ ":" IYFT_EXPAND_STRINGIFY(__LINE__)),\
     FUNCTION_NAME_MACRO,\
     __FILE__,\
     __LINE__,\
@@ -334,6 +454,75 @@ static iyft::ScopeInfo& ScopeInfo##name = iyft::InsertScopeInfo(\
 /// \brief Depending on the number of parameters, chooses one of profiling macros.
 #define IYFT_PROFILE(...) IYFT_PROFILE_MACRO_PICKER(IYFT_PROFILE, __VA_ARGS__)
 
+/// \brief Registers a named counter or flow. Used by the macros below.
+#define IYFT_PROFILER_MARKER_INFO(name) \
+static iyft::ScopeInfo& MarkerInfo##name = iyft::InsertScopeInfo(\
+    #name,\
+    IYFT_THREAD_PROFILER_SCOPE_HASH(__FILE__ ":" IYFT_EXPAND_STRINGIFY(__LINE__)),\
+    FUNCTION_NAME_MACRO,\
+    __FILE__,\
+    __LINE__,\
+    iyft::ProfilerTag::NoTag);
+
+/// \brief Records a sample of a named counter, e.g., the length of a queue.
+///
+/// The value is only evaluated while the profiler is recording. Samples that share
+/// a name end up on the same counter track when the results are exported.
+///
+/// \param name The name of the counter.
+/// \param value A number that gets converted to double.
+#define IYFT_PROFILER_COUNTER(name, value) \
+do { \
+    if (iyft::IsRecording()) { \
+        IYFT_PROFILER_MARKER_INFO(name) \
+        iyft::InsertCounterSample(MarkerInfo##name, static_cast<double>(value)); \
+    } \
+} while (false);
+
+/// \brief Returns a new flow ID as an std::uint64_t or 0 if the profiler isn't
+/// recording. See iyft::NewFlowID().
+#define IYFT_PROFILER_NEW_FLOW_ID iyft::NewFlowID()
+
+/// \brief Marks the start of a flow, e.g., the place where some work is submitted.
+///
+/// Flows link related points in the timelines of different threads. The exporters
+/// attach every marker to the innermost scope that's open when it's recorded. All
+/// markers of a flow should use the same name.
+///
+/// \param name The name of the flow.
+/// \param id The ID of the flow, e.g., from IYFT_PROFILER_NEW_FLOW_ID. Markers with
+/// the ID 0 are ignored.
+#define IYFT_PROFILER_FLOW_BEGIN(name, id) \
+do { \
+    if (iyft::IsRecording()) { \
+        IYFT_PROFILER_MARKER_INFO(name) \
+        iyft::InsertFlowMarker(MarkerInfo##name, id, iyft::ProfilerFlowPhase::Begin); \
+    } \
+} while (false);
+
+/// \brief Marks an intermediate point of a flow, e.g., the place where submitted work
+/// starts running.
+///
+/// \copydetails IYFT_PROFILER_FLOW_BEGIN
+#define IYFT_PROFILER_FLOW_STEP(name, id) \
+do { \
+    if (iyft::IsRecording()) { \
+        IYFT_PROFILER_MARKER_INFO(name) \
+        iyft::InsertFlowMarker(MarkerInfo##name, id, iyft::ProfilerFlowPhase::Step); \
+    } \
+} while (false);
+
+/// \brief Marks the end of a flow.
+///
+/// \copydetails IYFT_PROFILER_FLOW_BEGIN
+#define IYFT_PROFILER_FLOW_END(name, id) \
+do { \
+    if (iyft::IsRecording()) { \
+        IYFT_PROFILER_MARKER_INFO(name) \
+        iyft::InsertFlowMarker(MarkerInfo##name, id, iyft::ProfilerFlowPhase::End); \
+    } \
+} while (false);
+
 /// \brief Used to start or stop a recording
 ///
 /// \param a A boolean. If true, starts a recording, if false, stops it.
@@ -350,6 +539,22 @@ static iyft::ScopeInfo& ScopeInfo##name = iyft::InsertScopeInfo(\
 /// \brief Depending on the number of parameters, chooses one of profiling macros.
 #define IYFT_PROFILE(...) ((void)0);
 
+/// \brief Records a sample of a named counter, e.g., the length of a queue.
+#define IYFT_PROFILER_COUNTER(name, value) ((void)0);
+
+/// \brief Returns a new flow ID as an std::uint64_t. Always 0 if profiling is disabled.
+#define IYFT_PROFILER_NEW_FLOW_ID std::uint64_t(0)
+
+/// \brief Marks the start of a flow, e.g., the place where some work is submitted.
+#define IYFT_PROFILER_FLOW_BEGIN(name, id) ((void)0);
+
+/// \brief Marks an intermediate point of a flow, e.g., the place where submitted work
+/// starts running.
+#define IYFT_PROFILER_FLOW_STEP(name, id) ((void)0);
+
+/// \brief Marks the end of a flow.
+#define IYFT_PROFILER_FLOW_END(name, id) ((void)0);
+
 /// \brief Used to start or stop a recording
 ///
 /// \param a A boolean. If true, starts a recording, if false, stops it.
@@ -32,7 +32,15 @@
 #ifndef IYFT_THREAD_PROFILER_CORE_HPP
 #define IYFT_THREAD_PROFILER_CORE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <limits>
 #include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <deque>
 #include <vector>
@@ -40,8 +48,21 @@
 #include <array>
 #include <string>
 #include <memory>
+#include <cstring>
 #include "Spinlock.hpp"
 
+#ifndef IYFT_THREAD_PROFILER_NO_TSC
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define IYFT_THREAD_PROFILER_USES_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define IYFT_THREAD_PROFILER_USES_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define IYFT_THREAD_PROFILER_USES_TSC
+#endif
+#endif // IYFT_THREAD_PROFILER_NO_TSC
+
 #ifdef IYFT_PROFILER_WITH_IMGUI
 #include "imgui.h"
 #include <cinttypes>
@@ -52,6 +73,26 @@ namespace iyft {
 /// \brief The clock that the profiler will use.
 using ProfilerClock = std::chrono::high_resolution_clock;
 
+/// \brief Reads the raw timestamp that is stored in the event buffers.
+///
+/// Uses the time stamp counter on x86 and the virtual counter on AArch64. Both are
+/// converted to ProfilerClock nanoseconds in ThreadProfiler::getResults(). On other
+/// platforms, or if IYFT_THREAD_PROFILER_NO_TSC is defined, this returns ProfilerClock
+/// nanoseconds directly.
+///
+/// \return The current timestamp in ticks.
+inline std::uint64_t GetProfilerTicks() {
+#if defined(IYFT_THREAD_PROFILER_USES_TSC) && defined(__aarch64__)
+    std::uint64_t ticks;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#elif defined(IYFT_THREAD_PROFILER_USES_TSC)
+    return static_cast<std::uint64_t>(__rdtsc());
+#else // IYFT_THREAD_PROFILER_USES_TSC
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ProfilerClock::now().time_since_epoch()).count());
+#endif // IYFT_THREAD_PROFILER_USES_TSC
+}
+
 #ifdef IYFT_PROFILER_WITH_COOKIE
 using ProfilerCookie = std::uint64_t;
 #endif // IYFT_PROFILER_WITH_COOKIE
@@ -104,6 +145,13 @@ struct hash<iyft::ScopeKey> {
 
 
 namespace iyft {
+/// \brief Returns the smallest power of two that is >= value.
+///
+/// \param power The current candidate. Don't set it manually.
+constexpr std::size_t NextPowerOfTwo(std::size_t value, std::size_t power = 1) {
+    return (power >= value) ? power : NextPowerOfTwo(value, power * 2);
+}
+
 /// \brief Data unique per profiled scope.
 class ScopeInfo {
 public:
@@ -116,8 +164,9 @@ public:
     /// \param fileName The name of the file that the the profiled scope reisdes in.
     /// \param lineNumber The line number of the profiled scope.
     /// \param tag A tag assigned to the profiled scope
-    inline ScopeInfo(ScopeKey key, std::string name, std::string functionName, std::string fileName, std::uint32_t lineNumber, ProfilerTag tag)
-        : key(key), tag(tag), name(std::move(name)), functionName(std::move(functionName)), fileName(std::move(fileName)), lineNumber(lineNumber) {}
+    /// \param index A dense index of the scope. Check getIndex() for more info.
+    inline ScopeInfo(ScopeKey key, std::string name, std::string functionName, std::string fileName, std::uint32_t lineNumber, ProfilerTag tag, std::uint32_t index = 0)
+        : key(key), tag(tag), name(std::move(name)), functionName(std::move(functionName)), fileName(std::move(fileName)), lineNumber(lineNumber), index(index) {}
     
     /// \brief Returns the key of this scope.
     ///
@@ -126,6 +175,17 @@ public:
         return key;
     }
     
+    /// \brief Returns the dense index of this scope.
+    ///
+    /// The ThreadProfiler numbers the scopes sequentially as they get registered and
+    /// stores these numbers in its event buffers. Scopes that were loaded from a file
+    /// are numbered in the order in which they are stored in it.
+    ///
+    /// \return The index of this scope.
+    inline std::uint32_t getIndex() const {
+        return index;
+    }
+    
     /// \brief The name of the scope that was provided by the user.
     ///
     /// \return The name of the scope.
@@ -161,12 +221,12 @@ public:
         return tag;
     }
     
-    /// A comparison operator
+    /// A comparison operator. The index is ignored.
     inline friend bool operator==(const ScopeInfo& a, const ScopeInfo& b) {
         return (a.key == b.key) &&
                (a.tag == b.tag) &&
                (a.name == b.name) &&
-               (a.functionName == a.functionName) &&
+               (a.functionName == b.functionName) &&
                (a.fileName == b.fileName) &&
                (a.lineNumber == b.lineNumber);
     }
@@ -177,6 +237,7 @@ private:
     std::string functionName;
     std::string fileName;
     std::uint32_t lineNumber;
+    std::uint32_t index;
 };
 
 /// \brief Base class for profiler objects that use timing functionality.
@@ -188,8 +249,6 @@ public:
     TimedProfilerObject(std::chrono::nanoseconds start) 
         : start(start), end() {}
     
-    virtual ~TimedProfilerObject() = default;
-    
     /// \brief Returns the start time as a duration since the clock's epoch.
     ///
     /// \return The start time as a duration since the clock's epoch.
@@ -334,1149 +393,4194 @@ private:
     std::uint64_t number;
 };
 
-class ProfilerResults;
-
-/// \brief The main class that manages and coordinates all profiling and result
-/// exporting actions.
-class ThreadProfiler {
+/// \brief A sample of a counter that was recorded with IYFT_PROFILER_COUNTER.
+class CounterSample {
 public:
-    /// \brief Creates a new ThreadProfiler instance.
-    ThreadProfiler() : recording(false), frameNumber(0) { }
-    
-    /// \brief Inserts a new scope.
+    /// \brief Creates a new CounterSample object.
     ///
-    /// \param scopeName The name of the scope. Must be a string literal.
-    /// \param identifier An identifier that the hash used by the ScopeKey is
-    /// generated from. Must be a string literal.
-    /// \param functionName The name of the function. Must be the result of the
-    /// __func__ variable.
-    /// \param fileName The name of the file. Must be the result of the __FILE__
-    /// macro.
-    /// \param line The number of the line. Must be the result of the __LINE__ macro.
-    /// \param tag The tag of the scope.
-    inline ScopeInfo& insertScopeInfo(const char* scopeName, const char* identifier, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag) {
-        std::lock_guard<Spinlock> lock(scopeMapSpinLock);
-        
-        const std::uint32_t hash = static_cast<std::uint32_t>(IYFT_THREAD_PROFILER_HASH(std::string(identifier)));
-        const ScopeKey scopeKey(hash);
-        
-        auto result = scopes.find(scopeKey);
-        if (result != scopes.end()) {
-            return result->second;
-        }
-        
-        ScopeInfo scopeInfo(scopeKey, scopeName, functionName, fileName, line, tag);
-        auto insertionResult = scopes.emplace(scopeKey, std::move(scopeInfo));
-        
-        return insertionResult.first->second;
-    }
+    /// \param key The key of the counter.
+    /// \param time The time of the sample as a duration since the clock's epoch.
+    /// \param value The value of the counter.
+    inline CounterSample(ScopeKey key, std::chrono::nanoseconds time, double value)
+        : key(key), time(time), value(value) {}
     
-    /// \brief Inserts the start of the scope.
-    /// 
-    /// \param info A ScopeInfo instance.
-    inline void insertScopeStart(const ScopeInfo& info) {
-        const ScopeKey key = info.getKey();
-        
-        const std::size_t threadID = GetCurrentThreadID();
-        ThreadData& threadData = threads[threadID];
-        
-        threadData.depth++;
-        
-//         if (isRecording()) {
-            threadData.activeStack.emplace_back(key, threadData.depth, ProfilerClock::now().time_since_epoch());
-//         } else {
-//             // Don't even call the clock
-//             threadData.activeStack.emplace_back(key, threadData.depth, ProfilerClock::time_point().time_since_epoch());
-//         }
-//         
-#ifdef IYFT_PROFILER_WITH_COOKIE
-        threadData.activeStack.back().setCookie(threadData.cookie);
-        threadData.cookie++;
-#endif // IYFT_PROFILER_WITH_COOKIE
+    /// \brief Returns the key that identifies the counter.
+    inline ScopeKey getKey() const {
+        return key;
     }
     
-    /// \brief Inserts the end of the scope.
-    /// 
-    /// \param info A ScopeInfo instance.
-    inline void insertScopeEnd(const ScopeInfo& info) {
-        const ScopeKey key = info.getKey();
-        
-        const std::size_t threadID = GetCurrentThreadID();
-        ThreadData& threadData = threads[threadID];
-        
-        if (isRecording()) {
-            auto& lastElement = threadData.activeStack.back();
-            
-            IYFT_ASSERT(key == lastElement.getKey());
-            
-            if (lastElement.isValid()) {
-                lastElement.setEnd(ProfilerClock::now().time_since_epoch());
-                
-                std::lock_guard<Spinlock> lock(threadData.recordSpinLock);
-                threadData.recordedEvents.emplace_back(std::move(lastElement));
-            }
-        }
-        
-        threadData.activeStack.pop_back();
-        
-        threadData.depth--;
+    /// \brief Returns the time of the sample as a duration since the clock's epoch.
+    inline std::chrono::nanoseconds getTime() const {
+        return time;
     }
     
-    /// \brief Enables or disables recording.
-    inline void setRecording(bool state) {
-        recording.store(state, std::memory_order_release);
+    /// \brief Returns the value of the counter.
+    inline double getValue() const {
+        return value;
     }
     
-    /// \brief Checks if the ThreadProfiler is recording or not.
-    ///
-    /// \return If the ThreadProfiler is recording or not.
-    inline bool isRecording() const {
-        return recording.load(std::memory_order_acquire);
+    /// \brief A comparison operator.
+    inline friend bool operator==(const CounterSample& a, const CounterSample& b) {
+        return (a.key == b.key) && (a.time == b.time) && (a.value == b.value);
     }
-    
-    /// \brief Starts the next frame.
-    inline void nextFrame() {
-        std::lock_guard<Spinlock> lock(frameSpinLock);
-        
-        const std::uint64_t lastFrameNumber = frameNumber;
-        frameNumber++;
+private:
+    ScopeKey key;
+    std::chrono::nanoseconds time;
+    double value;
+};
 
-        auto now = ProfilerClock::now().time_since_epoch();
-        
-        if (!frames.empty()) {
-            FrameData& lastFrame = frames.back();
-            
-            if (lastFrame.getNumber() == lastFrameNumber) {
-                lastFrame.setEnd(now);
-            }
-        }
-        
-        if (isRecording()) {
-            frames.emplace_back(frameNumber, now);
-        }
-    }
-    
-    /// \brief Obtains the current results and clears the current data buffers.
+/// \brief A flow marker that was recorded with one of the IYFT_PROFILER_FLOW_* macros.
+///
+/// Markers of different threads that share the ID belong to the same flow.
+class FlowEvent {
+public:
+    /// \brief Creates a new FlowEvent object.
     ///
-    /// \return All currently recorded data.
-    ProfilerResults getResults();
-private:
-    /// Internal struct used to manage per-thread data
-    struct ThreadData {
-#ifdef IYFT_PROFILER_WITH_COOKIE
-        ThreadData() : depth(-1), cookie(0) {
-            activeStack.reserve(256);
-        }
-#else // IYFT_PROFILER_WITH_COOKIE
-        ThreadData() : depth(-1) {
-            activeStack.reserve(256);
-        }
-#endif // IYFT_PROFILER_WITH_COOKIE
-        /// Sadly, even if profiling is disabled, I need to keep track of the stack
-        /// state. The impact is minimized by using a vector with plenty of reserved
-        /// space instead of a deque (deques may deallocate storage when shrinking).
-        /// Moreover, I don't even call now() and keep the start and end times empty.
-        std::vector<RecordedEvent> activeStack;
-        
-        /// Protects the records
-        Spinlock recordSpinLock;
-        
-        /// Using a queue here to store events because it is faster than a list for
-        /// our purposes.
-        std::deque<RecordedEvent> recordedEvents;
-        
-        /// Current stack depth.
-        std::int32_t depth;
-    #ifdef IYFT_PROFILER_WITH_COOKIE
-        std::uint64_t cookie;
-    #endif // IYFT_PROFILER_WITH_COOKIE
-    };
-    
-    /// Used to tell the threads if the profiler is currently recording or not.
-    std::atomic<bool> recording;
+    /// \param key The key of the flow.
+    /// \param id The ID of the flow.
+    /// \param phase The kind of the marker.
+    /// \param time The time of the marker as a duration since the clock's epoch.
+    inline FlowEvent(ScopeKey key, std::uint64_t id, ProfilerFlowPhase phase, std::chrono::nanoseconds time)
+        : key(key), id(id), phase(phase), time(time) {}
+    
+    /// \brief Returns the key that identifies the name of the flow.
+    inline ScopeKey getKey() const {
+        return key;
+    }
     
-    /// Used to protect the scope map.
-    Spinlock scopeMapSpinLock;
+    /// \brief Returns the ID of the flow.
+    inline std::uint64_t getID() const {
+        return id;
+    }
     
-    /// Contains information on all scopes tracked by the ThreadProfiler. This is used
-    /// to avoid storing tons of duplicate data every time we start profiling a scope.
-    std::unordered_map<ScopeKey, ScopeInfo> scopes;
+    /// \brief Returns the kind of the marker.
+    inline ProfilerFlowPhase getPhase() const {
+        return phase;
+    }
     
-    /// Contains per-thread data
-    std::array<ThreadData, IYFT_THREAD_PROFILER_MAX_THREAD_COUNT> threads;
+    /// \brief Returns the time of the marker as a duration since the clock's epoch.
+    inline std::chrono::nanoseconds getTime() const {
+        return time;
+    }
     
-    std::uint64_t frameNumber;
-    Spinlock frameSpinLock;
-    std::deque<FrameData> frames;
+    /// \brief A comparison operator.
+    inline friend bool operator==(const FlowEvent& a, const FlowEvent& b) {
+        return (a.key == b.key) && (a.id == b.id) && (a.phase == b.phase) && (a.time == b.time);
+    }
+private:
+    ScopeKey key;
+    std::uint64_t id;
+    ProfilerFlowPhase phase;
+    std::chrono::nanoseconds time;
 };
 
-/// Returns a reference to the default ThreadProfiler instance
-ThreadProfiler& GetThreadProfiler();
-
-/// \brief A minimal interval tree used for windowing queries.
+/// \brief A fixed size, mergeable histogram of durations with log-linear buckets.
 ///
-/// This is based on https://www.cs.princeton.edu/~rs/talks/LLRB/LLRB.pdf
-/// and https://en.wikipedia.org/wiki/Interval_tree#Augmented_tree
-template <typename T>
-class InsertOnlyIntervalTree {
+/// Durations shorter than 2 * SubBucketCount nanoseconds get a bucket each. Every
+/// longer power of two range is split into SubBucketCount equal buckets, so the
+/// values returned by getPercentile() are never more than about 3% too high.
+/// Durations longer than MaxValue are counted as MaxValue.
+class DurationHistogram {
 public:
-    /// \brief The type used for interval values, e.g., float, std::chrono::nanoseconds, etc.
-    using IntervalType = typename T::IntervalType;
+    /// \brief Determines the number of buckets that every power of two is split into.
+    static constexpr std::size_t SubBucketBits = 5;
     
-    /// \brief Creates a new InsertOnlyIntervalTree that can contain up to maxNodes
-    ///
-    /// \param maxNodes The maximum number of node this InsertOnlyIntervalTree can
-    /// contain.
-    InsertOnlyIntervalTree(std::size_t maxNodes) : root(nullptr), maxNodes(maxNodes) {
-        nodes.reserve(maxNodes);
-    }
+    /// \brief The number of buckets that every power of two is split into.
+    static constexpr std::size_t SubBucketCount = std::size_t(1) << SubBucketBits;
     
-    /// \brief Prints the tree nodes in pre order.
-    std::string print() const;
+    /// \brief The number of bits in the largest value that can be stored.
+    static constexpr std::size_t MaxValueBits = 40;
     
-    /// \brief Finds intervals that intersect the searchInterval.
-    ///
-    /// \param searchInterval The interval to intersect with.
-    /// \param intervals Returns all intervals that intersect with the searchInterval
-    void findIntervals(const T& searchInterval, std::vector<T>& intervals) const {
-        findIntervals(root, searchInterval, intervals);
-    }
+    /// \brief The largest value that can be stored (roughly 18 minutes, if the values are nanoseconds).
+    static constexpr std::uint64_t MaxValue = (std::uint64_t(1) << MaxValueBits) - 1;
     
-    /// \brief Returns the number of intervals stored in the tree.
-    std::size_t size() const {
-        return nodes.size();
-    }
+    /// \brief The total number of buckets.
+    static constexpr std::size_t BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBucketCount;
     
-    /// \brief Recalculates the maximums. Must be called after inserting all intervals.
-    void updateMaximumValues() {
-        updateMaximumValues(root);
-    }
+    DurationHistogram() : counts(), totalCount(0), minValue(MaxValue), maxValue(0) {}
     
-    /// \brief Inserts a new interval
-    void insert(const T& item) {
-        root = insert(root, item);
-        root->isRed = false;
+    /// \brief A comparison operator.
+    inline friend bool operator==(const DurationHistogram& a, const DurationHistogram& b) {
+        return (a.totalCount == b.totalCount) &&
+               (a.minValue == b.minValue) &&
+               (a.maxValue == b.maxValue) &&
+               (a.counts == b.counts);
     }
-private:
-    struct Node {
-        inline Node(T item) : left(nullptr), right(nullptr), sibling(nullptr),  item(item), maximum(), isRed(true) {}
-        
-        Node* left;
-        Node* right;
-        Node* sibling;
-        T item;
-        IntervalType maximum;
-        bool isRed;
-    };
     
-    void findIntervals(const Node* node, const T& searchInterval, std::vector<T>& intervals) const {
-        if (node == nullptr) {
-            return;
-        }
-        
-        if (searchInterval.getStart() > node->maximum) {
-            return;
-        }
-        
-        if (node->left != nullptr) {
-            findIntervals(node->left, searchInterval, intervals);
+    /// \brief Returns the index of the bucket that contains the provided value.
+    static inline std::size_t GetBucketIndex(std::uint64_t value) {
+        if (value > MaxValue) {
+            value = MaxValue;
         }
         
-        const Node* currentNode = node;
-        while (currentNode != nullptr) {
-            if (overlapsWith(currentNode->item, searchInterval)) {
-                intervals.push_back(currentNode->item);
-            }
-            
-            currentNode = currentNode->sibling;
+        if (value < 2 * SubBucketCount) {
+            return static_cast<std::size_t>(value);
         }
         
-        if (searchInterval.getEnd() < node->item.getStart()) {
-            return;
+        // The value is in [SubBucketCount << shift, SubBucketCount << (shift + 1)).
+        const std::size_t shift = MostSignificantBit(value) - SubBucketBits;
+        return shift * SubBucketCount + static_cast<std::size_t>(value >> shift);
+    }
+    
+    /// \brief Returns the smallest value that belongs to the bucket with the provided index.
+    static inline std::uint64_t GetBucketLowerBound(std::size_t index) {
+        if (index < 2 * SubBucketCount) {
+            return index;
         }
         
-        if (node->right != nullptr) {
-            findIntervals(node->right, searchInterval, intervals);
-        }
+        const std::size_t shift = index / SubBucketCount - 1;
+        return static_cast<std::uint64_t>(index % SubBucketCount + SubBucketCount) << shift;
     }
     
-    inline bool overlapsWith(const T& a, const T& b) const {
-        return a.getStart() <= b.getEnd() && b.getStart() <= a.getEnd();
+    /// \brief Returns the largest value that belongs to the bucket with the provided index.
+    static inline std::uint64_t GetBucketUpperBound(std::size_t index) {
+        return (index + 1 < BucketCount) ? (GetBucketLowerBound(index + 1) - 1) : MaxValue;
     }
     
-    inline bool isRed(Node* h) const {
-        if (h != nullptr) {
-            return h->isRed;
-        } else {
-            return false;
+    /// \brief Adds a value to the histogram.
+    ///
+    /// \param value The value, e.g., a duration in nanoseconds.
+    /// \param count How many times the value should be added.
+    inline void record(std::uint64_t value, std::uint64_t count = 1) {
+        if (value > MaxValue) {
+            value = MaxValue;
         }
+        
+        counts[GetBucketIndex(value)] += count;
+        totalCount += count;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
     }
     
-    inline Node* insert(Node* h, const T& item) {
-        if (h == nullptr) {
-            return newNode(item);
-        }
-        
-        if (isRed(h->left) && isRed(h->right)) {
-            flipColors(h);
-        }
-        
-        if (item == h->item) {
-            Node* listItem = h;
-            while (listItem->sibling != nullptr) {
-                listItem = listItem->sibling;
-            }
-            
-            listItem->sibling = newNode(item);
-        } else if (item < h->item) {
-            h->left = insert(h->left, item);
-        } else {
-            h->right = insert(h->right, item);
-        }
-        
-        if (isRed(h->right) && !(isRed(h->left))) {
-            h = rotateLeft(h);
-        }
-        
-        if (isRed(h->left) && isRed(h->left->left)) {
-            h = rotateRight(h);
-        }
-        
-        return h;
+    /// \brief Adds a duration to the histogram.
+    inline void record(std::chrono::nanoseconds duration, std::uint64_t count = 1) {
+        record(static_cast<std::uint64_t>(std::max(duration.count(), std::chrono::nanoseconds::rep(0))), count);
     }
     
-    inline Node* newNode(const T& item) {
-        if (nodes.size() + 1 > maxNodes) {
-            throw std::length_error("Can't insert more than maxNodes nodes");
+    /// \brief Adds the values of another histogram to this one.
+    void merge(const DurationHistogram& other) {
+        for (std::size_t i = 0; i < BucketCount; ++i) {
+            counts[i] += other.counts[i];
         }
         
-        nodes.emplace_back(item);
-        return &nodes.back();
+        totalCount += other.totalCount;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+    
+    /// \brief Removes all values from the histogram.
+    void clear() {
+        counts.fill(0);
+        totalCount = 0;
+        minValue = MaxValue;
+        maxValue = 0;
     }
     
-    inline void flipColors(Node* h) {
-        h->isRed = !h->isRed;
-        h->left->isRed = !h->left->isRed;
-        h->right->isRed = !h->right->isRed;
+    /// \brief Returns the number of values that were added to the histogram.
+    inline std::uint64_t getCount() const {
+        return totalCount;
     }
     
-    inline Node* rotateLeft(Node* h) {
-        Node* temp = h->right;
-        h->right = temp->left;
-        temp->left = h;
-        temp->isRed = h->isRed;
-        h->isRed = true;
-        return temp;
+    /// \brief Returns the smallest value or 0 if the histogram is empty.
+    inline std::chrono::nanoseconds getMin() const {
+        return std::chrono::nanoseconds((totalCount != 0) ? minValue : 0);
     }
     
-    inline Node* rotateRight(Node* h) {
-        Node* temp = h->left;
-        h->left= temp->right;
-        temp->right= h;
-        temp->isRed = h->isRed;
-        h->isRed = true;
-        return temp;
+    /// \brief Returns the largest value or 0 if the histogram is empty.
+    inline std::chrono::nanoseconds getMax() const {
+        return std::chrono::nanoseconds(maxValue);
     }
     
-    void printTreePreOrder(std::stringstream& ss, const Node* node, std::size_t depth) const;
+    /// \brief Returns the number of values in the bucket with the provided index.
+    inline std::uint64_t getBucketCount(std::size_t index) const {
+        return counts[index];
+    }
     
-    inline IntervalType getMaximumSelf(const Node* node) const {
-        IntervalType selfMax = node->item.getEnd();
+    /// \brief Returns a value that's greater than or equal to the specified percentage
+    /// of all values, e.g., 99.0 returns the 99th percentile.
+    ///
+    /// \param percentile A value in [0, 100].
+    ///
+    /// \return The upper bound of the bucket that contains the percentile, limited to
+    /// the recorded minimum and maximum, or 0 if the histogram is empty.
+    std::chrono::nanoseconds getPercentile(double percentile) const {
+        if (totalCount == 0) {
+            return std::chrono::nanoseconds(0);
+        }
         
-        const Node* listItem = node->sibling;
-        while (listItem != nullptr) {
-            selfMax = std::max(selfMax, listItem->item.getEnd());
+        const double clamped = std::max(0.0, std::min(percentile, 100.0));
+        const std::uint64_t rank = std::max(std::uint64_t(1), static_cast<std::uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(totalCount))));
+        
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i) {
+            seen += counts[i];
             
-            listItem = listItem->sibling;
+            if (seen >= rank) {
+                const std::uint64_t value = std::max(minValue, std::min(GetBucketUpperBound(i), maxValue));
+                return std::chrono::nanoseconds(value);
+            }
         }
         
-        return selfMax;
+        return std::chrono::nanoseconds(maxValue);
     }
-    
-    IntervalType updateMaximumValues(Node* node) {
-        if (node == nullptr) {
-            return IntervalType();
+private:
+    static inline std::size_t MostSignificantBit(std::uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(63 - __builtin_clzll(value));
+#else
+        std::size_t index = 0;
+        while (value >>= 1) {
+            index++;
         }
         
-        const IntervalType self = getMaximumSelf(node);
-        const IntervalType left = updateMaximumValues(node->left);
-        const IntervalType right = updateMaximumValues(node->right);
-        
-        const IntervalType maximum = std::max(std::max(self, left), right);
-        node->maximum = maximum;
-        return maximum;
+        return index;
+#endif
     }
     
-    Node* root;
-    std::size_t maxNodes;
-    std::vector<Node> nodes;
+    std::array<std::uint64_t, BucketCount> counts;
+    std::uint64_t totalCount;
+    std::uint64_t minValue;
+    std::uint64_t maxValue;
 };
 
-/// \brief A record of a tag name and color.
+/// \brief A fixed capacity single-producer/single-consumer ring buffer that stores the
+/// finished events of a single thread.
 ///
-/// We need to store this because the end users will use different thread 
-/// profiler settings.
-class TagNameAndColor {
+/// The owning thread pushes the events without locking anything. The storage is 
+/// allocated on the first push to avoid wasting memory on unused thread slots.
+///
+/// If IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL is defined, a full buffer makes the
+/// producer try to lock a spinlock that the consumer holds while draining. If it 
+/// succeeds, it discards the oldest event. Otherwise, it drops the new one. The producer
+/// never waits.
+template <typename T, std::size_t Capacity>
+class EventRingBuffer {
 public:
-    /// \brief Constructs an empty TagNameAndColor object.
-    TagNameAndColor() 
-        : name(GetTagName(ProfilerTag::NoTag)), color(GetTagColor(ProfilerTag::NoTag)) {}
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
     
-    /// \brief Constructs a TagNameAndColor object using explicit values.
-    TagNameAndColor(std::string name, ScopeColor color) : name(name), color(color) {}
-
-    /// Returns the name of the tag.
-    ///
-    /// \return The name of the tag.
-    inline const std::string& getName() const {
-        return name;
-    }
+    EventRingBuffer() : storage(nullptr), writeIndex(0), cachedReadIndex(0), readIndex(0), droppedCount(0) {}
     
-    /// Returns the color of the tag.
-    ///
-    /// \return The color of the tag.
-    inline const ScopeColor& getColor() const {
-        return color;
+    ~EventRingBuffer() {
+        delete[] storage.load();
     }
     
-    /// \brief A comparison operator.
-    inline friend bool operator==(const TagNameAndColor& a, const TagNameAndColor& b) {
-        return (a.name == b.name) && (a.color == b.color);
-    }
-private:
-    /// \brief The name of the tag.
-    std::string name;
+    /// \brief Explicitly disabled to get cleaner errors.
+    EventRingBuffer(const EventRingBuffer&) = delete;
     
-    /// \brief The color of the tag.
-    ScopeColor color;
-};
-
-/// \brief Possible results of the drawInImGui() function
-enum class ProfilerDrawResult {
-    DrawnSuccessfully, ///< Contents of this ProfilerResults object were drawn successfully
-    DrawingFailed, ///< An error message was drawn
-    ImGuiNotAvailable, ///< The profiler was built without IYFT_PROFILER_WITH_IMGUI and drawing is not available
-};
-
-#ifdef IYFT_PROFILER_WITH_IMGUI
-
-class ProfilerResultDrawData {
-public:
-    ProfilerResultDrawData(const ProfilerResults* results);
-    ProfilerDrawResult draw(float scale);
-private:
-    const ProfilerResults* results;
+    /// \brief Explicitly disabled to get cleaner errors.
+    EventRingBuffer& operator=(const EventRingBuffer&) = delete;
     
-    struct FullEventData {
-        using IntervalType = std::chrono::nanoseconds;
+    /// \brief Adds an item to the buffer.
+    ///
+    /// \warning Must only be called by the owning thread.
+    ///
+    /// \return true if the item was stored, false if it was dropped.
+    inline bool push(const T& item) {
+        T* buffer = storage.load(std::memory_order_relaxed);
+        if (buffer == nullptr) {
+            buffer = new T[Capacity];
+            storage.store(buffer, std::memory_order_release);
+        }
         
-        FullEventData(std::size_t id, const TimedProfilerObject* event, const ScopeInfo* scope, const TagNameAndColor* nameAndColor)
-            : id(id), event(event), scope(scope), nameAndColor(nameAndColor) {}
+        const std::uint64_t write = writeIndex.load(std::memory_order_relaxed);
         
-        inline friend bool operator<(const FullEventData& a, const FullEventData& b) {
-            return a.event->getStart() < b.event->getStart();
+        // The cached index is always behind the real one, which makes it safe to use
+        // for the fast path.
+        if (write - cachedReadIndex >= Capacity) {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            
+            if (write - cachedReadIndex >= Capacity) {
+#ifdef IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+                if (!consumerLock.try_lock()) {
+                    droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                
+                // The consumer can't move the read index while we hold the lock.
+                cachedReadIndex = readIndex.load(std::memory_order_relaxed);
+                if (write - cachedReadIndex >= Capacity) {
+                    cachedReadIndex++;
+                    readIndex.store(cachedReadIndex, std::memory_order_release);
+                    droppedCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                
+                buffer[write & (Capacity - 1)] = item;
+                writeIndex.store(write + 1, std::memory_order_release);
+                
+                consumerLock.unlock();
+                return true;
+#else // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+                droppedCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+#endif // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+            }
         }
         
-        inline friend bool operator==(const FullEventData& a, const FullEventData& b) {
-            return a.event->getStart() == b.event->getStart();
-        }
+        buffer[write & (Capacity - 1)] = item;
+        writeIndex.store(write + 1, std::memory_order_release);
         
-        void print(std::stringstream& ss) const;
+        return true;
+    }
+    
+    /// \brief Adds two items to the buffer. Either both of them are stored or none.
+    ///
+    /// The consumer sees both items in the same drain() call, unless the first one gets
+    /// overwritten.
+    ///
+    /// \warning Must only be called by the owning thread.
+    ///
+    /// \return true if the items were stored, false if they were dropped.
+    inline bool push(const T& first, const T& second) {
+        static_assert(Capacity >= 2, "Capacity must be at least 2 to store pairs");
         
-        inline std::chrono::nanoseconds getStart() const {
-            return event->getStart();
+        T* buffer = storage.load(std::memory_order_relaxed);
+        if (buffer == nullptr) {
+            buffer = new T[Capacity];
+            storage.store(buffer, std::memory_order_release);
         }
         
-        inline std::chrono::nanoseconds getEnd() const {
-            return event->getEnd();
-        }
+        const std::uint64_t write = writeIndex.load(std::memory_order_relaxed);
         
-        const std::size_t id;
-        const TimedProfilerObject* event;
-        const ScopeInfo* scope;
-        const TagNameAndColor* nameAndColor;
-    };
-    
-    enum class ValidationStatus {
-        Validated,
-        Invalid,
-        Pending
-    };
+        if (write + 1 - cachedReadIndex >= Capacity) {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            
+            if (write + 1 - cachedReadIndex >= Capacity) {
+#ifdef IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+                if (!consumerLock.try_lock()) {
+                    droppedCount.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                
+                cachedReadIndex = readIndex.load(std::memory_order_relaxed);
+                while (write + 1 - cachedReadIndex >= Capacity) {
+                    cachedReadIndex++;
+                    droppedCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                readIndex.store(cachedReadIndex, std::memory_order_release);
+                
+                buffer[write & (Capacity - 1)] = first;
+                buffer[(write + 1) & (Capacity - 1)] = second;
+                writeIndex.store(write + 2, std::memory_order_release);
+                
+                consumerLock.unlock();
+                return true;
+#else // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+                droppedCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+#endif // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+            }
+        }
+        
+        buffer[write & (Capacity - 1)] = first;
+        buffer[(write + 1) & (Capacity - 1)] = second;
+        writeIndex.store(write + 2, std::memory_order_release);
+        
+        return true;
+    }
     
-    struct ScopeStats {
-        inline constexpr ScopeStats() 
-            : totalCalls(0), averageCallDuration(), minCallDuration(), shortestFrameNumber(0), maxCallDuration(), longestFrameNumber(0) {}
+    /// \brief Calls consumer(item) for every buffered item in insertion order and 
+    /// removes them from the buffer.
+    ///
+    /// \warning Only one thread may drain the buffer at a time.
+    ///
+    /// \return The number of drained items.
+    template <typename F>
+    std::size_t drain(F&& consumer) {
+        const T* buffer = storage.load(std::memory_order_acquire);
+        if (buffer == nullptr) {
+            return 0;
+        }
         
-        std::uint64_t totalCalls;
-        std::chrono::duration<float, std::milli> averageCallDuration;
+#ifdef IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+        std::lock_guard<Spinlock> lock(consumerLock);
+#endif // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
         
-        std::chrono::duration<float, std::milli> minCallDuration;
-        std::uint64_t shortestFrameNumber;
+        const std::uint64_t read = readIndex.load(std::memory_order_relaxed);
+        const std::uint64_t write = writeIndex.load(std::memory_order_acquire);
         
-        std::chrono::duration<float, std::milli> maxCallDuration;
-        std::uint64_t longestFrameNumber;
-    };
-    
-    struct FullScopeData {
-        FullScopeData(const ScopeInfo* scopeInfo, const TagNameAndColor* tagInfo, const ScopeStats* stats)
-            : scopeInfo(scopeInfo), tagInfo(tagInfo), stats(stats) {}
+        for (std::uint64_t i = read; i < write; ++i) {
+            consumer(buffer[i & (Capacity - 1)]);
+        }
         
-        const ScopeInfo* scopeInfo;
-        const TagNameAndColor* tagInfo;
-        const ScopeStats* stats;
-    };
+        readIndex.store(write, std::memory_order_release);
+        
+        return static_cast<std::size_t>(write - read);
+    }
     
-    void drawScopeInfoColumnName(const char* name, std::vector<FullScopeData>& sortedScopes,
-                            bool (*const ascendingSort)(const FullScopeData& a, const FullScopeData& b),
-                            bool (*const descendingSort)(const FullScopeData& a, const FullScopeData& b));
+    /// \brief Returns the number of items that were dropped (or overwritten) since the
+    /// last call and resets the counter.
+    inline std::uint64_t takeDroppedCount() {
+        return droppedCount.exchange(0, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<T*> storage;
     
-    ValidationStatus validationStatus;
-    float scrollPercentage;
-    float lastScale;
-    float shortestFrameDuration;
-    float longestFrameDuration;
-    float splitterHeight;
-    bool lastClickedItemWasFrame;
-    std::size_t lastClickedItemID;
-    std::size_t threadWithSelectedItem;
-    std::string errorMessage;
-    std::vector<std::int32_t> maxDepths;
+    /// \brief Written by the producer.
+    std::atomic<std::uint64_t> writeIndex;
     
-    std::unordered_map<ScopeKey, ScopeStats> scopeStats;
-    std::vector<InsertOnlyIntervalTree<FullEventData>> intervalTrees;
-    std::vector<FullEventData> drawnIntervals;
-    std::vector<FullScopeData> sortedScopes;
+    /// \brief The last read index that the producer has seen.
+    std::uint64_t cachedReadIndex;
     
-    ImVec2 hoveredItemCoordinates;
-    static constexpr std::size_t TextBufferSize = 512;
-    std::array<char, TextBufferSize> primaryTextBuffer;
-    std::array<char, TextBufferSize> secondaryTextBuffer;
-    std::array<char, TextBufferSize> filterTextBuffer;
+    /// \brief Keeps the indices that are written by different threads on different cache
+    /// lines.
+    CacheLinePadding<> producerPadding;
+    
+    /// \brief Written by the consumer (and by the producer while it holds the
+    /// consumerLock when overwriting).
+    std::atomic<std::uint64_t> readIndex;
+    
+    /// \brief Incremented by the producer, reset by the consumer.
+    std::atomic<std::uint64_t> droppedCount;
+    
+#ifdef IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+    Spinlock consumerLock;
+#endif // IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
 };
 
-#endif // IYFT_PROFILER_WITH_IMGUI
+class ProfilerResults;
 
-/// \brief Contains results that were recorded by the ThreadProfiler.
-class ProfilerResults {
+/// \brief A function that receives the chunks that are produced while the ThreadProfiler
+/// is streaming.
+///
+/// The first parameter is the sequence number of the chunk (starting at 0). The chunk
+/// may be moved from. The function is called on the collector thread.
+using ProfilerChunkCallback = std::function<void(std::uint64_t, ProfilerResults&&)>;
+
+/// \brief A function that must call body(i) for every i in [0, count) and return once
+/// all calls are done. The calls may run in parallel.
+using ProfilerParallelFor = std::function<void(std::size_t, const std::function<void(std::size_t)>&)>;
+
+/// \brief The main class that manages and coordinates all profiling and result
+/// exporting actions.
+class ThreadProfiler {
 public:
-    /// \brief A comparison operator.
-    inline friend bool operator==(const ProfilerResults& a, const ProfilerResults& b) {
-        return (a.frames == b.frames) &&
-               (a.scopes == b.scopes) &&
-               (a.tags == b.tags) &&
-               (a.events == b.events) &&
-               (a.threadNames == b.threadNames) &&
-               (a.frameDataMissing == b.frameDataMissing) &&
-               (a.anyRecords == b.anyRecords) &&
-               (a.withCookie == b.withCookie);
+    /// \brief Creates a new ThreadProfiler instance.
+    ThreadProfiler() : nextScopeIndex(0), flowIDs(1), anchorTime(ProfilerClock::now().time_since_epoch()), anchorTicks(GetProfilerTicks()), frameNumber(0), 
+        streaming(false), stopCollector(false), chunkNumber(0), failedChunkCount(0) {
+        for (auto& s : scopesByIndex) {
+            s.store(nullptr, std::memory_order_relaxed);
+        }
+        
+        for (auto& s : scopeTable) {
+            s.store(nullptr, std::memory_order_relaxed);
+        }
     }
     
-    /// \brief Creates a ProfilerResults instance by reading data from a file.
+    /// \brief Stops streaming, if needed, and destroys the scopes.
+    ~ThreadProfiler() {
+        stopStreaming();
+        
+        for (auto& s : scopeTable) {
+            delete s.load(std::memory_order_acquire);
+        }
+    }
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ThreadProfiler(const ThreadProfiler&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ThreadProfiler& operator=(const ThreadProfiler&) = delete;
+    
+    /// \brief Registers a new scope or returns an existing one.
     ///
-    /// \warning This reads the data in native byte order.
+    /// This doesn't lock. Every scope gets a dense index that is stored in the event
+    /// buffers. If two different scopes end up with the same hash, the one that gets
+    /// registered later is assigned the next free key.
     ///
-    /// \return A ProfilerResults instance or a nullptr if file reading failed.
-    static std::unique_ptr<ProfilerResults> LoadFromFile(const std::string& path);
+    /// \param scopeName The name of the scope. Must be a string literal.
+    /// \param hash The hash of the scope identifier that's used to build the ScopeKey.
+    /// \param functionName The name of the function. Must be the result of the
+    /// __func__ variable.
+    /// \param fileName The name of the file. Must be the result of the __FILE__
+    /// macro.
+    /// \param line The number of the line. Must be the result of the __LINE__ macro.
+    /// \param tag The tag of the scope.
+    ///
+    /// \throws std::runtime_error if more than IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT
+    /// scopes are registered.
+    ScopeInfo& insertScopeInfo(const char* scopeName, std::uint32_t hash, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag);
     
-    /// \brief Writes the data to a file.
+    /// \brief Inserts the start of the scope if the ThreadProfiler is recording.
+    /// 
+    /// \param info A ScopeInfo instance.
     ///
-    /// \warning This writes the data in native byte order.
+    /// \return true if the start marker was stored. Only in that case insertScopeEnd()
+    /// must be called when the scope ends.
+    inline bool insertScopeStart(const ScopeInfo& info) {
+        if (!isRecording()) {
+            return false;
+        }
+        
+        ThreadData* threadData = getThreadData();
+        if (threadData == nullptr) {
+            return false;
+        }
+        
+        // Only recorded scopes count towards the depth. Scopes that started before the
+        // recording did or were dropped never appear in the results.
+        EventRecord record(GetProfilerTicks(), info.getIndex(), threadData->depth + 1, false);
+#ifdef IYFT_PROFILER_WITH_COOKIE
+        record.cookie = threadData->cookie;
+        threadData->cookie++;
+#endif // IYFT_PROFILER_WITH_COOKIE
+        
+        if (!threadData->recordedEvents.push(record)) {
+            return false;
+        }
+        
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        threadData->openTicks.push_back(record.ticks);
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        
+        threadData->depth++;
+        return true;
+    }
+    
+    /// \brief Inserts the end of a scope whose start was recorded.
+    /// 
+    /// \param info A ScopeInfo instance.
+    inline void insertScopeEnd(const ScopeInfo& info) {
+        ThreadData* threadData = getThreadData();
+        if (threadData == nullptr) {
+            return;
+        }
+        
+        IYFT_ASSERT(threadData->depth >= 0);
+        
+        // Called even if the recording has been stopped in the meantime. This keeps
+        // the markers in the buffer balanced.
+        const std::uint64_t ticks = GetProfilerTicks();
+        
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        // Updated before the end marker is stored. Events that getResults() returns are
+        // always in the live histograms already.
+        recordLiveDuration(*threadData, info.getIndex(), ticks - threadData->openTicks.back());
+        threadData->openTicks.pop_back();
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        
+        threadData->recordedEvents.push(EventRecord(ticks, info.getIndex(), threadData->depth, true));
+        
+        threadData->depth--;
+    }
+    
+    /// \brief Stores a sample of a counter if the ThreadProfiler is recording.
     ///
-    /// \return true if the operation succeeded, false if it didn't (e.g., if you 
-    /// didn't have the permission to write to the specified file).
-    bool writeToFile(const std::string& path) const;
+    /// \param info The ScopeInfo instance that names the counter.
+    /// \param value The value of the counter.
+    inline void insertCounterSample(const ScopeInfo& info, double value) {
+        if (!isRecording()) {
+            return;
+        }
+        
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        
+        ThreadData* threadData = getThreadData();
+        if (threadData != nullptr) {
+            threadData->recordedEvents.push(EventRecord(GetProfilerTicks(), info.getIndex(), RecordKind::CounterSample), EventRecord::Payload(bits));
+        }
+    }
     
-    /// \brief Writes the data to a human readable std::string.
+    /// \brief Stores a flow marker if the ThreadProfiler is recording.
     ///
-    /// \return A string that contains human readable data.
-    std::string writeToString() const;
+    /// \param info The ScopeInfo instance that names the flow.
+    /// \param id The ID of the flow. Markers with the ID 0 are ignored.
+    /// \param phase The kind of the marker.
+    inline void insertFlowMarker(const ScopeInfo& info, std::uint64_t id, ProfilerFlowPhase phase) {
+        if (id == 0 || !isRecording()) {
+            return;
+        }
+        
+        const RecordKind kind = static_cast<RecordKind>(static_cast<std::uint32_t>(RecordKind::FlowBegin) + static_cast<std::uint32_t>(phase));
+        
+        ThreadData* threadData = getThreadData();
+        if (threadData != nullptr) {
+            threadData->recordedEvents.push(EventRecord(GetProfilerTicks(), info.getIndex(), kind), EventRecord::Payload(id));
+        }
+    }
     
-    /// \brief Access the FrameData container.
-    const std::deque<FrameData>& getFrames() const {
-        return frames;
+    /// \brief Returns a new flow ID if the ThreadProfiler is recording and 0 otherwise.
+    /// The IDs are unique in the whole program.
+    ///
+    /// Every thread reserves blocks of IDs to avoid contention.
+    inline std::uint64_t newFlowID() {
+        if (!isRecording()) {
+            return 0;
+        }
+        
+        ThreadData* threadData = getThreadData();
+        if (threadData == nullptr) {
+            return 0;
+        }
+        
+        if (threadData->nextFlowID == threadData->lastFlowID) {
+            threadData->nextFlowID = flowIDs.fetch_add(FlowIDBlockSize, std::memory_order_relaxed);
+            threadData->lastFlowID = threadData->nextFlowID + FlowIDBlockSize;
+        }
+        
+        return threadData->nextFlowID++;
     }
     
-    /// \brief Access the RecordedEvent container.
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    /// \brief Returns the durations of all recorded calls of a scope that ended since
+    /// this ThreadProfiler was created, including the calls that getResults() already
+    /// collected.
     ///
-    /// \param threadID The ID of the thread. Must be less than getThreadCount()
-    const std::deque<RecordedEvent>& getEvents(std::size_t threadID) const {
-        return events[threadID];
+    /// Only available if IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS is defined. Safe to call
+    /// while other threads are recording.
+    ///
+    /// \param key The key of the scope, e.g., from ScopeInfo::getKey().
+    ///
+    /// \return The histogram or an empty one if the scope doesn't exist or never ended.
+    DurationHistogram getLiveHistogram(ScopeKey key);
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    
+    /// \brief Enables or disables recording.
+    ///
+    /// \remark The recording state is global and shared by all ThreadProfiler
+    /// instances.
+    inline void setRecording(bool state) {
+        ProfilerRecordingFlag.store(state, std::memory_order_release);
     }
     
-    /// \brief Access the ScopeInfo container.
-    const std::unordered_map<ScopeKey, ScopeInfo>& getScopes() const {
-        return scopes;
+    /// \brief Checks if the ThreadProfiler is recording or not.
+    ///
+    /// \return If the ThreadProfiler is recording or not.
+    inline bool isRecording() const {
+        return ProfilerRecordingFlag.load(std::memory_order_acquire);
     }
     
-    /// \brief Access the tag data container.
-    const std::unordered_map<std::uint32_t, TagNameAndColor>& getTags() const {
-        return tags;
+    /// \brief Starts the next frame.
+    inline void nextFrame() {
+        std::lock_guard<Spinlock> lock(frameSpinLock);
+        
+        const std::uint64_t lastFrameNumber = frameNumber;
+        frameNumber++;
+
+        auto now = ProfilerClock::now().time_since_epoch();
+        
+        if (!frames.empty()) {
+            FrameData& lastFrame = frames.back();
+            
+            if (lastFrame.getNumber() == lastFrameNumber) {
+                lastFrame.setEnd(now);
+            }
+        }
+        
+        if (isRecording()) {
+            frames.emplace_back(frameNumber, now);
+        }
     }
     
-    /// \brief Checks if frame data is missing.
+    /// \brief Obtains the current results and clears the current data buffers.
     ///
-    /// If this is true (may happen if the profiler didn't run for the whole frame or
-    /// if you didn't call IYFT_PROFILER_NEXT_FRAME), the frame deque will contain a 
-    /// single artificial frame that starts together with the earliest recorded event
-    /// and ends together with the last recorded event. If hasAnyRecords() is false
-    /// as well, the start and the end will be equal to 0 and 1.
-    bool isFrameDataMissing() const {
-        return frameDataMissing;
+    /// \remark This stops the recording. Scopes that are still open aren't included. If
+    /// the recording is restarted, they will be included in the next result set.
+    ///
+    /// \return All currently recorded data.
+    ProfilerResults getResults();
+    
+    /// \brief Obtains the current results and clears the current data buffers. The buffers
+    /// of different threads are processed in parallel.
+    ///
+    /// For example, with a ThreadPool:
+    /// \code
+    /// profiler.getResults([&pool](std::size_t count, const std::function<void(std::size_t)>& body) {
+    ///     pool.waitFor(*pool.parallelFor(0, count, 1, body));
+    /// });
+    /// \endcode
+    ///
+    /// \copydetails getResults()
+    ProfilerResults getResults(const ProfilerParallelFor& parallelFor);
+    
+    /// \brief Starts a background collector thread that periodically drains the event
+    /// buffers without stopping the recording.
+    ///
+    /// Every drain produces a chunk: a ProfilerResults instance that contains the events
+    /// that were finished and the frames that were completed since the previous chunk.
+    /// Chunks are handed to the callback and aren't kept by the ThreadProfiler, which
+    /// means that the memory use only depends on IYFT_THREAD_PROFILER_BUFFER_CAPACITY and
+    /// the interval. Chunks without any events or frames are skipped.
+    ///
+    /// \remark This enables recording. Calling getResults() while streaming is allowed,
+    /// but it stops the recording.
+    ///
+    /// \param callback The function that receives the chunks.
+    /// \param interval How often the buffers should be drained. Make sure the buffers are
+    /// big enough to hold all events that may be recorded during this interval.
+    ///
+    /// \return false if the ThreadProfiler was already streaming.
+    bool startStreaming(ProfilerChunkCallback callback, std::chrono::milliseconds interval);
+    
+    /// \brief Starts streaming chunks to files.
+    ///
+    /// Each chunk is written by ProfilerResults::writeToFile() to a separate file called
+    /// pathPrefix.NNNNNNNN.profres, where NNNNNNNN is the zero padded sequence number of the
+    /// chunk. All chunks can be opened independently.
+    ///
+    /// \param pathPrefix The path and the base name of the chunk files.
+    /// \param interval How often the buffers should be drained.
+    /// \param maxFileCount If this isn't 0, older chunk files are removed to make sure that
+    /// no more than this many files remain on disk.
+    ///
+    /// \remark Chunks that can't be written are counted by getFailedChunkCount().
+    ///
+    /// \return false if the ThreadProfiler was already streaming.
+    bool startStreaming(const std::string& pathPrefix, std::chrono::milliseconds interval, std::size_t maxFileCount = 0);
+    
+    /// \brief Stops the collector thread and hands the final chunk to the callback.
+    ///
+    /// \remark This doesn't change the recording state.
+    void stopStreaming();
+    
+    /// \brief Checks if the collector thread is running.
+    inline bool isStreaming() const {
+        return streaming.load(std::memory_order_acquire);
     }
     
-    /// \brief Checks if this ProfilerResults contains any records.
+    /// \brief Returns the number of chunks that couldn't be written to files since the
+    /// last startStreaming() call.
     ///
-    /// If this is false, no events were recorded and the event deques will be empty.
-    /// This may happen if you forgot to call IYFT_PROFILER_SET_RECORDING(true), 
-    /// disabled the profiler before it could record any data or if you didn't 
-    /// instrument your code with IYFT_PROFILE calls. Depending on the cause, the scope
-    /// data may still be available.
-    bool hasAnyRecords() const {
-        return anyRecords;
+    /// \remark Always 0 when streaming to a callback.
+    inline std::uint64_t getFailedChunkCount() const {
+        return failedChunkCount.load(std::memory_order_relaxed);
     }
+private:
+    /// \brief Values of EventRecord::depthAndMarker that identify records which aren't
+    /// scope markers. No scope is ever nested this deep.
+    ///
+    /// Counter samples and flow markers are stored as two records: one of these and a
+    /// Payload record that holds the value or the ID in its ticks field.
+    enum class RecordKind : std::uint32_t {
+        CounterSample = 0xFFFFFFF0u,
+        FlowBegin = 0xFFFFFFF1u,
+        FlowStep = 0xFFFFFFF2u,
+        FlowEnd = 0xFFFFFFF3u,
+        Payload = 0xFFFFFFF4u
+    };
     
-    /// \brief Draws the results in Imgui
-    ProfilerDrawResult drawInImGui(float scale);
+    /// \brief A compact begin or end marker that gets stored in the EventRingBuffer.
+    ///
+    /// The timestamps are raw GetProfilerTicks() values. They are paired into
+    /// RecordedEvent objects and converted to nanoseconds by getResults().
+    struct EventRecord {
+        EventRecord() : ticks(0), scope(0), depthAndMarker(0) {}
+        
+        EventRecord(std::uint64_t ticks, std::uint32_t scope, std::int32_t depth, bool end) 
+            : ticks(ticks), scope(scope), depthAndMarker((static_cast<std::uint32_t>(depth) << 1) | (end ? 1u : 0u)) {}
+        
+#ifdef IYFT_PROFILER_WITH_COOKIE
+        EventRecord(std::uint64_t ticks, std::uint32_t scope, RecordKind kind) 
+            : ticks(ticks), scope(scope), depthAndMarker(static_cast<std::uint32_t>(kind)), cookie(0) {}
+#else // IYFT_PROFILER_WITH_COOKIE
+        EventRecord(std::uint64_t ticks, std::uint32_t scope, RecordKind kind) 
+            : ticks(ticks), scope(scope), depthAndMarker(static_cast<std::uint32_t>(kind)) {}
+#endif // IYFT_PROFILER_WITH_COOKIE
+        
+        /// \brief Creates the second record of a counter sample or a flow marker.
+        static inline EventRecord Payload(std::uint64_t value) {
+            return EventRecord(value, 0, RecordKind::Payload);
+        }
+        
+        inline bool isEnd() const {
+            return (depthAndMarker & 1u) != 0;
+        }
+        
+        inline std::int32_t getDepth() const {
+            return static_cast<std::int32_t>(depthAndMarker >> 1);
+        }
+        
+        /// \brief Checks if this is a part of a counter sample or a flow marker.
+        inline bool isScopeMarker() const {
+            return depthAndMarker < static_cast<std::uint32_t>(RecordKind::CounterSample);
+        }
+        
+        inline RecordKind getKind() const {
+            return static_cast<RecordKind>(depthAndMarker);
+        }
+        
+        std::uint64_t ticks;
+        /// The dense index of the scope (ScopeInfo::getIndex()).
+        std::uint32_t scope;
+        /// The depth is stored in the upper 31 bits. The lowest bit is set for end
+        /// markers. Other records use the RecordKind values.
+        std::uint32_t depthAndMarker;
+#ifdef IYFT_PROFILER_WITH_COOKIE
+        ProfilerCookie cookie;
+#endif // IYFT_PROFILER_WITH_COOKIE
+    };
+    
+#ifndef IYFT_PROFILER_WITH_COOKIE
+    static_assert(sizeof(EventRecord) == 16, "EventRecord is expected to be 16 bytes long");
+#endif // IYFT_PROFILER_WITH_COOKIE
+    
+    /// \brief A begin marker that is waiting for its end marker.
+    struct OpenEvent {
+        OpenEvent(const EventRecord& begin, std::size_t slot) : begin(begin), slot(slot) {}
+        
+        EventRecord begin;
+        
+        /// The position of the event in the event deque that's currently being built.
+        std::size_t slot;
+    };
+    
+    /// Internal struct used to manage per-thread data
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    /// \brief Per-thread and per-scope counts of GetProfilerTicks() deltas that use the
+    /// buckets of DurationHistogram. Only the owning thread writes them.
+    struct LiveHistogram {
+        LiveHistogram() {
+            for (std::atomic<std::uint64_t>& c : counts) {
+                c.store(0, std::memory_order_relaxed);
+            }
+        }
+        
+        std::array<std::atomic<std::uint64_t>, DurationHistogram::BucketCount> counts;
+    };
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    
+    struct ThreadData {
+#ifdef IYFT_PROFILER_WITH_COOKIE
+        ThreadData(std::size_t id, std::uint64_t serial, std::string name) : id(id), serial(serial), name(std::move(name)), depth(-1), nextFlowID(0), lastFlowID(0), cookie(0) {}
+#else // IYFT_PROFILER_WITH_COOKIE
+        ThreadData(std::size_t id, std::uint64_t serial, std::string name) : id(id), serial(serial), name(std::move(name)), depth(-1), nextFlowID(0), lastFlowID(0) {}
+#endif // IYFT_PROFILER_WITH_COOKIE
+        
+        /// The ID of the thread. It may be reused once the thread exits.
+        std::size_t id;
+        
+        /// The unique serial number of the thread. Used to detect reused IDs.
+        std::uint64_t serial;
+        
+        /// The name of the thread. Kept here because a reused ID gets a new name.
+        std::string name;
+        
+        /// Begin and end markers. Written by the owning thread without locking and
+        /// drained by getResults().
+        EventRingBuffer<EventRecord, IYFT_THREAD_PROFILER_BUFFER_CAPACITY> recordedEvents;
+        
+        /// Begin markers that getResults() has drained, but whose end markers haven't
+        /// been drained yet. Only used by getResults().
+        std::vector<OpenEvent> openEvents;
+        
+        /// The depth of the innermost recorded scope that is still open.
+        std::int32_t depth;
+        
+        /// The flow IDs that this thread has reserved, but hasn't handed out yet.
+        std::uint64_t nextFlowID;
+        std::uint64_t lastFlowID;
+    #ifdef IYFT_PROFILER_WITH_COOKIE
+        std::uint64_t cookie;
+    #endif // IYFT_PROFILER_WITH_COOKIE
+    #ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        /// The start ticks of the recorded scopes that are still open.
+        std::vector<std::uint64_t> openTicks;
+        
+        /// Indexed by ScopeInfo::getIndex(). The histograms are allocated when a scope
+        /// ends on this thread for the first time.
+        std::unique_ptr<std::atomic<LiveHistogram*>[]> liveHistograms{new std::atomic<LiveHistogram*>[IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT]()};
+        
+        ~ThreadData() {
+            for (std::size_t i = 0; i < IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT; ++i) {
+                delete liveHistograms[i].load(std::memory_order_relaxed);
+            }
+        }
+    #endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    };
+    
+    /// \brief Converts GetProfilerTicks() values to ProfilerClock nanoseconds.
+    struct TickConverter {
+#ifdef IYFT_THREAD_PROFILER_USES_TSC
+        TickConverter(std::chrono::nanoseconds baseTime, std::uint64_t baseTicks, double nanosecondsPerTick) 
+            : baseTime(baseTime), baseTicks(baseTicks), nanosecondsPerTick(nanosecondsPerTick) {}
+        
+        inline std::chrono::nanoseconds operator()(std::uint64_t ticks) const {
+            const double delta = static_cast<double>(static_cast<std::int64_t>(ticks - baseTicks)) * nanosecondsPerTick;
+            return baseTime + std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(std::llround(delta)));
+        }
+        
+        /// \brief Converts a difference between two tick values.
+        inline std::chrono::nanoseconds toDuration(std::uint64_t ticks) const {
+            return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(std::llround(static_cast<double>(ticks) * nanosecondsPerTick)));
+        }
+        
+        std::chrono::nanoseconds baseTime;
+        std::uint64_t baseTicks;
+        double nanosecondsPerTick;
+#else // IYFT_THREAD_PROFILER_USES_TSC
+        inline std::chrono::nanoseconds operator()(std::uint64_t ticks) const {
+            return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(ticks));
+        }
+        
+        /// \brief Converts a difference between two tick values.
+        inline std::chrono::nanoseconds toDuration(std::uint64_t ticks) const {
+            return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(ticks));
+        }
+#endif // IYFT_THREAD_PROFILER_USES_TSC
+    };
+    
+    /// \brief Measures the tick rate against ProfilerClock over the whole lifetime of
+    /// the ThreadProfiler.
+    TickConverter calibrate() const;
+    
+    /// \brief The per-thread data that the calling thread used last.
+    struct ThreadDataCache {
+        ThreadProfiler* profiler;
+        ThreadData* data;
+        
+        /// Set when the thread exits. Its ID may belong to another thread afterwards.
+        bool exited;
+    };
+    
+    /// \brief Cached to avoid looking up the ThreadData on every call. Trivially
+    /// destructible, which keeps it usable in the destructors of other thread_local
+    /// variables.
+    static thread_local ThreadDataCache CurrentThreadData;
+    
+    /// \brief Returns the ThreadData of the calling thread and creates it if needed.
+    ///
+    /// \return The ThreadData or nullptr if the thread is exiting and mustn't record
+    /// anything anymore.
+    inline ThreadData* getThreadData() {
+        ThreadDataCache& cache = CurrentThreadData;
+        
+        if (cache.profiler == this) {
+            return cache.data;
+        }
+        
+        if (cache.exited) {
+            return nullptr;
+        }
+        
+        return &registerThread();
+    }
+    
+    /// \brief Finds or creates the ThreadData of the calling thread and caches it.
+    ThreadData& registerThread();
+    
+    /// \brief Called by ThreadIDReleaser before the ID of the calling thread is
+    /// released. Stops all further recording on the thread and hands its ThreadData
+    /// to retireThread() if the default ThreadProfiler owns it.
+    static void RetireCurrentThread();
+    
+    /// \brief Drains the buffer of an exiting thread into exitedThreads and destroys
+    /// its ThreadData.
+    void retireThread(ThreadData& threadData);
+    
+    friend struct ThreadIDReleaser;
+    
+    /// \brief Drains the buffer of a single thread and turns the markers into events
+    /// that are sorted by their start times. Counter samples and flow markers are
+    /// extracted as well.
+    void drainThread(ThreadData& threadData, const TickConverter& toNanoseconds, std::deque<RecordedEvent>& threadEvents,
+                     std::deque<CounterSample>& threadCounters, std::deque<FlowEvent>& threadFlows);
+    
+    /// \brief The events of a thread that has exited. The ThreadData and its buffer
+    /// are destroyed as soon as they're drained.
+    struct ExitedThread {
+        ExitedThread(std::uint64_t serial, std::string name) : serial(serial), name(std::move(name)), droppedEvents(0) {}
+        
+        inline bool isEmpty() const {
+            return events.empty() && counterSamples.empty() && flowEvents.empty() && droppedEvents == 0;
+        }
+        
+        std::uint64_t serial;
+        std::string name;
+        std::deque<RecordedEvent> events;
+        std::deque<CounterSample> counterSamples;
+        std::deque<FlowEvent> flowEvents;
+        std::uint64_t droppedEvents;
+    };
+    
+    /// \brief Drains the buffer of a thread that has exited for the last time.
+    ExitedThread drainExitedThread(ThreadData& threadData, const TickConverter& toNanoseconds);
+    
+    /// \brief Drains the event buffers and builds a ProfilerResults instance.
+    ///
+    /// \param allFrames If true, all frames are extracted and the last one gets closed.
+    /// Otherwise, the last frame is left in place if it's still running.
+    /// \param parallelFor If this isn't a nullptr, it's used to drain the threads in
+    /// parallel.
+    ProfilerResults collectResults(bool allFrames, const ProfilerParallelFor* parallelFor);
+    
+    /// \brief The main function of the collector thread.
+    void runCollector(std::chrono::milliseconds interval);
+    
+    /// \brief Hands a chunk to the streaming callback if it contains any data.
+    void emitChunk(ProfilerResults&& chunk);
+    
+    /// \brief The number of slots in the scope hash table. Kept at least half empty to
+    /// make the probe sequences short.
+    static constexpr std::size_t ScopeTableSize = NextPowerOfTwo(2 * IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT);
+    
+    /// Contains information on all scopes tracked by the ThreadProfiler, indexed by
+    /// ScopeInfo::getIndex(). This is used to avoid storing tons of duplicate data every
+    /// time we start profiling a scope. Entries are only written once. An entry may stay
+    /// empty if two threads registered the same scope at the same time.
+    std::array<std::atomic<ScopeInfo*>, IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT> scopesByIndex;
+    
+    /// The next free scope index.
+    std::atomic<std::uint32_t> nextScopeIndex;
+    
+    /// An open addressing hash table that maps ScopeKey values to registered scopes.
+    /// Uses linear probing. Slots are never cleared.
+    std::array<std::atomic<ScopeInfo*>, ScopeTableSize> scopeTable;
+    
+    /// Protects threads and retiredThreads.
+    std::mutex threadsMutex;
+    
+    /// Per-thread data, indexed by thread IDs. Allocated when a thread records its
+    /// first event. Entries are only destroyed while drainMutex is locked, either by
+    /// retireThread() when the thread exits or by collectResults().
+    std::vector<std::unique_ptr<ThreadData>> threads;
+    
+    /// Data of threads that exited before their ID got reused, but weren't retired
+    /// when they exited because the cache of the thread pointed to another instance.
+    /// It's kept until their remaining events are collected.
+    std::vector<std::unique_ptr<ThreadData>> retiredThreads;
+    
+    /// The number of flow IDs that a thread reserves at once.
+    static const std::uint64_t FlowIDBlockSize = 1024;
+    
+    /// The first flow ID that no thread has reserved yet.
+    std::atomic<std::uint64_t> flowIDs;
+    
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    /// \brief Stores a call of a scope in the live histogram of the calling thread.
+    inline void recordLiveDuration(ThreadData& threadData, std::uint32_t scope, std::uint64_t ticks) {
+        LiveHistogram* histogram = threadData.liveHistograms[scope].load(std::memory_order_relaxed);
+        if (histogram == nullptr) {
+            histogram = new LiveHistogram();
+            threadData.liveHistograms[scope].store(histogram, std::memory_order_release);
+        }
+        
+        // Only this thread writes the counter, so a separate load and store is enough.
+        std::atomic<std::uint64_t>& counter = histogram->counts[DurationHistogram::GetBucketIndex(ticks)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    
+    /// \brief Adds the live histograms of an exited thread to exitedThreadHistograms.
+    /// threadsMutex must be locked.
+    void keepLiveHistograms(const ThreadData& threadData);
+    
+    /// Tick based histograms of threads whose ThreadData was destroyed, indexed by
+    /// ScopeInfo::getIndex(). Protected by threadsMutex.
+    std::unordered_map<std::uint32_t, DurationHistogram> exitedThreadHistograms;
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    
+    /// The time and the tick count that were sampled when the ThreadProfiler was
+    /// created. Used by calibrate().
+    const std::chrono::nanoseconds anchorTime;
+    const std::uint64_t anchorTicks;
+    
+    std::uint64_t frameNumber;
+    Spinlock frameSpinLock;
+    std::deque<FrameData> frames;
+    
+    /// Makes sure only one thread drains the event buffers at a time. Draining can take
+    /// a while, which is why this isn't a Spinlock.
+    std::mutex drainMutex;
+    
+    /// Events of threads that exited since the last collectResults() call. Protected
+    /// by drainMutex.
+    std::vector<ExitedThread> exitedThreads;
+    
+    /// Used to start and stop the collector thread.
+    std::mutex streamMutex;
+    std::condition_variable streamCondition;
+    std::atomic<bool> streaming;
+    bool stopCollector;
+    std::thread collector;
+    ProfilerChunkCallback chunkCallback;
+    std::uint64_t chunkNumber;
+    
+    /// Incremented by the collector when a chunk file can't be written.
+    std::atomic<std::uint64_t> failedChunkCount;
+};
+
+/// Returns a reference to the default ThreadProfiler instance
+ThreadProfiler& GetThreadProfiler();
+
+/// \brief A record of a tag name and color.
+///
+/// We need to store this because the end users will use different thread 
+/// profiler settings.
+class TagNameAndColor {
+public:
+    /// \brief Constructs an empty TagNameAndColor object.
+    TagNameAndColor() 
+        : name(GetTagName(ProfilerTag::NoTag)), color(GetTagColor(ProfilerTag::NoTag)) {}
+    
+    /// \brief Constructs a TagNameAndColor object using explicit values.
+    TagNameAndColor(std::string name, ScopeColor color) : name(name), color(color) {}
+
+    /// Returns the name of the tag.
+    ///
+    /// \return The name of the tag.
+    inline const std::string& getName() const {
+        return name;
+    }
+    
+    /// Returns the color of the tag.
+    ///
+    /// \return The color of the tag.
+    inline const ScopeColor& getColor() const {
+        return color;
+    }
+    
+    /// \brief A comparison operator.
+    inline friend bool operator==(const TagNameAndColor& a, const TagNameAndColor& b) {
+        return (a.name == b.name) && (a.color == b.color);
+    }
+private:
+    /// \brief The name of the tag.
+    std::string name;
+    
+    /// \brief The color of the tag.
+    ScopeColor color;
+};
+
+/// \brief Possible results of the drawInImGui() function
+enum class ProfilerDrawResult {
+    DrawnSuccessfully, ///< Contents of this ProfilerResults object were drawn successfully
+    DrawingFailed, ///< An error message was drawn
+    ImGuiNotAvailable, ///< The profiler was built without IYFT_PROFILER_WITH_IMGUI and drawing is not available
+    Processing, ///< The results are still being processed in the background and a progress bar was drawn instead
+};
+
+#ifdef IYFT_PROFILER_WITH_IMGUI
+
+class ProfilerResultDrawData {
+public:
+    /// \brief Starts processing the results on a background thread.
+    ///
+    /// \param results The results to draw. They must not be moved or destroyed while this object exists.
+    /// \param parallelFor If this isn't empty, it's called on the background thread to process the events of
+    /// different threads in parallel.
+    ProfilerResultDrawData(const ProfilerResults* results, ProfilerParallelFor parallelFor);
+    
+    /// Waits for the background processing to finish.
+    ~ProfilerResultDrawData();
+    
+    /// Explicitly disabled to get cleaner errors.
+    ProfilerResultDrawData(const ProfilerResultDrawData&) = delete;
+    
+    /// Explicitly disabled to get cleaner errors.
+    ProfilerResultDrawData& operator=(const ProfilerResultDrawData&) = delete;
+    
+    ProfilerDrawResult draw(float scale);
+private:
+    const ProfilerResults* results;
+    
+    struct FullEventData {
+        FullEventData(std::size_t id, const RecordedEvent* event, const ScopeInfo* scope, const TagNameAndColor* nameAndColor)
+            : id(id), event(event), scope(scope), nameAndColor(nameAndColor) {}
+        
+        inline std::chrono::nanoseconds getStart() const {
+            return event->getStart();
+        }
+        
+        inline std::chrono::nanoseconds getEnd() const {
+            return event->getEnd();
+        }
+        
+        const std::size_t id;
+        const RecordedEvent* event;
+        const ScopeInfo* scope;
+        const TagNameAndColor* nameAndColor;
+    };
+    
+    enum class ValidationStatus {
+        Validated,
+        Invalid,
+        Pending
+    };
+    
+    struct ScopeStats {
+        inline constexpr ScopeStats() 
+            : totalCalls(0), averageCallDuration(), minCallDuration(), shortestFrameNumber(0), maxCallDuration(), longestFrameNumber(0),
+              medianCallDuration(), p95CallDuration(), p99CallDuration() {}
+        
+        std::uint64_t totalCalls;
+        std::chrono::duration<float, std::milli> averageCallDuration;
+        
+        std::chrono::duration<float, std::milli> minCallDuration;
+        std::uint64_t shortestFrameNumber;
+        
+        std::chrono::duration<float, std::milli> maxCallDuration;
+        std::uint64_t longestFrameNumber;
+        
+        /// Computed from a DurationHistogram of all calls.
+        std::chrono::duration<float, std::milli> medianCallDuration;
+        std::chrono::duration<float, std::milli> p95CallDuration;
+        std::chrono::duration<float, std::milli> p99CallDuration;
+    };
+    
+    /// \brief Consecutive events on the same depth of a thread that are drawn as a single rectangle.
+    struct AggregatedSpan {
+        AggregatedSpan(const FullEventData& first)
+            : start(first.getStart()), end(first.getEnd()), count(1), first(first) {}
+        
+        std::chrono::nanoseconds start;
+        std::chrono::nanoseconds end;
+        std::size_t count;
+        /// The earliest event of the span. Used for colours, names and selection.
+        FullEventData first;
+    };
+    
+    struct FullScopeData {
+        FullScopeData(const ScopeInfo* scopeInfo, const TagNameAndColor* tagInfo, const ScopeStats* stats)
+            : scopeInfo(scopeInfo), tagInfo(tagInfo), stats(stats) {}
+        
+        const ScopeInfo* scopeInfo;
+        const TagNameAndColor* tagInfo;
+        const ScopeStats* stats;
+    };
+    
+    /// \brief Validates the results, builds the levels of detail and computes the stats. Runs on the builder thread.
+    void prepare(const ProfilerParallelFor& parallelFor);
+    
+    /// \brief Processes the events of a single thread and stores the stats of its scopes in threadStats.
+    ///
+    /// \param threadHistograms Histograms are only allocated for the scopes that the thread used.
+    ///
+    /// \return false if an event refers to a missing scope.
+    bool prepareThread(std::size_t threadID, const std::unordered_map<ScopeKey, std::size_t>& scopeIndices, std::vector<ScopeStats>& threadStats,
+                       std::vector<std::unique_ptr<DurationHistogram>>& threadHistograms);
+    
+    /// \brief Greedily merges consecutive spans as long as the merged span is no longer than maxLength.
+    static void MergeSpans(const std::vector<AggregatedSpan>& source, std::chrono::nanoseconds maxLength, std::vector<AggregatedSpan>& destination);
+    
+    void drawScopeInfoColumnName(const char* name, std::vector<FullScopeData>& sortedScopes,
+                            bool (*const ascendingSort)(const FullScopeData& a, const FullScopeData& b),
+                            bool (*const descendingSort)(const FullScopeData& a, const FullScopeData& b));
+    
+    ValidationStatus validationStatus;
+    float scrollPercentage;
+    float lastScale;
+    float shortestFrameDuration;
+    float longestFrameDuration;
+    float splitterHeight;
+    bool lastClickedItemWasFrame;
+    std::size_t lastClickedItemID;
+    std::size_t threadWithSelectedItem;
+    std::string errorMessage;
+    std::vector<std::int32_t> maxDepths;
+    
+    /// Indexed in the same order in which ProfilerResults::getScopes() were iterated.
+    std::vector<ScopeStats> scopeStats;
+    std::vector<FullScopeData> sortedScopes;
+    
+    /// \brief The number of levels of detail built for every depth of every thread.
+    ///
+    /// Level 0 stores the unmerged events and is used to find the visible ones with a binary search. Spans of level L are at most FirstMergedLevelNanoseconds * 2^(L - 1)
+    /// long and draw() picks the level where a merged span fits in a single pixel.
+    static constexpr std::size_t LevelOfDetailCount = 9;
+    static constexpr std::int64_t FirstMergedLevelNanoseconds = 256;
+    
+    /// Indexed by thread and then by depth * LevelOfDetailCount + level. The spans of each level are sorted
+    /// and don't overlap. A merged level is left empty if merging didn't combine anything. The next lower
+    /// level that isn't empty should be drawn instead.
+    std::vector<std::vector<std::vector<AggregatedSpan>>> levelsOfDetail;
+    
+    ImVec2 hoveredItemCoordinates;
+    static constexpr std::size_t TextBufferSize = 512;
+    std::array<char, TextBufferSize> primaryTextBuffer;
+    std::array<char, TextBufferSize> secondaryTextBuffer;
+    std::array<char, TextBufferSize> filterTextBuffer;
+    
+    /// The data that's computed by prepare() must not be accessed by draw() until this becomes true.
+    std::atomic<bool> ready;
+    std::atomic<bool> cancelled;
+    std::atomic<std::size_t> processedThreads;
+    std::thread builder;
+};
+
+#endif // IYFT_PROFILER_WITH_IMGUI
+
+/// \brief The file formats that ProfilerResults can be written in.
+enum class ProfilerFileFormat : std::uint8_t {
+    /// The original format. Every value is written separately in native byte order.
+    Version1 = 1,
+    /// Fixed size little-endian records, a string table and a footer with section 
+    /// offsets and a frame index. It can be memory mapped by ProfilerFileView.
+    Version2 = 2,
+    /// Same as Version2, but the events are stored as delta encoded varints that
+    /// reference the scope table. If IYFT_PROFILER_WITH_ZSTD is defined, they're also
+    /// compressed with zstd. Files are usually 5-10 times smaller than Version2.
+    Version3 = 3,
+};
+
+/// \brief Formats that can be opened by other trace viewers.
+enum class ProfilerExportFormat {
+    /// The Chrome Trace Event JSON format. Can be opened in chrome://tracing or in
+    /// the Perfetto UI.
+    ChromeJSON,
+    /// The Perfetto protobuf trace format. Can be opened in the Perfetto UI or 
+    /// processed with its trace processor.
+    Perfetto,
+};
+
+/// \brief The latencies of all flows that share a name.
+struct FlowLatencyHistograms {
+    /// \brief The time between the begin marker and the first step marker. Empty if
+    /// the flows don't have any steps.
+    DurationHistogram firstStep;
+    
+    /// \brief The time between the begin and the end marker.
+    DurationHistogram total;
+};
+
+/// \brief Contains results that were recorded by the ThreadProfiler.
+class ProfilerResults {
+public:
+    /// \brief A comparison operator.
+    inline friend bool operator==(const ProfilerResults& a, const ProfilerResults& b) {
+        return (a.frames == b.frames) &&
+               (a.scopes == b.scopes) &&
+               (a.tags == b.tags) &&
+               (a.events == b.events) &&
+               (a.threadNames == b.threadNames) &&
+               (a.frameDataMissing == b.frameDataMissing) &&
+               (a.anyRecords == b.anyRecords) &&
+               (a.withCookie == b.withCookie);
+    }
+    
+    /// \brief Creates a ProfilerResults instance by reading data from a file.
+    ///
+    /// The format is detected automatically.
+    ///
+    /// \warning Version 1 files are read in native byte order.
+    ///
+    /// \return A ProfilerResults instance or a nullptr if file reading failed.
+    static std::unique_ptr<ProfilerResults> LoadFromFile(const std::string& path);
+    
+    /// \brief Writes the data to a file.
+    ///
+    /// \warning Version 1 files are written in native byte order.
+    ///
+    /// \param path The path of the file.
+    /// \param format The format of the file.
+    ///
+    /// \return true if the operation succeeded, false if it didn't (e.g., if you 
+    /// didn't have the permission to write to the specified file).
+    bool writeToFile(const std::string& path, ProfilerFileFormat format = ProfilerFileFormat::Version2) const;
+    
+    /// \brief Exports the data to a stream.
+    ///
+    /// Every thread becomes a track named after its thread name and the frames are
+    /// exported as a counter track. The data is written incrementally.
+    ///
+    /// \param os The output stream. Must be opened in binary mode for 
+    /// ProfilerExportFormat::Perfetto.
+    /// \param format The output format.
+    ///
+    /// \return true if the operation succeeded, false if writing failed.
+    bool exportToStream(std::ostream& os, ProfilerExportFormat format) const;
+    
+    /// \brief Exports the data to a file.
+    ///
+    /// \copydetails exportToStream()
+    ///
+    /// \param path The path of the file.
+    bool exportToFile(const std::string& path, ProfilerExportFormat format) const;
+    
+    /// \brief Writes the data to a human readable std::string.
+    ///
+    /// \return A string that contains human readable data.
+    std::string writeToString() const;
+    
+    /// \brief Access the FrameData container.
+    const std::deque<FrameData>& getFrames() const {
+        return frames;
+    }
+    
+    /// \brief Access the RecordedEvent container.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    const std::deque<RecordedEvent>& getEvents(std::size_t threadID) const {
+        return events[threadID];
+    }
+    
+    /// \brief Returns the number of begin and end markers that the thread lost because
+    /// its buffer was full (check IYFT_THREAD_PROFILER_BUFFER_CAPACITY). Every lost 
+    /// marker discards one event. Lost counter samples and flow markers are counted
+    /// as well.
+    ///
+    /// \remark This value is only stored in version 2 and 3 files and isn't compared by
+    /// operator==.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    std::uint64_t getDroppedEventCount(std::size_t threadID) const {
+        return (threadID < droppedEvents.size()) ? droppedEvents[threadID] : 0;
+    }
+    
+    /// \brief Access the CounterSample container of a thread. The samples are sorted
+    /// by their times.
+    ///
+    /// The names of the counters are stored in the ScopeInfo container.
+    ///
+    /// \remark The samples are only stored in version 2 and 3 files and aren't compared
+    /// by operator==.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    const std::deque<CounterSample>& getCounterSamples(std::size_t threadID) const {
+        return counterSamples[threadID];
+    }
+    
+    /// \brief Access the FlowEvent container of a thread. The markers are sorted by
+    /// their times.
+    ///
+    /// The names of the flows are stored in the ScopeInfo container.
+    ///
+    /// \remark The markers are only stored in version 2 and 3 files and aren't compared
+    /// by operator==.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    const std::deque<FlowEvent>& getFlowEvents(std::size_t threadID) const {
+        return flowEvents[threadID];
+    }
+    
+    /// \brief Access the ScopeInfo container.
+    const std::unordered_map<ScopeKey, ScopeInfo>& getScopes() const {
+        return scopes;
+    }
+    
+    /// \brief Access the tag data container.
+    const std::unordered_map<std::uint32_t, TagNameAndColor>& getTags() const {
+        return tags;
+    }
+    
+    /// \brief Builds a duration histogram for every scope that has recorded events.
+    ///
+    /// Use DurationHistogram::getPercentile() to obtain, e.g., the p50, p95 or p99
+    /// durations. The histograms of different ProfilerResults may be merged.
+    ///
+    /// \param threadID If this is less than getThreadCount(), only the events of this
+    /// thread are included. Otherwise, the events of all threads are.
+    std::unordered_map<ScopeKey, DurationHistogram> computeScopeHistograms(std::size_t threadID = std::numeric_limits<std::size_t>::max()) const;
+    
+    /// \brief Builds latency histograms for every flow name.
+    ///
+    /// The flows are matched by their IDs across all threads and grouped by the key of
+    /// their begin markers. Flows whose begin or end markers are missing are skipped.
+    /// For the flows of a ThreadPool (IYFT_THREAD_POOL_PROFILE), firstStep is the time
+    /// that the tasks spent in a queue and total is the end-to-end task latency.
+    std::unordered_map<ScopeKey, FlowLatencyHistograms> computeFlowHistograms() const;
+    
+    /// \brief Checks if frame data is missing.
+    ///
+    /// If this is true (may happen if the profiler didn't run for the whole frame or
+    /// if you didn't call IYFT_PROFILER_NEXT_FRAME), the frame deque will contain a 
+    /// single artificial frame that starts together with the earliest recorded event
+    /// and ends together with the last recorded event. If hasAnyRecords() is false
+    /// as well, the start and the end will be equal to 0 and 1.
+    bool isFrameDataMissing() const {
+        return frameDataMissing;
+    }
+    
+    /// \brief Checks if this ProfilerResults contains any records.
+    ///
+    /// If this is false, no events, counter samples or flow markers were recorded and
+    /// their deques will be empty.
+    /// This may happen if you forgot to call IYFT_PROFILER_SET_RECORDING(true), 
+    /// disabled the profiler before it could record any data or if you didn't 
+    /// instrument your code with IYFT_PROFILE calls. Depending on the cause, the scope
+    /// data may still be available.
+    bool hasAnyRecords() const {
+        return anyRecords;
+    }
+    
+    /// \brief Draws the results in Imgui
+    ///
+    /// The results are processed on a background thread when this is called for the first
+    /// time. A progress bar is drawn and ProfilerDrawResult::Processing is returned until
+    /// that's done.
+    ///
+    /// \warning This object must not be moved while the results are drawn.
+    ProfilerDrawResult drawInImGui(float scale);
+    
+    /// \brief Draws the results in Imgui. The events of different threads are processed
+    /// in parallel.
+    ///
+    /// For example, with a ThreadPool:
+    /// \code
+    /// results.drawInImGui(scale, [&pool](std::size_t count, const std::function<void(std::size_t)>& body) {
+    ///     pool.waitFor(*pool.parallelFor(0, count, 1, body));
+    /// });
+    /// \endcode
+    ///
+    /// \remark parallelFor is only used by the first call and it's called from a background
+    /// thread. Anything it refers to must stay alive until this returns something other than
+    /// ProfilerDrawResult::Processing.
+    ///
+    /// \copydetails drawInImGui(float)
+    ProfilerDrawResult drawInImGui(float scale, const ProfilerParallelFor& parallelFor);
+    
+    /// \brief Returns the number of threads that were profiled
+    std::size_t getThreadCount() const {
+        return threadNames.size();
+    }
+    
+    /// \brief Returns the name of a profiled thread
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    const std::string& getThreadName(std::size_t threadID) const {
+        return threadNames[threadID];
+    }
+    
+    /// \brief Minimal value that can be passed to drawInImGui()
+    static float GetMinScale() {
+        return 0.2f;
+    }
+    
+    /// \brief Maximum value that can be passed to drawInImGui()
+    static float GetMaxScale() {
+        return 15.0f;
+    }
+private:
+    friend class ThreadProfiler;
+    friend class ProfilerFileView;
+    
+    bool writeVersion1(std::ostream& os) const;
+    bool writeIndexed(std::ostream& os, bool compressed) const;
+    
+    /// The default constructed state isn't valid. It needs to be processed by the
+    /// ThreadProfiler.
+    ProfilerResults() 
+        : frameDataMissing(false), anyRecords(false), withCookie(false) {}
+    
+    std::deque<FrameData> frames;
+    std::unordered_map<ScopeKey, ScopeInfo> scopes;
+    std::unordered_map<std::uint32_t, TagNameAndColor> tags;
+    std::vector<std::deque<RecordedEvent>> events;
+    std::vector<std::deque<CounterSample>> counterSamples;
+    std::vector<std::deque<FlowEvent>> flowEvents;
+    std::vector<std::uint64_t> droppedEvents;
+    std::vector<std::string> threadNames;
+    bool frameDataMissing;
+    bool anyRecords;
+    bool withCookie;
+    
+#ifdef IYFT_PROFILER_WITH_IMGUI
+    std::unique_ptr<ProfilerResultDrawData> drawData;
+#endif // IYFT_PROFILER_WITH_IMGUI
+}; 
+
+static_assert(std::is_move_assignable<ProfilerResults>::value && std::is_move_constructible<ProfilerResults>::value,
+              "ProfilerResults must be moveable");
+
+/// \brief Provides read-only access to a version 2 or 3 file without loading it.
+///
+/// The file is memory mapped (if the platform supports it, otherwise it's read into 
+/// memory with a single call) and the records are decoded only when they're accessed.
+/// The event streams of version 3 files are decoded when the file is opened.
+/// Events of all threads are sorted by their start times. The frame index can be used
+/// to jump to the events of a specific frame.
+class ProfilerFileView {
+public:
+    /// \brief Opens and validates a version 2 or 3 file.
+    ///
+    /// \return A ProfilerFileView or a nullptr if the file couldn't be opened, isn't a
+    /// version 2 or 3 file, is damaged or is compressed with zstd while
+    /// IYFT_PROFILER_WITH_ZSTD isn't defined.
+    static std::unique_ptr<ProfilerFileView> Open(const std::string& path);
+    
+    ~ProfilerFileView();
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ProfilerFileView(const ProfilerFileView&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    ProfilerFileView& operator=(const ProfilerFileView&) = delete;
+    
+    /// \brief Returns the number of profiled threads.
+    std::size_t getThreadCount() const {
+        return threadCount;
+    }
+    
+    /// \brief Returns the name of a profiled thread.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    std::string getThreadName(std::size_t threadID) const;
+    
+    /// \brief Returns the number of markers that the thread lost.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    std::uint64_t getDroppedEventCount(std::size_t threadID) const;
+    
+    /// \brief Returns the number of events that were recorded by a thread.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    std::size_t getEventCount(std::size_t threadID) const;
+    
+    /// \brief Decodes an event.
+    ///
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    /// \param eventID The index of the event. Must be less than getEventCount(threadID)
+    RecordedEvent getEvent(std::size_t threadID, std::size_t eventID) const;
+    
+    /// \brief Returns the number of frames.
+    std::size_t getFrameCount() const {
+        return frameCount;
+    }
+    
+    /// \brief Decodes a frame.
+    ///
+    /// \param frameID The index of the frame. Must be less than getFrameCount()
+    FrameData getFrame(std::size_t frameID) const;
+    
+    /// \brief Returns the index of the first event of a thread that doesn't start 
+    /// before the frame.
+    ///
+    /// \param frameID The index of the frame. Must be less than getFrameCount()
+    /// \param threadID The ID of the thread. Must be less than getThreadCount()
+    std::size_t getFirstEventInFrame(std::size_t frameID, std::size_t threadID) const;
+    
+    /// \brief Copies everything into a new ProfilerResults instance.
+    std::unique_ptr<ProfilerResults> toResults() const;
+private:
+    ProfilerFileView();
+    
+    bool validate();
+    bool decodeEvents();
+    std::string getString(std::uint32_t stringID) const;
+    
+    const unsigned char* data;
+    std::size_t size;
+    
+    /// Platform specific handles of the mapping.
+    void* mapping;
+    void* file;
+    
+    /// Only used if memory mapping isn't available.
+    std::vector<unsigned char> buffer;
+    
+    /// The events of version 3 files, decoded into the fixed size records of version 2.
+    std::vector<unsigned char> decodedEvents;
+    
+    /// The first event of every thread.
+    std::vector<const unsigned char*> eventArrays;
+    
+    std::uint8_t version;
+    std::uint8_t flags;
+    std::size_t eventSize;
+    std::size_t threadSize;
+    
+    std::size_t threadCount;
+    std::size_t stringCount;
+    std::size_t tagCount;
+    std::size_t scopeCount;
+    std::size_t frameCount;
+    std::size_t counterCount;
+    std::size_t flowCount;
+    
+    std::size_t threadTable;
+    std::size_t stringTable;
+    std::size_t tagTable;
+    std::size_t scopeTable;
+    std::size_t frameTable;
+    std::size_t frameIndex;
+    std::size_t counterTable;
+    std::size_t flowTable;
+};
+}
+
+#endif // IYFT_THREAD_PROFILER_CORE_HPP
+
+#if defined IYFT_THREAD_PROFILER_IMPLEMENTATION && !defined IYFT_THREAD_PROFILER_IMPLEMENTATION_INCLUDED
+#define IYFT_THREAD_PROFILER_IMPLEMENTATION_INCLUDED
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <sstream>
+#include <limits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#include <windows.h>
+#endif
+
+#ifdef IYFT_PROFILER_WITH_ZSTD
+#include <zstd.h>
+#endif // IYFT_PROFILER_WITH_ZSTD
+
+namespace iyft {
+
+class ThreadIDAssigner {
+public:
+    ThreadIDAssigner() : counter(0), lastSerial(0) {
+        names.reserve(IYFT_THREAD_PROFILER_MAX_THREAD_COUNT);
+        serials.reserve(IYFT_THREAD_PROFILER_MAX_THREAD_COUNT);
+    }
+    
+    void assignNext(const char* name);
+    
+    /// Called when a thread exits. Makes its ID available to new threads.
+    void release(std::size_t id);
+    
+    inline std::size_t getThreadCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counter;
+    }
+    
+    /// This can be used to retrieve a name for a specific thread.
+    ///
+    /// \param id The id of the thread. Must be less than getThreadCount().
+    inline std::string getThreadName(std::size_t id) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names[id];
+    }
+    
+    /// Checks if the thread that got the provided serial number still owns the ID.
+    inline bool isAlive(std::size_t id, std::uint64_t serial) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (id < counter) && (serials[id] == serial);
+    }
+private:
+    mutable std::mutex mutex;
+    
+    /// One past the largest ID that has ever been assigned.
+    std::size_t counter;
+    
+    /// Every registered thread gets a unique serial number. Unlike IDs, these are
+    /// never reused.
+    std::uint64_t lastSerial;
+    
+    std::vector<std::string> names;
+    
+    /// The serial number of the thread that owns each ID or 0 if the ID is free.
+    std::vector<std::uint64_t> serials;
+    
+    /// A min-heap of released IDs. The smallest one is reused first.
+    std::vector<std::size_t> freeIDs;
+};
+
+static ThreadIDAssigner ThreadIDAssigner;
+
+std::atomic<bool> ProfilerRecordingFlag(false);
+
+const std::size_t emptyID = static_cast<std::size_t>(-1);
+static thread_local std::size_t CurrentThreadID = emptyID;
+static thread_local std::uint64_t CurrentThreadSerial = 0;
+static thread_local std::string CurrentThreadName = "";
+
+/// Releases the ID of the thread when the thread exits.
+struct ThreadIDReleaser {
+    ~ThreadIDReleaser() {
+        if (CurrentThreadID != emptyID) {
+            // The profiler data is indexed by the ID, which is why it's flushed before
+            // another thread can get the ID.
+            ThreadProfiler::RetireCurrentThread();
+            
+            ThreadIDAssigner.release(CurrentThreadID);
+        }
+    }
+};
+
+static thread_local ThreadIDReleaser CurrentThreadIDReleaser;
+
+void ThreadIDAssigner::assignNext(const char* name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    std::size_t id;
+    if (!freeIDs.empty()) {
+        std::pop_heap(freeIDs.begin(), freeIDs.end(), std::greater<std::size_t>());
+        id = freeIDs.back();
+        freeIDs.pop_back();
+    } else {
+        id = counter;
+        counter++;
+        
+        names.emplace_back();
+        serials.push_back(0);
+    }
+    
+    lastSerial++;
+    serials[id] = lastSerial;
+    
+    if (name == nullptr || (std::strlen(name) == 0)) {
+        names[id] = std::string("Thread") + std::to_string(id);
+    } else {
+        names[id] = name;
+    }
+    
+    CurrentThreadID = id;
+    CurrentThreadSerial = lastSerial;
+    CurrentThreadName = names[id];
+    
+    // Odr-using the releaser makes sure that its destructor runs when this thread exits.
+    (void)&CurrentThreadIDReleaser;
+}
+
+void ThreadIDAssigner::release(std::size_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    serials[id] = 0;
+    
+    freeIDs.push_back(id);
+    std::push_heap(freeIDs.begin(), freeIDs.end(), std::greater<std::size_t>());
+}
+
+std::size_t GetCurrentThreadID() {
+    if (CurrentThreadID == emptyID) {
+        ThreadIDAssigner.assignNext(nullptr);
+    }
+    
+    return CurrentThreadID;
+}
+
+const char* GetCurrentThreadName() {
+    if (CurrentThreadID == emptyID) {
+        ThreadIDAssigner.assignNext(nullptr);
+    }
+    
+    return CurrentThreadName.c_str();
+}
+
+std::size_t GetRegisteredThreadCount() {
+    return ThreadIDAssigner.getThreadCount();
+}
+
+bool AssignThreadName(const char* name) {
+    if (CurrentThreadID == emptyID) {
+        ThreadIDAssigner.assignNext(name);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+void MarkNextFrame() {
+    GetThreadProfiler().nextFrame();
+}
+
+ScopeInfo& InsertScopeInfo(const char* scopeName, std::uint32_t hash, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag) {
+    return GetThreadProfiler().insertScopeInfo(scopeName, hash, functionName, fileName, line, tag);
+}
+
+bool InsertScopeStart(const ScopeInfo& info) {
+    return GetThreadProfiler().insertScopeStart(info);
+}
+
+void InsertScopeEnd(const ScopeInfo& info) {
+    GetThreadProfiler().insertScopeEnd(info);
+}
+
+void InsertCounterSample(const ScopeInfo& info, double value) {
+    GetThreadProfiler().insertCounterSample(info, value);
+}
+
+void InsertFlowMarker(const ScopeInfo& info, std::uint64_t id, ProfilerFlowPhase phase) {
+    GetThreadProfiler().insertFlowMarker(info, id, phase);
+}
+
+std::uint64_t NewFlowID() {
+    return GetThreadProfiler().newFlowID();
+}
+
+void SetRecording(bool recording) {
+    GetThreadProfiler().setRecording(recording);
+}
+
+ProfilerStatus GetStatus() {
+    return iyft::GetThreadProfiler().isRecording() ? iyft::ProfilerStatus::EnabledAndRecording : iyft::ProfilerStatus::EnabledAndNotRecording;
+}
+
+ThreadProfiler& GetThreadProfiler() {
+    static ThreadProfiler profiler;
+    return profiler;
+}
+
+thread_local ThreadProfiler::ThreadDataCache ThreadProfiler::CurrentThreadData = {nullptr, nullptr, false};
+
+ThreadProfiler::TickConverter ThreadProfiler::calibrate() const {
+#ifdef IYFT_THREAD_PROFILER_USES_TSC
+    // A short interval would make the rounding errors of both clocks significant.
+    const std::chrono::nanoseconds minimumInterval = std::chrono::milliseconds(10);
+    
+    std::chrono::nanoseconds now = ProfilerClock::now().time_since_epoch();
+    std::uint64_t ticks = GetProfilerTicks();
+    while (now - anchorTime < minimumInterval || ticks == anchorTicks) {
+        std::this_thread::yield();
+        
+        now = ProfilerClock::now().time_since_epoch();
+        ticks = GetProfilerTicks();
+    }
+    
+    const double nanosecondsPerTick = static_cast<double>((now - anchorTime).count()) / static_cast<double>(ticks - anchorTicks);
+    return TickConverter(anchorTime, anchorTicks, nanosecondsPerTick);
+#else // IYFT_THREAD_PROFILER_USES_TSC
+    return TickConverter();
+#endif // IYFT_THREAD_PROFILER_USES_TSC
+}
+
+ProfilerResults ThreadProfiler::getResults() {
+    setRecording(false);
+    
+    return collectResults(true, nullptr);
+}
+
+ProfilerResults ThreadProfiler::getResults(const ProfilerParallelFor& parallelFor) {
+    setRecording(false);
+    
+    return collectResults(true, &parallelFor);
+}
+
+ScopeInfo& ThreadProfiler::insertScopeInfo(const char* scopeName, std::uint32_t hash, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag) {
+    const std::size_t mask = ScopeTableSize - 1;
+    
+    std::uint32_t keyValue = hash;
+    std::unique_ptr<ScopeInfo> candidate;
+    std::uint32_t index = 0;
+    
+    std::size_t slot = keyValue & mask;
+    while (true) {
+        ScopeInfo* existing = scopeTable[slot].load(std::memory_order_acquire);
+        
+        if (existing == nullptr) {
+            if (candidate == nullptr) {
+                index = nextScopeIndex.fetch_add(1, std::memory_order_relaxed);
+                
+                if (index >= IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT) {
+                    throw std::runtime_error("You've created more scopes than allowed.");
+                }
+            }
+            
+            if (candidate == nullptr || candidate->getKey().getValue() != keyValue) {
+                candidate.reset(new ScopeInfo(ScopeKey(keyValue), scopeName, functionName, fileName, line, tag, index));
+            }
+            
+            if (scopeTable[slot].compare_exchange_strong(existing, candidate.get(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                ScopeInfo* inserted = candidate.release();
+                scopesByIndex[index].store(inserted, std::memory_order_release);
+                
+                return *inserted;
+            }
+            
+            // Another thread took the slot. Check what it inserted.
+        }
+        
+        if (existing->getKey().getValue() == keyValue) {
+            if (existing->getLineNumber() == line && existing->getFileName() == fileName && existing->getName() == scopeName) {
+                // If the candidate was created, its index remains unused.
+                return *existing;
+            }
+            
+            // A different scope with the same hash. Retry with the next key.
+            keyValue++;
+            slot = keyValue & mask;
+            continue;
+        }
+        
+        slot = (slot + 1) & mask;
+    }
+}
+
+ThreadProfiler::ThreadData& ThreadProfiler::registerThread() {
+    const std::size_t id = GetCurrentThreadID();
+    
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    
+    if (threads.size() <= id) {
+        threads.resize(id + 1);
+    }
+    
+    std::unique_ptr<ThreadData>& slot = threads[id];
+    
+    // The ID belonged to a thread that has exited. Its events are collected later.
+    if (slot != nullptr && slot->serial != CurrentThreadSerial) {
+        retiredThreads.push_back(std::move(slot));
+    }
+    
+    if (slot == nullptr) {
+        slot.reset(new ThreadData(id, CurrentThreadSerial, CurrentThreadName));
+    }
+    
+    CurrentThreadData.profiler = this;
+    CurrentThreadData.data = slot.get();
+    
+    return *slot;
+}
+
+void ThreadProfiler::drainThread(ThreadData& threadData, const TickConverter& toNanoseconds, std::deque<RecordedEvent>& threadEvents,
+                                 std::deque<CounterSample>& threadCounters, std::deque<FlowEvent>& threadFlows) {
+    std::vector<OpenEvent>& openEvents = threadData.openEvents;
+    
+    // Markers arrive in the order in which the scopes started and ended. Every begin
+    // marker reserves a slot that gets filled by its end marker, which means that
+    // the events end up sorted by their start times without any sorting. Events that
+    // are still open from the previous drain started before everything else.
+    for (OpenEvent& open : openEvents) {
+        open.slot = threadEvents.size();
+        threadEvents.emplace_back(ScopeKey(0), -1, std::chrono::nanoseconds(0));
+    }
+    
+    std::size_t lostEvents = 0;
+    
+    // The first record of a counter sample or a flow marker that waits for its payload.
+    EventRecord header;
+    bool hasHeader = false;
+    
+    threadData.recordedEvents.drain([this, &threadEvents, &threadCounters, &threadFlows, &openEvents, &toNanoseconds, &lostEvents,
+                                     &header, &hasHeader](const EventRecord& e) {
+        if (!e.isScopeMarker()) {
+            if (e.getKind() != RecordKind::Payload) {
+                header = e;
+                hasHeader = true;
+                return;
+            }
+            
+            // A payload without a header is left behind when the header is overwritten.
+            if (!hasHeader) {
+                return;
+            }
+            
+            hasHeader = false;
+            
+            const ScopeInfo* scope = scopesByIndex[header.scope].load(std::memory_order_acquire);
+            IYFT_ASSERT(scope != nullptr);
+            
+            if (header.getKind() == RecordKind::CounterSample) {
+                double value;
+                std::memcpy(&value, &e.ticks, sizeof(value));
+                
+                threadCounters.emplace_back(scope->getKey(), toNanoseconds(header.ticks), value);
+            } else {
+                const ProfilerFlowPhase phase = static_cast<ProfilerFlowPhase>(static_cast<std::uint32_t>(header.getKind()) - static_cast<std::uint32_t>(RecordKind::FlowBegin));
+                
+                threadFlows.emplace_back(scope->getKey(), e.ticks, phase, toNanoseconds(header.ticks));
+            }
+            
+            return;
+        }
+        
+        const std::int32_t depth = e.getDepth();
+        
+        // Markers are lost when a buffer fills up. Open events at the same or
+        // a bigger depth will never be matched.
+        while (!openEvents.empty() && (openEvents.back().begin.getDepth() > depth || (!e.isEnd() && openEvents.back().begin.getDepth() == depth))) {
+            openEvents.pop_back();
+            lostEvents++;
+        }
+        
+        if (!e.isEnd()) {
+            openEvents.push_back(OpenEvent(e, threadEvents.size()));
+            threadEvents.emplace_back(ScopeKey(0), -1, std::chrono::nanoseconds(0));
+            return;
+        }
+        
+        if (openEvents.empty() || openEvents.back().begin.getDepth() != depth || openEvents.back().begin.scope != e.scope) {
+            return;
+        }
+        
+        const OpenEvent& open = openEvents.back();
+        
+        // The scope was registered before its first marker was pushed.
+        const ScopeInfo* scope = scopesByIndex[open.begin.scope].load(std::memory_order_acquire);
+        IYFT_ASSERT(scope != nullptr);
+        
+        RecordedEvent event(scope->getKey(), depth, toNanoseconds(open.begin.ticks));
+        event.setEnd(toNanoseconds(e.ticks));
+#ifdef IYFT_PROFILER_WITH_COOKIE
+        event.setCookie(open.begin.cookie);
+#endif // IYFT_PROFILER_WITH_COOKIE
+        threadEvents[open.slot] = event;
+        
+        openEvents.pop_back();
+    });
+    
+    // Remove the slots of the events that are still open or were lost. The remaining
+    // events keep their order.
+    if (lostEvents != 0 || !openEvents.empty()) {
+        threadEvents.erase(std::remove_if(threadEvents.begin(), threadEvents.end(), [](const RecordedEvent& e) {
+            return e.getDepth() < 0;
+        }), threadEvents.end());
+    }
+}
+
+ThreadProfiler::ExitedThread ThreadProfiler::drainExitedThread(ThreadData& threadData, const TickConverter& toNanoseconds) {
+    ExitedThread exited(threadData.serial, threadData.name);
+    
+    // Events that are still open will never end.
+    drainThread(threadData, toNanoseconds, exited.events, exited.counterSamples, exited.flowEvents);
+    exited.droppedEvents = threadData.recordedEvents.takeDroppedCount();
+    
+    return exited;
+}
+
+void ThreadProfiler::RetireCurrentThread() {
+    ThreadDataCache& cache = CurrentThreadData;
+    
+    ThreadProfiler* profiler = cache.profiler;
+    ThreadData* threadData = cache.data;
+    
+    cache.profiler = nullptr;
+    cache.data = nullptr;
+    cache.exited = true;
+    
+    // Only the default instance is known to outlive the threads that use it. Data of
+    // other instances is retired by collectResults().
+    if (profiler != nullptr && profiler == &GetThreadProfiler()) {
+        profiler->retireThread(*threadData);
+    }
+}
+
+void ThreadProfiler::retireThread(ThreadData& threadData) {
+    std::lock_guard<std::mutex> drainLock(drainMutex);
+    
+    ExitedThread exited = drainExitedThread(threadData, calibrate());
+    if (!exited.isEmpty()) {
+        exitedThreads.push_back(std::move(exited));
+    }
+    
+    std::unique_ptr<ThreadData> destroyed;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        keepLiveHistograms(threadData);
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        
+        if (threadData.id < threads.size() && threads[threadData.id].get() == &threadData) {
+            destroyed = std::move(threads[threadData.id]);
+        } else {
+            auto retired = std::find_if(retiredThreads.begin(), retiredThreads.end(), [&threadData](const std::unique_ptr<ThreadData>& t) {
+                return t.get() == &threadData;
+            });
+            
+            IYFT_ASSERT(retired != retiredThreads.end());
+            destroyed = std::move(*retired);
+            retiredThreads.erase(retired);
+        }
+    }
+}
+
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+void ThreadProfiler::keepLiveHistograms(const ThreadData& threadData) {
+    for (std::uint32_t i = 0; i < IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT; ++i) {
+        const LiveHistogram* histogram = threadData.liveHistograms[i].load(std::memory_order_acquire);
+        if (histogram == nullptr) {
+            continue;
+        }
+        
+        DurationHistogram& kept = exitedThreadHistograms[i];
+        for (std::size_t b = 0; b < DurationHistogram::BucketCount; ++b) {
+            const std::uint64_t count = histogram->counts[b].load(std::memory_order_relaxed);
+            if (count != 0) {
+                kept.record(DurationHistogram::GetBucketLowerBound(b), count);
+            }
+        }
+    }
+}
+
+DurationHistogram ThreadProfiler::getLiveHistogram(ScopeKey key) {
+    DurationHistogram result;
+    
+    const std::uint32_t scopeCount = std::min<std::uint32_t>(nextScopeIndex.load(std::memory_order_acquire), IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT);
+    std::uint32_t index = 0;
+    for (; index < scopeCount; ++index) {
+        const ScopeInfo* scope = scopesByIndex[index].load(std::memory_order_acquire);
+        if (scope != nullptr && scope->getKey() == key) {
+            break;
+        }
+    }
+    
+    if (index == scopeCount) {
+        return result;
+    }
+    
+    // The buckets count ticks. Every bucket is converted separately, which keeps the
+    // error within a bucket.
+    const TickConverter converter = calibrate();
+    auto addBucket = [&result, &converter](std::size_t bucket, std::uint64_t count) {
+        const std::uint64_t lower = DurationHistogram::GetBucketLowerBound(bucket);
+        const std::uint64_t middle = lower + (DurationHistogram::GetBucketUpperBound(bucket) - lower) / 2;
+        result.record(converter.toDuration(middle), count);
+    };
+    
+    auto addThread = [index, &addBucket](const ThreadData& threadData) {
+        const LiveHistogram* histogram = threadData.liveHistograms[index].load(std::memory_order_acquire);
+        if (histogram == nullptr) {
+            return;
+        }
+        
+        for (std::size_t b = 0; b < DurationHistogram::BucketCount; ++b) {
+            const std::uint64_t count = histogram->counts[b].load(std::memory_order_relaxed);
+            if (count != 0) {
+                addBucket(b, count);
+            }
+        }
+    };
+    
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    
+    for (const std::unique_ptr<ThreadData>& t : threads) {
+        if (t != nullptr) {
+            addThread(*t);
+        }
+    }
+    
+    for (const std::unique_ptr<ThreadData>& t : retiredThreads) {
+        addThread(*t);
+    }
+    
+    auto exited = exitedThreadHistograms.find(index);
+    if (exited != exitedThreadHistograms.end()) {
+        for (std::size_t b = 0; b < DurationHistogram::BucketCount; ++b) {
+            const std::uint64_t count = exited->second.getBucketCount(b);
+            if (count != 0) {
+                addBucket(b, count);
+            }
+        }
+    }
+    
+    return result;
+}
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+
+ProfilerResults ThreadProfiler::collectResults(bool allFrames, const ProfilerParallelFor* parallelFor) {
+    std::lock_guard<std::mutex> drainLock(drainMutex);
+    
+    const TickConverter toNanoseconds = calibrate();
+    
+    ProfilerResults results;
+    
+    // Most exited threads were drained when they exited.
+    std::vector<ExitedThread> exited;
+    exited.swap(exitedThreads);
+    
+    // Data of the remaining threads that have exited is drained one last time and
+    // destroyed. ThreadData is only destroyed while drainMutex is locked, which is why
+    // the pointers stay valid while threadsMutex isn't held. Live threads come first,
+    // ordered by their IDs.
+    std::vector<ThreadData*> drained;
+    std::vector<std::unique_ptr<ThreadData>> retired;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        
+        for (std::unique_ptr<ThreadData>& t : threads) {
+            if (t == nullptr) {
+                continue;
+            }
+            
+            if (ThreadIDAssigner.isAlive(t->id, t->serial)) {
+                drained.push_back(t.get());
+            } else {
+                retired.push_back(std::move(t));
+            }
+        }
+        
+        for (std::unique_ptr<ThreadData>& t : retiredThreads) {
+            retired.push_back(std::move(t));
+        }
+        retiredThreads.clear();
+        
+#ifdef IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+        // The threads have exited, which means that their histograms won't change anymore.
+        for (const std::unique_ptr<ThreadData>& t : retired) {
+            keepLiveHistograms(*t);
+        }
+#endif // IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+    }
+    
+    for (const std::unique_ptr<ThreadData>& t : retired) {
+        ExitedThread e = drainExitedThread(*t, toNanoseconds);
+        if (!e.isEmpty()) {
+            exited.push_back(std::move(e));
+        }
+    }
+    retired.clear();
+    
+    // Exited threads are reported in the order in which they were registered.
+    std::sort(exited.begin(), exited.end(), [](const ExitedThread& a, const ExitedThread& b) {
+        return a.serial < b.serial;
+    });
+    
+    const std::size_t threadCount = drained.size();
+    results.events.resize(threadCount);
+    results.counterSamples.resize(threadCount);
+    results.flowEvents.resize(threadCount);
+    results.droppedEvents.resize(threadCount);
+    results.threadNames.resize(threadCount);
+    
+    // The spinlock isn't held while draining. Threads that start frames (e.g., the
+    // workers of a pool that runs this function) can't be blocked.
+    auto drain = [this, &drained, &results, &toNanoseconds](std::size_t i) {
+        drainThread(*drained[i], toNanoseconds, results.events[i], results.counterSamples[i], results.flowEvents[i]);
+        
+        results.droppedEvents[i] = drained[i]->recordedEvents.takeDroppedCount();
+    };
+    
+    if (parallelFor != nullptr && *parallelFor && threadCount > 1) {
+        (*parallelFor)(threadCount, drain);
+    } else {
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            drain(i);
+        }
+    }
+    
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        results.threadNames[i] = drained[i]->name;
+    }
+    
+    // Exited threads that left nothing behind were skipped.
+    for (ExitedThread& e : exited) {
+        results.events.push_back(std::move(e.events));
+        results.counterSamples.push_back(std::move(e.counterSamples));
+        results.flowEvents.push_back(std::move(e.flowEvents));
+        results.droppedEvents.push_back(e.droppedEvents);
+        results.threadNames.push_back(std::move(e.name));
+    }
+    
+    // Every drained event has already registered its scope, which is why the scopes
+    // are copied after draining.
+    const std::size_t scopeCount = std::min<std::size_t>(nextScopeIndex.load(std::memory_order_acquire), IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT);
+    results.scopes.reserve(scopeCount);
+    for (std::size_t i = 0; i < scopeCount; ++i) {
+        const ScopeInfo* scope = scopesByIndex[i].load(std::memory_order_acquire);
+        
+        if (scope != nullptr) {
+            results.scopes.emplace(scope->getKey(), *scope);
+        }
+    }
+    
+    {
+        std::lock_guard<Spinlock> frameLock(frameSpinLock);
+        
+        results.frames.swap(frames);
+        
+        // The running frame stays in place to be completed by nextFrame().
+        if (!allFrames && !results.frames.empty() && !results.frames.back().isComplete()) {
+            frames.push_back(results.frames.back());
+            results.frames.pop_back();
+        }
+    }
+    
+    const std::uint32_t tagStart = static_cast<std::uint32_t>(ProfilerTag::NoTag);
+    const std::uint32_t tagEnd = static_cast<std::uint32_t>(ProfilerTag::COUNT);
+    for (std::uint32_t i = tagStart; i < tagEnd; ++i) {
+        const ProfilerTag tag = static_cast<ProfilerTag>(i);
+        TagNameAndColor nameAndColor(GetTagName(tag), GetTagColor(tag));
+        
+        results.tags.emplace(i, std::move(nameAndColor));
+    }
+    
+    bool hasAnyRecords = false;
+    
+    for (std::size_t i = 0; i < results.events.size(); ++i) {
+        if (!results.events[i].empty() || !results.counterSamples[i].empty() || !results.flowEvents[i].empty()) {
+            hasAnyRecords = true;
+        }
+    }
+    
+    results.anyRecords = hasAnyRecords;
+    
+    const std::size_t frameCount = results.frames.size();
+    if (frameCount == 0 && !hasAnyRecords) {
+        FrameData frame(0, std::chrono::nanoseconds(0));
+        frame.setEnd(std::chrono::nanoseconds(1));
+        results.frames.emplace_back(std::move(frame));
+        
+        results.frameDataMissing = true;
+    } else if (frameCount == 0) {
+        std::chrono::nanoseconds first(std::chrono::nanoseconds::max());
+        std::chrono::nanoseconds last(std::chrono::nanoseconds::min());
+        
+        for (std::size_t i = 0; i < results.events.size(); ++i) {
+            const std::deque<RecordedEvent>& threadEvents = results.events[i];
+            if (!threadEvents.empty()) {
+                first = std::min(first, threadEvents.front().getStart());
+                last = std::max(last, threadEvents.back().getStart());
+            }
+            
+            const std::deque<CounterSample>& threadCounters = results.counterSamples[i];
+            if (!threadCounters.empty()) {
+                first = std::min(first, threadCounters.front().getTime());
+                last = std::max(last, threadCounters.back().getTime());
+            }
+            
+            const std::deque<FlowEvent>& threadFlows = results.flowEvents[i];
+            if (!threadFlows.empty()) {
+                first = std::min(first, threadFlows.front().getTime());
+                last = std::max(last, threadFlows.back().getTime());
+            }
+        }
+        
+        IYFT_ASSERT(first != std::chrono::nanoseconds::max());
+        IYFT_ASSERT(last != std::chrono::nanoseconds::min());
+        
+        FrameData frame(0, first);
+        frame.setEnd(last);
+        results.frames.emplace_back(std::move(frame));
+        
+        results.frameDataMissing = true;
+    } else {
+        FrameData& lastFrame = results.frames.back();
+        
+        if (!lastFrame.isComplete()) {
+            lastFrame.setEnd(ProfilerClock::now().time_since_epoch());
+        }
+        
+        results.frameDataMissing = false;
+    }
+    
+#ifdef IYFT_PROFILER_WITH_COOKIE
+    results.withCookie = true;
+#else // IYFT_PROFILER_WITH_COOKIE
+    results.withCookie = false;
+#endif // IYFT_PROFILER_WITH_COOKIE
+    
+    return results;
+}
+
+bool ThreadProfiler::startStreaming(ProfilerChunkCallback callback, std::chrono::milliseconds interval) {
+    if (!callback) {
+        throw std::logic_error("The chunk callback must not be empty");
+    }
+    
+    if (interval.count() <= 0) {
+        throw std::logic_error("The streaming interval must be positive");
+    }
+    
+    std::lock_guard<std::mutex> lock(streamMutex);
+    
+    if (streaming.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    
+    chunkCallback = std::move(callback);
+    chunkNumber = 0;
+    stopCollector = false;
+    failedChunkCount.store(0, std::memory_order_relaxed);
+    
+    setRecording(true);
+    
+    collector = std::thread(&ThreadProfiler::runCollector, this, interval);
+    streaming.store(true, std::memory_order_release);
+    
+    return true;
+}
+
+bool ThreadProfiler::startStreaming(const std::string& pathPrefix, std::chrono::milliseconds interval, std::size_t maxFileCount) {
+    auto makePath = [pathPrefix](std::uint64_t chunk) {
+        std::stringstream ss;
+        ss << pathPrefix << ".";
+        ss.width(8);
+        ss.fill('0');
+        ss << chunk << ".profres";
+        
+        return ss.str();
+    };
+    
+    return startStreaming([this, makePath, maxFileCount](std::uint64_t chunk, ProfilerResults&& results) {
+        if (!results.writeToFile(makePath(chunk))) {
+            failedChunkCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        if (maxFileCount != 0 && chunk >= maxFileCount) {
+            std::remove(makePath(chunk - maxFileCount).c_str());
+        }
+    }, interval);
+}
+
+void ThreadProfiler::stopStreaming() {
+    std::unique_lock<std::mutex> lock(streamMutex);
+    
+    // Another thread may already be stopping the collector.
+    if (!streaming.load(std::memory_order_relaxed) || stopCollector) {
+        return;
+    }
+    
+    stopCollector = true;
+    lock.unlock();
+    
+    streamCondition.notify_one();
+    collector.join();
+    
+    lock.lock();
+    
+    emitChunk(collectResults(false, nullptr));
+    
+    chunkCallback = nullptr;
+    streaming.store(false, std::memory_order_release);
+}
+
+void ThreadProfiler::runCollector(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(streamMutex);
+    
+    auto nextDrain = std::chrono::steady_clock::now() + interval;
+    while (true) {
+        if (streamCondition.wait_until(lock, nextDrain, [this]{ return stopCollector; })) {
+            return;
+        }
+        
+        nextDrain = std::max(nextDrain + interval, std::chrono::steady_clock::now());
+        
+        // The callback may be slow. Don't make stopStreaming() wait for the lock.
+        lock.unlock();
+        emitChunk(collectResults(false, nullptr));
+        lock.lock();
+    }
+}
+
+void ThreadProfiler::emitChunk(ProfilerResults&& chunk) {
+    if (chunk.isFrameDataMissing() && !chunk.hasAnyRecords()) {
+        return;
+    }
+    
+    chunkCallback(chunkNumber, std::move(chunk));
+    chunkNumber++;
+}
+
+inline static std::uint64_t ReadUInt64(std::istream& is) {
+    std::uint64_t num;
+    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint64_t));
+    return num;
+}
+
+inline static std::uint32_t ReadUInt32(std::istream& is) {
+    std::uint32_t num;
+    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint32_t));
+    return num;
+}
+
+inline static std::int32_t ReadInt32(std::istream& is) {
+    std::int32_t num;
+    is.read(reinterpret_cast<char*>(&num), sizeof(std::int32_t));
+    return num;
+}
+
+inline static std::uint8_t ReadUInt8(std::istream& is) {
+    std::uint8_t num;
+    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint8_t));
+    return num;
+}
+
+inline static std::chrono::nanoseconds ReadNanos(std::istream& is) {
+    std::int64_t num;
+    is.read(reinterpret_cast<char*>(&num), sizeof(std::int64_t));
+    return std::chrono::nanoseconds(num);
+}
+
+inline static std::string ReadString(std::istream& is) {
+    std::uint16_t length;
+    is.read(reinterpret_cast<char*>(&length), sizeof(std::uint16_t));
+    
+    std::string string(length, '\0');
+    is.read(&string[0], length);
+    
+    return string;
+}
+
+std::unique_ptr<ProfilerResults> ProfilerResults::LoadFromFile(const std::string& path) {
+    // Warn about a file with cookies when no cookie support is enabled
+    std::unique_ptr<ProfilerResults> pr(new ProfilerResults());
+    
+    std::ifstream is(path, std::ios::binary);
+    
+    if (!is.is_open()) {
+        return nullptr;
+    }
+    
+    // Magic number
+    if (is.get() != 'I' || is.get() != 'Y' || is.get() != 'F' || is.get() != 'R') {
+        return nullptr;
+    }
+    
+    // Version and some parameters
+    const int version = is.get();
+    if (version == static_cast<int>(ProfilerFileFormat::Version2) || version == static_cast<int>(ProfilerFileFormat::Version3)) {
+        is.close();
+        
+        std::unique_ptr<ProfilerFileView> view = ProfilerFileView::Open(path);
+        return (view != nullptr) ? view->toResults() : nullptr;
+    } else if (version != static_cast<int>(ProfilerFileFormat::Version1)) {
+        return nullptr;
+    }
+    
+    pr->frameDataMissing = is.get();
+    pr->anyRecords = is.get();
+    pr->withCookie = is.get();
+    
+    // Thread names
+    const std::uint64_t threadCount = ReadUInt64(is);
+    pr->threadNames.reserve(threadCount);
+    
+    for (std::uint64_t i = 0; i < threadCount; ++i) {
+        pr->threadNames.push_back(ReadString(is));
+    }
+
+    // Frames
+    const std::uint64_t frameCount = ReadUInt64(is);
+    
+    for (std::uint64_t i = 0; i < frameCount; ++i) {
+        std::uint64_t frameNumber = ReadUInt64(is);
+        std::chrono::nanoseconds start = ReadNanos(is);
+        std::chrono::nanoseconds end = ReadNanos(is);
+        
+        FrameData frame(frameNumber, start);
+        frame.setEnd(end);
+        
+        pr->frames.emplace_back(std::move(frame));
+    }
+    
+    // Tags
+    const std::uint64_t tagCount = ReadUInt64(is);
+    pr->tags.reserve(tagCount);
+    
+    for (std::uint64_t i = 0; i < tagCount; ++i) {
+        std::uint32_t tagID = ReadUInt32(is);
+        IYFT_ASSERT(i == tagID);
+        
+        std::string name = ReadString(is);
+        
+        
+        const std::uint8_t r = ReadUInt8(is);
+        const std::uint8_t g = ReadUInt8(is);
+        const std::uint8_t b = ReadUInt8(is);
+        const std::uint8_t a = ReadUInt8(is);
+        ScopeColor color(r, g, b, a);
+        
+        TagNameAndColor nameAndColor(std::move(name), std::move(color));
+        
+        pr->tags.emplace(tagID, std::move(nameAndColor));
+    }
+    
+    // Scope info
+    const std::uint64_t scopeCount = ReadUInt64(is);
+    pr->scopes.reserve(scopeCount);
+    
+    for (std::uint64_t i = 0; i < scopeCount; ++i) {
+        const ScopeKey key(ReadUInt32(is));
+        
+        const ProfilerTag tag = static_cast<ProfilerTag>(ReadUInt32(is));
+        const std::string name = ReadString(is);
+        const std::string functionName = ReadString(is);
+        const std::string fileName = ReadString(is);
+        const std::uint32_t lineNumber = ReadUInt32(is);
+        
+        ScopeInfo scopeInfo(key, name, functionName, fileName, lineNumber, tag, static_cast<std::uint32_t>(i));
+        pr->scopes.emplace(key, std::move(scopeInfo));
+    }
+    
+    // Events for each thread. Counter samples and flow markers aren't stored.
+    pr->events.resize(threadCount);
+    pr->counterSamples.resize(threadCount);
+    pr->flowEvents.resize(threadCount);
+    for (std::uint64_t i = 0; i < threadCount; ++i) {
+        const std::uint64_t eventCount = ReadUInt64(is);
+        
+        std::deque<RecordedEvent>& threadData = pr->events[i];
+        for (std::uint64_t j = 0; j < eventCount; ++j) {
+            const ScopeKey key(ReadUInt32(is));
+            
+            const std::int32_t depth = ReadInt32(is);
+            const std::chrono::nanoseconds start = ReadNanos(is);
+            const std::chrono::nanoseconds end = ReadNanos(is);
+            
+            RecordedEvent event(key, depth, start);
+            event.setEnd(end);
+#ifdef IYFT_PROFILER_WITH_COOKIE
+            std::uint64_t cookie = 0;
+            if (pr->withCookie) {
+                cookie = ReadUInt64(is);
+            }
+            event.setCookie(cookie);
+#else // IYFT_PROFILER_WITH_COOKIE
+            if (pr->withCookie) {
+                ReadUInt64(is);
+            }
+#endif // IYFT_PROFILER_WITH_COOKIE
+
+            threadData.emplace_back(std::move(event));
+        }
+    }
+    
+    if (!is) {
+        return nullptr;
+    }
+    
+    return pr;
+}
+
+inline static void WriteUInt64(std::ostream& os, std::uint64_t num) {
+    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint64_t));
+}
+
+inline static void WriteUInt32(std::ostream& os, std::uint32_t num) {
+    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint32_t));
+}
+
+inline static void WriteInt32(std::ostream& os, std::int32_t num) {
+    os.write(reinterpret_cast<const char*>(&num), sizeof(std::int32_t));
+}
+
+inline static void WriteUInt8(std::ostream& os, std::uint8_t num) {
+    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint8_t));
+}
+
+inline static void WriteNanos(std::ostream& os, std::chrono::nanoseconds ns) {
+    const std::int64_t time = ns.count();
+    os.write(reinterpret_cast<const char*>(&time), sizeof(std::int64_t));
+}
+
+inline static void WriteString(std::ostream& os, const std::string& string) {
+    const std::uint16_t length = static_cast<std::uint16_t>(string.length());
+    os.write(reinterpret_cast<const char*>(&length), sizeof(std::uint16_t));
+    os.write(string.c_str(), length);
+}
+
+bool ProfilerResults::writeToFile(const std::string& path, ProfilerFileFormat format) const {
+    std::ofstream os(path, std::ios::binary);
+    
+    if (!os.is_open()) {
+        return false;
+    }
+    
+    switch (format) {
+    case ProfilerFileFormat::Version1:
+        return writeVersion1(os);
+    case ProfilerFileFormat::Version2:
+        return writeIndexed(os, false);
+    case ProfilerFileFormat::Version3:
+        return writeIndexed(os, true);
+    }
+    
+    return false;
+}
+
+bool ProfilerResults::writeVersion1(std::ostream& os) const {
+    // Magic number
+    os.put('I');
+    os.put('Y');
+    os.put('F');
+    os.put('R'); // P is used by different files in the IYFEngine
+    
+    // Version and some parameters
+    os.put(1); // Version [1 byte]
+    os.put(frameDataMissing);
+    os.put(anyRecords);
+    os.put(withCookie);
+    
+    IYFT_ASSERT(threadNames.size() == events.size());
+    
+    // Thread names
+    WriteUInt64(os, threadNames.size());
+    for (const std::string& name : threadNames) {
+        WriteString(os, name);
+    }
+
+    // Frames
+    WriteUInt64(os, frames.size());
+    for (const FrameData& frame : frames) {
+        WriteUInt64(os, frame.getNumber());
+        WriteNanos(os, frame.getStart());
+        WriteNanos(os, frame.getEnd());
+    }
+    
+    // Tags
+    WriteUInt64(os, tags.size());
+    for (const auto& t : tags) {
+        WriteUInt32(os, t.first);
+        
+        WriteString(os, t.second.getName());
+        
+        const ScopeColor& c = t.second.getColor();
+        WriteUInt8(os, c.getRed());
+        WriteUInt8(os, c.getGreen());
+        WriteUInt8(os, c.getBlue());
+        WriteUInt8(os, c.getAlpha());
+    }
+    
+    // Scope info
+    WriteUInt64(os, scopes.size());
+    for (const auto& s : scopes) {
+        const auto& scope = s.second;
+        
+        WriteUInt32(os, scope.getKey().getValue());
+        WriteUInt32(os, static_cast<std::uint32_t>(scope.getTag()));
+        WriteString(os, scope.getName());
+        WriteString(os, scope.getFunctionName());
+        WriteString(os, scope.getFileName());
+        WriteUInt32(os, scope.getLineNumber());
+    }
+    
+    // Events for each thread (the number of threads is already known, no need to
+    // write it)
+    for (const std::deque<RecordedEvent>& threadEvents : events) {
+        WriteUInt64(os, threadEvents.size());
+        for (const RecordedEvent& e : threadEvents) {
+            WriteUInt32(os, e.getKey().getValue());
+            WriteInt32(os, e.getDepth());
+            WriteNanos(os, e.getStart());
+            WriteNanos(os, e.getEnd());
+            
+            if (withCookie) {
+#ifdef IYFT_PROFILER_WITH_COOKIE
+                WriteUInt64(os, e.getCookie());
+#else
+                WriteUInt64(os, 0);
+#endif // IYFT_PROFILER_WITH_COOKIE
+            }
+        }
+    }
+    
+    return os.good();
+}
+
+// Version 2 layout. All values are little-endian and all sections start at offsets that
+// are multiples of 8.
+//
+// Header:       "IYFR", u8 version, u8 flags, u16 0, u32 event size, u32 0, u64 footer offset
+// Events:       an array per thread: u32 key, i32 depth, i64 start, i64 end, [u64 cookie]
+// Strings:      u64 offsets[count + 1] (relative to the end of the array), char data
+// Threads:      u32 name, u32 0, u64 event offset, u64 event count, u64 dropped count
+// Tags:         u32 id, u32 name, u8 r, u8 g, u8 b, u8 a
+// Scopes:       u32 key, u32 tag, u32 name, u32 function name, u32 file name, u32 line
+// Frames:       u64 number, i64 start, i64 end
+// Frame index:  u64 first event per frame per thread (frame major)
+// Counters:     u32 thread, u32 key, i64 time, f64 value (sorted by thread)
+// Flows:        u32 thread, u32 key, u32 phase, u32 0, i64 time, u64 id (sorted by thread)
+// Footer:       u64 count and u64 offset of threads, strings, tags, scopes and frames,
+//               u64 frame index offset, [u64 count and u64 offset of counters and flows]
+//
+// The counter and flow tables and their footer entries are only present if the markers
+// flag is set, which keeps the files of older versions of the library readable.
+//
+// Version 3 uses the same layout. The event arrays are replaced with byte streams and
+// every thread entry gets two more fields: u64 stream size and u64 decoded stream size
+// (they're only different if the stream is compressed with zstd). Every event is stored
+// as a sequence of varints:
+//
+//   scope     the index in the scope table + 1 or 0 followed by the raw key
+//   depth     zigzag encoded difference from the previous event
+//   start     zigzag encoded difference from the previous event
+//   duration  zigzag encoded
+//   [cookie]  zigzag encoded difference from the previous event
+static const std::size_t V2HeaderSize = 24;
+static const std::size_t V2FooterSize = 88;
+static const std::size_t V2EventSize = 24;
+static const std::size_t V2CookieEventSize = 32;
+static const std::size_t V2ThreadSize = 32;
+static const std::size_t V3ThreadSize = 48;
+static const std::size_t V2TagSize = 12;
+static const std::size_t V2ScopeSize = 24;
+static const std::size_t V2FrameSize = 24;
+static const std::size_t V2MarkerFooterSize = 120;
+static const std::size_t V2CounterSize = 24;
+static const std::size_t V2FlowSize = 32;
+
+static const std::uint8_t V2FrameDataMissingFlag = 1;
+static const std::uint8_t V2AnyRecordsFlag = 2;
+static const std::uint8_t V2WithCookieFlag = 4;
+static const std::uint8_t V3ZstdFlag = 8;
+static const std::uint8_t V2MarkersFlag = 16;
+
+inline static std::uint64_t ZigZagEncode(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+inline static std::int64_t ZigZagDecode(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+inline static void PutVarint(std::vector<unsigned char>& output, std::uint64_t value) {
+    while (value >= 0x80) {
+        output.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    
+    output.push_back(static_cast<unsigned char>(value));
+}
+
+inline static bool GetVarint(const unsigned char*& cursor, const unsigned char* end, std::uint64_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 64 && cursor != end; shift += 7) {
+        const unsigned char byte = *cursor;
+        ++cursor;
+        
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+inline static void StoreLittleEndian(unsigned char* destination, std::uint64_t value, std::size_t byteCount) {
+    for (std::size_t i = 0; i < byteCount; ++i) {
+        destination[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+inline static std::uint64_t LoadLittleEndian(const unsigned char* source, std::size_t byteCount) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < byteCount; ++i) {
+        value |= static_cast<std::uint64_t>(source[i]) << (8 * i);
+    }
+    
+    return value;
+}
+
+/// \brief Collects the output of writeVersion2() to avoid many small writes.
+class FileWriteBuffer {
+public:
+    explicit FileWriteBuffer(std::ostream& os) : os(os), position(0) {
+        buffer.reserve(Capacity);
+    }
+    
+    inline void putValue(std::uint64_t value, std::size_t byteCount) {
+        unsigned char bytes[8];
+        StoreLittleEndian(bytes, value, byteCount);
+        putBytes(bytes, byteCount);
+    }
+    
+    inline void putBytes(const void* bytes, std::size_t byteCount) {
+        const unsigned char* begin = static_cast<const unsigned char*>(bytes);
+        buffer.insert(buffer.end(), begin, begin + byteCount);
+        position += byteCount;
+        
+        if (buffer.size() >= Capacity) {
+            flush();
+        }
+    }
+    
+    inline void align() {
+        while (position % 8 != 0) {
+            putValue(0, 1);
+        }
+    }
+    
+    inline std::uint64_t getPosition() const {
+        return position;
+    }
+    
+    inline bool flush() {
+        os.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+        
+        return os.good();
+    }
+private:
+    static const std::size_t Capacity = 1024 * 1024;
+    
+    std::ostream& os;
+    std::vector<unsigned char> buffer;
+    std::uint64_t position;
+};
+
+/// \brief Deduplicates the strings of version 2 and 3 files.
+class StringTable {
+public:
+    inline std::uint32_t add(const std::string& string) {
+        auto result = indices.emplace(string, static_cast<std::uint32_t>(strings.size()));
+        if (result.second) {
+            strings.push_back(&result.first->first);
+        }
+        
+        return result.first->second;
+    }
+    
+    inline void write(FileWriteBuffer& writer) const {
+        std::uint64_t offset = 0;
+        writer.putValue(offset, 8);
+        for (const std::string* string : strings) {
+            offset += string->size();
+            writer.putValue(offset, 8);
+        }
+        
+        for (const std::string* string : strings) {
+            writer.putBytes(string->data(), string->size());
+        }
+    }
+    
+    inline std::size_t getCount() const {
+        return strings.size();
+    }
+private:
+    std::unordered_map<std::string, std::uint32_t> indices;
+    std::vector<const std::string*> strings;
+};
+
+bool ProfilerResults::writeIndexed(std::ostream& os, bool compressed) const {
+    IYFT_ASSERT(threadNames.size() == events.size());
+    
+    FileWriteBuffer writer(os);
+    
+#ifdef IYFT_PROFILER_WITH_ZSTD
+    const bool useZstd = compressed;
+#else // IYFT_PROFILER_WITH_ZSTD
+    const bool useZstd = false;
+#endif // IYFT_PROFILER_WITH_ZSTD
+    
+    std::size_t counterCount = 0;
+    std::size_t flowCount = 0;
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        counterCount += counterSamples[i].size();
+        flowCount += flowEvents[i].size();
+    }
+    
+    const bool withMarkers = (counterCount != 0) || (flowCount != 0);
+    
+    const ProfilerFileFormat format = compressed ? ProfilerFileFormat::Version3 : ProfilerFileFormat::Version2;
+    const std::size_t eventSize = withCookie ? V2CookieEventSize : V2EventSize;
+    const std::uint8_t flags = static_cast<std::uint8_t>((frameDataMissing ? V2FrameDataMissingFlag : 0) |
+                                                         (anyRecords ? V2AnyRecordsFlag : 0) |
+                                                         (withCookie ? V2WithCookieFlag : 0) |
+                                                         (useZstd ? V3ZstdFlag : 0) |
+                                                         (withMarkers ? V2MarkersFlag : 0));
+    
+    writer.putBytes("IYFR", 4);
+    writer.putValue(static_cast<std::uint8_t>(format), 1);
+    writer.putValue(flags, 1);
+    writer.putValue(0, 2);
+    writer.putValue(eventSize, 4);
+    writer.putValue(0, 4);
+    writer.putValue(0, 8); // Footer offset, patched at the end
+    
+    // The scope table is written in the iteration order of the map.
+    std::unordered_map<ScopeKey, std::uint64_t> scopeIndices;
+    if (compressed) {
+        scopeIndices.reserve(scopes.size());
+        for (const auto& s : scopes) {
+            scopeIndices.emplace(s.first, scopeIndices.size());
+        }
+    }
+    
+    // Events go first to keep the biggest arrays aligned
+    std::vector<std::uint64_t> eventOffsets;
+    std::vector<std::uint64_t> streamSizes;
+    std::vector<std::uint64_t> decodedStreamSizes;
+    eventOffsets.reserve(events.size());
+    
+    std::vector<unsigned char> stream;
+    for (const std::deque<RecordedEvent>& threadEvents : events) {
+        writer.align();
+        eventOffsets.push_back(writer.getPosition());
+        
+        if (compressed) {
+            stream.clear();
+            
+            std::int64_t lastDepth = 0;
+            std::int64_t lastStart = 0;
+            std::int64_t lastCookie = 0;
+            for (const RecordedEvent& e : threadEvents) {
+                const auto scopeIndex = scopeIndices.find(e.getKey());
+                if (scopeIndex != scopeIndices.end()) {
+                    PutVarint(stream, scopeIndex->second + 1);
+                } else {
+                    PutVarint(stream, 0);
+                    PutVarint(stream, e.getKey().getValue());
+                }
+                
+                PutVarint(stream, ZigZagEncode(e.getDepth() - lastDepth));
+                PutVarint(stream, ZigZagEncode(e.getStart().count() - lastStart));
+                PutVarint(stream, ZigZagEncode(e.getDuration().count()));
+                
+                // Must match the header flag and not the build settings because loaded
+                // results may have been recorded by a different build.
+                if (withCookie) {
+#ifdef IYFT_PROFILER_WITH_COOKIE
+                    const std::int64_t cookie = static_cast<std::int64_t>(e.getCookie());
+#else
+                    const std::int64_t cookie = 0;
+#endif // IYFT_PROFILER_WITH_COOKIE
+                    PutVarint(stream, ZigZagEncode(cookie - lastCookie));
+                    lastCookie = cookie;
+                }
+                
+                lastDepth = e.getDepth();
+                lastStart = e.getStart().count();
+            }
+            
+            decodedStreamSizes.push_back(stream.size());
+            
+#ifdef IYFT_PROFILER_WITH_ZSTD
+            if (!stream.empty()) {
+                std::vector<unsigned char> packed(ZSTD_compressBound(stream.size()));
+                const std::size_t packedSize = ZSTD_compress(packed.data(), packed.size(), stream.data(), stream.size(), 3);
+                if (ZSTD_isError(packedSize)) {
+                    return false;
+                }
+                
+                packed.resize(packedSize);
+                stream.swap(packed);
+            }
+#endif // IYFT_PROFILER_WITH_ZSTD
+            
+            streamSizes.push_back(stream.size());
+            writer.putBytes(stream.data(), stream.size());
+            
+            continue;
+        }
+        
+        for (const RecordedEvent& e : threadEvents) {
+            unsigned char record[V2CookieEventSize] = {};
+            StoreLittleEndian(record, e.getKey().getValue(), 4);
+            StoreLittleEndian(record + 4, static_cast<std::uint32_t>(e.getDepth()), 4);
+            StoreLittleEndian(record + 8, static_cast<std::uint64_t>(e.getStart().count()), 8);
+            StoreLittleEndian(record + 16, static_cast<std::uint64_t>(e.getEnd().count()), 8);
+#ifdef IYFT_PROFILER_WITH_COOKIE
+            StoreLittleEndian(record + 24, e.getCookie(), 8);
+#endif // IYFT_PROFILER_WITH_COOKIE
+            writer.putBytes(record, eventSize);
+        }
+    }
+    
+    StringTable strings;
+    
+    std::vector<std::uint32_t> threadNameIDs;
+    threadNameIDs.reserve(threadNames.size());
+    for (const std::string& name : threadNames) {
+        threadNameIDs.push_back(strings.add(name));
+    }
+    
+    std::vector<std::uint32_t> tagNameIDs;
+    tagNameIDs.reserve(tags.size());
+    for (const auto& t : tags) {
+        tagNameIDs.push_back(strings.add(t.second.getName()));
+    }
+    
+    std::vector<std::uint32_t> scopeStringIDs;
+    scopeStringIDs.reserve(scopes.size() * 3);
+    for (const auto& s : scopes) {
+        scopeStringIDs.push_back(strings.add(s.second.getName()));
+        scopeStringIDs.push_back(strings.add(s.second.getFunctionName()));
+        scopeStringIDs.push_back(strings.add(s.second.getFileName()));
+    }
+    
+    writer.align();
+    const std::uint64_t stringTableOffset = writer.getPosition();
+    strings.write(writer);
+    
+    writer.align();
+    const std::uint64_t threadTableOffset = writer.getPosition();
+    for (std::size_t i = 0; i < events.size(); ++i) {
+        writer.putValue(threadNameIDs[i], 4);
+        writer.putValue(0, 4);
+        writer.putValue(eventOffsets[i], 8);
+        writer.putValue(events[i].size(), 8);
+        writer.putValue(getDroppedEventCount(i), 8);
+        
+        if (compressed) {
+            writer.putValue(streamSizes[i], 8);
+            writer.putValue(decodedStreamSizes[i], 8);
+        }
+    }
+    
+    const std::uint64_t tagTableOffset = writer.getPosition();
+    std::size_t tagNumber = 0;
+    for (const auto& t : tags) {
+        const ScopeColor& c = t.second.getColor();
+        
+        writer.putValue(t.first, 4);
+        writer.putValue(tagNameIDs[tagNumber], 4);
+        writer.putValue(c.getRed(), 1);
+        writer.putValue(c.getGreen(), 1);
+        writer.putValue(c.getBlue(), 1);
+        writer.putValue(c.getAlpha(), 1);
+        
+        tagNumber++;
+    }
+    
+    writer.align();
+    const std::uint64_t scopeTableOffset = writer.getPosition();
+    std::size_t scopeNumber = 0;
+    for (const auto& s : scopes) {
+        const auto& scope = s.second;
+        
+        writer.putValue(scope.getKey().getValue(), 4);
+        writer.putValue(static_cast<std::uint32_t>(scope.getTag()), 4);
+        writer.putValue(scopeStringIDs[scopeNumber * 3], 4);
+        writer.putValue(scopeStringIDs[scopeNumber * 3 + 1], 4);
+        writer.putValue(scopeStringIDs[scopeNumber * 3 + 2], 4);
+        writer.putValue(scope.getLineNumber(), 4);
+        
+        scopeNumber++;
+    }
+    
+    const std::uint64_t frameTableOffset = writer.getPosition();
+    for (const FrameData& frame : frames) {
+        writer.putValue(frame.getNumber(), 8);
+        writer.putValue(static_cast<std::uint64_t>(frame.getStart().count()), 8);
+        writer.putValue(static_cast<std::uint64_t>(frame.getEnd().count()), 8);
+    }
+    
+    const std::uint64_t frameIndexOffset = writer.getPosition();
+    for (const FrameData& frame : frames) {
+        for (const std::deque<RecordedEvent>& threadEvents : events) {
+            const auto first = std::lower_bound(threadEvents.begin(), threadEvents.end(), frame.getStart(), [](const RecordedEvent& e, std::chrono::nanoseconds start) {
+                return e.getStart() < start;
+            });
+            
+            writer.putValue(static_cast<std::uint64_t>(first - threadEvents.begin()), 8);
+        }
+    }
     
-    /// \brief Returns the number of threads that were profiled
-    std::size_t getThreadCount() const {
-        return threadNames.size();
+    const std::uint64_t counterTableOffset = writer.getPosition();
+    for (std::size_t i = 0; i < counterSamples.size(); ++i) {
+        for (const CounterSample& sample : counterSamples[i]) {
+            const double value = sample.getValue();
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            
+            writer.putValue(i, 4);
+            writer.putValue(sample.getKey().getValue(), 4);
+            writer.putValue(static_cast<std::uint64_t>(sample.getTime().count()), 8);
+            writer.putValue(bits, 8);
+        }
     }
     
-    /// \brief Returns the name of a profiled thread
-    ///
-    /// \param threadID The ID of the thread. Must be less than getThreadCount()
-    const std::string& getThreadName(std::size_t threadID) const {
-        return threadNames[threadID];
+    const std::uint64_t flowTableOffset = writer.getPosition();
+    for (std::size_t i = 0; i < flowEvents.size(); ++i) {
+        for (const FlowEvent& flow : flowEvents[i]) {
+            writer.putValue(i, 4);
+            writer.putValue(flow.getKey().getValue(), 4);
+            writer.putValue(static_cast<std::uint32_t>(flow.getPhase()), 4);
+            writer.putValue(0, 4);
+            writer.putValue(static_cast<std::uint64_t>(flow.getTime().count()), 8);
+            writer.putValue(flow.getID(), 8);
+        }
     }
     
-    /// \brief Minimal value that can be passed to drawInImGui()
-    static float GetMinScale() {
-        return 0.2f;
+    const std::uint64_t footerOffset = writer.getPosition();
+    writer.putValue(events.size(), 8);
+    writer.putValue(threadTableOffset, 8);
+    writer.putValue(strings.getCount(), 8);
+    writer.putValue(stringTableOffset, 8);
+    writer.putValue(tags.size(), 8);
+    writer.putValue(tagTableOffset, 8);
+    writer.putValue(scopes.size(), 8);
+    writer.putValue(scopeTableOffset, 8);
+    writer.putValue(frames.size(), 8);
+    writer.putValue(frameTableOffset, 8);
+    writer.putValue(frameIndexOffset, 8);
+    
+    if (withMarkers) {
+        writer.putValue(counterCount, 8);
+        writer.putValue(counterTableOffset, 8);
+        writer.putValue(flowCount, 8);
+        writer.putValue(flowTableOffset, 8);
     }
     
-    /// \brief Maximum value that can be passed to drawInImGui()
-    static float GetMaxScale() {
-        return 15.0f;
+    if (!writer.flush()) {
+        return false;
     }
-private:
-    friend class ThreadProfiler;
     
-    /// The default constructed state isn't valid. It needs to be processed by the
-    /// ThreadProfiler.
-    ProfilerResults() 
-        : frameDataMissing(false), anyRecords(false), withCookie(false) {}
+    unsigned char footerOffsetBytes[8];
+    StoreLittleEndian(footerOffsetBytes, footerOffset, 8);
     
-    std::deque<FrameData> frames;
-    std::unordered_map<ScopeKey, ScopeInfo> scopes;
-    std::unordered_map<std::uint32_t, TagNameAndColor> tags;
-    std::vector<std::deque<RecordedEvent>> events;
-    std::vector<std::string> threadNames;
-    bool frameDataMissing;
-    bool anyRecords;
-    bool withCookie;
+    os.seekp(16);
+    os.write(reinterpret_cast<const char*>(footerOffsetBytes), 8);
     
-#ifdef IYFT_PROFILER_WITH_IMGUI
-    std::unique_ptr<ProfilerResultDrawData> drawData;
-#endif // IYFT_PROFILER_WITH_IMGUI
-}; 
-
-static_assert(std::is_move_assignable<ProfilerResults>::value && std::is_move_constructible<ProfilerResults>::value,
-              "ProfilerResults must be moveable");
+    return os.good();
 }
 
-#endif // IYFT_THREAD_PROFILER_CORE_HPP
-
-#if defined IYFT_THREAD_PROFILER_IMPLEMENTATION && !defined IYFT_THREAD_PROFILER_IMPLEMENTATION_INCLUDED
-#define IYFT_THREAD_PROFILER_IMPLEMENTATION_INCLUDED
-
-#include <chrono>
-#include <mutex>
-#include <stdexcept>
-#include <cstring>
-#include <thread>
-
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
-#include <sstream>
+ProfilerFileView::ProfilerFileView() 
+    : data(nullptr), size(0), mapping(nullptr), file(nullptr), version(0), flags(0), eventSize(0), threadSize(0), threadCount(0), stringCount(0),
+      tagCount(0), scopeCount(0), frameCount(0), counterCount(0), flowCount(0), threadTable(0), stringTable(0), tagTable(0), scopeTable(0),
+      frameTable(0), frameIndex(0), counterTable(0), flowTable(0) {}
 
-namespace iyft {
+ProfilerFileView::~ProfilerFileView() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (mapping != nullptr) {
+        munmap(mapping, size);
+    }
+#elif defined(_WIN32)
+    if (mapping != nullptr) {
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+    }
+    
+    if (file != nullptr) {
+        CloseHandle(file);
+    }
+#endif
+}
 
-class ThreadIDAssigner {
-public:
-    ThreadIDAssigner() : counter(0) {
-        for (std::size_t i = 0; i < IYFT_THREAD_PROFILER_MAX_THREAD_COUNT; ++i) {
-            names[i] = std::string("Thread") + std::to_string(i);
-        }
+std::unique_ptr<ProfilerFileView> ProfilerFileView::Open(const std::string& path) {
+    std::unique_ptr<ProfilerFileView> view(new ProfilerFileView());
+    
+#if defined(__unix__) || defined(__APPLE__)
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor == -1) {
+        return nullptr;
     }
     
-    void assignNext(const char* name);
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size < static_cast<off_t>(V2HeaderSize)) {
+        close(descriptor);
+        return nullptr;
+    }
     
-    inline std::size_t getThreadCount() const {
-        std::lock_guard<std::mutex> lock(mutex);
-        return counter;
+    view->size = static_cast<std::size_t>(status.st_size);
+    void* mapped = mmap(nullptr, view->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    
+    if (mapped == MAP_FAILED) {
+        return nullptr;
     }
     
-    /// This can be used to retrieve a name for a specific thread.
-    ///
-    /// \param id The id of the thread. Must be less than getThreadCount().
-    inline std::string getThreadName(std::size_t id) const {
-        std::lock_guard<std::mutex> lock(mutex);
-        return names[id];
+    view->mapping = mapped;
+    view->data = static_cast<const unsigned char*>(mapped);
+#elif defined(_WIN32)
+    HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        return nullptr;
     }
-private:
-    mutable std::mutex mutex;
-    std::size_t counter;
-    std::array<std::string, IYFT_THREAD_PROFILER_MAX_THREAD_COUNT> names;
-};
-
-static ThreadIDAssigner ThreadIDAssigner;
-
-const std::size_t emptyID = static_cast<std::size_t>(-1);
-static thread_local std::size_t CurrentThreadID = emptyID;
-static thread_local std::string CurrentThreadName = "";
-
-void ThreadIDAssigner::assignNext(const char* name) {
-    std::lock_guard<std::mutex> lock(mutex);
     
-    CurrentThreadID = counter;
+    view->file = fileHandle;
+    
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(V2HeaderSize)) {
+        return nullptr;
+    }
     
-    if (CurrentThreadID >= IYFT_THREAD_PROFILER_MAX_THREAD_COUNT) {
-        throw std::runtime_error("You've created more threads than allowed.");
+    view->size = static_cast<std::size_t>(fileSize.QuadPart);
+    
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        return nullptr;
     }
-    counter++;
     
-    if (name == nullptr || (std::strlen(name) == 0)) {
-        names[CurrentThreadID] = std::string("Thread") + std::to_string(CurrentThreadID);
-    } else {
-        names[CurrentThreadID] = name;
+    view->mapping = mappingHandle;
+    view->data = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    
+    if (view->data == nullptr) {
+        CloseHandle(mappingHandle);
+        view->mapping = nullptr;
+        return nullptr;
+    }
+#else
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    if (!is.is_open()) {
+        return nullptr;
     }
     
-    CurrentThreadName = names[CurrentThreadID];
-}
-
-std::size_t GetCurrentThreadID() {
-    if (CurrentThreadID == emptyID) {
-        ThreadIDAssigner.assignNext(nullptr);
+    view->buffer.resize(static_cast<std::size_t>(is.tellg()));
+    is.seekg(0);
+    is.read(reinterpret_cast<char*>(view->buffer.data()), static_cast<std::streamsize>(view->buffer.size()));
+    
+    if (!is) {
+        return nullptr;
     }
     
-    return CurrentThreadID;
-}
-
-const char* GetCurrentThreadName() {
-    if (CurrentThreadID == emptyID) {
-        ThreadIDAssigner.assignNext(nullptr);
+    view->size = view->buffer.size();
+    view->data = view->buffer.data();
+#endif
+    
+    if (!view->validate()) {
+        return nullptr;
     }
     
-    return CurrentThreadName.c_str();
-}
-
-std::size_t GetRegisteredThreadCount() {
-    return ThreadIDAssigner.getThreadCount();
+    return view;
 }
 
-bool AssignThreadName(const char* name) {
-    if (CurrentThreadID == emptyID) {
-        ThreadIDAssigner.assignNext(name);
-        return true;
-    } else {
+bool ProfilerFileView::validate() {
+    if (size < V2HeaderSize || std::memcmp(data, "IYFR", 4) != 0) {
         return false;
     }
-}
-
-void MarkNextFrame() {
-    GetThreadProfiler().nextFrame();
-}
-
-ScopeInfo& InsertScopeInfo(const char* scopeName, const char* identifier, const char* functionName, const char* fileName, std::uint32_t line, ProfilerTag tag) {
-    return GetThreadProfiler().insertScopeInfo(scopeName, identifier, functionName, fileName, line, tag);
-}
-
-void InsertScopeStart(const ScopeInfo& info) {
-    GetThreadProfiler().insertScopeStart(info);
-}
-
-void InsertScopeEnd(const ScopeInfo& info) {
-    GetThreadProfiler().insertScopeEnd(info);
-}
-
-void SetRecording(bool recording) {
-    GetThreadProfiler().setRecording(recording);
-}
-
-ProfilerStatus GetStatus() {
-    return iyft::GetThreadProfiler().isRecording() ? iyft::ProfilerStatus::EnabledAndRecording : iyft::ProfilerStatus::EnabledAndNotRecording;
-}
-
-ThreadProfiler& GetThreadProfiler() {
-    static ThreadProfiler profiler;
-    return profiler;
-}
+    
+    version = data[4];
+    if (version != static_cast<std::uint8_t>(ProfilerFileFormat::Version2) && version != static_cast<std::uint8_t>(ProfilerFileFormat::Version3)) {
+        return false;
+    }
+    
+    threadSize = (version == static_cast<std::uint8_t>(ProfilerFileFormat::Version3)) ? V3ThreadSize : V2ThreadSize;
+    
+    flags = data[5];
+#ifndef IYFT_PROFILER_WITH_ZSTD
+    if ((flags & V3ZstdFlag) != 0) {
+        return false;
+    }
+#endif // IYFT_PROFILER_WITH_ZSTD
 
-ProfilerResults ThreadProfiler::getResults() {
-    setRecording(false);
+    eventSize = static_cast<std::size_t>(LoadLittleEndian(data + 8, 4));
+    if (eventSize != (((flags & V2WithCookieFlag) != 0) ? V2CookieEventSize : V2EventSize)) {
+        return false;
+    }
     
-    ProfilerResults results;
+    const std::uint64_t footer = LoadLittleEndian(data + 16, 8);
+    if (footer > size || size - footer < (((flags & V2MarkersFlag) != 0) ? V2MarkerFooterSize : V2FooterSize)) {
+        return false;
+    }
     
-    {
-        // Lock to make sure the scope map and the frame deque don't get enabled
-        // while we're extracting their data
-        std::lock_guard<Spinlock> scopeLock(scopeMapSpinLock);
-        std::lock_guard<Spinlock> frameLock(frameSpinLock);
+    // Makes sure that count elements of elementSize bytes starting at offset are within
+    // the file.
+    auto inBounds = [this](std::uint64_t offset, std::uint64_t count, std::uint64_t elementSize) {
+        return offset <= size && count <= (size - offset) / elementSize;
+    };
+    
+    const unsigned char* f = data + footer;
+    const std::uint64_t threads = LoadLittleEndian(f, 8);
+    const std::uint64_t strings = LoadLittleEndian(f + 16, 8);
+    const std::uint64_t tagEntries = LoadLittleEndian(f + 32, 8);
+    const std::uint64_t scopeEntries = LoadLittleEndian(f + 48, 8);
+    const std::uint64_t frameEntries = LoadLittleEndian(f + 64, 8);
+    
+    threadTable = static_cast<std::size_t>(LoadLittleEndian(f + 8, 8));
+    stringTable = static_cast<std::size_t>(LoadLittleEndian(f + 24, 8));
+    tagTable = static_cast<std::size_t>(LoadLittleEndian(f + 40, 8));
+    scopeTable = static_cast<std::size_t>(LoadLittleEndian(f + 56, 8));
+    frameTable = static_cast<std::size_t>(LoadLittleEndian(f + 72, 8));
+    frameIndex = static_cast<std::size_t>(LoadLittleEndian(f + 80, 8));
+    
+    // The counts come from the file. Each one is checked on its own before it's used in
+    // a sum or a product to keep damaged files from causing overflows.
+    if (!inBounds(threadTable, threads, threadSize) || !inBounds(tagTable, tagEntries, V2TagSize) ||
+        !inBounds(scopeTable, scopeEntries, V2ScopeSize) || !inBounds(frameTable, frameEntries, V2FrameSize) ||
+        !inBounds(stringTable, strings, 8) || !inBounds(stringTable, strings + 1, 8)) {
+        return false;
+    }
+    
+    if (threads != 0 && (!inBounds(frameIndex, threads, 8) || !inBounds(frameIndex, frameEntries, threads * 8))) {
+        return false;
+    }
+    
+    if ((flags & V2MarkersFlag) != 0) {
+        const std::uint64_t counterEntries = LoadLittleEndian(f + 88, 8);
+        const std::uint64_t flowEntries = LoadLittleEndian(f + 104, 8);
         
-        results.frames.swap(frames);
-        results.scopes = scopes;
+        counterTable = static_cast<std::size_t>(LoadLittleEndian(f + 96, 8));
+        flowTable = static_cast<std::size_t>(LoadLittleEndian(f + 112, 8));
+        
+        if (!inBounds(counterTable, counterEntries, V2CounterSize) || !inBounds(flowTable, flowEntries, V2FlowSize)) {
+            return false;
+        }
         
-        const std::size_t threadCount = GetRegisteredThreadCount();
-        results.events.resize(threadCount);
-        results.threadNames.resize(threadCount);
+        counterCount = static_cast<std::size_t>(counterEntries);
+        flowCount = static_cast<std::size_t>(flowEntries);
         
-        for (std::size_t i = 0; i < threadCount; ++i) {
-            ThreadData& threadData = threads[i];
-            
-            std::lock_guard<Spinlock> lock(threadData.recordSpinLock);
-            results.events[i].swap(threadData.recordedEvents);
-            results.threadNames[i] = ThreadIDAssigner.getThreadName(i);
+        for (std::size_t i = 0; i < counterCount; ++i) {
+            if (LoadLittleEndian(data + counterTable + i * V2CounterSize, 4) >= threads) {
+                return false;
+            }
+        }
+        
+        for (std::size_t i = 0; i < flowCount; ++i) {
+            const unsigned char* e = data + flowTable + i * V2FlowSize;
+            if (LoadLittleEndian(e, 4) >= threads || LoadLittleEndian(e + 8, 4) > static_cast<std::uint32_t>(ProfilerFlowPhase::End)) {
+                return false;
+            }
         }
     }
     
-    const std::uint32_t tagStart = static_cast<std::uint32_t>(ProfilerTag::NoTag);
-    const std::uint32_t tagEnd = static_cast<std::uint32_t>(ProfilerTag::COUNT);
-    for (std::uint32_t i = tagStart; i < tagEnd; ++i) {
-        const ProfilerTag tag = static_cast<ProfilerTag>(i);
-        TagNameAndColor nameAndColor(GetTagName(tag), GetTagColor(tag));
+    threadCount = static_cast<std::size_t>(threads);
+    stringCount = static_cast<std::size_t>(strings);
+    tagCount = static_cast<std::size_t>(tagEntries);
+    scopeCount = static_cast<std::size_t>(scopeEntries);
+    frameCount = static_cast<std::size_t>(frameEntries);
+    
+    // String offsets must be ascending and point inside the file
+    const std::size_t stringData = stringTable + (stringCount + 1) * 8;
+    std::uint64_t lastOffset = 0;
+    for (std::size_t i = 0; i <= stringCount; ++i) {
+        const std::uint64_t offset = LoadLittleEndian(data + stringTable + i * 8, 8);
+        if (offset < lastOffset || !inBounds(stringData, offset, 1)) {
+            return false;
+        }
         
-        results.tags.emplace(i, std::move(nameAndColor));
+        lastOffset = offset;
     }
     
-    bool hasAnyRecords = false;
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        const unsigned char* t = data + threadTable + i * threadSize;
+        if (LoadLittleEndian(t, 4) >= stringCount) {
+            return false;
+        }
+        
+        if (threadSize == V2ThreadSize) {
+            if (!inBounds(LoadLittleEndian(t + 8, 8), LoadLittleEndian(t + 16, 8), eventSize)) {
+                return false;
+            }
+            
+            eventArrays.push_back(data + LoadLittleEndian(t + 8, 8));
+        } else if (!inBounds(LoadLittleEndian(t + 8, 8), LoadLittleEndian(t + 32, 8), 1)) {
+            return false;
+        }
+    }
     
-    for (const auto& t : results.events) {
-        if (!t.empty()) {
-            hasAnyRecords = true;
+    for (std::size_t i = 0; i < tagCount; ++i) {
+        if (LoadLittleEndian(data + tagTable + i * V2TagSize + 4, 4) >= stringCount) {
+            return false;
         }
     }
     
-    results.anyRecords = hasAnyRecords;
+    for (std::size_t i = 0; i < scopeCount; ++i) {
+        const unsigned char* s = data + scopeTable + i * V2ScopeSize;
+        if (LoadLittleEndian(s + 8, 4) >= stringCount || LoadLittleEndian(s + 12, 4) >= stringCount || LoadLittleEndian(s + 16, 4) >= stringCount) {
+            return false;
+        }
+    }
     
-    const std::size_t frameCount = results.frames.size();
-    if (frameCount == 0 && !hasAnyRecords) {
-        FrameData frame(0, std::chrono::nanoseconds(0));
-        frame.setEnd(std::chrono::nanoseconds(1));
-        results.frames.emplace_back(std::move(frame));
-        
-        results.frameDataMissing = true;
-    } else if (frameCount == 0) {
-        std::chrono::nanoseconds first(std::chrono::nanoseconds::max());
-        std::chrono::nanoseconds last(std::chrono::nanoseconds::min());
+    return (threadSize == V2ThreadSize) || decodeEvents();
+}
+
+bool ProfilerFileView::decodeEvents() {
+    // Each event takes at least 4 bytes
+    std::uint64_t totalEvents = 0;
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        const unsigned char* t = data + threadTable + i * threadSize;
+        const std::uint64_t eventCount = LoadLittleEndian(t + 16, 8);
+        const std::uint64_t streamSize = LoadLittleEndian(t + 32, 8);
+        const std::uint64_t decodedSize = LoadLittleEndian(t + 40, 8);
         
-        for (const auto& t : results.events) {
-            if (!t.empty()) {
-                first = std::min(first, t.front().getStart());
-                last = std::max(last, t.back().getStart());
-            }
+        // Only the stream size has been checked against the file size. Uncompressed
+        // and empty streams must decode to themselves, the decoded size of compressed
+        // ones is checked against the zstd frame header below.
+        if (((flags & V3ZstdFlag) == 0 || streamSize == 0) && decodedSize != streamSize) {
+            return false;
         }
         
-        IYFT_ASSERT(first != std::chrono::nanoseconds::max());
-        IYFT_ASSERT(last != std::chrono::nanoseconds::min());
+        if (eventCount > decodedSize / 4 || eventCount > std::numeric_limits<std::size_t>::max() / eventSize - totalEvents) {
+            return false;
+        }
         
-        FrameData frame(0, first);
-        frame.setEnd(last);
-        results.frames.emplace_back(std::move(frame));
+        totalEvents += eventCount;
+    }
+    
+    decodedEvents.resize(static_cast<std::size_t>(totalEvents) * eventSize);
+    
+    std::vector<unsigned char> unpacked;
+    std::size_t decodedOffset = 0;
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        const unsigned char* t = data + threadTable + i * threadSize;
+        const std::size_t eventCount = static_cast<std::size_t>(LoadLittleEndian(t + 16, 8));
+        const unsigned char* cursor = data + LoadLittleEndian(t + 8, 8);
+        const unsigned char* end = cursor + LoadLittleEndian(t + 32, 8);
         
-        results.frameDataMissing = true;
-    } else {
-        FrameData& lastFrame = results.frames.back();
+#ifdef IYFT_PROFILER_WITH_ZSTD
+        if ((flags & V3ZstdFlag) != 0 && cursor != end) {
+            // The size that's stored in the file must match the one in the zstd frame
+            // header. This keeps damaged files from causing huge allocations.
+            const std::uint64_t unpackedSize = LoadLittleEndian(t + 40, 8);
+            if (unpackedSize > std::numeric_limits<std::size_t>::max() || 
+                ZSTD_getFrameContentSize(cursor, static_cast<std::size_t>(end - cursor)) != unpackedSize) {
+                return false;
+            }
+            
+            unpacked.resize(static_cast<std::size_t>(unpackedSize));
+            const std::size_t result = ZSTD_decompress(unpacked.data(), unpacked.size(), cursor, static_cast<std::size_t>(end - cursor));
+            if (ZSTD_isError(result) || result != unpacked.size()) {
+                return false;
+            }
+            
+            cursor = unpacked.data();
+            end = cursor + unpacked.size();
+        }
+#endif // IYFT_PROFILER_WITH_ZSTD
         
-        if (!lastFrame.isComplete()) {
-            lastFrame.setEnd(ProfilerClock::now().time_since_epoch());
+        std::int64_t depth = 0;
+        std::int64_t start = 0;
+        std::int64_t cookie = 0;
+        for (std::size_t j = 0; j < eventCount; ++j) {
+            std::uint64_t scope, key, depthDelta, startDelta, duration, cookieDelta = 0;
+            if (!GetVarint(cursor, end, scope)) {
+                return false;
+            }
+            
+            if (scope == 0) {
+                if (!GetVarint(cursor, end, key)) {
+                    return false;
+                }
+            } else if (scope <= scopeCount) {
+                key = LoadLittleEndian(data + scopeTable + (scope - 1) * V2ScopeSize, 4);
+            } else {
+                return false;
+            }
+            
+            if (!GetVarint(cursor, end, depthDelta) || !GetVarint(cursor, end, startDelta) || !GetVarint(cursor, end, duration)) {
+                return false;
+            }
+            
+            if ((flags & V2WithCookieFlag) != 0 && !GetVarint(cursor, end, cookieDelta)) {
+                return false;
+            }
+            
+            // Unsigned arithmetic to keep damaged files from causing overflows
+            depth = static_cast<std::int64_t>(static_cast<std::uint64_t>(depth) + static_cast<std::uint64_t>(ZigZagDecode(depthDelta)));
+            start = static_cast<std::int64_t>(static_cast<std::uint64_t>(start) + static_cast<std::uint64_t>(ZigZagDecode(startDelta)));
+            cookie = static_cast<std::int64_t>(static_cast<std::uint64_t>(cookie) + static_cast<std::uint64_t>(ZigZagDecode(cookieDelta)));
+            
+            unsigned char* record = decodedEvents.data() + decodedOffset + j * eventSize;
+            StoreLittleEndian(record, key, 4);
+            StoreLittleEndian(record + 4, static_cast<std::uint64_t>(depth), 4);
+            StoreLittleEndian(record + 8, static_cast<std::uint64_t>(start), 8);
+            StoreLittleEndian(record + 16, static_cast<std::uint64_t>(start) + static_cast<std::uint64_t>(ZigZagDecode(duration)), 8);
+            
+            if (eventSize == V2CookieEventSize) {
+                StoreLittleEndian(record + 24, static_cast<std::uint64_t>(cookie), 8);
+            }
         }
         
-        results.frameDataMissing = false;
-    }
-    
-#ifdef IYFT_PROFILER_WITH_COOKIE
-    results.withCookie = true;
-#else // IYFT_PROFILER_WITH_COOKIE
-    results.withCookie = false;
-#endif // IYFT_PROFILER_WITH_COOKIE
-    
-    // Yeah, prettier and faster ways exist, but this is good enough
-    for (auto& t : results.events) {
-        if (t.size() > 1) {
-            std::sort(t.begin(), t.end());
-        }
+        eventArrays.push_back(decodedEvents.data() + decodedOffset);
+        decodedOffset += eventCount * eventSize;
     }
     
-    return results;
+    return true;
 }
 
-inline static std::uint64_t ReadUInt64(std::istream& is) {
-    std::uint64_t num;
-    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint64_t));
-    return num;
+std::string ProfilerFileView::getString(std::uint32_t stringID) const {
+    const std::size_t stringData = stringTable + (stringCount + 1) * 8;
+    const std::size_t begin = static_cast<std::size_t>(LoadLittleEndian(data + stringTable + stringID * 8, 8));
+    const std::size_t end = static_cast<std::size_t>(LoadLittleEndian(data + stringTable + (stringID + 1) * 8, 8));
+    
+    return std::string(reinterpret_cast<const char*>(data + stringData + begin), end - begin);
 }
 
-inline static std::uint32_t ReadUInt32(std::istream& is) {
-    std::uint32_t num;
-    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint32_t));
-    return num;
+std::string ProfilerFileView::getThreadName(std::size_t threadID) const {
+    return getString(static_cast<std::uint32_t>(LoadLittleEndian(data + threadTable + threadID * threadSize, 4)));
 }
 
-inline static std::int32_t ReadInt32(std::istream& is) {
-    std::int32_t num;
-    is.read(reinterpret_cast<char*>(&num), sizeof(std::int32_t));
-    return num;
+std::uint64_t ProfilerFileView::getDroppedEventCount(std::size_t threadID) const {
+    return LoadLittleEndian(data + threadTable + threadID * threadSize + 24, 8);
 }
 
-inline static std::uint8_t ReadUInt8(std::istream& is) {
-    std::uint8_t num;
-    is.read(reinterpret_cast<char*>(&num), sizeof(std::uint8_t));
-    return num;
+std::size_t ProfilerFileView::getEventCount(std::size_t threadID) const {
+    return static_cast<std::size_t>(LoadLittleEndian(data + threadTable + threadID * threadSize + 16, 8));
 }
 
-inline static std::chrono::nanoseconds ReadNanos(std::istream& is) {
-    std::int64_t num;
-    is.read(reinterpret_cast<char*>(&num), sizeof(std::int64_t));
-    return std::chrono::nanoseconds(num);
+RecordedEvent ProfilerFileView::getEvent(std::size_t threadID, std::size_t eventID) const {
+    const unsigned char* e = eventArrays[threadID] + eventID * eventSize;
+    
+    const ScopeKey key(static_cast<std::uint32_t>(LoadLittleEndian(e, 4)));
+    const std::int32_t depth = static_cast<std::int32_t>(static_cast<std::uint32_t>(LoadLittleEndian(e + 4, 4)));
+    const std::chrono::nanoseconds start(static_cast<std::int64_t>(LoadLittleEndian(e + 8, 8)));
+    const std::chrono::nanoseconds end(static_cast<std::int64_t>(LoadLittleEndian(e + 16, 8)));
+    
+    RecordedEvent event(key, depth, start);
+    event.setEnd(end);
+#ifdef IYFT_PROFILER_WITH_COOKIE
+    event.setCookie(((flags & V2WithCookieFlag) != 0) ? LoadLittleEndian(e + 24, 8) : 0);
+#endif // IYFT_PROFILER_WITH_COOKIE
+    
+    return event;
 }
 
-inline static std::string ReadString(std::istream& is) {
-    std::uint16_t length;
-    is.read(reinterpret_cast<char*>(&length), sizeof(std::uint16_t));
+FrameData ProfilerFileView::getFrame(std::size_t frameID) const {
+    const unsigned char* f = data + frameTable + frameID * V2FrameSize;
     
-    std::string string(length, '\0');
-    is.read(&string[0], length);
+    FrameData frame(LoadLittleEndian(f, 8), std::chrono::nanoseconds(static_cast<std::int64_t>(LoadLittleEndian(f + 8, 8))));
+    frame.setEnd(std::chrono::nanoseconds(static_cast<std::int64_t>(LoadLittleEndian(f + 16, 8))));
     
-    return string;
+    return frame;
 }
 
-std::unique_ptr<ProfilerResults> ProfilerResults::LoadFromFile(const std::string& path) {
-    // Warn about a file with cookies when no cookie support is enabled
+std::size_t ProfilerFileView::getFirstEventInFrame(std::size_t frameID, std::size_t threadID) const {
+    return static_cast<std::size_t>(LoadLittleEndian(data + frameIndex + (frameID * threadCount + threadID) * 8, 8));
+}
+
+std::unique_ptr<ProfilerResults> ProfilerFileView::toResults() const {
     std::unique_ptr<ProfilerResults> pr(new ProfilerResults());
     
-    std::ifstream is(path, std::ios::binary);
+    pr->frameDataMissing = (flags & V2FrameDataMissingFlag) != 0;
+    pr->anyRecords = (flags & V2AnyRecordsFlag) != 0;
+    pr->withCookie = (flags & V2WithCookieFlag) != 0;
     
-    if (!is.is_open()) {
-        return nullptr;
-    }
+    pr->threadNames.reserve(threadCount);
+    pr->droppedEvents.reserve(threadCount);
+    pr->events.resize(threadCount);
+    pr->counterSamples.resize(threadCount);
+    pr->flowEvents.resize(threadCount);
     
-    // Magic number
-    if (is.get() != 'I' || is.get() != 'Y' || is.get() != 'F' || is.get() != 'R') {
-        return nullptr;
+    for (std::size_t i = 0; i < threadCount; ++i) {
+        pr->threadNames.push_back(getThreadName(i));
+        pr->droppedEvents.push_back(getDroppedEventCount(i));
+        
+        std::deque<RecordedEvent>& threadEvents = pr->events[i];
+        const std::size_t eventCount = getEventCount(i);
+        for (std::size_t j = 0; j < eventCount; ++j) {
+            threadEvents.push_back(getEvent(i, j));
+        }
     }
     
-    // Version and some parameters
-    if (is.get() != 1) {
-        return nullptr;
+    for (std::size_t i = 0; i < counterCount; ++i) {
+        const unsigned char* c = data + counterTable + i * V2CounterSize;
+        
+        const std::uint64_t bits = LoadLittleEndian(c + 16, 8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        
+        pr->counterSamples[static_cast<std::size_t>(LoadLittleEndian(c, 4))].emplace_back(ScopeKey(static_cast<std::uint32_t>(LoadLittleEndian(c + 4, 4))),
+                                                                                        std::chrono::nanoseconds(static_cast<std::int64_t>(LoadLittleEndian(c + 8, 8))),
+                                                                                        value);
     }
     
-    pr->frameDataMissing = is.get();
-    pr->anyRecords = is.get();
-    pr->withCookie = is.get();
-    
-    // Thread names
-    const std::uint64_t threadCount = ReadUInt64(is);
-    pr->threadNames.reserve(threadCount);
-    
-    for (std::uint64_t i = 0; i < threadCount; ++i) {
-        pr->threadNames.push_back(ReadString(is));
+    for (std::size_t i = 0; i < flowCount; ++i) {
+        const unsigned char* e = data + flowTable + i * V2FlowSize;
+        
+        pr->flowEvents[static_cast<std::size_t>(LoadLittleEndian(e, 4))].emplace_back(ScopeKey(static_cast<std::uint32_t>(LoadLittleEndian(e + 4, 4))),
+                                                                                    LoadLittleEndian(e + 24, 8),
+                                                                                    static_cast<ProfilerFlowPhase>(LoadLittleEndian(e + 8, 4)),
+                                                                                    std::chrono::nanoseconds(static_cast<std::int64_t>(LoadLittleEndian(e + 16, 8))));
     }
-
-    // Frames
-    const std::uint64_t frameCount = ReadUInt64(is);
     
-    for (std::uint64_t i = 0; i < frameCount; ++i) {
-        std::uint64_t frameNumber = ReadUInt64(is);
-        std::chrono::nanoseconds start = ReadNanos(is);
-        std::chrono::nanoseconds end = ReadNanos(is);
-        
-        FrameData frame(frameNumber, start);
-        frame.setEnd(end);
-        
-        pr->frames.emplace_back(std::move(frame));
+    for (std::size_t i = 0; i < frameCount; ++i) {
+        pr->frames.push_back(getFrame(i));
     }
     
-    // Tags
-    const std::uint64_t tagCount = ReadUInt64(is);
     pr->tags.reserve(tagCount);
-    
-    for (std::uint64_t i = 0; i < tagCount; ++i) {
-        std::uint32_t tagID = ReadUInt32(is);
-        IYFT_ASSERT(i == tagID);
-        
-        std::string name = ReadString(is);
+    for (std::size_t i = 0; i < tagCount; ++i) {
+        const unsigned char* t = data + tagTable + i * V2TagSize;
         
+        const ScopeColor color(t[8], t[9], t[10], t[11]);
+        TagNameAndColor nameAndColor(getString(static_cast<std::uint32_t>(LoadLittleEndian(t + 4, 4))), color);
         
-        const std::uint8_t r = ReadUInt8(is);
-        const std::uint8_t g = ReadUInt8(is);
-        const std::uint8_t b = ReadUInt8(is);
-        const std::uint8_t a = ReadUInt8(is);
-        ScopeColor color(r, g, b, a);
-        
-        TagNameAndColor nameAndColor(std::move(name), std::move(color));
-        
-        pr->tags.emplace(tagID, std::move(nameAndColor));
+        pr->tags.emplace(static_cast<std::uint32_t>(LoadLittleEndian(t, 4)), std::move(nameAndColor));
     }
     
-    // Scope info
-    const std::uint64_t scopeCount = ReadUInt64(is);
     pr->scopes.reserve(scopeCount);
-    
-    for (std::uint64_t i = 0; i < scopeCount; ++i) {
-        const ScopeKey key(ReadUInt32(is));
+    for (std::size_t i = 0; i < scopeCount; ++i) {
+        const unsigned char* s = data + scopeTable + i * V2ScopeSize;
         
-        const ProfilerTag tag = static_cast<ProfilerTag>(ReadUInt32(is));
-        const std::string name = ReadString(is);
-        const std::string functionName = ReadString(is);
-        const std::string fileName = ReadString(is);
-        const std::uint32_t lineNumber = ReadUInt32(is);
+        const ScopeKey key(static_cast<std::uint32_t>(LoadLittleEndian(s, 4)));
+        const ProfilerTag tag = static_cast<ProfilerTag>(LoadLittleEndian(s + 4, 4));
+        const std::string name = getString(static_cast<std::uint32_t>(LoadLittleEndian(s + 8, 4)));
+        const std::string functionName = getString(static_cast<std::uint32_t>(LoadLittleEndian(s + 12, 4)));
+        const std::string fileName = getString(static_cast<std::uint32_t>(LoadLittleEndian(s + 16, 4)));
+        const std::uint32_t lineNumber = static_cast<std::uint32_t>(LoadLittleEndian(s + 20, 4));
         
-        ScopeInfo scopeInfo(key, name, functionName, fileName, lineNumber, tag);
+        ScopeInfo scopeInfo(key, name, functionName, fileName, lineNumber, tag, static_cast<std::uint32_t>(i));
         pr->scopes.emplace(key, std::move(scopeInfo));
     }
     
-    // Events for each thread
-    pr->events.resize(threadCount);
-    for (std::uint64_t i = 0; i < threadCount; ++i) {
-        const std::uint64_t eventCount = ReadUInt64(is);
-        
-        std::deque<RecordedEvent>& threadData = pr->events[i];
-        for (std::uint64_t j = 0; j < eventCount; ++j) {
-            const ScopeKey key(ReadUInt32(is));
-            
-            const std::int32_t depth = ReadInt32(is);
-            const std::chrono::nanoseconds start = ReadNanos(is);
-            const std::chrono::nanoseconds end = ReadNanos(is);
-            
-            RecordedEvent event(key, depth, start);
-            event.setEnd(end);
-#ifdef IYFT_PROFILER_WITH_COOKIE
-            const std::uint64_t cookie = 0;
-            if (pr->withCookie) {
-                cookie = ReadUInt64(is);
-            }
-            event.setCookie(cookie);
-#else // IYFT_PROFILER_WITH_COOKIE
-            if (pr->withCookie) {
-                ReadUInt64(is);
-            }
-#endif // IYFT_PROFILER_WITH_COOKIE
+    return pr;
+}
 
-            threadData.emplace_back(std::move(event));
-        }
+/// \brief Returns the name and the tag name of the scope of an event.
+inline static std::pair<const std::string*, const std::string*> GetEventNames(const ProfilerResults& results, ScopeKey key) {
+    static const std::string unknown = "Unknown";
+    
+    const auto& scopes = results.getScopes();
+    const auto scope = scopes.find(key);
+    if (scope == scopes.end()) {
+        return std::make_pair(&unknown, &unknown);
     }
     
-    return pr;
+    const auto& tags = results.getTags();
+    const auto tag = tags.find(static_cast<std::uint32_t>(scope->second.getTag()));
+    
+    return std::make_pair(&scope->second.getName(), (tag != tags.end()) ? &tag->second.getName() : &unknown);
 }
 
-inline static void WriteUInt64(std::ostream& os, std::uint64_t num) {
-    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint64_t));
+inline static void PutJSONString(FileWriteBuffer& writer, const std::string& string) {
+    static const char hex[] = "0123456789abcdef";
+    
+    writer.putBytes("\"", 1);
+    for (const char c : string) {
+        const unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            const char escaped[2] = {'\\', c};
+            writer.putBytes(escaped, 2);
+        } else if (u < 0x20) {
+            const char escaped[6] = {'\\', 'u', '0', '0', hex[u >> 4], hex[u & 0xF]};
+            writer.putBytes(escaped, 6);
+        } else {
+            writer.putBytes(&c, 1);
+        }
+    }
+    writer.putBytes("\"", 1);
 }
 
-inline static void WriteUInt32(std::ostream& os, std::uint32_t num) {
-    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint32_t));
+inline static void PutJSONText(FileWriteBuffer& writer, const char* text) {
+    writer.putBytes(text, std::strlen(text));
 }
 
-inline static void WriteInt32(std::ostream& os, std::int32_t num) {
-    os.write(reinterpret_cast<const char*>(&num), sizeof(std::int32_t));
+inline static void PutJSONNumber(FileWriteBuffer& writer, std::uint64_t number) {
+    char digits[20];
+    std::size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count] = static_cast<char>('0' + number % 10);
+        number /= 10;
+        count++;
+    } while (number != 0);
+    
+    writer.putBytes(digits + sizeof(digits) - count, count);
 }
 
-inline static void WriteUInt8(std::ostream& os, std::uint8_t num) {
-    os.write(reinterpret_cast<const char*>(&num), sizeof(std::uint8_t));
+/// \brief Writes a double. JSON can't represent infinities and NaNs, which is why
+/// they're written as 0.
+inline static void PutJSONDouble(FileWriteBuffer& writer, double number) {
+    if (!std::isfinite(number)) {
+        PutJSONText(writer, "0");
+        return;
+    }
+    
+    char digits[32];
+    const int count = std::snprintf(digits, sizeof(digits), "%.17g", number);
+    writer.putBytes(digits, static_cast<std::size_t>(count));
 }
 
-inline static void WriteNanos(std::ostream& os, std::chrono::nanoseconds ns) {
-    const std::int64_t time = ns.count();
-    os.write(reinterpret_cast<const char*>(&time), sizeof(std::int64_t));
+/// \brief Writes nanoseconds as microseconds with 3 decimal places.
+inline static void PutJSONMicroseconds(FileWriteBuffer& writer, std::chrono::nanoseconds time) {
+    const std::uint64_t nanoseconds = static_cast<std::uint64_t>(std::max(time.count(), static_cast<std::chrono::nanoseconds::rep>(0)));
+    const std::uint64_t fraction = nanoseconds % 1000;
+    
+    PutJSONNumber(writer, nanoseconds / 1000);
+    
+    const char decimals[4] = {'.', static_cast<char>('0' + fraction / 100), static_cast<char>('0' + fraction / 10 % 10), static_cast<char>('0' + fraction % 10)};
+    writer.putBytes(decimals, 4);
 }
 
-inline static void WriteString(std::ostream& os, const std::string& string) {
-    const std::uint16_t length = static_cast<std::uint16_t>(string.length());
-    os.write(reinterpret_cast<const char*>(&length), sizeof(std::uint16_t));
-    os.write(string.c_str(), length);
+static bool ExportChromeJSON(const ProfilerResults& results, FileWriteBuffer& writer) {
+    // All timestamps are relative to the earliest frame or event to keep them short.
+    std::chrono::nanoseconds base = std::chrono::nanoseconds::max();
+    if (!results.getFrames().empty()) {
+        base = results.getFrames().front().getStart();
+    }
+    
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        if (!results.getEvents(i).empty()) {
+            base = std::min(base, results.getEvents(i).front().getStart());
+        }
+        
+        if (!results.getCounterSamples(i).empty()) {
+            base = std::min(base, results.getCounterSamples(i).front().getTime());
+        }
+        
+        if (!results.getFlowEvents(i).empty()) {
+            base = std::min(base, results.getFlowEvents(i).front().getTime());
+        }
+    }
+    
+    PutJSONText(writer, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    PutJSONText(writer, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"IYFThreading\"}}");
+    
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        PutJSONText(writer, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+        PutJSONNumber(writer, i);
+        PutJSONText(writer, ",\"args\":{\"name\":");
+        PutJSONString(writer, results.getThreadName(i));
+        PutJSONText(writer, "}}");
+    }
+    
+    for (const FrameData& frame : results.getFrames()) {
+        PutJSONText(writer, ",\n{\"name\":\"Frame\",\"ph\":\"C\",\"pid\":1,\"ts\":");
+        PutJSONMicroseconds(writer, frame.getStart() - base);
+        PutJSONText(writer, ",\"args\":{\"number\":");
+        PutJSONNumber(writer, frame.getNumber());
+        PutJSONText(writer, "}}");
+    }
+    
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        for (const RecordedEvent& e : results.getEvents(i)) {
+            const auto names = GetEventNames(results, e.getKey());
+            
+            PutJSONText(writer, ",\n{\"name\":");
+            PutJSONString(writer, *names.first);
+            PutJSONText(writer, ",\"cat\":");
+            PutJSONString(writer, *names.second);
+            PutJSONText(writer, ",\"ph\":\"X\",\"pid\":1,\"tid\":");
+            PutJSONNumber(writer, i);
+            PutJSONText(writer, ",\"ts\":");
+            PutJSONMicroseconds(writer, e.getStart() - base);
+            PutJSONText(writer, ",\"dur\":");
+            PutJSONMicroseconds(writer, e.getDuration());
+            PutJSONText(writer, "}");
+        }
+        
+        // Counters are process wide. Samples of different threads share a track.
+        for (const CounterSample& c : results.getCounterSamples(i)) {
+            PutJSONText(writer, ",\n{\"name\":");
+            PutJSONString(writer, *GetEventNames(results, c.getKey()).first);
+            PutJSONText(writer, ",\"ph\":\"C\",\"pid\":1,\"tid\":");
+            PutJSONNumber(writer, i);
+            PutJSONText(writer, ",\"ts\":");
+            PutJSONMicroseconds(writer, c.getTime() - base);
+            PutJSONText(writer, ",\"args\":{\"value\":");
+            PutJSONDouble(writer, c.getValue());
+            PutJSONText(writer, "}}");
+        }
+        
+        // Flow markers bind to the enclosing slices. The IDs are written as strings
+        // because JSON numbers can't hold all 64 bit values.
+        for (const FlowEvent& f : results.getFlowEvents(i)) {
+            static const char* phases[] = {"s", "t", "f"};
+            const auto names = GetEventNames(results, f.getKey());
+            
+            PutJSONText(writer, ",\n{\"name\":");
+            PutJSONString(writer, *names.first);
+            PutJSONText(writer, ",\"cat\":");
+            PutJSONString(writer, *names.second);
+            PutJSONText(writer, ",\"ph\":\"");
+            PutJSONText(writer, phases[static_cast<std::size_t>(f.getPhase())]);
+            PutJSONText(writer, (f.getPhase() == ProfilerFlowPhase::End) ? "\",\"bp\":\"e\",\"id\":\"" : "\",\"id\":\"");
+            PutJSONNumber(writer, f.getID());
+            PutJSONText(writer, "\",\"pid\":1,\"tid\":");
+            PutJSONNumber(writer, i);
+            PutJSONText(writer, ",\"ts\":");
+            PutJSONMicroseconds(writer, f.getTime() - base);
+            PutJSONText(writer, "}");
+        }
+    }
+    
+    PutJSONText(writer, "\n]}\n");
+    
+    return writer.flush();
 }
 
-bool ProfilerResults::writeToFile(const std::string& path) const {
-    std::ofstream os(path, std::ios::binary);
+// Field numbers and values from Perfetto's protos/perfetto/trace
+static const std::uint32_t PerfettoTracePacketField = 1;
+static const std::uint32_t PerfettoTimestampField = 8;
+static const std::uint32_t PerfettoSequenceIDField = 10;
+static const std::uint32_t PerfettoTrackEventField = 11;
+static const std::uint32_t PerfettoTrackDescriptorField = 60;
+
+static const std::uint32_t PerfettoEventTypeField = 9;
+static const std::uint32_t PerfettoEventTrackField = 11;
+static const std::uint32_t PerfettoEventNameField = 23;
+static const std::uint32_t PerfettoCounterValueField = 30;
+static const std::uint32_t PerfettoDoubleCounterValueField = 44;
+static const std::uint32_t PerfettoFlowIDsField = 47;
+static const std::uint32_t PerfettoTerminatingFlowIDsField = 48;
+
+static const std::uint32_t PerfettoTrackUUIDField = 1;
+static const std::uint32_t PerfettoTrackNameField = 2;
+static const std::uint32_t PerfettoTrackProcessField = 3;
+static const std::uint32_t PerfettoTrackThreadField = 4;
+static const std::uint32_t PerfettoTrackCounterField = 8;
+
+static const std::uint32_t PerfettoPIDField = 1;
+static const std::uint32_t PerfettoTIDField = 2;
+static const std::uint32_t PerfettoThreadNameField = 5;
+static const std::uint32_t PerfettoProcessNameField = 6;
+
+static const std::uint64_t PerfettoSliceBegin = 1;
+static const std::uint64_t PerfettoSliceEnd = 2;
+static const std::uint64_t PerfettoInstant = 3;
+static const std::uint64_t PerfettoCounter = 4;
+
+static const std::uint64_t PerfettoProcessUUID = 1;
+static const std::uint64_t PerfettoFrameTrackUUID = 2;
+static const std::uint64_t PerfettoFirstThreadUUID = 16;
+
+/// \brief Builds protobuf messages.
+class ProtoMessage {
+public:
+    inline ProtoMessage& putVarint(std::uint32_t field, std::uint64_t value) {
+        PutVarint(bytes, static_cast<std::uint64_t>(field) << 3);
+        PutVarint(bytes, value);
+        return *this;
+    }
     
-    if (!os.is_open()) {
-        return false;
+    inline ProtoMessage& putFixed64(std::uint32_t field, std::uint64_t value) {
+        PutVarint(bytes, (static_cast<std::uint64_t>(field) << 3) | 1);
+        for (std::size_t i = 0; i < 8; ++i) {
+            bytes.push_back(static_cast<unsigned char>(value >> (8 * i)));
+        }
+        return *this;
     }
     
-    // Magic number
-    os.put('I');
-    os.put('Y');
-    os.put('F');
-    os.put('R'); // P is used by different files in the IYFEngine
+    inline ProtoMessage& putDouble(std::uint32_t field, double value) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return putFixed64(field, bits);
+    }
     
-    // Version and some parameters
-    os.put(1); // Version [1 byte]
-    os.put(frameDataMissing);
-    os.put(anyRecords);
-    os.put(withCookie);
+    inline ProtoMessage& putBytes(std::uint32_t field, const void* data, std::size_t size) {
+        PutVarint(bytes, (static_cast<std::uint64_t>(field) << 3) | 2);
+        PutVarint(bytes, size);
+        
+        const unsigned char* begin = static_cast<const unsigned char*>(data);
+        bytes.insert(bytes.end(), begin, begin + size);
+        return *this;
+    }
     
-    IYFT_ASSERT(threadNames.size() == events.size());
+    inline ProtoMessage& putString(std::uint32_t field, const std::string& string) {
+        return putBytes(field, string.data(), string.size());
+    }
     
-    // Thread names
-    WriteUInt64(os, threadNames.size());
-    for (const std::string& name : threadNames) {
-        WriteString(os, name);
+    inline ProtoMessage& putMessage(std::uint32_t field, const ProtoMessage& message) {
+        return putBytes(field, message.bytes.data(), message.bytes.size());
+    }
+    
+    inline void clear() {
+        bytes.clear();
+    }
+    
+    /// \brief Writes this message as a packet of a Trace message.
+    inline void writePacket(FileWriteBuffer& writer) {
+        std::vector<unsigned char> header;
+        PutVarint(header, (static_cast<std::uint64_t>(PerfettoTracePacketField) << 3) | 2);
+        PutVarint(header, bytes.size());
+        
+        writer.putBytes(header.data(), header.size());
+        writer.putBytes(bytes.data(), bytes.size());
     }
+private:
+    std::vector<unsigned char> bytes;
+};
 
-    // Frames
-    WriteUInt64(os, frames.size());
-    for (const FrameData& frame : frames) {
-        WriteUInt64(os, frame.getNumber());
-        WriteNanos(os, frame.getStart());
-        WriteNanos(os, frame.getEnd());
+static bool ExportPerfetto(const ProfilerResults& results, FileWriteBuffer& writer) {
+    const std::uint64_t sequenceID = 1;
+    ProtoMessage packet;
+    
+    packet.putVarint(PerfettoSequenceIDField, sequenceID)
+          .putMessage(PerfettoTrackDescriptorField, ProtoMessage()
+              .putVarint(PerfettoTrackUUIDField, PerfettoProcessUUID)
+              .putMessage(PerfettoTrackProcessField, ProtoMessage()
+                  .putVarint(PerfettoPIDField, 1)
+                  .putString(PerfettoProcessNameField, "IYFThreading")));
+    packet.writePacket(writer);
+    packet.clear();
+    
+    packet.putVarint(PerfettoSequenceIDField, sequenceID)
+          .putMessage(PerfettoTrackDescriptorField, ProtoMessage()
+              .putVarint(PerfettoTrackUUIDField, PerfettoFrameTrackUUID)
+              .putString(PerfettoTrackNameField, "Frame")
+              .putMessage(PerfettoTrackCounterField, ProtoMessage()));
+    packet.writePacket(writer);
+    packet.clear();
+    
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        packet.putVarint(PerfettoSequenceIDField, sequenceID)
+              .putMessage(PerfettoTrackDescriptorField, ProtoMessage()
+                  .putVarint(PerfettoTrackUUIDField, PerfettoFirstThreadUUID + i)
+                  .putMessage(PerfettoTrackThreadField, ProtoMessage()
+                      .putVarint(PerfettoPIDField, 1)
+                      .putVarint(PerfettoTIDField, i + 1)
+                      .putString(PerfettoThreadNameField, results.getThreadName(i))));
+        packet.writePacket(writer);
+        packet.clear();
+    }
+    
+    // Every counter gets its own track. The tracks follow the ones of the threads.
+    std::unordered_map<ScopeKey, std::uint64_t> counterTracks;
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        for (const CounterSample& c : results.getCounterSamples(i)) {
+            const std::uint64_t track = PerfettoFirstThreadUUID + results.getThreadCount() + counterTracks.size();
+            if (!counterTracks.emplace(c.getKey(), track).second) {
+                continue;
+            }
+            
+            packet.putVarint(PerfettoSequenceIDField, sequenceID)
+                  .putMessage(PerfettoTrackDescriptorField, ProtoMessage()
+                      .putVarint(PerfettoTrackUUIDField, track)
+                      .putString(PerfettoTrackNameField, *GetEventNames(results, c.getKey()).first)
+                      .putMessage(PerfettoTrackCounterField, ProtoMessage()));
+            packet.writePacket(writer);
+            packet.clear();
+        }
+    }
+    
+    for (const FrameData& frame : results.getFrames()) {
+        packet.putVarint(PerfettoTimestampField, static_cast<std::uint64_t>(frame.getStart().count()))
+              .putVarint(PerfettoSequenceIDField, sequenceID)
+              .putMessage(PerfettoTrackEventField, ProtoMessage()
+                  .putVarint(PerfettoEventTypeField, PerfettoCounter)
+                  .putVarint(PerfettoEventTrackField, PerfettoFrameTrackUUID)
+                  .putVarint(PerfettoCounterValueField, frame.getNumber()));
+        packet.writePacket(writer);
+        packet.clear();
     }
     
-    // Tags
-    WriteUInt64(os, tags.size());
-    for (const auto& t : tags) {
-        WriteUInt32(os, t.first);
+    auto writeSlice = [&packet, &writer, sequenceID](std::uint64_t type, std::uint64_t track, std::chrono::nanoseconds time, const std::string* name) {
+        ProtoMessage event;
+        event.putVarint(PerfettoEventTypeField, type)
+             .putVarint(PerfettoEventTrackField, track);
+        
+        if (name != nullptr) {
+            event.putString(PerfettoEventNameField, *name);
+        }
+        
+        packet.putVarint(PerfettoTimestampField, static_cast<std::uint64_t>(time.count()))
+              .putVarint(PerfettoSequenceIDField, sequenceID)
+              .putMessage(PerfettoTrackEventField, event);
+        packet.writePacket(writer);
+        packet.clear();
+    };
+    
+    // Events are sorted by their start times. A stack turns them into properly nested
+    // begin and end pairs.
+    std::vector<std::chrono::nanoseconds> openEnds;
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        const std::uint64_t track = PerfettoFirstThreadUUID + i;
         
-        WriteString(os, t.second.getName());
+        for (const RecordedEvent& e : results.getEvents(i)) {
+            while (!openEnds.empty() && !(e.getStart() < openEnds.back())) {
+                writeSlice(PerfettoSliceEnd, track, openEnds.back(), nullptr);
+                openEnds.pop_back();
+            }
+            
+            writeSlice(PerfettoSliceBegin, track, e.getStart(), GetEventNames(results, e.getKey()).first);
+            openEnds.push_back(e.getEnd());
+        }
         
-        const ScopeColor& c = t.second.getColor();
-        WriteUInt8(os, c.getRed());
-        WriteUInt8(os, c.getGreen());
-        WriteUInt8(os, c.getBlue());
-        WriteUInt8(os, c.getAlpha());
+        while (!openEnds.empty()) {
+            writeSlice(PerfettoSliceEnd, track, openEnds.back(), nullptr);
+            openEnds.pop_back();
+        }
+        
+        for (const CounterSample& c : results.getCounterSamples(i)) {
+            packet.putVarint(PerfettoTimestampField, static_cast<std::uint64_t>(c.getTime().count()))
+                  .putVarint(PerfettoSequenceIDField, sequenceID)
+                  .putMessage(PerfettoTrackEventField, ProtoMessage()
+                      .putVarint(PerfettoEventTypeField, PerfettoCounter)
+                      .putVarint(PerfettoEventTrackField, counterTracks[c.getKey()])
+                      .putDouble(PerfettoDoubleCounterValueField, c.getValue()));
+            packet.writePacket(writer);
+            packet.clear();
+        }
+        
+        // Flow markers become instant events that carry the flow IDs. The trace
+        // processor sorts everything by time.
+        for (const FlowEvent& f : results.getFlowEvents(i)) {
+            const bool terminating = (f.getPhase() == ProfilerFlowPhase::End);
+            
+            packet.putVarint(PerfettoTimestampField, static_cast<std::uint64_t>(f.getTime().count()))
+                  .putVarint(PerfettoSequenceIDField, sequenceID)
+                  .putMessage(PerfettoTrackEventField, ProtoMessage()
+                      .putVarint(PerfettoEventTypeField, PerfettoInstant)
+                      .putVarint(PerfettoEventTrackField, track)
+                      .putString(PerfettoEventNameField, *GetEventNames(results, f.getKey()).first)
+                      .putFixed64(terminating ? PerfettoTerminatingFlowIDsField : PerfettoFlowIDsField, f.getID()));
+            packet.writePacket(writer);
+            packet.clear();
+        }
     }
     
-    // Scope info
-    WriteUInt64(os, scopes.size());
-    for (const auto& s : scopes) {
-        const auto& scope = s.second;
-        
-        WriteUInt32(os, scope.getKey().getValue());
-        WriteUInt32(os, static_cast<std::uint32_t>(scope.getTag()));
-        WriteString(os, scope.getName());
-        WriteString(os, scope.getFunctionName());
-        WriteString(os, scope.getFileName());
-        WriteUInt32(os, scope.getLineNumber());
+    return writer.flush();
+}
+
+bool ProfilerResults::exportToStream(std::ostream& os, ProfilerExportFormat format) const {
+    FileWriteBuffer writer(os);
+    
+    switch (format) {
+    case ProfilerExportFormat::ChromeJSON:
+        return ExportChromeJSON(*this, writer);
+    case ProfilerExportFormat::Perfetto:
+        return ExportPerfetto(*this, writer);
     }
     
-    // Events for each thread (the number of threads is already known, no need to
-    // write it)
-    for (const std::deque<RecordedEvent>& threadEvents : events) {
-        WriteUInt64(os, threadEvents.size());
-        for (const RecordedEvent& e : threadEvents) {
-            WriteUInt32(os, e.getKey().getValue());
-            WriteInt32(os, e.getDepth());
-            WriteNanos(os, e.getStart());
-            WriteNanos(os, e.getEnd());
-#ifdef IYFT_PROFILER_WITH_COOKIE
-            WriteUInt64(e.getCookie());
-#endif // IYFT_PROFILER_WITH_COOKIE
-        }
+    return false;
+}
+
+bool ProfilerResults::exportToFile(const std::string& path, ProfilerExportFormat format) const {
+    std::ofstream os(path, std::ios::binary);
+    
+    if (!os.is_open()) {
+        return false;
     }
     
-    return true;
+    return exportToStream(os, format);
 }
 
 static void writeFrameData(std::stringstream& ss, const FrameData& frame) {
@@ -1485,6 +4589,77 @@ static void writeFrameData(std::stringstream& ss, const FrameData& frame) {
        << "; Duration: " << duration.count() << IYFT_THREAD_TEXT_OUTPUT_NAME "\n";
 }
 
+std::unordered_map<ScopeKey, DurationHistogram> ProfilerResults::computeScopeHistograms(std::size_t threadID) const {
+    std::unordered_map<ScopeKey, DurationHistogram> histograms;
+    
+    const std::size_t first = (threadID < events.size()) ? threadID : 0;
+    const std::size_t last = (threadID < events.size()) ? (threadID + 1) : events.size();
+    for (std::size_t i = first; i < last; ++i) {
+        for (const RecordedEvent& e : events[i]) {
+            histograms[e.getKey()].record(e.getDuration());
+        }
+    }
+    
+    return histograms;
+}
+
+std::unordered_map<ScopeKey, FlowLatencyHistograms> ProfilerResults::computeFlowHistograms() const {
+    struct FlowTimes {
+        FlowTimes() : key(0), begin(0), firstStep(0), end(0), hasBegin(false), hasStep(false), hasEnd(false) {}
+        
+        ScopeKey key;
+        std::chrono::nanoseconds begin;
+        std::chrono::nanoseconds firstStep;
+        std::chrono::nanoseconds end;
+        bool hasBegin;
+        bool hasStep;
+        bool hasEnd;
+    };
+    
+    // The markers of a flow may be spread over several threads.
+    std::unordered_map<std::uint64_t, FlowTimes> flows;
+    for (const std::deque<FlowEvent>& threadFlows : flowEvents) {
+        for (const FlowEvent& f : threadFlows) {
+            FlowTimes& times = flows[f.getID()];
+            
+            switch (f.getPhase()) {
+            case ProfilerFlowPhase::Begin:
+                times.key = f.getKey();
+                times.begin = f.getTime();
+                times.hasBegin = true;
+                break;
+            case ProfilerFlowPhase::Step:
+                if (!times.hasStep || f.getTime() < times.firstStep) {
+                    times.firstStep = f.getTime();
+                    times.hasStep = true;
+                }
+                break;
+            case ProfilerFlowPhase::End:
+                times.end = f.getTime();
+                times.hasEnd = true;
+                break;
+            }
+        }
+    }
+    
+    std::unordered_map<ScopeKey, FlowLatencyHistograms> histograms;
+    for (const auto& f : flows) {
+        const FlowTimes& times = f.second;
+        if (!times.hasBegin || !times.hasEnd) {
+            continue;
+        }
+        
+        FlowLatencyHistograms& flowHistograms = histograms[times.key];
+        flowHistograms.total.record(times.end - times.begin);
+        
+        if (times.hasStep) {
+            flowHistograms.firstStep.record(times.firstStep - times.begin);
+        }
+    }
+    
+    return histograms;
+}
+
 std::string ProfilerResults::writeToString() const {
     std::stringstream ss;
     
@@ -1493,7 +4668,13 @@ std::string ProfilerResults::writeToString() const {
     for (std::size_t i = 0; i < threadNames.size(); ++i) {
         const std::deque<RecordedEvent>& data = events[i];
         
-        ss << "THREAD: " << threadNames[i] << "; Event count: " << data.size() << "\n";
+        ss << "THREAD: " << threadNames[i] << "; Event count: " << data.size();
+        
+        if (getDroppedEventCount(i) != 0) {
+            ss << "; Dropped markers: " << getDroppedEventCount(i);
+        }
+        
+        ss << "\n";
         
         auto frameIter = frames.begin();
         const auto lastFrame = std::prev(frames.end());
@@ -1532,6 +4713,22 @@ std::string ProfilerResults::writeToString() const {
                << "; Function: " << info.getFunctionName()
                << "; Duration: " << d.count() << IYFT_THREAD_TEXT_OUTPUT_NAME "\n";
         }
+        
+        for (const CounterSample& c : counterSamples[i]) {
+            const auto result = scopes.find(c.getKey());
+            IYFT_ASSERT(result != scopes.end());
+            
+            ss << "  COUNTER: " << result->second.getName() << "; Value: " << c.getValue() << "\n";
+        }
+        
+        for (const FlowEvent& f : flowEvents[i]) {
+            static const char* phases[] = {"BEGIN", "STEP", "END"};
+            
+            const auto result = scopes.find(f.getKey());
+            IYFT_ASSERT(result != scopes.end());
+            
+            ss << "  FLOW " << phases[static_cast<std::size_t>(f.getPhase())] << ": " << result->second.getName() << "; ID: " << f.getID() << "\n";
+        }
     }
     
     return ss.str();
@@ -1668,47 +4865,6 @@ inline static std::uint64_t ComputeFrameNumber(const std::deque<FrameData>& fram
     }
 }
 
-template <typename T>
-std::string InsertOnlyIntervalTree<T>::print() const {
-    std::stringstream ss;
-    printTreePreOrder(ss, root, 0);
-    return ss.str();
-}
-
-template <typename T>
-void InsertOnlyIntervalTree<T>::printTreePreOrder(std::stringstream& ss, const Node* node, std::size_t depth) const {
-    if (node == nullptr) {
-        return;
-    }
-    
-    const std::string offsetString(depth, ' ');
-    
-    ss << offsetString;
-    node->item.print(ss);
-    ss << " MAX: " << node->maximum.count();
-    
-    if (node->sibling != nullptr) {
-        ss << "; SIBLINGS: ";
-        
-        const Node* listItem = node->sibling;
-        while (listItem != nullptr) {
-            listItem->item.print(ss);
-            
-            listItem = listItem->sibling;
-            if (listItem != nullptr) {
-                ss << ", ";
-            }
-        }
-    }
-    
-    ss << "\n";
-    
-    const std::size_t currentDepth = ++depth;
-    
-    printTreePreOrder(ss, node->left, currentDepth);
-    printTreePreOrder(ss, node->right, currentDepth);
-}
-
 void ProfilerResultDrawData::drawScopeInfoColumnName(const char* name, std::vector<FullScopeData>& sortedScopes,
                                                      bool (*const ascendingSort)(const FullScopeData& a, const FullScopeData& b),
                                                      bool (*const descendingSort)(const FullScopeData& a, const FullScopeData& b)) {
@@ -1730,7 +4886,7 @@ void ProfilerResultDrawData::drawScopeInfoColumnName(const char* name, std::vect
     ImGui::Text("%s", name);
 }
 
-ProfilerResultDrawData::ProfilerResultDrawData(const ProfilerResults* results) 
+ProfilerResultDrawData::ProfilerResultDrawData(const ProfilerResults* results, ProfilerParallelFor parallelFor) 
     : results(results),
       validationStatus(ValidationStatus::Pending),
       scrollPercentage(0.0f),
@@ -1743,8 +4899,26 @@ ProfilerResultDrawData::ProfilerResultDrawData(const ProfilerResults* results)
       threadWithSelectedItem(0),
       primaryTextBuffer(),
       secondaryTextBuffer(),
-      filterTextBuffer()
+      filterTextBuffer(),
+      ready(false),
+      cancelled(false),
+      processedThreads(0)
 {
+    builder = std::thread([this, parallelFor]() {
+        prepare(parallelFor);
+        ready.store(true, std::memory_order_release);
+    });
+}
+
+ProfilerResultDrawData::~ProfilerResultDrawData() {
+    cancelled = true;
+    
+    if (builder.joinable()) {
+        builder.join();
+    }
+}
+
+void ProfilerResultDrawData::prepare(const ProfilerParallelFor& parallelFor) {
     if (!results->hasAnyRecords()) {
         errorMessage = "No necords. Did you instrument the code and start the recording?";
         validationStatus = ValidationStatus::Invalid;
@@ -1787,124 +4961,116 @@ ProfilerResultDrawData::ProfilerResultDrawData(const ProfilerResults* results)
     
     const std::size_t threadCount = results->getThreadCount();
     
+    const std::unordered_map<ScopeKey, ScopeInfo>& scopes = results->getScopes();
+    const std::unordered_map<std::uint32_t, TagNameAndColor>& tags = results->getTags();
+    
+    // The scopes and their tags are resolved once and get dense indices. Afterwards,
+    // a single lookup per event finds everything that's needed to draw it and to
+    // update the stats.
+    std::unordered_map<ScopeKey, std::size_t> scopeIndices;
+    scopeIndices.reserve(scopes.size());
+    scopeStats.resize(scopes.size());
+    sortedScopes.reserve(scopes.size());
+    for (const auto& s : scopes) {
+        auto tagResult = tags.find(static_cast<std::uint32_t>(s.second.getTag()));
+        if (tagResult == tags.end()) {
+            errorMessage = "Missing tag information.";
+            validationStatus = ValidationStatus::Invalid;
+            
+            return;
+        }
+        
+        scopeIndices.emplace(s.first, sortedScopes.size());
+        sortedScopes.emplace_back(&(s.second), &(tagResult->second), &scopeStats[sortedScopes.size()]);
+    }
+    
+    // Every thread is processed separately and gets its own copy of the stats. They're
+    // merged in thread order afterwards, which produces the same results as a serial pass.
     maxDepths.resize(threadCount, 0);
-    for (std::size_t e = 0; e < threadCount; ++e) {
-        const std::deque<RecordedEvent>& records = results->getEvents(e);
+    levelsOfDetail.resize(threadCount);
+    std::vector<std::vector<ScopeStats>> threadStats(threadCount, std::vector<ScopeStats>(scopes.size()));
+    std::vector<std::vector<std::unique_ptr<DurationHistogram>>> threadHistograms(threadCount);
+    std::unique_ptr<bool[]> threadValid(new bool[threadCount]());
+    
+    auto process = [this, &scopeIndices, &threadStats, &threadHistograms, &threadValid](std::size_t i) {
+        if (!cancelled) {
+            threadHistograms[i].resize(threadStats[i].size());
+            threadValid[i] = prepareThread(i, scopeIndices, threadStats[i], threadHistograms[i]);
+        }
         
-        for (const RecordedEvent& r : records) {
-            maxDepths[e] = std::max(maxDepths[e], r.getDepth());
+        processedThreads.fetch_add(1, std::memory_order_relaxed);
+    };
+    
+    if (parallelFor && threadCount > 1) {
+        parallelFor(threadCount, process);
+    } else {
+        for (std::size_t i = 0; i < threadCount; ++i) {
+            process(i);
         }
     }
     
-    const std::unordered_map<ScopeKey, ScopeInfo>& scopes = results->getScopes();
-    const std::unordered_map<std::uint32_t, TagNameAndColor>& tags = results->getTags();
+    if (cancelled) {
+        return;
+    }
     
-    intervalTrees.reserve(threadCount);
+    std::vector<std::unique_ptr<DurationHistogram>> histograms(scopeStats.size());
     for (std::size_t i = 0; i < threadCount; ++i) {
-        const std::deque<RecordedEvent>& records = results->getEvents(i);
-        
-        intervalTrees.emplace_back(records.size());
-        InsertOnlyIntervalTree<FullEventData>& currentTree = intervalTrees.back();
-        
-        auto eventIter = records.begin();
-        for (std::size_t j = 0; j < records.size(); ++j) {
-            const RecordedEvent& e = *eventIter;
-            eventIter++;
-            
-//             if (!e.isValid() || !e.isComplete()) {
-//                 continue;
-//             }
+        if (!threadValid[i]) {
+            errorMessage = "Missing scope information.";
+            validationStatus = ValidationStatus::Invalid;
             
-            auto scopeResult = scopes.find(e.getKey());
-            if (scopeResult == scopes.end()) {
-                errorMessage = "Missing scope information.";
-                validationStatus = ValidationStatus::Invalid;
-                
-                return;
+            return;
+        }
+        
+        for (std::size_t s = 0; s < scopeStats.size(); ++s) {
+            std::unique_ptr<DurationHistogram>& partialHistogram = threadHistograms[i][s];
+            if (histograms[s] == nullptr) {
+                histograms[s] = std::move(partialHistogram);
+            } else if (partialHistogram != nullptr) {
+                histograms[s]->merge(*partialHistogram);
             }
             
-            const ScopeInfo& scope = scopeResult->second;
+            partialHistogram.reset();
             
-            auto tagResult = tags.find(static_cast<std::uint32_t>(scope.getTag()));
-            if (tagResult == tags.end()) {
-                errorMessage = "Missing tag information.";
-                validationStatus = ValidationStatus::Invalid;
-                
-                return;
+            const ScopeStats& partial = threadStats[i][s];
+            ScopeStats& stats = scopeStats[s];
+            
+            if (partial.totalCalls == 0) {
+                continue;
+            } else if (stats.totalCalls == 0) {
+                stats = partial;
+                continue;
             }
             
-            const TagNameAndColor& tagInfo = tagResult->second;
+            stats.totalCalls += partial.totalCalls;
+            stats.averageCallDuration += partial.averageCallDuration;
             
-            currentTree.insert(FullEventData(j, &e, &scope, &tagInfo));
+            if (partial.minCallDuration < stats.minCallDuration) {
+                stats.minCallDuration = partial.minCallDuration;
+                stats.shortestFrameNumber = partial.shortestFrameNumber;
+            }
             
-// std::uint64_t totalCalls;
-// std::chrono::duration<float, std::milli> averageCallDuration;
-// 
-// std::chrono::duration<float, std::milli> minCallDuration;
-// std::uint64_t shortestFrameNumber;
-// 
-// std::chrono::duration<float, std::milli> maxCallDuration;
-// std::uint64_t longestFrameNumber;
-            // Build the stats
-            
-            std::uint64_t firstFrameNumber = frames.begin()->getNumber();
-            auto statResult = scopeStats.find(e.getKey());
-            if (statResult != scopeStats.end()) {
-                ScopeStats& stats = statResult->second;
-                
-                stats.totalCalls += 1;
-                stats.averageCallDuration += e.getDuration();
-                
-                if (e.getDuration() < stats.minCallDuration) {
-                    stats.minCallDuration = e.getDuration();
-                    stats.shortestFrameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
-                }
-                
-                if (e.getDuration() > stats.maxCallDuration) {
-                    stats.maxCallDuration = e.getDuration();
-                    stats.longestFrameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
-                }
-            } else {
-                ScopeStats stats;
-                
-                stats.totalCalls = 1;
-                stats.averageCallDuration = e.getDuration();
-                
-                const std::uint64_t frameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
-                
-                stats.minCallDuration = e.getDuration();
-                stats.shortestFrameNumber = frameNumber;
-                
-                stats.maxCallDuration = e.getDuration();
-                stats.longestFrameNumber = frameNumber;
-                
-                scopeStats[e.getKey()] = std::move(stats);
+            if (partial.maxCallDuration > stats.maxCallDuration) {
+                stats.maxCallDuration = partial.maxCallDuration;
+                stats.longestFrameNumber = partial.longestFrameNumber;
             }
         }
-        
-        currentTree.updateMaximumValues();
-    }
-    
-    for (auto& s : scopeStats) {
-        s.second.averageCallDuration /= static_cast<float>(s.second.totalCalls);
     }
     
-    sortedScopes.reserve(scopes.size());
-    for (const auto& s : scopes) {
-        auto tagResult = tags.find(static_cast<std::uint32_t>(s.second.getTag()));
-        if (tagResult == tags.end()) {
-            errorMessage = "Missing tag information.";
-            validationStatus = ValidationStatus::Invalid;
-            
-            return;
+    for (std::size_t s = 0; s < scopeStats.size(); ++s) {
+        ScopeStats& stats = scopeStats[s];
+        if (stats.totalCalls != 0) {
+            stats.averageCallDuration /= static_cast<float>(stats.totalCalls);
         }
         
-        // This will create a default initialized ScopeStats instance if one is missing
-        const ScopeStats& stats = scopeStats[s.first];
-        
-        sortedScopes.emplace_back(&(s.second), &(tagResult->second), &stats);
+        if (histograms[s] != nullptr) {
+            stats.medianCallDuration = histograms[s]->getPercentile(50.0);
+            stats.p95CallDuration = histograms[s]->getPercentile(95.0);
+            stats.p99CallDuration = histograms[s]->getPercentile(99.0);
+        }
     }
     
+    // The stats stay in place. Only the FullScopeData entries that point to them get sorted.
     std::sort(sortedScopes.begin(), sortedScopes.end(), [](const FullScopeData& a, const FullScopeData& b){
         return a.scopeInfo->getName() < b.scopeInfo->getName();
     });
@@ -1912,6 +5078,95 @@ ProfilerResultDrawData::ProfilerResultDrawData(const ProfilerResults* results)
     errorMessage = "";
     validationStatus = ValidationStatus::Validated;
 }
+
+bool ProfilerResultDrawData::prepareThread(std::size_t threadID, const std::unordered_map<ScopeKey, std::size_t>& scopeIndices, std::vector<ScopeStats>& threadStats,
+                                           std::vector<std::unique_ptr<DurationHistogram>>& threadHistograms) {
+    const std::deque<FrameData>& frames = results->getFrames();
+    const std::uint64_t firstFrameNumber = frames.begin()->getNumber();
+    const std::deque<RecordedEvent>& records = results->getEvents(threadID);
+    
+    std::int32_t& maxDepth = maxDepths[threadID];
+    for (const RecordedEvent& r : records) {
+        maxDepth = std::max(maxDepth, r.getDepth());
+    }
+    
+    std::vector<std::vector<AggregatedSpan>>& currentLevels = levelsOfDetail[threadID];
+    currentLevels.resize(static_cast<std::size_t>(maxDepth + 1) * LevelOfDetailCount);
+    
+    auto eventIter = records.begin();
+    for (std::size_t j = 0; j < records.size(); ++j) {
+        const RecordedEvent& e = *eventIter;
+        eventIter++;
+        
+//         if (!e.isValid() || !e.isComplete()) {
+//             continue;
+//         }
+        
+        auto indexResult = scopeIndices.find(e.getKey());
+        if (indexResult == scopeIndices.end()) {
+            return false;
+        }
+        
+        const std::size_t scopeIndex = indexResult->second;
+        const FullScopeData& scopeData = sortedScopes[scopeIndex];
+        
+        // The records are sorted by their start times and events on the same depth don't overlap,
+        // which means that every level stays sorted as well.
+        currentLevels[static_cast<std::size_t>(e.getDepth()) * LevelOfDetailCount].emplace_back(FullEventData(j, &e, scopeData.scopeInfo, scopeData.tagInfo));
+        
+        // Build the stats. The averageCallDuration stores the sum until the stats of all threads are merged.
+        std::unique_ptr<DurationHistogram>& histogram = threadHistograms[scopeIndex];
+        if (histogram == nullptr) {
+            histogram.reset(new DurationHistogram());
+        }
+        
+        histogram->record(e.getDuration());
+        
+        ScopeStats& stats = threadStats[scopeIndex];
+        if (stats.totalCalls != 0) {
+            stats.totalCalls += 1;
+            stats.averageCallDuration += e.getDuration();
+            
+            if (e.getDuration() < stats.minCallDuration) {
+                stats.minCallDuration = e.getDuration();
+                stats.shortestFrameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
+            }
+            
+            if (e.getDuration() > stats.maxCallDuration) {
+                stats.maxCallDuration = e.getDuration();
+                stats.longestFrameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
+            }
+        } else {
+            stats.totalCalls = 1;
+            stats.averageCallDuration = e.getDuration();
+            
+            const std::uint64_t frameNumber = ComputeFrameNumber(frames, e.getStart(), firstFrameNumber);
+            
+            stats.minCallDuration = e.getDuration();
+            stats.shortestFrameNumber = frameNumber;
+            
+            stats.maxCallDuration = e.getDuration();
+            stats.longestFrameNumber = frameNumber;
+        }
+    }
+    
+    for (std::size_t d = 0; d < currentLevels.size(); d += LevelOfDetailCount) {
+        std::size_t source = d;
+        for (std::size_t l = 1; l < LevelOfDetailCount; ++l) {
+            const std::chrono::nanoseconds maxLength(FirstMergedLevelNanoseconds << (l - 1));
+            MergeSpans(currentLevels[source], maxLength, currentLevels[d + l]);
+            
+            if (currentLevels[d + l].size() == currentLevels[source].size()) {
+                currentLevels[d + l].clear();
+                currentLevels[d + l].shrink_to_fit();
+            } else {
+                source = d + l;
+            }
+        }
+    }
+    
+    return true;
+}
     
 ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
     // Splitter behaviour based on https://github.com/ocornut/imgui/issues/125#issuecomment-135775009
@@ -1919,6 +5174,21 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
     // otherwise
     
     ImGui::BeginChild("ProfilerWrapper");
+    if (!ready.load(std::memory_order_acquire)) {
+        const std::size_t threadCount = results->getThreadCount();
+        const std::size_t processed = processedThreads.load(std::memory_order_relaxed);
+        
+        ImGui::Text("Processing the results of %zu/%zu threads", processed, threadCount);
+        ImGui::ProgressBar((threadCount != 0) ? static_cast<float>(processed) / static_cast<float>(threadCount) : 0.0f);
+        
+        ImGui::EndChild();
+        return ProfilerDrawResult::Processing;
+    }
+    
+    if (builder.joinable()) {
+        builder.join();
+    }
+    
     if (validationStatus != ValidationStatus::Validated) {
         ImGui::Text("Profiler results are invalid. ERROR:%s", errorMessage.c_str());
         
@@ -2083,6 +5353,16 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
     const float recordedEventHeight = lineWithoutSpacing;
     const float recordedEventSpacing = lineSpacing;
     
+    // When zoomed out, events that are shorter than a pixel are merged into spans taken from a level of
+    // detail. This keeps the number of drawn rectangles proportional to the width of the window instead
+    // of the number of visible events.
+    const float msPerPixel = 1.0f / pixelsPerMs;
+    const float nanosecondsPerPixel = 1000000.0f * msPerPixel;
+    std::size_t levelOfDetail = 0;
+    while ((levelOfDetail + 1) < LevelOfDetailCount && static_cast<float>(FirstMergedLevelNanoseconds << levelOfDetail) <= nanosecondsPerPixel) {
+        levelOfDetail++;
+    }
+    
     ProfilerItemStatus allThreadEventStatus = ProfilerItemStatus::NoInteraction;
     for (std::size_t i = 0; i < results->getThreadCount(); ++i) {
         // Make sure the name is always visible
@@ -2090,12 +5370,6 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
         const std::string& threadName = results->getThreadName(i);
         ImGui::Text("Thread: %s", threadName.c_str());
         
-        drawnIntervals.clear();
-        
-        TimedProfilerObject checkInterval(firstVisibleNanosecond);
-        checkInterval.setEnd(lastVisibleNanosecond);
-        intervalTrees[i].findIntervals(FullEventData(0, &checkInterval, nullptr, nullptr), drawnIntervals);
-        
         const ImVec2 threadRecordCursorPos = ImGui::GetCursorScreenPos();
         const ImVec2 threadRecordDrawStart(threadRecordCursorPos.x, threadRecordCursorPos.y + recordedEventSpacing);
         const float totalHeight = CalculateThreadRowHeight(recordedEventHeight, recordedEventSpacing, maxDepths[i]);
@@ -2104,8 +5378,8 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
         
         ProfilerItemStatus eventStatus = ProfilerItemStatus::NoInteraction;
         
-        for (const FullEventData& e : drawnIntervals) {
-            const RecordedEvent* event = dynamic_cast<const RecordedEvent*>(e.event);
+        auto drawEvent = [&](const FullEventData& e) {
+            const RecordedEvent* event = e.event;
             const ScopeInfo* scope = e.scope;
             const TagNameAndColor* nameAndColor = e.nameAndColor;
             const std::size_t itemID = e.id;
@@ -2118,6 +5392,38 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
             eventStatus |= DrawRectWithText(drawList, threadRecordDrawStart, recordedEventHeight, (recordedEventHeight + recordedEventSpacing) * event->getDepth(), pixelsPerMs,
                                             eventStartMs, eventEndMs, itemColor, itemID, lastClickedItemID, hoveredItemCoordinates, primaryTextBuffer.data(), secondaryTextBuffer.data(),
                                             TextBufferSize, "%s (%f ms)", scope->getName().c_str(), eventDuration);
+        };
+        
+        const std::vector<std::vector<AggregatedSpan>>& threadLevels = levelsOfDetail[i];
+        for (std::size_t d = 0; d < threadLevels.size(); d += LevelOfDetailCount) {
+            std::size_t level = levelOfDetail;
+            while (level > 0 && threadLevels[d + level].empty()) {
+                level--;
+            }
+            
+            const std::vector<AggregatedSpan>& spans = threadLevels[d + level];
+            
+            // The spans don't overlap, which means that their end times are sorted as well.
+            auto spanIter = std::lower_bound(spans.begin(), spans.end(), firstVisibleNanosecond, [](const AggregatedSpan& lhs, const std::chrono::nanoseconds& rhs){
+                return lhs.end < rhs;
+            });
+            
+            for (; spanIter != spans.end() && spanIter->start <= lastVisibleNanosecond; ++spanIter) {
+                const AggregatedSpan& span = *spanIter;
+                if (span.count == 1) {
+                    drawEvent(span.first);
+                    continue;
+                }
+                
+                const float spanStartMs = std::chrono::duration<float, std::milli>(span.start - start).count();
+                const float spanEndMs = std::max(std::chrono::duration<float, std::milli>(span.end - start).count(), spanStartMs + msPerPixel);
+                const float spanDuration = std::chrono::duration<float, std::milli>(span.end - span.start).count();
+                
+                const ImColor itemColor = ImColorFromScopeColor(span.first.nameAndColor->getColor());
+                eventStatus |= DrawRectWithText(drawList, threadRecordDrawStart, recordedEventHeight, (recordedEventHeight + recordedEventSpacing) * static_cast<float>(span.first.event->getDepth()), pixelsPerMs,
+                                                spanStartMs, spanEndMs, itemColor, span.first.id, lastClickedItemID, hoveredItemCoordinates, primaryTextBuffer.data(), secondaryTextBuffer.data(),
+                                                TextBufferSize, "%zu merged events (%f ms)", span.count, spanDuration);
+            }
         }
         
         if (static_cast<bool>(eventStatus & ProfilerItemStatus::Clicked)) {
@@ -2203,7 +5509,7 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
         ImGui::InputText("Filter", filterTextBuffer.data(), filterTextBuffer.size());
         const std::size_t filterStringLength = std::strlen(filterTextBuffer.data());
         
-        ImGui::Columns(7, "ScopeInfoColumns");
+        ImGui::Columns(8, "ScopeInfoColumns");
         
         ImGui::Separator();
         
@@ -2247,6 +5553,15 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
                                 });
         ImGui::NextColumn();
         
+        drawScopeInfoColumnName("p50 / p95 / p99 duration", sortedScopes, 
+                                [](const FullScopeData& a, const FullScopeData& b) {
+                                    return a.stats->p99CallDuration < b.stats->p99CallDuration;
+                                },
+                                [](const FullScopeData& a, const FullScopeData& b) {
+                                    return a.stats->p99CallDuration > b.stats->p99CallDuration;
+                                });
+        ImGui::NextColumn();
+        
         ImGui::AlignTextToFramePadding();
         ImGui::Text("Max duration (frame)");
         ImGui::NextColumn();
@@ -2277,6 +5592,9 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
             ImGui::Text("%fms", s.stats->averageCallDuration.count());
             ImGui::NextColumn();
             
+            ImGui::Text("%fms / %fms / %fms", s.stats->medianCallDuration.count(), s.stats->p95CallDuration.count(), s.stats->p99CallDuration.count());
+            ImGui::NextColumn();
+            
             ImGui::Text("%fms (%lu)", s.stats->maxCallDuration.count(), s.stats->longestFrameNumber);
             ImGui::NextColumn();
             
@@ -2289,7 +5607,6 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
         ImGui::Spacing();
     }
     
-    //ImGui::Text("%s", intervalTrees[0].print().c_str());
     ImGui::EndChild();
     ImGui::EndChild();
     
@@ -2297,21 +5614,39 @@ ProfilerDrawResult ProfilerResultDrawData::draw(float scale) {
 }
 
 ProfilerDrawResult ProfilerResults::drawInImGui(float scale) {
+    return drawInImGui(scale, ProfilerParallelFor());
+}
+
+ProfilerDrawResult ProfilerResults::drawInImGui(float scale, const ProfilerParallelFor& parallelFor) {
     if (drawData == nullptr) {
-        drawData = std::unique_ptr<ProfilerResultDrawData>(new ProfilerResultDrawData(this));
+        drawData = std::unique_ptr<ProfilerResultDrawData>(new ProfilerResultDrawData(this, parallelFor));
     }
     
     return drawData->draw(scale);
 }
 
-void ProfilerResultDrawData::FullEventData::print(std::stringstream& ss) const {
-    ss << "[" << event->getStart().count() << "; " << event->getEnd().count() << "]";
+void ProfilerResultDrawData::MergeSpans(const std::vector<AggregatedSpan>& source, std::chrono::nanoseconds maxLength, std::vector<AggregatedSpan>& destination) {
+    destination.clear();
+    
+    for (const AggregatedSpan& span : source) {
+        if (!destination.empty() && (span.end - destination.back().start) <= maxLength) {
+            AggregatedSpan& merged = destination.back();
+            merged.end = span.end;
+            merged.count += span.count;
+        } else {
+            destination.push_back(span);
+        }
+    }
 }
 
 #else // IYFT_PROFILER_WITH_IMGUI
 ProfilerDrawResult ProfilerResults::drawInImGui(float) {
     return ProfilerDrawResult::ImGuiNotAvailable;
 }
+
+ProfilerDrawResult ProfilerResults::drawInImGui(float, const ProfilerParallelFor&) {
+    return ProfilerDrawResult::ImGuiNotAvailable;
+}
 #endif // IYFT_PROFILER_WITH_IMGUI
 }
 
@@ -33,12 +33,39 @@
 
 namespace iyft {
 
-// The maximum number of threads that the ThreadProfiler will need to track in your 
-// program. Default is 16. Must be >= 1
+// The number of threads that the ThreadProfiler reserves space for up front. More
+// threads may register. IDs of threads that have exited are reused, and their
+// remaining events are kept until the next ThreadProfiler::getResults() call. Default
+// is 16. Must be >= 1
 //#define IYFT_THREAD_PROFILER_MAX_THREAD_COUNT 64
 
+// The number of begin and end markers (two per event) that every thread can buffer
+// until they're retrieved by ThreadProfiler::getResults(). Each thread allocates its buffer when it records its
+// first event. Default is 65536. Must be a power of two.
+//#define IYFT_THREAD_PROFILER_BUFFER_CAPACITY 65536
+
+// By default, new events are dropped when the buffer of a thread is full. Uncomment this
+// to overwrite the oldest markers instead. Either way, the number of lost markers is
+// reported by ProfilerResults::getDroppedEventCount().
+//#define IYFT_THREAD_PROFILER_OVERWRITE_WHEN_FULL
+
+// On x86 and AArch64, events are timestamped with the raw CPU counter (rdtsc or cntvct)
+// and converted to ProfilerClock time when ThreadProfiler::getResults() is called. This
+// assumes an invariant counter. Uncomment this to read ProfilerClock directly instead.
+//#define IYFT_THREAD_PROFILER_NO_TSC
+
+// The maximum number of distinct profiled scopes (IYFT_PROFILE uses) in your program.
+// Default is 4096. Must be >= 1
+//#define IYFT_THREAD_PROFILER_MAX_SCOPE_COUNT 4096
+
+// Uncomment this to keep a DurationHistogram of every scope per thread. It's updated when
+// a recorded scope ends and can be read at any time with ThreadProfiler::getLiveHistogram().
+// Costs roughly 9 KiB per used scope per thread.
+//#define IYFT_THREAD_PROFILER_LIVE_HISTOGRAMS
+
 // A custom hashing function. Must return a 32 bit integer and take std::string as the
-// parameter.
+// parameter. By default, scope identifiers are hashed with FNV-1a at compile time.
+// Either way, colliding scopes are detected and kept apart.
 //#define IYFT_THREAD_PROFILER_HASH(a) SOME-FUNCTION-HERE
 
 // Either define both or none. This allows you to customize the duration type that's
@@ -50,6 +77,11 @@ namespace iyft {
 // Uncomment this to tag recorded events with monotonically increasing 64 bit integers.
 //#define IYFT_PROFILER_WITH_COOKIE
 
+// If this macro is defined, ProfilerFileFormat::Version3 files are additionally compressed
+// with zstd (from https://github.com/facebook/zstd). Requires linking with libzstd. Files
+// that use zstd can't be opened unless this is defined.
+//#define IYFT_PROFILER_WITH_ZSTD
+
 // If this is macro is defined, and the Dear Imgui library (from https://github.com/ocornut/imgui)
 // is included in your project, you'll be able to draw ProfilerResults by calling drawInImGui.
 //#define IYFT_PROFILER_WITH_IMGUI
@@ -0,0 +1,523 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file Topology.hpp Contains a CPU topology discovery layer and thread pinning
+/// helpers.
+
+#ifndef IYFT_TOPOLOGY_HPP
+#define IYFT_TOPOLOGY_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#include <windows.h>
+#endif
+
+namespace iyft {
+/// \brief Describes a single logical processor (a hardware thread).
+struct LogicalProcessor {
+    /// \brief The ID that the operating system uses for this processor. On Windows,
+    /// it's computed as processorGroup * 64 + processorNumberInGroup.
+    std::size_t id;
+    
+    /// \brief A dense, zero-based ID of the physical core. Logical processors that
+    /// share a core (e.g., due to SMT) have the same core ID.
+    std::size_t core;
+    
+    /// \brief A dense, zero-based ID of the group of cores that share the last level
+    /// cache (e.g., a CCX on AMD's Zen processors).
+    std::size_t cacheGroup;
+    
+    /// \brief A dense, zero-based ID of the physical package (socket).
+    std::size_t package;
+    
+    /// \brief A dense, zero-based ID of the NUMA node.
+    std::size_t node;
+};
+
+/// \brief Determines how the workers of a ThreadPool are pinned to the logical
+/// processors.
+enum class WorkerPlacement {
+    /// The workers aren't pinned and the pool uses a single set of queues.
+    Unpinned,
+    /// Every worker is pinned to a single logical processor. The workers are spread
+    /// across different physical cores before any SMT siblings are used.
+    PerCore,
+    /// Every worker is pinned to all logical processors of a cache group (e.g., a CCX),
+    /// which allows the OS to move it between the cores that share the last level 
+    /// cache.
+    PerCacheGroup
+};
+
+/// \brief The topology of the logical processors, cores, caches and NUMA nodes of the 
+/// current machine.
+///
+/// Linux uses sysfs and Windows uses GetLogicalProcessorInformationEx(). On other 
+/// platforms (or if the detection fails), std::thread::hardware_concurrency() logical 
+/// processors without SMT are assumed, all of them sharing a single node.
+class CPUTopology {
+public:
+    /// \brief Creates an empty topology that has a single node and no processors.
+    CPUTopology() : nodeCount(1), coreCount(0), cacheGroupCount(0), packageCount(0) {}
+    
+    /// \brief Creates a topology from a custom list of processors, e.g., a subset of a
+    /// detected topology or a simulated one. The IDs don't need to be dense.
+    explicit CPUTopology(const std::vector<LogicalProcessor>& customProcessors) : CPUTopology() {
+        std::vector<RawProcessor> raw;
+        raw.reserve(customProcessors.size());
+        
+        for (const LogicalProcessor& p : customProcessors) {
+            const RawProcessor r = {p.id, p.core, p.cacheGroup, p.package, p.node};
+            raw.push_back(r);
+        }
+        
+        finalize(std::move(raw));
+    }
+    
+    /// \brief Detects the topology of the current machine.
+    static CPUTopology Detect() {
+        CPUTopology topology;
+        
+#if defined(__linux__)
+        topology.detectLinux();
+#elif defined(_WIN32)
+        topology.detectWindows();
+#endif
+        
+        if (topology.processors.empty()) {
+            topology.detectFallback();
+        }
+        
+        return topology;
+    }
+    
+    /// \brief Returns all logical processors ordered by their node, package, cache
+    /// group, core and OS ID.
+    inline const std::vector<LogicalProcessor>& getProcessors() const {
+        return processors;
+    }
+    
+    /// \brief Returns the number of NUMA nodes. Always >= 1.
+    inline std::size_t getNodeCount() const {
+        return nodeCount;
+    }
+    
+    /// \brief Returns the number of physical cores.
+    inline std::size_t getCoreCount() const {
+        return coreCount;
+    }
+    
+    /// \brief Returns the number of groups of cores that share the last level cache.
+    inline std::size_t getCacheGroupCount() const {
+        return cacheGroupCount;
+    }
+    
+    /// \brief Returns the number of physical packages (sockets).
+    inline std::size_t getPackageCount() const {
+        return packageCount;
+    }
+    
+    /// \brief Returns the OS IDs of the logical processors that belong to the
+    /// specified cache group.
+    std::vector<std::size_t> getCacheGroupProcessors(std::size_t cacheGroup) const {
+        std::vector<std::size_t> result;
+        
+        for (const LogicalProcessor& p : processors) {
+            if (p.cacheGroup == cacheGroup) {
+                result.push_back(p.id);
+            }
+        }
+        
+        return result;
+    }
+    
+    /// \brief Orders the logical processors in a way that spreads work across different
+    /// physical cores before any SMT siblings are used.
+    ///
+    /// \return Indices into the vector returned by getProcessors().
+    std::vector<std::size_t> getSpreadOrder() const {
+        std::vector<std::size_t> order;
+        order.reserve(processors.size());
+        
+        std::vector<bool> taken(processors.size(), false);
+        
+        // Every pass takes at most one logical processor from every core.
+        while (order.size() < processors.size()) {
+            std::vector<bool> coreUsedInPass(coreCount, false);
+            
+            for (std::size_t i = 0; i < processors.size(); ++i) {
+                const std::size_t core = processors[i].core;
+                
+                if (!taken[i] && !coreUsedInPass[core]) {
+                    taken[i] = true;
+                    coreUsedInPass[core] = true;
+                    order.push_back(i);
+                }
+            }
+        }
+        
+        return order;
+    }
+    
+    /// \brief Pins the calling thread to the specified logical processors.
+    ///
+    /// \remark On Windows, all processors must belong to the same processor group as
+    /// the first one. Others are ignored.
+    ///
+    /// \param processorIDs OS IDs of the logical processors (LogicalProcessor::id).
+    /// \return true if the affinity was changed, false if it failed or if pinning is
+    /// not supported on this platform.
+    static bool PinCurrentThread(const std::vector<std::size_t>& processorIDs) {
+        if (processorIDs.empty()) {
+            return false;
+        }
+        
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        
+        for (std::size_t id : processorIDs) {
+            if (id < CPU_SETSIZE) {
+                CPU_SET(id, &set);
+            }
+        }
+        
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#elif defined(_WIN32)
+        GROUP_AFFINITY affinity;
+        ZeroMemory(&affinity, sizeof(GROUP_AFFINITY));
+        affinity.Group = static_cast<WORD>(processorIDs[0] / 64);
+        
+        for (std::size_t id : processorIDs) {
+            if (id / 64 == affinity.Group) {
+                affinity.Mask |= static_cast<KAFFINITY>(1) << (id % 64);
+            }
+        }
+        
+        return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+        return false;
+#endif
+    }
+private:
+    /// \brief Temporary data used during detection. Uses raw (sparse) OS IDs.
+    struct RawProcessor {
+        std::size_t id;
+        std::size_t core;
+        std::size_t cacheGroup;
+        std::size_t package;
+        std::size_t node;
+    };
+    
+    /// \brief Sorts the processors, converts sparse IDs into dense ones and counts the
+    /// nodes, cores, cache groups and packages.
+    ///
+    /// The dense IDs are assigned after sorting, which means that they grow together
+    /// with the index of the processor (e.g., cache group 0 is always on the first node).
+    void finalize(std::vector<RawProcessor> raw) {
+        std::sort(raw.begin(), raw.end(), [](const RawProcessor& a, const RawProcessor& b) {
+            if (a.node != b.node) return a.node < b.node;
+            if (a.package != b.package) return a.package < b.package;
+            if (a.cacheGroup != b.cacheGroup) return a.cacheGroup < b.cacheGroup;
+            if (a.core != b.core) return a.core < b.core;
+            return a.id < b.id;
+        });
+        
+        std::vector<std::size_t> nodes, packages;
+        std::vector<std::pair<std::size_t, std::size_t>> cores, cacheGroups;
+        
+        processors.clear();
+        processors.reserve(raw.size());
+        
+        for (const RawProcessor& r : raw) {
+            LogicalProcessor p;
+            p.id = r.id;
+            p.node = DenseID(nodes, r.node);
+            p.package = DenseID(packages, r.package);
+            // Combine with the package because core IDs are only unique within one.
+            p.core = DenseID(cores, std::make_pair(r.package, r.core));
+            p.cacheGroup = DenseID(cacheGroups, std::make_pair(r.package, r.cacheGroup));
+            
+            processors.push_back(p);
+        }
+        
+        nodeCount = nodes.empty() ? 1 : nodes.size();
+        packageCount = packages.size();
+        coreCount = cores.size();
+        cacheGroupCount = cacheGroups.size();
+    }
+    
+    template <typename T>
+    static std::size_t DenseID(std::vector<T>& known, const T& value) {
+        for (std::size_t i = 0; i < known.size(); ++i) {
+            if (known[i] == value) {
+                return i;
+            }
+        }
+        
+        known.push_back(value);
+        return known.size() - 1;
+    }
+    
+    /// \brief Assumes hardware_concurrency() processors, no SMT and a single node.
+    void detectFallback() {
+        const std::size_t count = (std::thread::hardware_concurrency() == 0) ? 1 : std::thread::hardware_concurrency();
+        
+        std::vector<RawProcessor> raw(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            raw[i].id = i;
+            raw[i].core = i;
+            raw[i].cacheGroup = 0;
+            raw[i].package = 0;
+            raw[i].node = 0;
+        }
+        
+        finalize(std::move(raw));
+    }
+    
+#if defined(__linux__)
+    /// \brief Parses a list in the "0-3,8,10-11" format used by sysfs.
+    static std::vector<std::size_t> ParseList(const std::string& list) {
+        std::vector<std::size_t> result;
+        
+        std::size_t i = 0;
+        while (i < list.size()) {
+            if (list[i] < '0' || list[i] > '9') {
+                i++;
+                continue;
+            }
+            
+            std::size_t first = 0;
+            while (i < list.size() && list[i] >= '0' && list[i] <= '9') {
+                first = first * 10 + static_cast<std::size_t>(list[i] - '0');
+                i++;
+            }
+            
+            std::size_t last = first;
+            if (i < list.size() && list[i] == '-') {
+                i++;
+                
+                last = 0;
+                while (i < list.size() && list[i] >= '0' && list[i] <= '9') {
+                    last = last * 10 + static_cast<std::size_t>(list[i] - '0');
+                    i++;
+                }
+            }
+            
+            for (std::size_t v = first; v <= last; ++v) {
+                result.push_back(v);
+            }
+        }
+        
+        return result;
+    }
+    
+    static bool ReadLine(const std::string& path, std::string& line) {
+        std::ifstream file(path);
+        return static_cast<bool>(std::getline(file, line));
+    }
+    
+    static std::size_t ReadNumber(const std::string& path, std::size_t defaultValue) {
+        std::string line;
+        if (!ReadLine(path, line)) {
+            return defaultValue;
+        }
+        
+        const std::vector<std::size_t> values = ParseList(line);
+        return values.empty() ? defaultValue : values[0];
+    }
+    
+    void detectLinux() {
+        std::string line;
+        if (!ReadLine("/sys/devices/system/cpu/online", line)) {
+            return;
+        }
+        
+        const std::vector<std::size_t> online = ParseList(line);
+        std::vector<RawProcessor> raw;
+        raw.reserve(online.size());
+        
+        for (std::size_t id : online) {
+            const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(id);
+            
+            RawProcessor r;
+            r.id = id;
+            r.package = ReadNumber(base + "/topology/physical_package_id", 0);
+            r.core = ReadNumber(base + "/topology/core_id", id);
+            r.node = 0;
+            
+            // The group of processors that share the highest level cache is identified
+            // by the smallest ID in it.
+            r.cacheGroup = r.package;
+            std::size_t highestLevel = 0;
+            for (std::size_t index = 0; ; ++index) {
+                const std::string cache = base + "/cache/index" + std::to_string(index);
+                
+                const std::size_t level = ReadNumber(cache + "/level", 0);
+                if (level == 0) {
+                    break;
+                }
+                
+                std::string shared;
+                if (level >= highestLevel && ReadLine(cache + "/shared_cpu_list", shared)) {
+                    const std::vector<std::size_t> sharing = ParseList(shared);
+                    
+                    if (!sharing.empty()) {
+                        highestLevel = level;
+                        r.cacheGroup = sharing[0];
+                    }
+                }
+            }
+            
+            raw.push_back(r);
+        }
+        
+        // Processors of nodes that don't exist in sysfs (e.g., kernels without NUMA
+        // support) stay in node 0.
+        if (ReadLine("/sys/devices/system/node/online", line)) {
+            for (std::size_t node : ParseList(line)) {
+                std::string cpus;
+                if (!ReadLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpus)) {
+                    continue;
+                }
+                
+                for (std::size_t id : ParseList(cpus)) {
+                    for (RawProcessor& r : raw) {
+                        if (r.id == id) {
+                            r.node = node;
+                        }
+                    }
+                }
+            }
+        }
+        
+        finalize(std::move(raw));
+    }
+#elif defined(_WIN32)
+    /// \brief Calls f(id) for every logical processor in the group affinity.
+    template <typename F>
+    static void ForEachProcessor(const GROUP_AFFINITY& affinity, F f) {
+        for (std::size_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+            if ((affinity.Mask >> bit) & 1) {
+                f(static_cast<std::size_t>(affinity.Group) * 64 + bit);
+            }
+        }
+    }
+    
+    void detectWindows() {
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+        if (length == 0) {
+            return;
+        }
+        
+        std::vector<char> buffer(length);
+        if (!GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length)) {
+            return;
+        }
+        
+        std::vector<RawProcessor> raw;
+        auto find = [&raw](std::size_t id) -> RawProcessor& {
+            for (RawProcessor& r : raw) {
+                if (r.id == id) {
+                    return r;
+                }
+            }
+            
+            RawProcessor r = {id, 0, 0, 0, 0};
+            raw.push_back(r);
+            return raw.back();
+        };
+        
+        // Cores are processed first to create all processors.
+        for (int pass = 0; pass < 2; ++pass) {
+            std::size_t coreID = 0, packageID = 0;
+            
+            for (DWORD offset = 0; offset < length;) {
+                const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info = *reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+                offset += info.Size;
+                
+                if (pass == 0 && info.Relationship == RelationProcessorCore) {
+                    for (WORD g = 0; g < info.Processor.GroupCount; ++g) {
+                        ForEachProcessor(info.Processor.GroupMask[g], [&](std::size_t id) {
+                            find(id).core = coreID;
+                        });
+                    }
+                    
+                    coreID++;
+                } else if (pass == 1 && info.Relationship == RelationProcessorPackage) {
+                    for (WORD g = 0; g < info.Processor.GroupCount; ++g) {
+                        ForEachProcessor(info.Processor.GroupMask[g], [&](std::size_t id) {
+                            find(id).package = packageID;
+                        });
+                    }
+                    
+                    packageID++;
+                } else if (pass == 1 && info.Relationship == RelationNumaNode) {
+                    ForEachProcessor(info.NumaNode.GroupMask, [&](std::size_t id) {
+                        find(id).node = info.NumaNode.NodeNumber;
+                    });
+                } else if (pass == 1 && info.Relationship == RelationCache && info.Cache.Level == 3) {
+                    // Identify the group by the first processor in it.
+                    std::size_t first = static_cast<std::size_t>(-1);
+                    ForEachProcessor(info.Cache.GroupMask, [&](std::size_t id) {
+                        if (first == static_cast<std::size_t>(-1)) {
+                            first = id;
+                        }
+                        
+                        find(id).cacheGroup = first;
+                    });
+                }
+            }
+        }
+        
+        finalize(std::move(raw));
+    }
+#endif
+    
+    std::vector<LogicalProcessor> processors;
+    std::size_t nodeCount;
+    std::size_t coreCount;
+    std::size_t cacheGroupCount;
+    std::size_t packageCount;
+};
+}
+
+#endif // IYFT_TOPOLOGY_HPP
@@ -0,0 +1,232 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file WorkStealingDeque.hpp Contains a Chase-Lev work stealing deque.
+
+#ifndef IYFT_WORK_STEALING_DEQUE_HPP
+#define IYFT_WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Spinlock.hpp"
+
+namespace iyft {
+/// \brief A lock-free, dynamically growing Chase-Lev work stealing deque.
+///
+/// The owning thread pushes and pops items at the bottom end while any other thread
+/// may steal them from the top end. This is based on "Dynamic Circular Work-Stealing
+/// Deque" by Chase and Lev and the adaptation for weak memory models by Lê, Pop,
+/// Cohen and Zappa Nardelli.
+///
+/// Thieves read items speculatively, before they know if the steal succeeded, therefore,
+/// T must be trivially copyable. The ThreadPool stores pointers to tasks.
+///
+/// \warning push() and pop() may only be called by the thread that owns the deque.
+template <typename T>
+class WorkStealingDeque {
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque items must be trivially copyable");
+    
+    /// \brief Creates a new WorkStealingDeque.
+    ///
+    /// \throws std::logic_error if initialCapacity is not a power of two.
+    ///
+    /// \param initialCapacity The number of items that can be stored before the deque
+    /// has to grow. Must be a power of two.
+    explicit WorkStealingDeque(std::size_t initialCapacity = 256) : top(0), padding(), bottom(0) {
+        if (initialCapacity == 0 || (initialCapacity & (initialCapacity - 1)) != 0) {
+            throw std::logic_error("initialCapacity must be a power of two");
+        }
+        
+        buffers.emplace_back(new Buffer(initialCapacity));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    
+    /// \brief Explicitly disabled to get cleaner errors.
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+    
+    /// \brief Adds an item to the bottom of the deque. Grows the storage if needed.
+    ///
+    /// \warning Must only be called by the owning thread.
+    void push(T item) {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed);
+        const std::int64_t t = top.load(std::memory_order_acquire);
+        Buffer* current = buffer.load(std::memory_order_relaxed);
+        
+        if (b - t > static_cast<std::int64_t>(current->capacity) - 1) {
+            current = grow(current, b, t);
+        }
+        
+        current->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+    
+    /// \brief Removes the most recently pushed item from the bottom of the deque.
+    ///
+    /// \warning Must only be called by the owning thread.
+    ///
+    /// \param item The removed item will be written here.
+    ///
+    /// \return true if an item was removed, false if the deque was empty.
+    bool pop(T& item) {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* current = buffer.load(std::memory_order_relaxed);
+        
+        // Using seq_cst operations instead of a standalone fence keeps the thread
+        // sanitizer happy and costs the same on x86.
+        bottom.store(b, std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_seq_cst);
+        
+        if (t > b) {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        item = current->get(b);
+        
+        if (t == b) {
+            // This is the last item. We need to race the thieves for it.
+            const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            
+            return won;
+        }
+        
+        return true;
+    }
+    
+    /// \brief Removes the oldest item from the top of the deque.
+    ///
+    /// May be called by any thread.
+    ///
+    /// \param item The removed item will be written here.
+    ///
+    /// \return true if an item was stolen, false if the deque was empty or if another
+    /// thread won the race for the item.
+    bool steal(T& item) {
+        std::int64_t t = top.load(std::memory_order_seq_cst);
+        const std::int64_t b = bottom.load(std::memory_order_seq_cst);
+        
+        if (t >= b) {
+            return false;
+        }
+        
+        Buffer* current = buffer.load(std::memory_order_acquire);
+        const T stolen = current->get(t);
+        
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        
+        item = stolen;
+        return true;
+    }
+    
+    /// \brief Returns an approximate number of items in the deque.
+    ///
+    /// \return The number of items. The value may be outdated by the time it's returned.
+    std::size_t size() const {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed);
+        const std::int64_t t = top.load(std::memory_order_relaxed);
+        
+        return (b > t) ? static_cast<std::size_t>(b - t) : 0;
+    }
+    
+    /// \brief Checks if the deque is empty.
+    ///
+    /// \return true if the deque appears to be empty. The value may be outdated by the
+    /// time it's returned.
+    bool empty() const {
+        return size() == 0;
+    }
+private:
+    /// \brief A circular array of items.
+    struct Buffer {
+        explicit Buffer(std::size_t capacity)
+            : capacity(capacity), mask(capacity - 1), items(new std::atomic<T>[capacity]) {}
+        
+        inline void put(std::int64_t i, T item) {
+            items[static_cast<std::size_t>(i) & mask].store(item, std::memory_order_relaxed);
+        }
+        
+        inline T get(std::int64_t i) const {
+            return items[static_cast<std::size_t>(i) & mask].load(std::memory_order_relaxed);
+        }
+        
+        const std::size_t capacity;
+        const std::size_t mask;
+        std::unique_ptr<std::atomic<T>[]> items;
+    };
+    
+    /// \brief Doubles the capacity of the deque.
+    ///
+    /// Thieves may still be reading from the old Buffer, therefore, it is kept alive
+    /// until the deque is destroyed. The total amount of retired memory never exceeds
+    /// the size of the current Buffer.
+    Buffer* grow(Buffer* old, std::int64_t b, std::int64_t t) {
+        std::unique_ptr<Buffer> grown(new Buffer(old->capacity * 2));
+        
+        for (std::int64_t i = t; i < b; ++i) {
+            grown->put(i, old->get(i));
+        }
+        
+        Buffer* result = grown.get();
+        buffers.emplace_back(std::move(grown));
+        buffer.store(result, std::memory_order_release);
+        
+        return result;
+    }
+    
+    /// \brief The index that thieves steal from.
+    std::atomic<std::int64_t> top;
+    
+    /// \brief Keeps top and bottom on separate cache lines to avoid false sharing.
+    CacheLinePadding<sizeof(std::atomic<std::int64_t>)> padding;
+    
+    /// \brief The index that the owner pushes to and pops from.
+    std::atomic<std::int64_t> bottom;
+    
+    /// \brief The current Buffer.
+    std::atomic<Buffer*> buffer;
+    
+    /// \brief All Buffers that were ever allocated by this deque. Only accessed by
+    /// the owner.
+    std::vector<std::unique_ptr<Buffer>> buffers;
+};
+}
+
+#endif // IYFT_WORK_STEALING_DEQUE_HPP
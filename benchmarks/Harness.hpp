@@ -0,0 +1,225 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// \file Harness.hpp A tiny benchmarking harness that the benchmarks in this folder use.
+
+#ifndef IYFT_BENCHMARK_HARNESS_HPP
+#define IYFT_BENCHMARK_HARNESS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace iyft {
+namespace benchmark {
+
+/// \brief The result of a single benchmark.
+struct BenchmarkResult {
+    BenchmarkResult(std::string name, std::string unit, double nanosecondsPerIteration, std::uint64_t iterations, std::uint64_t bytesPerIteration = 0)
+        : name(std::move(name)), unit(std::move(unit)), nanosecondsPerIteration(nanosecondsPerIteration), iterations(iterations),
+          bytesPerIteration(bytesPerIteration) {}
+    
+    /// The name of the benchmark.
+    std::string name;
+    
+    /// The name of a single iteration, e.g., "scope".
+    std::string unit;
+    
+    /// The duration of a single iteration in the fastest repetition.
+    double nanosecondsPerIteration;
+    
+    /// The number of iterations in every repetition.
+    std::uint64_t iterations;
+    
+    /// The number of bytes processed by a single iteration or 0 if the benchmark
+    /// doesn't measure bandwidth.
+    std::uint64_t bytesPerIteration;
+    
+    /// \brief Returns the bandwidth in MiB/s or 0 if bytesPerIteration is 0.
+    double getMebibytesPerSecond() const {
+        if (bytesPerIteration == 0 || nanosecondsPerIteration <= 0.0) {
+            return 0.0;
+        }
+        
+        return (static_cast<double>(bytesPerIteration) / (1024.0 * 1024.0)) / (nanosecondsPerIteration * 1e-9);
+    }
+};
+
+/// \brief Runs a benchmark several times and measures the fastest run.
+///
+/// The fastest run is used because it is the least disturbed by other processes,
+/// interrupts and frequency changes.
+///
+/// \param body A callable that takes a std::uint64_t and runs that many iterations of
+/// the benchmarked code.
+/// \param setup A callable that is invoked before every repetition. It isn't timed.
+/// \param iterations The number of iterations in every repetition.
+/// \param repetitions The number of repetitions.
+///
+/// \return The duration of a single iteration in nanoseconds.
+template <typename Body, typename Setup>
+double MeasureNanosecondsPerIteration(Body&& body, Setup&& setup, std::uint64_t iterations, std::size_t repetitions) {
+    double best = std::numeric_limits<double>::max();
+    
+    for (std::size_t i = 0; i < repetitions; ++i) {
+        setup();
+        
+        const auto start = std::chrono::steady_clock::now();
+        body(iterations);
+        const auto end = std::chrono::steady_clock::now();
+        
+        const double nanoseconds = std::chrono::duration<double, std::nano>(end - start).count();
+        best = std::min(best, nanoseconds / static_cast<double>(iterations));
+    }
+    
+    return best;
+}
+
+/// \brief Same as the other overload, but without the setup step.
+template <typename Body>
+double MeasureNanosecondsPerIteration(Body&& body, std::uint64_t iterations, std::size_t repetitions) {
+    return MeasureNanosecondsPerIteration(std::forward<Body>(body), [](){}, iterations, repetitions);
+}
+
+/// \brief Prints the results as an aligned table.
+inline void PrintResults(const std::vector<BenchmarkResult>& results) {
+    std::size_t nameWidth = 0;
+    std::size_t unitWidth = 0;
+    for (const BenchmarkResult& r : results) {
+        nameWidth = std::max(nameWidth, r.name.size());
+        unitWidth = std::max(unitWidth, r.unit.size());
+    }
+    
+    for (const BenchmarkResult& r : results) {
+        std::printf("%-*s %12.3f ns/%-*s (%llu iterations)", static_cast<int>(nameWidth), r.name.c_str(), r.nanosecondsPerIteration,
+                    static_cast<int>(unitWidth), r.unit.c_str(), static_cast<unsigned long long>(r.iterations));
+        
+        if (r.bytesPerIteration != 0) {
+            std::printf(" %10.1f MiB/s", r.getMebibytesPerSecond());
+        }
+        
+        std::printf("\n");
+    }
+}
+
+/// \brief Writes a JSON string literal, escaping the characters that need it.
+inline void WriteJSONString(std::FILE* file, const std::string& text) {
+    std::fputc('"', file);
+    
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', file);
+            std::fputc(c, file);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            std::fprintf(file, "\\u%04x", static_cast<unsigned int>(c));
+        } else {
+            std::fputc(c, file);
+        }
+    }
+    
+    std::fputc('"', file);
+}
+
+/// \brief Writes the results to a JSON file that can be compared by scripts.
+///
+/// The file contains a single object with a "benchmarks" array. Every element has
+/// the "name", "unit", "ns_per_iteration" and "iterations" members and, if the
+/// benchmark measures bandwidth, "bytes_per_iteration" and "mib_per_second".
+///
+/// \param results The results to write.
+/// \param path The path of the file. It's overwritten if it exists.
+///
+/// \return true if the file was written, false otherwise.
+inline bool WriteResultsAsJSON(const std::vector<BenchmarkResult>& results, const char* path) {
+    std::FILE* file = std::fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    
+    std::fprintf(file, "{\n  \"benchmarks\": [");
+    
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        
+        std::fprintf(file, "%s\n    {\"name\": ", (i == 0) ? "" : ",");
+        WriteJSONString(file, r.name);
+        std::fprintf(file, ", \"unit\": ");
+        WriteJSONString(file, r.unit);
+        std::fprintf(file, ", \"ns_per_iteration\": %.3f, \"iterations\": %llu", r.nanosecondsPerIteration, static_cast<unsigned long long>(r.iterations));
+        
+        if (r.bytesPerIteration != 0) {
+            std::fprintf(file, ", \"bytes_per_iteration\": %llu, \"mib_per_second\": %.3f", static_cast<unsigned long long>(r.bytesPerIteration), r.getMebibytesPerSecond());
+        }
+        
+        std::fprintf(file, "}");
+    }
+    
+    std::fprintf(file, "\n  ]\n}\n");
+    
+    return (std::fclose(file) == 0);
+}
+
+/// \brief Returns the path that follows the "--json" argument or nullptr if there's
+/// no such argument.
+inline const char* FindJSONOutputPath(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            return argv[i + 1];
+        }
+    }
+    
+    return nullptr;
+}
+
+/// \brief Prints the results and, if the "--json <path>" argument was passed, writes them
+/// to a JSON file.
+///
+/// \return 0 on success or 1 if the JSON file couldn't be written. Suitable as the exit
+/// code of main().
+inline int ReportResults(const std::vector<BenchmarkResult>& results, int argc, char** argv) {
+    PrintResults(results);
+    
+    const char* path = FindJSONOutputPath(argc, argv);
+    if (path != nullptr && !WriteResultsAsJSON(results, path)) {
+        std::fprintf(stderr, "Failed to write the results to %s\n", path);
+        return 1;
+    }
+    
+    return 0;
+}
+
+}
+}
+
+#endif // IYFT_BENCHMARK_HARNESS_HPP
@@ -0,0 +1,190 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Measures the cost of a single profiled scope while the ThreadProfiler is or isn't
+// recording and the bandwidth of writing and loading result files. Pass 
+// "--json <path>" to also write the results to a JSON file.
+
+#define IYFT_THREAD_PROFILER_IMPLEMENTATION
+#include "ThreadProfiler.hpp"
+#include "ThreadProfilerCore.hpp"
+
+#include "Harness.hpp"
+
+#include <fstream>
+#include <thread>
+
+namespace {
+/// Keeps the compiler from removing the benchmarked loops.
+volatile std::uint64_t Sink = 0;
+
+void UnprofiledFunction() {
+    Sink = Sink + 1;
+}
+
+void ProfiledFunction() {
+    IYFT_PROFILE(BenchmarkedScope)
+    
+    Sink = Sink + 1;
+}
+
+void ProfiledNestedFunction() {
+    IYFT_PROFILE(BenchmarkedOuterScope)
+    
+    ProfiledFunction();
+}
+
+/// Every scope produces two markers. Each batch must fit into the buffer.
+const std::uint64_t BatchSize = IYFT_THREAD_PROFILER_BUFFER_CAPACITY / 4;
+
+/// Scopes that aren't recorded don't touch the buffer and can run longer.
+const std::uint64_t UnrecordedIterations = 1 << 20;
+const std::size_t Repetitions = 50;
+
+/// Timing noise may make the difference slightly negative.
+double Overhead(double measured, double baseline) {
+    return std::max(0.0, measured - baseline);
+}
+
+/// Empties the buffers and restarts the recording.
+void ResetRecording() {
+    iyft::GetThreadProfiler().getResults();
+    IYFT_PROFILER_SET_RECORDING(true)
+}
+
+/// The number of threads that record the results used by the file benchmarks.
+const std::size_t FileThreadCount = 4;
+const std::size_t FileRepetitions = 10;
+const char* const FilePath = "benchmarkResults.profres";
+
+/// Records BatchSize nested scopes on FileThreadCount threads and returns the results.
+iyft::ProfilerResults RecordFileResults() {
+    ResetRecording();
+    
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < FileThreadCount; ++i) {
+        threads.emplace_back([]() {
+            for (std::uint64_t j = 0; j < BatchSize / 2; ++j) {
+                ProfiledNestedFunction();
+            }
+        });
+    }
+    
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    
+    IYFT_PROFILER_SET_RECORDING(false)
+    return iyft::GetThreadProfiler().getResults();
+}
+
+/// Returns the size of a file in bytes or 0 if it can't be opened.
+std::uint64_t GetFileSize(const char* path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    
+    const std::streamoff size = file ? static_cast<std::streamoff>(file.tellg()) : 0;
+    return (size > 0) ? static_cast<std::uint64_t>(size) : 0;
+}
+
+/// Measures how long it takes to write and to load the results in the specified format.
+/// The bandwidth is computed from the size of the file.
+void MeasureFileBandwidth(const iyft::ProfilerResults& results, iyft::ProfilerFileFormat format, const char* formatName,
+                          std::vector<iyft::benchmark::BenchmarkResult>& output) {
+    using iyft::benchmark::MeasureNanosecondsPerIteration;
+    
+    bool succeeded = true;
+    const double write = MeasureNanosecondsPerIteration([&](std::uint64_t) {
+        succeeded = results.writeToFile(FilePath, format) && succeeded;
+    }, 1, FileRepetitions);
+    
+    const std::uint64_t size = GetFileSize(FilePath);
+    
+    const double load = MeasureNanosecondsPerIteration([&](std::uint64_t) {
+        succeeded = (iyft::ProfilerResults::LoadFromFile(FilePath) != nullptr) && succeeded;
+    }, 1, FileRepetitions);
+    
+    std::remove(FilePath);
+    
+    if (!succeeded || size == 0) {
+        std::fprintf(stderr, "Failed to write or load a %s file\n", formatName);
+        return;
+    }
+    
+    output.emplace_back(std::string("writeToFile, ") + formatName, "file", write, 1, size);
+    output.emplace_back(std::string("LoadFromFile, ") + formatName, "file", load, 1, size);
+}
+}
+
+int main(int argc, char** argv) {
+    using iyft::benchmark::BenchmarkResult;
+    using iyft::benchmark::MeasureNanosecondsPerIteration;
+    
+    IYFT_PROFILER_NAME_THREAD("Benchmark");
+    
+    std::vector<BenchmarkResult> results;
+    
+    const double baseline = MeasureNanosecondsPerIteration([](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            UnprofiledFunction();
+        }
+    }, UnrecordedIterations, Repetitions);
+    
+    IYFT_PROFILER_SET_RECORDING(false)
+    const double notRecording = MeasureNanosecondsPerIteration([](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            ProfiledFunction();
+        }
+    }, UnrecordedIterations, Repetitions);
+    results.emplace_back("Scope, not recording", "scope", Overhead(notRecording, baseline), UnrecordedIterations);
+    
+    const double recording = MeasureNanosecondsPerIteration([](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            ProfiledFunction();
+        }
+    }, ResetRecording, BatchSize, Repetitions);
+    results.emplace_back("Scope, recording", "scope", Overhead(recording, baseline), BatchSize);
+    
+    // Two scopes per iteration
+    const double recordingNested = MeasureNanosecondsPerIteration([](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            ProfiledNestedFunction();
+        }
+    }, ResetRecording, BatchSize / 2, Repetitions);
+    results.emplace_back("Nested scopes, recording", "scope", Overhead(recordingNested, baseline) / 2.0, BatchSize);
+    
+    IYFT_PROFILER_SET_RECORDING(false)
+    
+    const iyft::ProfilerResults fileResults = RecordFileResults();
+    MeasureFileBandwidth(fileResults, iyft::ProfilerFileFormat::Version1, "version 1", results);
+    MeasureFileBandwidth(fileResults, iyft::ProfilerFileFormat::Version2, "version 2", results);
+    MeasureFileBandwidth(fileResults, iyft::ProfilerFileFormat::Version3, "version 3", results);
+    
+    std::printf("An unprofiled call takes %.3f ns. It is subtracted from the scope results.\n", baseline);
+    std::printf("The files contain %llu scopes recorded by %zu threads.\n", static_cast<unsigned long long>(FileThreadCount * BatchSize), FileThreadCount);
+    return iyft::benchmark::ReportResults(results, argc, argv);
+}
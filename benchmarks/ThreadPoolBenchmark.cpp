@@ -0,0 +1,157 @@
+// The IYFThreading library
+//
+// Copyright (C) 2018, Manvydas Šliamka
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+// conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+// of conditions and the following disclaimer in the documentation and/or other materials
+// provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of other contributors may be
+// used to endorse or promote products derived from this software without specific prior
+// written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+// SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+// BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Measures the submission latency, the throughput of empty tasks, the scaling of
+// small tasks from 1 to N workers and the cost of a Barrier round trip. Pass
+// "--json <path>" to also write the results to a JSON file.
+
+#include "ThreadPool.hpp"
+
+#include "Harness.hpp"
+
+#include <memory>
+
+namespace {
+/// Keeps the compiler from removing the benchmarked work.
+volatile std::uint64_t Sink = 0;
+
+void EmptyTask() {}
+
+/// The number of additions performed by a task in the scaling benchmarks.
+const std::size_t WorkIterations = 1024;
+
+void WorkTask(std::size_t) {
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < WorkIterations; ++i) {
+        sum += i * i;
+        // Prevents the compiler from computing the sum at compile time.
+        Sink = sum;
+    }
+}
+
+const std::uint64_t TaskIterations = 1 << 16;
+const std::uint64_t RoundTripIterations = 1 << 12;
+const std::size_t Repetitions = 10;
+
+const char* GetModeName(iyft::SchedulingMode mode) {
+    return (mode == iyft::SchedulingMode::WorkStealing) ? "WorkStealing" : "SharedQueue";
+}
+
+/// Returns 1, 2, 4, ... up to and including the number of hardware threads.
+std::vector<std::size_t> GetWorkerCounts() {
+    const std::size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    
+    std::vector<std::size_t> counts;
+    for (std::size_t count = 1; count < hardwareThreads; count *= 2) {
+        counts.push_back(count);
+    }
+    
+    counts.push_back(hardwareThreads);
+    return counts;
+}
+
+/// Measures the benchmarks that don't depend on the number of workers.
+void MeasureLatencies(iyft::SchedulingMode mode, std::vector<iyft::benchmark::BenchmarkResult>& results) {
+    using iyft::benchmark::MeasureNanosecondsPerIteration;
+    
+    iyft::ThreadPool pool(1, mode);
+    const std::string suffix = std::string(", ") + GetModeName(mode);
+    
+    // Only the time spent by the submitting thread is measured. The worker drains the 
+    // tasks of the previous repetition in the setup step.
+    const double submit = MeasureNanosecondsPerIteration([&pool](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            pool.addTask(EmptyTask);
+        }
+    }, [&pool]() {
+        pool.waitForAll();
+    }, TaskIterations, Repetitions);
+    pool.waitForAll();
+    results.emplace_back("addTask latency" + suffix, "task", submit, TaskIterations);
+    
+    // The waiting thread may execute the task itself.
+    const double helpingRoundTrip = MeasureNanosecondsPerIteration([&pool](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            iyft::Barrier barrier(1);
+            pool.addTask(barrier, EmptyTask);
+            pool.waitFor(barrier);
+        }
+    }, RoundTripIterations, Repetitions);
+    results.emplace_back("Barrier round trip, ThreadPool::waitFor" + suffix, "round trip", helpingRoundTrip, RoundTripIterations);
+    
+    // The task always runs on the worker, which has to wake up the waiting thread.
+    const double blockingRoundTrip = MeasureNanosecondsPerIteration([&pool](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            iyft::Barrier barrier(1);
+            pool.addTask(barrier, EmptyTask);
+            barrier.waitForAll();
+        }
+    }, RoundTripIterations, Repetitions);
+    results.emplace_back("Barrier round trip, Barrier::waitForAll" + suffix, "round trip", blockingRoundTrip, RoundTripIterations);
+}
+
+/// Measures the throughput of empty tasks and the scaling of small tasks.
+void MeasureThroughput(iyft::SchedulingMode mode, std::size_t workerCount, std::vector<iyft::benchmark::BenchmarkResult>& results) {
+    using iyft::benchmark::MeasureNanosecondsPerIteration;
+    
+    iyft::ThreadPool pool(workerCount, mode);
+    const std::string suffix = std::string(", ") + GetModeName(mode) + ", " + std::to_string(workerCount) + " worker(s)";
+    
+    const double empty = MeasureNanosecondsPerIteration([&pool](std::uint64_t count) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            pool.addTask(EmptyTask);
+        }
+        
+        pool.waitForAll();
+    }, TaskIterations, Repetitions);
+    results.emplace_back("Empty tasks" + suffix, "task", empty, TaskIterations);
+    
+    const double work = MeasureNanosecondsPerIteration([&pool](std::uint64_t count) {
+        pool.waitFor(*pool.parallelFor(0, static_cast<std::size_t>(count), 1, WorkTask));
+    }, TaskIterations, Repetitions);
+    results.emplace_back("parallelFor, " + std::to_string(WorkIterations) + " additions per index" + suffix, "index", work, TaskIterations);
+}
+}
+
+int main(int argc, char** argv) {
+    std::vector<iyft::benchmark::BenchmarkResult> results;
+    
+    const iyft::SchedulingMode modes[] = {iyft::SchedulingMode::SharedQueue, iyft::SchedulingMode::WorkStealing};
+    
+    for (iyft::SchedulingMode mode : modes) {
+        MeasureLatencies(mode, results);
+    }
+    
+    for (iyft::SchedulingMode mode : modes) {
+        for (std::size_t workerCount : GetWorkerCounts()) {
+            MeasureThroughput(mode, workerCount, results);
+        }
+    }
+    
+    return iyft::benchmark::ReportResults(results, argc, argv);
+}
@@ -30,12 +30,20 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <cstdio>
+#include <fstream>
 #include <chrono>
 #include <cassert>
+#include <array>
+#include <memory>
+#include <vector>
 
 #include "ThreadProfiler.hpp"
 #include "ThreadProfilerCore.hpp"
 #include "ThreadPool.hpp"
+#include "TaskGraph.hpp"
+#include "Strand.hpp"
+#include "ThreadPoolCoroutines.hpp"
 
 #ifdef __linux__
 #include <pthread.h>
@@ -82,6 +90,716 @@ std::chrono::milliseconds incrementExpected(std::chrono::milliseconds duration)
     return duration;
 }
 
+/// Demonstrates a work stealing pool where tasks add more tasks.
+void workStealingTest(iyft::ThreadPool& pool) {
+    const int outerTaskCount = 8;
+    const int innerTaskCount = 64;
+    
+    std::atomic<int> counter(0);
+    iyft::Barrier outerBarrier(outerTaskCount);
+    iyft::Barrier innerBarrier(outerTaskCount * innerTaskCount);
+    
+    for (int i = 0; i < outerTaskCount; ++i) {
+        // Tasks that are added by the main thread go to the shared queue.
+        pool.addTask(outerBarrier, [&pool, &counter, &innerBarrier](){
+            for (int j = 0; j < innerTaskCount; ++j) {
+                // Tasks that are added by a worker go to its own deque and may be
+                // stolen by other workers.
+                pool.addTask(innerBarrier, [&counter](){
+                    counter++;
+                });
+            }
+        });
+    }
+    
+    outerBarrier.waitForAll();
+    innerBarrier.waitForAll();
+    
+    assert(counter == outerTaskCount * innerTaskCount);
+    std::cout << "Work stealing pool executed " << counter << " nested tasks\n";
+}
+
+/// Demonstrates tasks that capture move-only or large objects.
+void inplaceTaskTest(iyft::ThreadPool& pool) {
+    iyft::Barrier barrier(2);
+    
+    std::atomic<int> sum(0);
+    
+    // Move-only arguments don't need to be copied anymore.
+    std::unique_ptr<int> value(new int(40));
+    pool.addTask(barrier, [&sum](std::unique_ptr<int>& v){
+        sum += *v;
+    }, std::move(value));
+    
+    // Callables that don't fit into IYFT_INPLACE_TASK_SIZE bytes are moved to the heap.
+    std::array<int, 64> large;
+    large.fill(0);
+    large[63] = 2;
+    static_assert(!iyft::InplaceTask::StoresInline<decltype(large)>(), "The array must be too big for the inline storage");
+    
+    pool.addTask(barrier, [&sum, large](){
+        sum += large[63];
+    });
+    
+    barrier.waitForAll();
+    
+    assert(sum == 42);
+    std::cout << "Move-only and large tasks computed " << sum << "\n";
+}
+
+/// Demonstrates bulk task submission and parallelFor.
+void bulkSubmissionTest(iyft::ThreadPool& pool) {
+    // A range of callables
+    std::atomic<int> callableCounter(0);
+    std::vector<std::function<void()>> callables(16, [&callableCounter](){
+        callableCounter++;
+    });
+    
+    iyft::Barrier callableBarrier(static_cast<int>(callables.size()));
+    pool.addTasks(callableBarrier, callables.begin(), callables.end());
+    
+    // An index range split into chunks
+    const std::size_t count = 1000;
+    const std::size_t grain = 64;
+    std::vector<int> data(count, 0);
+    
+    iyft::Barrier chunkBarrier(static_cast<int>(iyft::ThreadPool::ChunkCount(0, count, grain)));
+    pool.addTasks(chunkBarrier, 0, count, grain, [&data](std::size_t begin, std::size_t end){
+        for (std::size_t i = begin; i < end; ++i) {
+            data[i] += 1;
+        }
+    });
+    
+    callableBarrier.waitForAll();
+    chunkBarrier.waitForAll();
+    
+    // Recursive splitting
+    std::shared_ptr<iyft::Barrier> parallelForBarrier = pool.parallelFor(0, count, grain, [&data](std::size_t i){
+        data[i] += 1;
+    });
+    parallelForBarrier->waitForAll();
+    
+    assert(callableCounter == 16);
+    for (int d : data) {
+        assert(d == 2);
+        (void)d;
+    }
+    
+    std::cout << "Bulk submission executed " << callableCounter << " callables and processed " << count << " indices twice\n";
+}
+
+/// Demonstrates waiting for all tasks in a pool with and without a timeout.
+void waitForAllTest(iyft::ThreadPool& pool) {
+    pool.addTask([](){
+        std::this_thread::sleep_for(ms(50));
+    });
+    
+    const bool completedEarly = pool.waitForAll(ms(1));
+    pool.waitForAll();
+    
+    assert(!completedEarly);
+    assert(pool.getPendingTaskCount() == 0);
+    (void)completedEarly;
+    
+    std::cout << "Timed out while waiting for the pool, then waited for all tasks\n";
+}
+
+/// Demonstrates a pipeline built from continuations. No thread blocks until the last
+/// stage completes.
+void continuationTest(iyft::ThreadPool& pool) {
+    const int firstStageTaskCount = 8;
+    std::atomic<int> firstStageCounter(0);
+    int secondStageResult = 0;
+    
+    iyft::Barrier firstStage(firstStageTaskCount);
+    iyft::Barrier secondStage(1);
+    
+    // The continuation runs once every task of the first stage completes and notifies
+    // the second barrier once it's done.
+    pool.addContinuation(firstStage, secondStage, [&firstStageCounter, &secondStageResult](){
+        secondStageResult = firstStageCounter * 2;
+    });
+    
+    for (int i = 0; i < firstStageTaskCount; ++i) {
+        pool.addTask(firstStage, [&firstStageCounter](){
+            firstStageCounter++;
+        });
+    }
+    
+    secondStage.waitForAll();
+    
+    assert(secondStageResult == firstStageTaskCount * 2);
+    std::cout << "Continuation computed " << secondStageResult << "\n";
+}
+
+/// Demonstrates a reusable dependency graph.
+void taskGraphTest(iyft::ThreadPool& pool) {
+    // A diamond: the first node feeds two independent nodes, both of which feed the last
+    // one.
+    int input = 0;
+    int left = 0;
+    int right = 0;
+    int output = 0;
+    
+    iyft::TaskGraph graph;
+    
+    const iyft::TaskGraph::NodeID load = graph.addNode("GraphLoad", [&input](){
+        input++;
+    });
+    const iyft::TaskGraph::NodeID processLeft = graph.addNode("GraphProcessLeft", [&input, &left](){
+        left = input * 2;
+    });
+    const iyft::TaskGraph::NodeID processRight = graph.addNode("GraphProcessRight", [&input, &right](){
+        right = input * 3;
+    });
+    const iyft::TaskGraph::NodeID combine = graph.addNode("GraphCombine", [&left, &right, &output](){
+        output += left + right;
+    });
+    
+    graph.addEdge(load, processLeft);
+    graph.addEdge(load, processRight);
+    graph.addEdge(processLeft, combine);
+    graph.addEdge(processRight, combine);
+    
+    // The same graph is executed multiple times, e.g., once per frame.
+    for (std::size_t i = 0; i < IterationCount; ++i) {
+        graph.execute(pool);
+    }
+    
+    // 5 * (1 + 2 + 3 + 4 + 5)
+    assert(output == 75);
+    std::cout << "Task graph with " << graph.getNodeCount() << " nodes computed " << output << "\n";
+}
+
+/// Demonstrates task priorities.
+void priorityTest(iyft::ThreadPool& pool) {
+    const int backgroundTaskCount = 64;
+    std::atomic<int> backgroundCounter(0);
+    iyft::Barrier backgroundBarrier(backgroundTaskCount);
+    
+    for (int i = 0; i < backgroundTaskCount; ++i) {
+        pool.addTask(iyft::TaskPriority::Low, backgroundBarrier, [&backgroundCounter](){
+            backgroundCounter++;
+        });
+    }
+    
+    // Latency critical work doesn't have to wait for the background tasks that were
+    // queued before it.
+    auto answer = pool.addTaskWithResult(iyft::TaskPriority::High, sleepingAnswer, ms(1), true);
+    const std::size_t answerValue = answer.get();
+    
+    backgroundBarrier.waitForAll();
+    
+    assert(answerValue == 42);
+    assert(backgroundCounter == backgroundTaskCount);
+    std::cout << "High priority task returned " << answerValue << " with " << backgroundCounter << " background tasks around it\n";
+}
+
+/// Recursively sums [begin, end) by forking a task for one half of the range.
+std::size_t nestedSum(iyft::ThreadPool& pool, std::size_t begin, std::size_t end) {
+    if (end - begin <= 16) {
+        std::size_t sum = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            sum += i;
+        }
+        
+        return sum;
+    }
+    
+    const std::size_t middle = begin + (end - begin) / 2;
+    
+    std::size_t firstHalf = 0;
+    iyft::Barrier barrier(1);
+    pool.addTask(barrier, [&pool, &firstHalf, begin, middle](){
+        firstHalf = nestedSum(pool, begin, middle);
+    });
+    
+    auto secondHalf = pool.addTaskWithResult(nestedSum, std::ref(pool), middle, end);
+    
+    // Blocking in Barrier::waitForAll() or std::future::get() would take this worker
+    // out of the pool and deadlock once the nesting gets deeper than the worker count.
+    pool.waitFor(barrier);
+    pool.waitFor(secondHalf);
+    
+    return firstHalf + secondHalf.get();
+}
+
+/// Demonstrates cooperative waiting.
+void nestedWaitTest(iyft::ThreadPool& pool) {
+    const std::size_t count = 4096;
+    
+    auto result = pool.addTaskWithResult(nestedSum, std::ref(pool), 0, count);
+    pool.waitFor(result);
+    
+    const std::size_t sum = result.get();
+    assert(sum == count * (count - 1) / 2);
+    std::cout << "Nested fork/join over " << count / 16 << " leaves computed " << sum << "\n";
+}
+
+/// Demonstrates topology detection and worker pinning.
+void topologyTest() {
+    const iyft::CPUTopology topology = iyft::CPUTopology::Detect();
+    
+    std::cout << "Detected " << topology.getProcessors().size() << " logical processor(s), " <<
+                 topology.getCoreCount() << " core(s), " << topology.getCacheGroupCount() << " cache group(s) and " <<
+                 topology.getNodeCount() << " NUMA node(s)\n";
+    
+    iyft::ThreadPool pool(2, iyft::SchedulingMode::WorkStealing, topology, iyft::WorkerPlacement::PerCore);
+    
+    std::atomic<int> counter(0);
+    iyft::Barrier barrier(static_cast<int>(4 * pool.getNodeCount()));
+    for (std::size_t node = 0; node < pool.getNodeCount(); ++node) {
+        for (int i = 0; i < 4; ++i) {
+            pool.addTask(iyft::TaskOptions(iyft::TaskPriority::Normal, node), barrier, [&counter](){
+                counter++;
+            });
+        }
+    }
+    
+    barrier.waitForAll();
+    
+    assert(counter == static_cast<int>(4 * pool.getNodeCount()));
+    std::cout << "Pinned pool ran " << counter << " node hinted tasks with " << pool.getRemoteStealCount() << " remote steal(s)\n";
+}
+
+/// Demonstrates strands that run their tasks in order, while different strands run in parallel.
+void strandTest(iyft::ThreadPool& pool) {
+    iyft::Strand first(pool);
+    iyft::Strand second(pool);
+    
+    std::vector<int> firstOrder;
+    std::vector<int> secondOrder;
+    for (int i = 0; i < 100; ++i) {
+        // No locks are needed because the tasks of a strand never overlap.
+        first.post([&firstOrder, i](){
+            firstOrder.push_back(i);
+        });
+        
+        second.post([&secondOrder, i](){
+            secondOrder.push_back(i);
+        });
+    }
+    
+    std::future<std::size_t> count = first.postWithResult([&firstOrder](){
+        return firstOrder.size();
+    });
+    
+    pool.waitFor(count);
+    second.waitForAll();
+    
+    assert(count.get() == 100);
+    for (int i = 0; i < 100; ++i) {
+        assert(firstOrder[static_cast<std::size_t>(i)] == i && secondOrder[static_cast<std::size_t>(i)] == i);
+    }
+    
+    std::cout << "Two strands ran " << firstOrder.size() + secondOrder.size() << " tasks in order\n";
+}
+
+#ifdef IYFT_HAS_COROUTINES
+/// A coroutine that waits for regular pool tasks without holding a thread.
+iyft::Task<int> coroutineSum(iyft::ThreadPool& pool) {
+    co_await pool.schedule();
+    
+    std::atomic<int> sum(0);
+    iyft::Barrier barrier(10);
+    for (int i = 1; i <= 10; ++i) {
+        pool.addTask(barrier, [&sum, i](){
+            sum += i;
+        });
+    }
+    
+    co_await barrier;
+    co_return sum.load();
+}
+
+/// Demonstrates the C++20 coroutine support.
+void coroutineTest(iyft::ThreadPool& pool) {
+    std::future<int> result = iyft::Submit(pool, coroutineSum(pool));
+    pool.waitFor(result);
+    
+    const int sum = result.get();
+    assert(sum == 55);
+    std::cout << "Coroutine computed " << sum << "\n";
+}
+#endif // IYFT_HAS_COROUTINES
+
+/// Demonstrates an elastic pool that starts workers during a burst and stops them afterwards.
+void elasticPoolTest() {
+    iyft::ThreadPool pool(iyft::ElasticWorkers(1, 3, std::chrono::microseconds(100), std::chrono::milliseconds(10)));
+    
+    iyft::Barrier barrier(32);
+    for (int i = 0; i < 32; ++i) {
+        pool.addTask(barrier, [](){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+    }
+    
+    pool.waitFor(barrier);
+    const std::size_t activeAfterBurst = pool.getActiveWorkerCount();
+    
+    // Give the extra workers time to reach the idle timeout. The deadline is generous
+    // because loaded machines may take a while to schedule them.
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool.getActiveWorkerCount() > 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    
+    assert(pool.getActiveWorkerCount() == 1);
+    std::cout << "Elastic pool ran " << activeAfterBurst << " worker(s) after a burst, started " << pool.getStatistics().spawnedWorkers <<
+                 " and is back to " << pool.getActiveWorkerCount() << "\n";
+}
+
+#ifdef IYFT_ENABLE_PROFILING
+/// Demonstrates always-on capture. A collector thread drains the buffers in the background.
+void streamingTest() {
+    std::atomic<std::size_t> chunkCount(0);
+    std::atomic<std::size_t> eventCount(0);
+    
+    iyft::GetThreadProfiler().startStreaming([&chunkCount, &eventCount](std::uint64_t, iyft::ProfilerResults&& chunk) {
+        chunkCount++;
+        
+        // Pool workers may finish scopes that started during an earlier recording.
+        for (std::size_t i = 0; i < chunk.getThreadCount(); ++i) {
+            if (chunk.getThreadName(i) == "MAIN") {
+                eventCount += chunk.getEvents(i).size();
+            }
+        }
+    }, std::chrono::milliseconds(5));
+    
+    for (int i = 0; i < 10; ++i) {
+        IYFT_PROFILE(StreamedScope)
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    
+    iyft::GetThreadProfiler().stopStreaming();
+    IYFT_PROFILER_SET_RECORDING(false)
+    
+    assert(eventCount == 10);
+    std::cout << "Streamed " << eventCount << " events in " << chunkCount << " chunk(s)\n";
+    
+    // Chunks that can't be written are counted instead of being lost silently.
+    iyft::GetThreadProfiler().startStreaming("missingDirectory/capture", std::chrono::milliseconds(5));
+    {
+        IYFT_PROFILE(UnwrittenScope)
+    }
+    iyft::GetThreadProfiler().stopStreaming();
+    IYFT_PROFILER_SET_RECORDING(false)
+    
+    assert(iyft::GetThreadProfiler().getFailedChunkCount() >= 1);
+}
+
+/// Threads that have exited give their IDs to new threads. Their events are kept.
+void shortLivedThreadTest() {
+    const std::size_t idCount = iyft::GetRegisteredThreadCount();
+    
+    // Destroyed after the thread has released its ID. Nothing it records may end up
+    // in the data of the thread that gets the ID next.
+    struct LateRecorder {
+        ~LateRecorder() {
+            IYFT_PROFILE(LateScope)
+        }
+    };
+    
+    IYFT_PROFILER_SET_RECORDING(true)
+    for (int i = 0; i < 100; ++i) {
+        std::thread thread([](){
+            static thread_local LateRecorder recorder;
+            (void)recorder;
+            
+            IYFT_PROFILER_NAME_THREAD("ShortLived");
+            IYFT_PROFILE(ShortLivedThreadScope)
+        });
+        thread.join();
+    }
+    
+    const iyft::ProfilerResults results = iyft::GetThreadProfiler().getResults();
+    
+    std::size_t eventCount = 0;
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        for (const iyft::RecordedEvent& e : results.getEvents(i)) {
+            assert(results.getScopes().at(e.getKey()).getName() != "LateScope");
+        }
+        
+        if (results.getThreadName(i) == "ShortLived") {
+            eventCount += results.getEvents(i).size();
+        }
+    }
+    
+    assert(eventCount == 100);
+    assert(iyft::GetRegisteredThreadCount() <= idCount + 1);
+    std::cout << "Collected " << eventCount << " events from 100 short lived threads\n";
+}
+
+/// Counter samples and flows are recorded next to the events. The pool links the
+/// submission of every task to its execution with a PoolTask flow.
+void counterAndFlowTest() {
+    iyft::ThreadPool pool(2);
+    
+    IYFT_PROFILER_SET_RECORDING(true)
+    
+    const std::uint64_t flowID = IYFT_PROFILER_NEW_FLOW_ID;
+    {
+        IYFT_PROFILE(SendItems)
+        IYFT_PROFILER_FLOW_BEGIN(ItemFlow, flowID)
+    }
+    
+    std::thread thread([flowID](){
+        IYFT_PROFILE(ReceiveItems)
+        IYFT_PROFILER_FLOW_END(ItemFlow, flowID)
+        
+        for (int i = 1; i <= 4; ++i) {
+            IYFT_PROFILER_COUNTER(ReceivedItems, i)
+        }
+    });
+    thread.join();
+    
+    pool.waitFor(*pool.parallelFor(0, 16, 1, [](std::size_t) {}));
+    
+    const iyft::ProfilerResults results = iyft::GetThreadProfiler().getResults();
+    
+    std::size_t sampleCount = 0;
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        for (const iyft::CounterSample& sample : results.getCounterSamples(i)) {
+            if (results.getScopes().at(sample.getKey()).getName() == "ReceivedItems") {
+                sampleCount++;
+            }
+        }
+    }
+    
+    std::uint64_t itemFlows = 0;
+    std::uint64_t taskFlows = 0;
+    std::chrono::nanoseconds queueLatency(0);
+    for (const auto& f : results.computeFlowHistograms()) {
+        const std::string& name = results.getScopes().at(f.first).getName();
+        if (name == "ItemFlow") {
+            itemFlows += f.second.total.getCount();
+        } else if (name == "PoolTask") {
+            taskFlows += f.second.total.getCount();
+            queueLatency = f.second.firstStep.getPercentile(50.0);
+        }
+    }
+    
+    assert(sampleCount == 4);
+    assert(itemFlows == 1);
+    
+    // The tasks end their flows before they notify the barrier.
+    assert(taskFlows == 16);
+    std::cout << "Recorded " << sampleCount << " counter samples and " << taskFlows << " task flows (median queue latency: " <<
+                 queueLatency.count() << "ns)\n";
+}
+
+/// Counts the non-overlapping occurrences of a substring.
+std::size_t CountOccurrences(const std::string& string, const std::string& substring) {
+    std::size_t count = 0;
+    for (std::size_t i = string.find(substring); i != std::string::npos; i = string.find(substring, i + substring.size())) {
+        count++;
+    }
+    
+    return count;
+}
+
+/// Reads a protobuf varint. Returns false if the data ends too early.
+bool ReadVarint(const std::string& data, std::size_t& position, std::uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && position < data.size(); shift += 7) {
+        const unsigned char byte = static_cast<unsigned char>(data[position++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/// Walks the fields of a protobuf message and returns false if it's malformed. Calls
+/// the function with the number and the contents of every length-delimited field and
+/// with the number and the value of every varint field.
+template <typename F>
+bool WalkProtoFields(const std::string& data, F&& f) {
+    std::size_t position = 0;
+    while (position < data.size()) {
+        std::uint64_t key, value;
+        if (!ReadVarint(data, position, key)) {
+            return false;
+        }
+        
+        const std::uint64_t field = key >> 3;
+        switch (key & 7) {
+        case 0:
+            if (!ReadVarint(data, position, value)) {
+                return false;
+            }
+            
+            f(field, nullptr, value);
+            break;
+        case 1:
+            if (data.size() - position < 8) {
+                return false;
+            }
+            
+            position += 8;
+            break;
+        case 2: {
+            if (!ReadVarint(data, position, value) || value > data.size() - position) {
+                return false;
+            }
+            
+            const std::string contents = data.substr(position, static_cast<std::size_t>(value));
+            position += static_cast<std::size_t>(value);
+            
+            if (!f(field, &contents, 0)) {
+                return false;
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/// Exports a small capture to both formats and checks that every event is there.
+void exportTest() {
+    IYFT_PROFILER_SET_RECORDING(true)
+    for (int i = 0; i < 3; ++i) {
+        IYFT_PROFILE(ExportOuter)
+        IYFT_PROFILE(ExportInner)
+    }
+    
+    const iyft::ProfilerResults results = iyft::GetThreadProfiler().getResults();
+    
+    std::size_t eventCount = 0;
+    for (std::size_t i = 0; i < results.getThreadCount(); ++i) {
+        eventCount += results.getEvents(i).size();
+    }
+    
+    std::stringstream json;
+    const bool jsonExported = results.exportToStream(json, iyft::ProfilerExportFormat::ChromeJSON);
+    const std::string jsonText = json.str();
+    
+    // Every event becomes a complete ("X") event with a duration
+    assert(jsonExported);
+    assert(jsonText.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0);
+    assert(jsonText.compare(jsonText.size() - 4, 4, "\n]}\n") == 0);
+    assert(CountOccurrences(jsonText, "\"ph\":\"X\"") == eventCount);
+    assert(CountOccurrences(jsonText, "\"dur\":") == eventCount);
+    assert(CountOccurrences(jsonText, "\"name\":\"ExportOuter\"") == 3);
+    assert(CountOccurrences(jsonText, "\"name\":\"ExportInner\"") == 3);
+    
+    std::stringstream perfetto(std::ios::in | std::ios::out | std::ios::binary);
+    const bool perfettoExported = results.exportToStream(perfetto, iyft::ProfilerExportFormat::Perfetto);
+    
+    // The trace must only contain TracePacket fields. Every event must be written as a
+    // begin and an end slice.
+    std::size_t packetCount = 0;
+    std::size_t beginCount = 0;
+    std::size_t endCount = 0;
+    const bool wellFormed = WalkProtoFields(perfetto.str(), [&](std::uint64_t field, const std::string* packet, std::uint64_t) {
+        if (field != 1 || packet == nullptr) {
+            return false;
+        }
+        
+        packetCount++;
+        return WalkProtoFields(*packet, [&](std::uint64_t packetField, const std::string* trackEvent, std::uint64_t) {
+            if (packetField != 11 || trackEvent == nullptr) {
+                return true;
+            }
+            
+            return WalkProtoFields(*trackEvent, [&](std::uint64_t eventField, const std::string*, std::uint64_t value) {
+                if (eventField == 9) {
+                    beginCount += (value == 1);
+                    endCount += (value == 2);
+                }
+                
+                return true;
+            });
+        });
+    });
+    
+    assert(perfettoExported && wellFormed);
+    assert(beginCount == eventCount && endCount == eventCount);
+    
+    std::cout << "Exported " << eventCount << " events as " << jsonText.size() << " bytes of JSON and " << packetCount << " Perfetto packets\n";
+    (void)jsonExported;
+    (void)perfettoExported;
+    (void)wellFormed;
+}
+
+template <typename T>
+void WriteNative(std::ostream& os, T value) {
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/// Loaded results may have been recorded by a build with different cookie settings.
+/// Saving them must follow the results and not the build.
+void cookieMismatchTest() {
+#ifdef IYFT_PROFILER_WITH_COOKIE
+    const bool withCookie = false;
+#else
+    const bool withCookie = true;
+#endif // IYFT_PROFILER_WITH_COOKIE
+    
+    // A hand written version 1 file with one thread, two scopes and four events
+    {
+        std::ofstream os("cookieTest.profres", std::ios::binary);
+        os.write("IYFR", 4);
+        WriteNative<std::uint8_t>(os, 1);
+        WriteNative<std::uint8_t>(os, 1);
+        WriteNative<std::uint8_t>(os, 1);
+        WriteNative<std::uint8_t>(os, withCookie);
+        
+        WriteNative<std::uint64_t>(os, 1);
+        WriteNative<std::uint16_t>(os, 4);
+        os.write("MAIN", 4);
+        
+        WriteNative<std::uint64_t>(os, 0);
+        WriteNative<std::uint64_t>(os, 0);
+        
+        WriteNative<std::uint64_t>(os, 2);
+        for (std::uint32_t key : {0x1234u, 0x5678u}) {
+            WriteNative<std::uint32_t>(os, key);
+            WriteNative<std::uint32_t>(os, 0);
+            WriteNative<std::uint16_t>(os, 5);
+            os.write("Scope", 5);
+            WriteNative<std::uint16_t>(os, 0);
+            WriteNative<std::uint16_t>(os, 0);
+            WriteNative<std::uint32_t>(os, key);
+        }
+        
+        WriteNative<std::uint64_t>(os, 4);
+        for (std::int64_t i = 0; i < 4; ++i) {
+            WriteNative<std::uint32_t>(os, (i % 2 == 0) ? 0x1234u : 0x5678u);
+            WriteNative<std::int32_t>(os, static_cast<std::int32_t>(i % 2));
+            WriteNative<std::int64_t>(os, i * 100);
+            WriteNative<std::int64_t>(os, i * 100 + 50);
+            if (withCookie) {
+                WriteNative<std::uint64_t>(os, 0);
+            }
+        }
+    }
+    
+    auto source = iyft::ProfilerResults::LoadFromFile("cookieTest.profres");
+    assert(source != nullptr);
+    assert(source->getEvents(0).size() == 4);
+    
+    for (iyft::ProfilerFileFormat format : {iyft::ProfilerFileFormat::Version1, iyft::ProfilerFileFormat::Version2, iyft::ProfilerFileFormat::Version3}) {
+        const bool written = source->writeToFile("cookieTest.profres", format);
+        assert(written);
+        
+        auto loaded = iyft::ProfilerResults::LoadFromFile("cookieTest.profres");
+        assert(loaded != nullptr && *loaded == *source);
+        (void)written;
+    }
+    
+    std::remove("cookieTest.profres");
+    std::cout << "Results with mismatched cookie settings survived a round trip\n";
+}
+#endif // IYFT_ENABLE_PROFILING
+
 int main() {
     // Explicitly name a thread. You should call this at the start. Otherwise, some
     // other function may assign it a default name and id.
@@ -205,15 +923,27 @@ int main() {
     // You may also use IYFT_PROFILER_RESULTS_TO_FILE("profilerResults") to write the results to a file
     // or IYFT_PROFILER_RESULT_STRING to write them to an std::string.
     //
-    // This function uses Spinlocks, std::swap, etc. internally to return the current results and clear
-    // the data buffers as quickly as possible. If you recorded a ton of data, you may also wish to run
+    // This function drains the per-thread event buffers to return the current results and clear them
+    // as quickly as possible. If you recorded a ton of data, you may also wish to run
     // this function on a separate thread. However, make sure that recording DOES NOT GET ENABLED until 
     // this function is done or you may get very scrambled eggs for breakfast.
+    //
+    // The buffers of different threads can be processed in parallel by the pool.
     auto resultStart = std::chrono::high_resolution_clock::now();
-    iyft::ProfilerResults results = iyft::GetThreadProfiler().getResults();
+    iyft::ProfilerResults results = iyft::GetThreadProfiler().getResults([&pool](std::size_t count, const std::function<void(std::size_t)>& body) {
+        pool->waitFor(*pool->parallelFor(0, count, 1, body));
+    });
     auto resultEnd = std::chrono::high_resolution_clock::now();
 #endif // IYFT_ENABLE_PROFILING 
     
+    // The counters are maintained even if the profiler is disabled.
+    pool->waitForAll();
+    const iyft::ThreadPoolStatistics statistics = pool->getStatistics();
+    const iyft::ThreadPoolWorkerStatistics total = statistics.getTotal();
+    std::cout << "Pool executed " << total.executedTasks << " tasks (" << statistics.externalThreads.executedTasks <<
+                 " on waiting threads), woke up " << total.wakeups << " time(s) (" << total.spuriousWakeups <<
+                 " spurious), queued at most " << statistics.queueHighWaterMark << " tasks\n";
+    
     // Make sure to finish all tasks
     pool = nullptr;
     
@@ -229,6 +959,28 @@ int main() {
     std::cout << "Single thread would have taken " << expectedTime.count() << "ms\n";
     std::cout << "Improvement: " << static_cast<double>(expectedTime.count()) / duration.count() << " x\n";
     
+    {
+        // Reuse a single pool for all remaining demos instead of starting new
+        // workers for each one.
+        iyft::ThreadPool workStealingPool(4, iyft::SchedulingMode::WorkStealing);
+        
+        workStealingTest(workStealingPool);
+        inplaceTaskTest(workStealingPool);
+        bulkSubmissionTest(workStealingPool);
+        waitForAllTest(workStealingPool);
+        continuationTest(workStealingPool);
+        taskGraphTest(workStealingPool);
+        priorityTest(workStealingPool);
+        nestedWaitTest(workStealingPool);
+        strandTest(workStealingPool);
+#ifdef IYFT_HAS_COROUTINES
+        coroutineTest(workStealingPool);
+#endif // IYFT_HAS_COROUTINES
+    }
+    
+    topologyTest();
+    elasticPoolTest();
+    
 // A check to make sure we don't get errors in ThreadPool only builds
 #ifdef IYFT_ENABLE_PROFILING
     std::chrono::duration<double, std::milli> resultDuraion = resultEnd - resultStart;
@@ -247,6 +999,12 @@ int main() {
         assert(*loadedResults == results);
         std::cout << (*loadedResults).writeToString() << "\n";
     }
+    
+    streamingTest();
+    shortLivedThreadTest();
+    counterAndFlowTest();
+    exportTest();
+    cookieMismatchTest();
 #endif // IYFT_ENABLE_PROFILING 
     
     return 0;